@@ -0,0 +1,71 @@
+/**
+ * @file channel.hpp
+ * @brief Unbounded multi-producer queue for handing work to another thread.
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace chat {
+
+/**
+ * @brief Thread-safe FIFO that a consumer thread blocks on.
+ *
+ * The client's network thread uses it to hand terminal output to the UI thread, so
+ * slow console writes never hold up reading from the server.
+ * @tparam T Item type; moved in and out.
+ */
+template <typename T>
+class Channel {
+public:
+    /**
+     * @brief Appends an item. Items pushed after `close()` are dropped.
+     * @param item The item.
+     */
+    void push(T item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_) {
+                return;
+            }
+            items_.push_back(std::move(item));
+        }
+        ready_.notify_one();
+    }
+
+    /**
+     * @brief Waits for the next item.
+     * @return The item, or nothing once the channel is closed and drained.
+     */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items_.front());
+        items_.pop_front();
+        return item;
+    }
+
+    /**
+     * @brief Ends the channel; the consumer still receives the items already queued.
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        ready_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;                  ///< Protects the fields below.
+    std::condition_variable ready_;     ///< Signalled on push and close.
+    std::deque<T> items_;               ///< Queued items.
+    bool closed_ = false;               ///< Set by `close()`.
+};
+
+}  // namespace chat
@@ -0,0 +1,779 @@
+/**
+ * @file chat_client.hpp
+ * @brief Headless, asynchronous client for the chat protocol (libchatclient).
+ *
+ * Everything a program needs to talk to the server without a terminal: TLS connect,
+ * registration, sending messages, room and user-list requests, file DATA frames and
+ * callbacks for what arrives. Heartbeats, frame compression and end-to-end encryption
+ * of direct messages are handled inside.
+ *
+ * A `chat::Client` owns no thread. It runs on an `io_context` supplied by the caller,
+ * so one process can drive thousands of clients from a handful of threads (the
+ * interactive client uses one, `loadgen chat` one per core).
+ */
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../common/capabilities.hpp"
+#include "../common/compression.hpp"
+#include "../common/file_transfer.hpp"
+#include "../common/frame.hpp"
+#include "../common/message.hpp"
+#include "../common/utils.hpp"
+#include "e2e.hpp"
+
+namespace chat {
+
+/**
+ * @brief One connection to the chat server.
+ *
+ * All I/O and all callbacks run on the client's strand, so a client is never used by
+ * two threads at once even when its `io_context` is run by several. Public methods may
+ * be called from any thread; they hand their work to the strand and return at once.
+ * Writes are queued in order with at most one `async_write` in flight.
+ *
+ * Create with `Client::create()`, set the callbacks, then `connect()` and
+ * `register_user()`. The client stays alive while it has I/O pending.
+ */
+class Client : public std::enable_shared_from_this<Client> {
+public:
+    using Stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;  ///< Underlying SSL stream type.
+    using ResultHandler = std::function<void(const boost::system::error_code&)>;               ///< Completion of connect or registration.
+    using MessageHandler = std::function<void(const Message&)>;                                 ///< A received message.
+    using DataHandler = std::function<void(std::uint64_t transfer_id, const char* data, std::size_t size)>;  ///< A received file chunk.
+
+    /**
+     * @brief Creates an unconnected client.
+     * @param io_context Context the client's I/O and callbacks run on.
+     * @param ssl_context TLS settings; must outlive the client.
+     */
+    static std::shared_ptr<Client> create(boost::asio::io_context& io_context, boost::asio::ssl::context& ssl_context) {
+        return std::shared_ptr<Client>(new Client(io_context, ssl_context));
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /**
+     * @brief Sets the callback for every received message except heartbeats.
+     *
+     * `LIST` messages (the user list, pushed whenever someone comes or goes, and pages
+     * that were asked for) arrive here too. Set callbacks before `connect()`.
+     */
+    void on_message(MessageHandler handler) { on_message_ = std::move(handler); }
+
+    /**
+     * @brief Sets the callback for received file chunks.
+     */
+    void on_data(DataHandler handler) { on_data_ = std::move(handler); }
+
+    /**
+     * @brief Sets the callback run once when the connection ends, with the reason.
+     *
+     * `close()` reports `boost::asio::error::operation_aborted`.
+     */
+    void on_close(ResultHandler handler) { on_close_ = std::move(handler); }
+
+    /**
+     * @brief Chooses whether to offer compressed frames at registration (default on).
+     */
+    void set_compression(bool enabled) { offer_compression_ = enabled; }
+
+    /**
+     * @brief Sets the password sent in `REGISTER`, for servers that require authentication.
+     */
+    void set_password(std::string password) { password_ = std::move(password); }
+
+    /**
+     * @brief Sets a session token from an earlier login, sent in `REGISTER` instead of the password.
+     */
+    void set_token(std::string token) { token_ = std::move(token); }
+
+    /**
+     * @brief Encrypts direct messages end to end with this key pair. Call before `connect()`.
+     *
+     * The public key is published in `REGISTER`. Before the first message to a user the
+     * client asks the server for theirs (`KEY`) and holds the messages until it arrives.
+     * The first key seen for a user is pinned. For a user without a key the messages stay
+     * held, with a `SYSTEM` notice, until `send_unencrypted()` or a later send finds a key;
+     * a key different from the pinned one is only used after `trust_new_key()`, and
+     * messages sealed under it are not shown. Servers without `Feature::e2e_keys` get
+     * plaintext, with a notice. Received envelopes are decrypted before `on_message`, so
+     * callers only ever see plaintext. Room messages stay unencrypted.
+     */
+    void enable_e2e(E2eIdentity identity) { e2e_ = std::make_unique<EndToEnd>(std::move(identity)); }
+
+    /**
+     * @brief Connects and completes the TLS handshake.
+     * @param endpoints Resolved server address.
+     * @param handler Called on the strand with the result.
+     */
+    void connect(const boost::asio::ip::tcp::resolver::results_type& endpoints, ResultHandler handler) {
+        auto self = shared_from_this();
+        boost::asio::async_connect(stream_.lowest_layer(), endpoints,
+            boost::asio::bind_executor(strand_, [this, self, handler](const boost::system::error_code& error,
+                                                                      const boost::asio::ip::tcp::endpoint&) {
+                if (error) {
+                    handler(error);
+                    return;
+                }
+                stream_.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+                stream_.async_handshake(boost::asio::ssl::stream_base::client,
+                    boost::asio::bind_executor(strand_, [this, self, handler](const boost::system::error_code& error) {
+                        if (!error) {
+                            connected_ = true;
+                            start_read();
+                        }
+                        handler(error);
+                    }));
+            }));
+    }
+
+    /**
+     * @brief Registers a username.
+     *
+     * Call once `connect()` has succeeded. The server answers with a welcome (or a
+     * refusal) as a `SYSTEM` message, which is passed to `on_message` as well. A refusal
+     * closes the connection.
+     * @param username Name to register.
+     * @param handler Called on the strand: success once registered,
+     *                `boost::asio::error::access_denied` if the name or credentials were refused.
+     */
+    void register_user(std::string username, ResultHandler handler) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), username = std::move(username),
+                                        handler = std::move(handler)]() mutable {
+            username_ = std::move(username);
+            on_registered_ = std::move(handler);
+
+            // Offer features both as a list and, for version 1 servers, the codec field
+            FeatureSet offered{Feature::history, Feature::batch};
+            Message reg;
+            reg.type = MessageType::REGISTER;
+            reg.sender = username_;
+            reg.version = kProtocolVersion;
+            if (!token_.empty()) {
+                reg.token = token_;
+            } else {
+                reg.password = password_;
+            }
+            if (offer_compression_) {
+                offered.add(Feature::compression);
+                reg.compression = kCompressionCodec;
+            }
+            if (e2e_) {
+                offered.add(Feature::e2e_keys);
+                const std::string& key = e2e_->public_key();
+                reg.public_key = to_hex(reinterpret_cast<const unsigned char*>(key.data()), key.size());
+            }
+            reg.features = offered.names();
+            queue_write(encode_frame(reg.serialize()));
+        });
+    }
+
+    /**
+     * @brief Sends a message; `sender` is filled in with the registered username.
+     *
+     * With `enable_e2e()`, a direct `MESSAGE` is encrypted first.
+     */
+    void send(Message message) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), message = std::move(message)]() mutable {
+            submit(std::move(message));
+        });
+    }
+
+    /**
+     * @brief Sends several messages at once, such as a paste or a bot's burst.
+     *
+     * With `Feature::batch`, the `MESSAGE`s go out packed into `BATCH` frames of at most
+     * `kMaxBatchSize` messages and `kMaxBatchBytes`, which the server relays in one pass.
+     * Without it every message is sent on its own, as with `send()`. Order is kept, except
+     * that messages waiting for a recipient's key follow once it arrives.
+     */
+    void send_batch(std::vector<Message> messages) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), messages = std::move(messages)]() mutable {
+            batching_ = features_.has(Feature::batch);
+            for (auto& message : messages) {
+                submit(std::move(message));
+            }
+            batching_ = false;
+            flush_batch();
+        });
+    }
+
+    /**
+     * @brief Sends the messages held for a user without an encryption key as plaintext.
+     *
+     * Call only once the user has agreed; does nothing if a key has been pinned meanwhile.
+     */
+    void send_unencrypted(const std::string& user) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), user]() {
+            auto held = awaiting_key_.find(user);
+            if (held == awaiting_key_.end() || peer_keys_.count(user) != 0) {
+                return;
+            }
+            std::vector<Message> messages = std::move(held->second);
+            awaiting_key_.erase(held);
+            for (auto& message : messages) {
+                write_message(message);
+            }
+        });
+    }
+
+    /**
+     * @brief Answers a key change reported for a user.
+     * @param accept Pin the new key; otherwise keep the old one. Either way the messages
+     *               held for the user are sealed with the key kept.
+     */
+    void trust_new_key(const std::string& user, bool accept = true) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), user, accept]() {
+            auto changed = changed_keys_.find(user);
+            if (changed == changed_keys_.end()) {
+                return;
+            }
+            if (accept) {
+                peer_keys_[user] = changed->second;
+            }
+            changed_keys_.erase(changed);
+            release_held(user);
+        });
+    }
+
+    /**
+     * @brief Sends a chat message.
+     * @param recipient Username or `#room`.
+     * @param content The text.
+     */
+    void send_message(const std::string& recipient, const std::string& content) {
+        Message message;
+        message.type = MessageType::MESSAGE;
+        message.recipient = recipient;
+        message.content = content;
+        send(std::move(message));
+    }
+
+    /**
+     * @brief Asks for one page of the user list; the answer arrives as a `LIST` message.
+     * @param prefix Only usernames starting with this.
+     * @param offset Index of the first user within the matches.
+     * @param limit Page size; 0 asks for the full, unpaged list.
+     */
+    void request_users(const std::string& prefix = "", std::uint32_t offset = 0,
+                       std::uint32_t limit = kDefaultListPageSize) {
+        Message message;
+        message.type = MessageType::LIST;
+        message.prefix = prefix;
+        message.offset = offset;
+        message.limit = limit;
+        send(std::move(message));
+    }
+
+    /**
+     * @brief Creates, joins or leaves a room.
+     * @param type `ROOM_CREATE`, `ROOM_JOIN` or `ROOM_LEAVE`.
+     * @param room Room name starting with '#'.
+     */
+    void room_request(MessageType type, const std::string& room) {
+        Message message;
+        message.type = type;
+        message.recipient = room;
+        send(std::move(message));
+    }
+
+    /**
+     * @brief Asks for one page of the stored history of a conversation.
+     *
+     * The server answers with `HISTORY` messages, oldest first, then one with an empty
+     * `sender` that ends the page.
+     * @param peer The other user or a `#room`.
+     * @param before If non-zero, the newest messages older than this timestamp.
+     * @param after If non-zero (and `before` is 0), the oldest messages newer than this timestamp.
+     * @param limit Page size; 0 for the server's default.
+     */
+    void request_history(const std::string& peer, std::uint64_t before = 0, std::uint64_t after = 0, std::uint32_t limit = 0) {
+        Message message;
+        message.type = MessageType::HISTORY;
+        message.recipient = peer;
+        message.before = before;
+        message.after = after;
+        message.limit = limit;
+        send(std::move(message));
+    }
+
+    /**
+     * @brief Sends one chunk of a file transfer.
+     * @param transfer_id The transfer, accepted by the receiver.
+     * @param data Chunk bytes; copied before returning.
+     * @param size Chunk size, at most `kFileChunkSize`.
+     */
+    void send_data(std::uint64_t transfer_id, const char* data, std::size_t size) {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this(), frame = encode_data_frame(transfer_id, data, size)]() mutable {
+            queue_write(std::move(frame));
+        });
+    }
+
+    /**
+     * @brief Closes the connection; pending writes are discarded.
+     */
+    void close() {
+        boost::asio::dispatch(strand_, [this, self = shared_from_this()]() {
+            fail(boost::asio::error::operation_aborted);
+        });
+    }
+
+    /**
+     * @brief Returns the strand the client's I/O and callbacks run on.
+     */
+    const boost::asio::strand<boost::asio::io_context::executor_type>& strand() const { return strand_; }
+
+    /**
+     * @brief Returns the registered username. Strand only.
+     */
+    const std::string& username() const { return username_; }
+
+    /**
+     * @brief Returns whether the server agreed to compressed frames. Strand only.
+     */
+    bool compression() const { return features_.has(Feature::compression); }
+
+    /**
+     * @brief Returns the protocol version agreed with the server; 0 before registration.
+     *
+     * Only valid on the strand, or once `register_user()` has completed.
+     */
+    std::uint32_t protocol_version() const { return protocol_version_; }
+
+    /**
+     * @brief Returns the optional features the server enabled for this connection.
+     *
+     * Only valid on the strand, or once `register_user()` has completed. A version 1
+     * server reports at most `Feature::compression`.
+     */
+    FeatureSet features() const { return features_; }
+
+    /**
+     * @brief Returns the session token of the last successful login, or the one set.
+     *
+     * Only valid on the strand, or once `register_user()` has completed.
+     */
+    const std::string& token() const { return token_; }
+
+    /**
+     * @brief Returns the bytes queued but not yet written. Strand only.
+     *
+     * Lets producers such as file senders and load generators hold back while the
+     * connection is congested.
+     */
+    std::size_t queued_bytes() const { return queued_bytes_; }
+
+private:
+    Client(boost::asio::io_context& io_context, boost::asio::ssl::context& ssl_context)
+        : strand_(boost::asio::make_strand(io_context)), stream_(strand_, ssl_context) {}
+
+    /**
+     * @brief Keeps one read pending and hands every complete frame to `dispatch_frame()`.
+     */
+    void start_read() {
+        stream_.async_read_some(boost::asio::buffer(read_buffer_),
+            boost::asio::bind_executor(strand_, [this, self = shared_from_this()](const boost::system::error_code& error,
+                                                                                  std::size_t length) {
+                if (error) {
+                    fail(error);
+                    return;
+                }
+                try {
+                    std::string frame;
+                    reader_.feed(read_buffer_.data(), length);
+                    while (connected_ && reader_.next(frame)) {
+                        dispatch_frame(frame);
+                    }
+                } catch (const std::length_error&) {
+                    fail(boost::asio::error::message_size);
+                    return;
+                }
+                if (connected_) {
+                    start_read();
+                }
+            }));
+    }
+
+    /**
+     * @brief Decodes one frame and runs the matching callback.
+     * @param frame The frame payload; may be modified.
+     */
+    void dispatch_frame(std::string& frame) {
+        if (is_compressed_frame(frame) && !decompress_frame(frame, kMaxFrameSize)) {
+            return;
+        }
+        if (is_data_frame(frame)) {
+            std::uint64_t transfer_id = 0;
+            if (parse_data_frame(frame, transfer_id) && on_data_) {
+                on_data_(transfer_id, frame.data() + kDataHeaderSize, frame.size() - kDataHeaderSize);
+            }
+            return;
+        }
+
+        Message message;
+        if (!Message::try_deserialize(frame, message)) {
+            return;
+        }
+        if (message.type == MessageType::KEY) {
+            learn_key(message);
+            return;
+        }
+        if ((message.type == MessageType::MESSAGE || message.type == MessageType::HISTORY) &&
+            EndToEnd::is_envelope(message.content)) {
+            open_envelope(message);
+        }
+        if (message.type == MessageType::PING) {
+            // Answer heartbeats so the server doesn't drop us as idle
+            Message pong;
+            pong.type = MessageType::PONG;
+            queue_write(encode_frame(pong.serialize()));
+            return;
+        }
+
+        // The first SYSTEM message after REGISTER is the server's verdict
+        bool refused = false;
+        ResultHandler registered;
+        if (message.type == MessageType::SYSTEM && on_registered_) {
+            registered = std::move(on_registered_);
+            on_registered_ = nullptr;
+            refused = message.content.rfind("Welcome ", 0) != 0;
+            if (!refused) {
+                protocol_version_ = negotiate_version(message.version);
+                features_ = FeatureSet::from_names(message.features);
+                if (message.compression == kCompressionCodec) {
+                    features_.add(Feature::compression);
+                }
+                if (!message.token.empty()) {
+                    token_ = message.token;
+                }
+            }
+        }
+
+        if (on_message_) {
+            on_message_(message);
+        }
+        if (registered && !refused && e2e_ && !features_.has(Feature::e2e_keys)) {
+            notify("The server does not support end-to-end encryption; messages are sent unencrypted.");
+        }
+        if (registered) {
+            registered(refused ? boost::asio::error::access_denied : boost::system::error_code());
+        }
+        if (refused) {
+            fail(boost::asio::error::access_denied);
+        }
+    }
+
+    /**
+     * @brief Sends a message, encrypting direct ones first with `enable_e2e()`. Strand only.
+     */
+    void submit(Message message) {
+        if (!e2e_ || !features_.has(Feature::e2e_keys) || message.type != MessageType::MESSAGE ||
+            is_room_name(message.recipient)) {
+            write_message(message);
+            return;
+        }
+        auto key = peer_keys_.find(message.recipient);
+        if (key != peer_keys_.end() && awaiting_key_.count(message.recipient) == 0 &&
+            changed_keys_.count(message.recipient) == 0) {
+            seal_and_write(message, key->second);
+            return;
+        }
+        // Hold the message behind any others until the recipient's key is known. A user
+        // who had no key at the last request is asked for again, in case they have one now.
+        std::string recipient = message.recipient;
+        awaiting_key_[recipient].push_back(std::move(message));
+        if (key == peer_keys_.end() && key_requests_.insert(recipient).second) {
+            Message request;
+            request.type = MessageType::KEY;
+            request.recipient = recipient;
+            write_message(request);
+        }
+    }
+
+    /**
+     * @brief Fills in the sender and queues a message, or collects it for the current batch. Strand only.
+     *
+     * Anything but a `MESSAGE` flushes the batch first, so messages keep their order.
+     */
+    void write_message(Message& message) {
+        message.sender = username_;
+        if (batching_ && message.type == MessageType::MESSAGE) {
+            batch_.push_back(std::move(message));
+            return;
+        }
+        flush_batch();
+        write_payload(message.serialize());
+    }
+
+    /**
+     * @brief Frames an encoded message, compressed if agreed, and queues it. Strand only.
+     */
+    void write_payload(const std::string& payload) {
+        queue_write(features_.has(Feature::compression) ? encode_compressed_frame(payload) : encode_frame(payload));
+    }
+
+    /**
+     * @brief Sends the messages collected in `batch_` as `BATCH` frames. Strand only.
+     */
+    void flush_batch() {
+        for (std::size_t first = 0; first < batch_.size(); first += kMaxBatchSize) {
+            write_batch(first, std::min(batch_.size(), first + kMaxBatchSize));
+        }
+        batch_.clear();
+    }
+
+    /**
+     * @brief Sends `batch_[first, last)` as one `BATCH` frame, halving it while it is over `kMaxBatchBytes`.
+     *
+     * A single message goes out as a plain `MESSAGE`.
+     */
+    void write_batch(std::size_t first, std::size_t last) {
+        if (last - first == 1) {
+            write_payload(batch_[first].serialize());
+            return;
+        }
+        Message batch;
+        batch.type = MessageType::BATCH;
+        batch.sender = username_;
+        batch.batch.assign(batch_.begin() + first, batch_.begin() + last);
+        std::string payload = batch.serialize();
+        if (payload.size() > kMaxBatchBytes) {
+            std::size_t middle = first + (last - first) / 2;
+            write_batch(first, middle);
+            write_batch(middle, last);
+            return;
+        }
+        write_payload(payload);
+    }
+
+    /**
+     * @brief Encrypts a direct message for a peer key and queues it. Strand only.
+     * @param peer_key The recipient's raw public key.
+     */
+    void seal_and_write(Message& message, const std::string& peer_key) {
+        std::string envelope;
+        if (!e2e_->seal(peer_key, message.content, envelope)) {
+            notify("Cannot encrypt for " + message.recipient + "; message not sent.");
+            return;
+        }
+        message.content = std::move(envelope);
+        write_message(message);
+    }
+
+    /**
+     * @brief Seals and sends the messages held for a user with their pinned key. Strand only.
+     *
+     * Keeps holding them while the user has no pinned key or a key change is unanswered.
+     */
+    void release_held(const std::string& user) {
+        auto key = peer_keys_.find(user);
+        auto held = awaiting_key_.find(user);
+        if (key == peer_keys_.end() || held == awaiting_key_.end() || changed_keys_.count(user) != 0) {
+            return;
+        }
+        std::vector<Message> messages = std::move(held->second);
+        awaiting_key_.erase(held);
+        for (auto& message : messages) {
+            seal_and_write(message, key->second);
+        }
+    }
+
+    /**
+     * @brief Notes a key for a user that differs from the pinned one, to be confirmed with `trust_new_key()`. Strand only.
+     */
+    void key_changed(const std::string& user, const std::string& key) {
+        auto& changed = changed_keys_[user];
+        if (changed != key) {
+            changed = key;
+            notify("The encryption key of " + user + " has changed. Messages to them are held, and messages "
+                   "under the new key hidden, until you accept it.");
+        }
+    }
+
+    /**
+     * @brief Pins a user's key from a `KEY` reply and sends the messages held for it. Strand only.
+     *
+     * No key is remembered for a user without one, so the next message asks again.
+     */
+    void learn_key(const Message& reply) {
+        key_requests_.erase(reply.sender);
+        std::string key;
+        if (!from_hex(reply.public_key, key) || key.size() != kE2eKeySize) {
+            key.clear();
+        }
+
+        auto pinned = peer_keys_.find(reply.sender);
+        if (pinned == peer_keys_.end()) {
+            if (key.empty()) {
+                auto held = awaiting_key_.find(reply.sender);
+                if (held != awaiting_key_.end()) {
+                    notify(reply.sender + " has no encryption key; " + std::to_string(held->second.size()) +
+                           " message(s) to them are held until you agree to send them unencrypted.");
+                }
+                return;
+            }
+            peer_keys_.emplace(reply.sender, key);
+        } else if (!key.empty() && key != pinned->second) {
+            key_changed(reply.sender, key);
+            return;
+        }
+        release_held(reply.sender);
+    }
+
+    /**
+     * @brief Replaces an encrypted `content` with its text, or with a note why it cannot be read. Strand only.
+     *
+     * A live message pins the sender's key if none is pinned yet, saving the `KEY` round
+     * trip for a reply. An envelope whose other party's key differs from the pinned one
+     * is not shown, since anyone may have sealed it; a live one reports the key change.
+     */
+    void open_envelope(Message& message) {
+        if (!e2e_) {
+            message.content = "[Encrypted message]";
+            return;
+        }
+        std::string plaintext;
+        std::string peer_key;
+        switch (e2e_->open(message.content, plaintext, peer_key)) {
+        case EndToEnd::Opened::ok: {
+            // A copy of this user's own message names the recipient's key
+            bool live = message.type == MessageType::MESSAGE && message.sender != username_;
+            const std::string& peer = message.sender == username_ ? message.recipient : message.sender;
+            auto pinned = peer_keys_.find(peer);
+            if (pinned != peer_keys_.end() && pinned->second != peer_key) {
+                message.content = "[Encrypted with a key of " + peer + " you have not accepted]";
+                if (live) {
+                    key_changed(peer, peer_key);
+                }
+                break;
+            }
+            message.content = std::move(plaintext);
+            if (live && pinned == peer_keys_.end()) {
+                peer_keys_.emplace(peer, peer_key);
+                release_held(peer);
+            }
+            break;
+        }
+        case EndToEnd::Opened::foreign:
+            message.content = "[Encrypted for another key]";
+            break;
+        case EndToEnd::Opened::corrupt:
+            message.content = "[Message could not be decrypted]";
+            break;
+        }
+    }
+
+    /**
+     * @brief Passes a locally generated `SYSTEM` notice to `on_message`. Strand only.
+     */
+    void notify(const std::string& text) {
+        if (on_message_) {
+            Message notice;
+            notice.type = MessageType::SYSTEM;
+            notice.content = text;
+            on_message_(notice);
+        }
+    }
+
+    /**
+     * @brief Appends a frame to the write queue and starts writing if idle.
+     */
+    void queue_write(std::string frame) {
+        if (!connected_) {
+            return;
+        }
+        queued_bytes_ += frame.size();
+        write_queue_.push_back(std::move(frame));
+        if (write_queue_.size() == 1) {
+            write_next();
+        }
+    }
+
+    /**
+     * @brief Writes the frame at the front of the queue, then the rest in order.
+     */
+    void write_next() {
+        boost::asio::async_write(stream_, boost::asio::buffer(write_queue_.front()),
+            boost::asio::bind_executor(strand_, [this, self = shared_from_this()](const boost::system::error_code& error,
+                                                                                  std::size_t /*length*/) {
+                if (error) {
+                    fail(error);
+                    return;
+                }
+                queued_bytes_ -= write_queue_.front().size();
+                write_queue_.pop_front();
+                if (!write_queue_.empty()) {
+                    write_next();
+                }
+            }));
+    }
+
+    /**
+     * @brief Ends the connection once and reports why.
+     */
+    void fail(const boost::system::error_code& error) {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        connected_ = false;
+        write_queue_.clear();
+        queued_bytes_ = 0;
+        boost::system::error_code ignored;
+        stream_.lowest_layer().close(ignored);
+
+        if (on_registered_) {
+            auto registered = std::move(on_registered_);
+            on_registered_ = nullptr;
+            registered(error);
+        }
+        if (on_close_) {
+            auto closed = std::move(on_close_);
+            on_close_ = nullptr;
+            closed(error);
+        }
+    }
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;    ///< Serializes I/O and callbacks.
+    Stream stream_;                                 ///< TLS connection to the server.
+    std::array<char, 16384> read_buffer_;           ///< Bytes of the pending read.
+    FrameReader reader_;                            ///< Frames received but not yet handled.
+    std::deque<std::string> write_queue_;           ///< Frames waiting to be written; front is in flight.
+    std::size_t queued_bytes_ = 0;                  ///< Bytes in `write_queue_`.
+    std::string username_;                          ///< Registered username.
+    std::string password_;                          ///< Password sent in `REGISTER`.
+    std::string token_;                             ///< Session token sent in, or received after, `REGISTER`.
+    bool offer_compression_ = true;                 ///< Offer compressed frames in `REGISTER`.
+    std::unique_ptr<EndToEnd> e2e_;                 ///< Seals direct messages, or null without end-to-end encryption.
+    std::map<std::string, std::string> peer_keys_;  ///< Pinned raw public key of each user with a known key.
+    std::map<std::string, std::string> changed_keys_;           ///< Unconfirmed key differing from the pinned one, per user.
+    std::set<std::string> key_requests_;            ///< Users asked for their key with no reply yet.
+    std::map<std::string, std::vector<Message>> awaiting_key_;  ///< Messages held until the recipient's key is settled.
+    std::vector<Message> batch_;                    ///< Messages collected by `send_batch()`, not yet written.
+    bool batching_ = false;                         ///< Whether `write_message()` collects into `batch_`.
+    std::uint32_t protocol_version_ = 0;            ///< Protocol version agreed in the welcome.
+    FeatureSet features_;                           ///< Features the server enabled in the welcome.
+    bool connected_ = false;                        ///< Handshake done and not yet closed.
+    bool closed_ = false;                           ///< `fail()` has run.
+
+    MessageHandler on_message_;                     ///< Received messages.
+    DataHandler on_data_;                           ///< Received file chunks.
+    ResultHandler on_close_;                        ///< Connection ended.
+    ResultHandler on_registered_;                   ///< Pending `register_user()` completion.
+};
+
+}  // namespace chat
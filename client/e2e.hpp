@@ -0,0 +1,390 @@
+/**
+ * @file e2e.hpp
+ * @brief End-to-end encryption of direct messages: X25519 keys and AES-256-GCM.
+ *
+ * Two users derive the same key from their X25519 key pairs, so the server only ever
+ * relays, logs and stores ciphertext. The encrypted text travels in `content` as an
+ * envelope (`kE2ePrefix` and base64 of both public keys, the nonce, the ciphertext and
+ * the tag), so history, clustering and compression pass it through unchanged.
+ */
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "../common/message.hpp"
+
+namespace chat {
+
+constexpr std::size_t kE2eKeySize = 32;     ///< Bytes of an X25519 public key and of the derived AES key.
+constexpr std::size_t kE2eNonceSize = 12;   ///< Bytes of the GCM nonce.
+constexpr std::size_t kE2eTagSize = 16;     ///< Bytes of the GCM tag.
+
+/**
+ * @brief Encodes bytes as base64 with padding.
+ */
+inline std::string base64_encode(const std::string& data) {
+    std::string out(4 * ((data.size() + 2) / 3), '\0');
+    int length = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&out[0]),
+                                 reinterpret_cast<const unsigned char*>(data.data()), static_cast<int>(data.size()));
+    out.resize(static_cast<std::size_t>(length));
+    return out;
+}
+
+/**
+ * @brief Decodes padded base64.
+ * @return false if `text` is not valid base64.
+ */
+inline bool base64_decode(const std::string& text, std::string& out) {
+    if (text.size() % 4 != 0) {
+        return false;
+    }
+    out.assign(3 * (text.size() / 4), '\0');
+    int length = EVP_DecodeBlock(reinterpret_cast<unsigned char*>(&out[0]),
+                                 reinterpret_cast<const unsigned char*>(text.data()), static_cast<int>(text.size()));
+    if (length < 0) {
+        return false;
+    }
+    // EVP_DecodeBlock counts the padding as zero bytes
+    std::size_t padding = text.empty() ? 0 : (text.back() == '=') + (text.size() > 1 && text[text.size() - 2] == '=');
+    out.resize(static_cast<std::size_t>(length) - padding);
+    return true;
+}
+
+/**
+ * @brief A user's X25519 key pair.
+ *
+ * Devices that should read each other's conversations share the private key file.
+ */
+class E2eIdentity {
+public:
+    /**
+     * @brief Creates a fresh key pair.
+     * @throws std::runtime_error if OpenSSL fails.
+     */
+    static E2eIdentity generate() {
+        EVP_PKEY* key = EVP_PKEY_Q_keygen(nullptr, nullptr, "X25519");
+        if (!key) {
+            throw std::runtime_error("cannot generate an X25519 key");
+        }
+        return E2eIdentity(key);
+    }
+
+    /**
+     * @brief Reads the raw private key from a file, creating the file with a new key if needed.
+     * @throws std::runtime_error if the file cannot be read or written.
+     */
+    static E2eIdentity load_or_create(const std::string& path) {
+        std::string secret(kE2eKeySize, '\0');
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ssize_t got = ::read(fd, &secret[0], secret.size());
+            ::close(fd);
+            if (got != static_cast<ssize_t>(secret.size())) {
+                throw std::runtime_error("malformed key file " + path);
+            }
+            return from_private(secret);
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0 || RAND_bytes(reinterpret_cast<unsigned char*>(&secret[0]), static_cast<int>(secret.size())) != 1 ||
+            ::write(fd, secret.data(), secret.size()) != static_cast<ssize_t>(secret.size())) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("cannot create " + path);
+        }
+        ::close(fd);
+        return from_private(secret);
+    }
+
+    /**
+     * @brief Builds the key pair from a raw 32-byte private key.
+     * @throws std::runtime_error if the key is malformed.
+     */
+    static E2eIdentity from_private(const std::string& secret) {
+        EVP_PKEY* key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, nullptr,
+                                                     reinterpret_cast<const unsigned char*>(secret.data()), secret.size());
+        if (!key) {
+            throw std::runtime_error("malformed X25519 private key");
+        }
+        return E2eIdentity(key);
+    }
+
+    /**
+     * @brief Returns the raw 32-byte public key.
+     */
+    const std::string& public_key() const { return public_key_; }
+
+    /**
+     * @brief Computes the X25519 shared secret with a peer.
+     * @param peer_public The peer's raw public key.
+     * @return false if the peer key is malformed or of low order.
+     */
+    bool shared_secret(const std::string& peer_public, std::string& out) const {
+        std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> peer(
+            EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr,
+                                        reinterpret_cast<const unsigned char*>(peer_public.data()), peer_public.size()),
+            &EVP_PKEY_free);
+        if (!peer) {
+            return false;
+        }
+        std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new(key_.get(), nullptr),
+                                                                        &EVP_PKEY_CTX_free);
+        std::size_t length = kE2eKeySize;
+        out.assign(length, '\0');
+        return ctx && EVP_PKEY_derive_init(ctx.get()) == 1 && EVP_PKEY_derive_set_peer(ctx.get(), peer.get()) == 1 &&
+               EVP_PKEY_derive(ctx.get(), reinterpret_cast<unsigned char*>(&out[0]), &length) == 1 &&
+               length == kE2eKeySize;
+    }
+
+private:
+    explicit E2eIdentity(EVP_PKEY* key) : key_(key, &EVP_PKEY_free), public_key_(kE2eKeySize, '\0') {
+        std::size_t length = public_key_.size();
+        if (EVP_PKEY_get_raw_public_key(key, reinterpret_cast<unsigned char*>(&public_key_[0]), &length) != 1 ||
+            length != kE2eKeySize) {
+            throw std::runtime_error("cannot read X25519 public key");
+        }
+    }
+
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key_;   ///< The key pair.
+    std::string public_key_;                                    ///< Raw public key.
+};
+
+/**
+ * @brief AES-256-GCM under one key.
+ *
+ * The key schedule is expanded once into an encryption and a decryption context, and
+ * every message only sets a new nonce, so sealing a short message costs about as much
+ * as the AES-NI/PCLMUL (or VAES) code OpenSSL picks for the CPU. Both users (and their
+ * devices) seal under the same key, so each cipher starts its nonces at a random
+ * 96-bit value and counts up from there: a collision would need two of them to start
+ * within 2^64 of each other, and no message pays for a `RAND_bytes` call. Not thread-safe.
+ */
+class E2eCipher {
+public:
+    /**
+     * @brief Prepares both contexts for a 32-byte key.
+     * @throws std::runtime_error if OpenSSL fails.
+     */
+    explicit E2eCipher(const std::string& key) : seal_(EVP_CIPHER_CTX_new()), open_(EVP_CIPHER_CTX_new()) {
+        auto raw = reinterpret_cast<const unsigned char*>(key.data());
+        if (!seal_ || !open_ || key.size() != kE2eKeySize ||
+            EVP_EncryptInit_ex(seal_.get(), EVP_aes_256_gcm(), nullptr, raw, nullptr) != 1 ||
+            EVP_DecryptInit_ex(open_.get(), EVP_aes_256_gcm(), nullptr, raw, nullptr) != 1) {
+            throw std::runtime_error("cannot set up AES-256-GCM");
+        }
+        if (RAND_bytes(nonce_, sizeof(nonce_)) != 1) {
+            throw std::runtime_error("cannot draw a nonce");
+        }
+    }
+
+    /**
+     * @brief Appends nonce, ciphertext and tag of `plaintext` to `out`.
+     * @param aad Authenticated but unencrypted bytes.
+     * @return false if OpenSSL fails.
+     */
+    bool seal(const std::string& aad, const std::string& plaintext, std::string& out) {
+        std::size_t start = out.size();
+        out.resize(start + kE2eNonceSize + plaintext.size() + kE2eTagSize);
+        auto nonce = reinterpret_cast<unsigned char*>(&out[start]);
+        auto body = nonce + kE2eNonceSize;
+        std::copy(nonce_, nonce_ + kE2eNonceSize, nonce);
+        for (std::size_t i = kE2eNonceSize; i-- > 0 && ++nonce_[i] == 0;) {
+        }
+        int length = 0;
+        bool ok = EVP_EncryptInit_ex(seal_.get(), nullptr, nullptr, nullptr, nonce) == 1 &&
+                  EVP_EncryptUpdate(seal_.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()),
+                                    static_cast<int>(aad.size())) == 1 &&
+                  EVP_EncryptUpdate(seal_.get(), body, &length, reinterpret_cast<const unsigned char*>(plaintext.data()),
+                                    static_cast<int>(plaintext.size())) == 1 &&
+                  EVP_EncryptFinal_ex(seal_.get(), body + length, &length) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(seal_.get(), EVP_CTRL_GCM_GET_TAG, kE2eTagSize, body + plaintext.size()) == 1;
+        if (!ok) {
+            out.resize(start);
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Checks and decrypts nonce, ciphertext and tag.
+     * @param aad The bytes passed to `seal()`.
+     * @return false if the data was tampered with or sealed under another key.
+     */
+    bool open(const std::string& aad, const char* data, std::size_t size, std::string& plaintext) {
+        if (size < kE2eNonceSize + kE2eTagSize) {
+            return false;
+        }
+        auto nonce = reinterpret_cast<const unsigned char*>(data);
+        auto body = nonce + kE2eNonceSize;
+        std::size_t body_size = size - kE2eNonceSize - kE2eTagSize;
+        plaintext.assign(body_size, '\0');
+        unsigned char tag[kE2eTagSize];
+        std::copy(body + body_size, body + body_size + kE2eTagSize, tag);
+        int length = 0;
+        unsigned char* out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+        return EVP_DecryptInit_ex(open_.get(), nullptr, nullptr, nullptr, nonce) == 1 &&
+               EVP_DecryptUpdate(open_.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()),
+                                 static_cast<int>(aad.size())) == 1 &&
+               EVP_DecryptUpdate(open_.get(), out, &length, body, static_cast<int>(body_size)) == 1 &&
+               EVP_CIPHER_CTX_ctrl(open_.get(), EVP_CTRL_GCM_SET_TAG, kE2eTagSize, tag) == 1 &&
+               EVP_DecryptFinal_ex(open_.get(), out + length, &length) == 1;
+    }
+
+private:
+    struct ContextFree {
+        void operator()(EVP_CIPHER_CTX* ctx) const { EVP_CIPHER_CTX_free(ctx); }
+    };
+
+    std::unique_ptr<EVP_CIPHER_CTX, ContextFree> seal_;     ///< Keyed encryption context.
+    std::unique_ptr<EVP_CIPHER_CTX, ContextFree> open_;     ///< Keyed decryption context.
+    unsigned char nonce_[kE2eNonceSize];                    ///< Nonce of the next sealed message.
+};
+
+/**
+ * @brief Seals and opens message envelopes for one identity.
+ *
+ * One `E2eCipher` is kept per peer key, so the X25519 agreement and HKDF run once per
+ * peer rather than once per message. Not thread-safe; `chat::Client` uses it on its strand.
+ */
+class EndToEnd {
+public:
+    /**
+     * @brief Result of `open()`.
+     */
+    enum class Opened {
+        ok,         ///< Decrypted.
+        foreign,    ///< Sealed for a key pair this identity is not part of.
+        corrupt     ///< Malformed or tampered with.
+    };
+
+    /**
+     * @brief Creates the sealer for a key pair.
+     * @param max_peers Ciphers kept before the cache starts over.
+     */
+    explicit EndToEnd(E2eIdentity identity, std::size_t max_peers = 4096)
+        : identity_(std::move(identity)), max_peers_(max_peers) {}
+
+    /**
+     * @brief Returns true if `content` is an encrypted envelope.
+     */
+    static bool is_envelope(const std::string& content) {
+        return content.compare(0, sizeof(kE2ePrefix) - 1, kE2ePrefix) == 0;
+    }
+
+    /**
+     * @brief Returns this identity's raw public key.
+     */
+    const std::string& public_key() const { return identity_.public_key(); }
+
+    /**
+     * @brief Encrypts a message for a peer.
+     * @param peer_public The peer's raw public key.
+     * @param plaintext The message text.
+     * @param envelope Receives the `content` to send.
+     * @return false if the peer key is unusable.
+     */
+    bool seal(const std::string& peer_public, const std::string& plaintext, std::string& envelope) {
+        E2eCipher* cipher = cipher_for(peer_public);
+        if (!cipher) {
+            return false;
+        }
+        std::string keys = public_key() + peer_public;
+        std::string binary = keys;
+        if (!cipher->seal(keys, plaintext, binary)) {
+            return false;
+        }
+        envelope = kE2ePrefix + base64_encode(binary);
+        return true;
+    }
+
+    /**
+     * @brief Decrypts an envelope sealed by or for this identity.
+     * @param envelope A `content` for which `is_envelope()` holds.
+     * @param plaintext Receives the text.
+     * @param peer_public Receives the other party's raw public key.
+     */
+    Opened open(const std::string& envelope, std::string& plaintext, std::string& peer_public) {
+        std::string binary;
+        if (!base64_decode(envelope.substr(sizeof(kE2ePrefix) - 1), binary) || binary.size() < 2 * kE2eKeySize) {
+            return Opened::corrupt;
+        }
+        std::string sender = binary.substr(0, kE2eKeySize);
+        std::string recipient = binary.substr(kE2eKeySize, kE2eKeySize);
+        if (sender == public_key()) {
+            peer_public = recipient;
+        } else if (recipient == public_key()) {
+            peer_public = sender;
+        } else {
+            return Opened::foreign;
+        }
+        E2eCipher* cipher = cipher_for(peer_public);
+        if (!cipher || !cipher->open(binary.substr(0, 2 * kE2eKeySize), binary.data() + 2 * kE2eKeySize,
+                                     binary.size() - 2 * kE2eKeySize, plaintext)) {
+            return Opened::corrupt;
+        }
+        return Opened::ok;
+    }
+
+    /**
+     * @brief Returns the number of cached peer ciphers.
+     */
+    std::size_t peers() const { return ciphers_.size(); }
+
+private:
+    /**
+     * @brief Returns the cipher shared with a peer key, deriving it on first use.
+     *
+     * The key is HKDF-SHA256 of the X25519 secret, salted with both public keys in a
+     * fixed order so both sides derive the same one.
+     * @return null if the peer key is unusable.
+     */
+    E2eCipher* cipher_for(const std::string& peer_public) {
+        auto it = ciphers_.find(peer_public);
+        if (it != ciphers_.end()) {
+            return it->second.get();
+        }
+        std::string secret;
+        if (peer_public.size() != kE2eKeySize || !identity_.shared_secret(peer_public, secret)) {
+            return nullptr;
+        }
+        std::string salt = std::min(public_key(), peer_public) + std::max(public_key(), peer_public);
+        std::string key(kE2eKeySize, '\0');
+        std::size_t length = key.size();
+        static const char info[] = "chat e2e v1";
+        std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr),
+                                                                        &EVP_PKEY_CTX_free);
+        bool ok = ctx && EVP_PKEY_derive_init(ctx.get()) == 1 && EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha256()) == 1 &&
+                  EVP_PKEY_CTX_set1_hkdf_salt(ctx.get(), reinterpret_cast<const unsigned char*>(salt.data()),
+                                              static_cast<int>(salt.size())) == 1 &&
+                  EVP_PKEY_CTX_set1_hkdf_key(ctx.get(), reinterpret_cast<const unsigned char*>(secret.data()),
+                                             static_cast<int>(secret.size())) == 1 &&
+                  EVP_PKEY_CTX_add1_hkdf_info(ctx.get(), reinterpret_cast<const unsigned char*>(info),
+                                              static_cast<int>(sizeof(info) - 1)) == 1 &&
+                  EVP_PKEY_derive(ctx.get(), reinterpret_cast<unsigned char*>(&key[0]), &length) == 1;
+        OPENSSL_cleanse(&secret[0], secret.size());
+        if (!ok) {
+            return nullptr;
+        }
+        if (ciphers_.size() >= max_peers_) {
+            ciphers_.clear();
+        }
+        auto cipher = std::make_unique<E2eCipher>(key);
+        OPENSSL_cleanse(&key[0], key.size());
+        return ciphers_.emplace(peer_public, std::move(cipher)).first->second.get();
+    }
+
+    E2eIdentity identity_;                                                  ///< This user's key pair.
+    std::size_t max_peers_;                                                 ///< Cache bound.
+    std::unordered_map<std::string, std::unique_ptr<E2eCipher>> ciphers_;   ///< Cipher per peer public key.
+};
+
+}  // namespace chat
@@ -0,0 +1,360 @@
+/**
+ * @file history.hpp
+ * @brief Bounded per-conversation chat history with compact in-memory storage.
+ */
+#pragma once
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "search_index.hpp"
+
+namespace chat {
+
+/**
+ * @brief Messages kept in memory per conversation unless configured otherwise.
+ */
+constexpr std::size_t kDefaultHistoryCapacity = 1000;
+
+/**
+ * @brief Spilled messages per entry of the sparse spill-file index.
+ */
+constexpr std::size_t kSpillIndexStride = 64;
+
+/**
+ * @brief Usernames interned to small ids, so history entries store 4 bytes instead of a string.
+ */
+class SenderTable {
+public:
+    /**
+     * @brief Returns the id of a name, assigning the next one on first use.
+     */
+    std::uint32_t intern(const std::string& name) {
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        auto id = static_cast<std::uint32_t>(names_.size());
+        names_.push_back(name);
+        ids_.emplace(name, id);
+        return id;
+    }
+
+    /**
+     * @brief Returns the name of an id handed out by `intern()`.
+     */
+    const std::string& name(std::uint32_t id) const { return names_[id]; }
+
+private:
+    std::vector<std::string> names_;                        ///< Names by id.
+    std::unordered_map<std::string, std::uint32_t> ids_;    ///< Ids by name.
+};
+
+/**
+ * @brief History of one conversation: a byte arena plus a fixed-size index entry per message.
+ *
+ * Message texts are stored back to back in one contiguous buffer, and each message adds
+ * only a 24-byte index entry (sender id, offset, length, timestamp). Reading recent
+ * messages therefore walks two dense arrays instead of chasing a pair of heap strings
+ * per message.
+ *
+ * At most `capacity` messages stay in memory. When the history grows past that, the
+ * oldest half is appended to a spill file and dropped from memory, which keeps appends
+ * amortized O(1). Spilled messages are still readable through `visit()`; a sparse index
+ * of every `kSpillIndexStride`-th record keeps that to a short sequential read. Without
+ * a spill file they are discarded.
+ *
+ * Not thread-safe; the client guards it with a mutex.
+ */
+class Conversation {
+public:
+    /**
+     * @brief Creates an empty history.
+     * @param capacity Messages kept in memory; at least 2.
+     * @param spill_path File for older messages (truncated), or empty to discard them. It
+     *                   holds decrypted texts, so it is created readable by the owner only.
+     */
+    explicit Conversation(std::size_t capacity = kDefaultHistoryCapacity, std::string spill_path = "")
+        : capacity_(capacity < 2 ? 2 : capacity), spill_path_(std::move(spill_path)) {
+        if (!spill_path_.empty()) {
+            int fd = ::open(spill_path_.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_NOFOLLOW, 0600);
+            if (fd < 0) {
+                return;
+            }
+            ::fchmod(fd, 0600);     // An existing file keeps its mode otherwise
+            ::close(fd);
+            spill_.open(spill_path_, std::ios::binary | std::ios::trunc | std::ios::in | std::ios::out);
+        }
+    }
+
+    Conversation(const Conversation&) = delete;
+    Conversation& operator=(const Conversation&) = delete;
+
+    ~Conversation() {
+        if (spill_.is_open()) {
+            spill_.close();
+            std::remove(spill_path_.c_str());
+        }
+    }
+
+    /**
+     * @brief Adds a message.
+     * @param sender Interned sender id.
+     * @param text Message text.
+     * @param timestamp Time of the message (µs since the Unix epoch).
+     * @return The number of messages in the conversation, this one included.
+     */
+    std::size_t append(std::uint32_t sender, std::string_view text, std::uint64_t timestamp) {
+        if (entries_.size() == capacity_) {
+            evict(capacity_ / 2);
+        }
+        entries_.push_back({timestamp, sender, static_cast<std::uint32_t>(arena_.size()), static_cast<std::uint32_t>(text.size())});
+        arena_.append(text.data(), text.size());
+        return size();
+    }
+
+    /**
+     * @brief Returns the number of messages, spilled ones included.
+     */
+    std::size_t size() const { return evicted_ + entries_.size(); }
+
+    /**
+     * @brief Returns the index of the oldest message still in memory.
+     */
+    std::size_t first_in_memory() const { return evicted_; }
+
+    /**
+     * @brief Calls `visitor(sender_id, text, timestamp)` for messages `[begin, end)`, oldest first.
+     *
+     * Messages that were spilled are read back from disk; messages that were discarded
+     * are skipped.
+     */
+    template <typename Visitor>
+    void visit(std::size_t begin, std::size_t end, Visitor&& visitor) {
+        end = std::min(end, size());
+        if (begin < evicted_ && spill_.is_open()) {
+            visit_spilled(begin, std::min(end, evicted_), visitor);
+        }
+        for (std::size_t i = std::max(begin, evicted_); i < end; ++i) {
+            const Entry& entry = entries_[i - evicted_];
+            visitor(entry.sender, std::string_view(arena_.data() + entry.offset, entry.length), entry.timestamp);
+        }
+    }
+
+    /**
+     * @brief Returns the bytes held in memory (arena and index).
+     */
+    std::size_t memory_bytes() const { return arena_.capacity() + entries_.capacity() * sizeof(Entry); }
+
+private:
+    /**
+     * @brief Index entry of one in-memory message.
+     */
+    struct Entry {
+        std::uint64_t timestamp;    ///< Time of the message.
+        std::uint32_t sender;       ///< Interned sender id.
+        std::uint32_t offset;       ///< Start of the text in `arena_`.
+        std::uint32_t length;       ///< Length of the text.
+    };
+
+    /**
+     * @brief Moves the oldest `count` messages out of memory, into the spill file if there is one.
+     */
+    void evict(std::size_t count) {
+        if (spill_.is_open()) {
+            spill_.seekp(0, std::ios::end);
+            for (std::size_t i = 0; i < count; ++i) {
+                if ((evicted_ + i) % kSpillIndexStride == 0) {
+                    spill_index_.push_back(static_cast<std::uint64_t>(spill_.tellp()));
+                }
+                const Entry& entry = entries_[i];
+                spill_.write(reinterpret_cast<const char*>(&entry.timestamp), sizeof(entry.timestamp));
+                spill_.write(reinterpret_cast<const char*>(&entry.sender), sizeof(entry.sender));
+                spill_.write(reinterpret_cast<const char*>(&entry.length), sizeof(entry.length));
+                spill_.write(arena_.data() + entry.offset, entry.length);
+            }
+            spill_.flush();
+        }
+
+        std::uint32_t cut = entries_[count].offset;
+        arena_.erase(0, cut);
+        entries_.erase(entries_.begin(), entries_.begin() + static_cast<std::ptrdiff_t>(count));
+        for (Entry& entry : entries_) {
+            entry.offset -= cut;
+        }
+        evicted_ += count;
+    }
+
+    /**
+     * @brief Reads spilled messages `[begin, end)` back, starting from the nearest indexed record.
+     */
+    template <typename Visitor>
+    void visit_spilled(std::size_t begin, std::size_t end, Visitor& visitor) {
+        std::size_t i = begin / kSpillIndexStride * kSpillIndexStride;
+        spill_.seekg(static_cast<std::streamoff>(spill_index_[i / kSpillIndexStride]));
+        std::string text;
+        for (; i < end; ++i) {
+            Entry entry{};
+            spill_.read(reinterpret_cast<char*>(&entry.timestamp), sizeof(entry.timestamp));
+            spill_.read(reinterpret_cast<char*>(&entry.sender), sizeof(entry.sender));
+            spill_.read(reinterpret_cast<char*>(&entry.length), sizeof(entry.length));
+            text.resize(entry.length);
+            spill_.read(&text[0], entry.length);
+            if (!spill_) {
+                spill_.clear();
+                return;
+            }
+            if (i >= begin) {
+                visitor(entry.sender, std::string_view(text), entry.timestamp);
+            }
+        }
+    }
+
+    std::size_t capacity_;                      ///< Messages kept in memory.
+    std::string arena_;                         ///< Texts of the in-memory messages, back to back.
+    std::vector<Entry> entries_;                ///< Index of the in-memory messages, oldest first.
+    std::size_t evicted_ = 0;                   ///< Messages moved out of memory.
+    std::string spill_path_;                    ///< Spill file; empty if older messages are discarded.
+    std::fstream spill_;                        ///< Open spill file.
+    std::vector<std::uint64_t> spill_index_;    ///< File offset of every `kSpillIndexStride`-th spilled message.
+};
+
+/**
+ * @brief The histories of all conversations, sharing one sender table and one search index.
+ *
+ * Every message is indexed as it is appended; the index maps message ids to their
+ * conversation and position with 8 bytes per message, so search results are read back
+ * through the same path as scrollback.
+ *
+ * Not thread-safe; the client guards it with a mutex.
+ */
+class ChatHistory {
+public:
+    /**
+     * @brief Creates an empty history.
+     * @param capacity Messages kept in memory per conversation.
+     * @param spill_prefix Path prefix of the spill files (the directory must exist), or empty to
+     *                     discard older messages.
+     */
+    explicit ChatHistory(std::size_t capacity = kDefaultHistoryCapacity, std::string spill_prefix = "")
+        : capacity_(capacity), spill_prefix_(std::move(spill_prefix)) {}
+
+    /**
+     * @brief Adds a message to a conversation and indexes it.
+     * @param conversation Username or `#room`.
+     * @param sender Sender's username.
+     * @param text Message text.
+     * @param timestamp Time of the message (µs since the Unix epoch).
+     * @return The number of messages in the conversation, this one included.
+     */
+    std::size_t append(const std::string& conversation, const std::string& sender, std::string_view text,
+                       std::uint64_t timestamp) {
+        std::uint32_t id = conversation_id(conversation);
+        std::size_t line = conversations_[id]->append(senders_.intern(sender), text, timestamp);
+        search_index_.add(text);
+        refs_.push_back({id, static_cast<std::uint32_t>(line - 1)});
+        return line;
+    }
+
+    /**
+     * @brief Returns the number of messages in a conversation.
+     */
+    std::size_t size(const std::string& conversation) const {
+        auto it = ids_.find(conversation);
+        return it == ids_.end() ? 0 : conversations_[it->second]->size();
+    }
+
+    /**
+     * @brief Calls `visitor(sender, text, timestamp)` for messages `[begin, end)` of a conversation.
+     */
+    template <typename Visitor>
+    void visit(const std::string& conversation, std::size_t begin, std::size_t end, Visitor&& visitor) {
+        auto it = ids_.find(conversation);
+        if (it == ids_.end()) {
+            return;
+        }
+        conversations_[it->second]->visit(begin, end, [this, &visitor](std::uint32_t sender, std::string_view text,
+                                                                       std::uint64_t timestamp) {
+            visitor(senders_.name(sender), text, timestamp);
+        });
+    }
+
+    /**
+     * @brief Finds messages containing every word of a query, newest first.
+     *
+     * Calls `visitor(conversation, line, sender, text, timestamp)` for each match, where
+     * `line` is the message's index in its conversation. Matches whose message was
+     * discarded (no spill file) are skipped.
+     * @param query Words to match; case-insensitive for ASCII.
+     * @param limit Most matches to look up.
+     */
+    template <typename Visitor>
+    void search(std::string_view query, std::size_t limit, Visitor&& visitor) {
+        for (std::uint32_t id : search_index_.search(query, limit)) {
+            const MessageRef& ref = refs_[id];
+            conversations_[ref.conversation]->visit(ref.line, ref.line + 1, [&](std::uint32_t sender, std::string_view text,
+                                                                                std::uint64_t timestamp) {
+                visitor(names_[ref.conversation], static_cast<std::size_t>(ref.line), senders_.name(sender), text, timestamp);
+            });
+        }
+    }
+
+    /**
+     * @brief Returns the interned sender names.
+     */
+    const SenderTable& senders() const { return senders_; }
+
+    /**
+     * @brief Returns the search index.
+     */
+    const SearchIndex& search_index() const { return search_index_; }
+
+private:
+    /**
+     * @brief Where an indexed message lives.
+     */
+    struct MessageRef {
+        std::uint32_t conversation;     ///< Conversation id.
+        std::uint32_t line;             ///< Position within the conversation.
+    };
+
+    /**
+     * @brief Returns the id of a conversation, creating it on first use.
+     */
+    std::uint32_t conversation_id(const std::string& conversation) {
+        auto it = ids_.find(conversation);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        auto id = static_cast<std::uint32_t>(conversations_.size());
+        std::string spill_path;
+        if (!spill_prefix_.empty()) {
+            spill_path = spill_prefix_ + std::to_string(id) + ".spill";
+        }
+        conversations_.push_back(std::make_unique<Conversation>(capacity_, spill_path));
+        names_.push_back(conversation);
+        ids_.emplace(conversation, id);
+        return id;
+    }
+
+    std::size_t capacity_;                                      ///< Messages kept in memory per conversation.
+    std::string spill_prefix_;                                  ///< Path prefix of spill files; empty discards.
+    SenderTable senders_;                                       ///< Interned senders.
+    std::vector<std::unique_ptr<Conversation>> conversations_;  ///< Histories by conversation id.
+    std::vector<std::string> names_;                            ///< Username or `#room` by conversation id.
+    std::map<std::string, std::uint32_t> ids_;                  ///< Conversation ids by name.
+    SearchIndex search_index_;                                  ///< Words of all messages.
+    std::vector<MessageRef> refs_;                              ///< Location of every indexed message, by id.
+};
+
+}  // namespace chat
@@ -13,7 +13,25 @@
 #include <atomic>
 #include <map>
 #include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <functional>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../common/file_transfer.hpp"
 #include "../common/message.hpp"
+#include "../common/utils.hpp"
+#include "channel.hpp"
+#include "chat_client.hpp"
+#include "history.hpp"
+#include "renderer.hpp"
 
 namespace asio = boost::asio;
 using asio::ip::tcp;
@@ -44,16 +62,25 @@ namespace Color {
  *
  * Handles connection to the server, sending and receiving messages,
  * and user interface.
+ *
+ * The protocol itself is handled by `chat::Client`, whose I/O and callbacks all run
+ * on one io thread; the input thread only hands it outgoing messages. Console output
+ * caused by incoming messages is passed to a UI thread through a channel, so a slow
+ * terminal never stalls the connection.
  */
 class ChatClient {
 private:
     // Connection related
     asio::io_context& io_context_;          ///< Boost.Asio I/O context.
     ssl::context ssl_context_;              ///< Boost.Asio SSL context.
-    std::shared_ptr<ssl::stream<tcp::socket>> ssl_socket_; ///< SSL socket for communication.
+    std::shared_ptr<chat::Client> client_;  ///< Protocol connection to the server.
     std::string server_ip_;                 ///< IP address of the server.
     std::string port_;                      ///< Port number of the server.
     std::string username_;                  ///< Username of the client.
+    bool trace_ = false;                    ///< Stamp outgoing messages for server tracing and print relay latency.
+    bool ask_password_ = false;             ///< Ask for a password at login, for servers run with `--auth`.
+    std::string e2e_key_file_;              ///< Private key file for end-to-end encryption; empty disables it.
+    asio::executor_work_guard<asio::io_context::executor_type> work_;  ///< Keeps the io thread running between operations.
 
     // State
     /**
@@ -67,23 +94,74 @@ private:
     };
 
     std::atomic<ClientState> state_{ClientState::DISCONNECTED}; ///< Current state of the client.
-    std::string selected_user_;                                 ///< Username of the currently selected chat partner.
-    std::vector<std::string> user_list_;                        ///< List of available users.
-    std::mutex user_list_mutex_;                                ///< Mutex to protect access to the user list.
+    std::string selected_user_;                                 ///< Username or `#room` of the currently selected chat partner.
+    std::vector<std::string> user_list_;                        ///< Currently displayed page of available users.
+    std::string list_prefix_;                                   ///< Username prefix filter of the displayed page.
+    std::uint32_t list_offset_ = 0;                             ///< Offset of the displayed page in the filtered list.
+    std::uint32_t list_total_ = 0;                              ///< Number of users matching `list_prefix_` on the server.
+    std::mutex user_list_mutex_;                                ///< Mutex to protect access to the user list and paging state.
+
+    // Message history for each user or room
+    chat::ChatHistory chat_history_;                            ///< Bounded chat history with other users and rooms.
+    std::mutex chat_history_mutex_;                             ///< Mutex to protect access to chat history and history_fetches_.
+
+    /**
+     * @brief The server history of a conversation being fetched because it was opened empty.
+     */
+    struct HistoryFetch {
+        std::vector<chat::Message> page;                        ///< Stored messages received so far, oldest first.
+        std::vector<chat::Message> held;                        ///< Live messages sent or received meanwhile.
+    };
+    std::map<std::string, HistoryFetch> history_fetches_;       ///< Pending fetch per conversation.
+
+    // File transfers
+    /**
+     * @brief A file being sent, streamed from its mapping as the receiver grants credit.
+     */
+    struct OutgoingFile {
+        std::unique_ptr<chat::MappedFile> file;     ///< Mapped file contents.
+        std::string recipient;                      ///< Receiving user.
+        std::string name;                           ///< File name shown to the receiver.
+        std::uint64_t sent = 0;                     ///< Bytes written to the server.
+        std::uint64_t acked = 0;                    ///< Bytes the receiver has acknowledged.
+        std::uint32_t window = 0;                   ///< Granted window; 0 until accepted.
+    };
 
-    // Message history for each user
-    std::map<std::string, std::vector<std::pair<std::string, std::string>>> chat_history_; ///< Stores chat history with other users.
-    std::mutex chat_history_mutex_;                                                      ///< Mutex to protect access to chat history.
+    /**
+     * @brief A file being received, written to disk chunk by chunk.
+     */
+    struct IncomingFile {
+        std::string sender;                         ///< Sending user.
+        std::string name;                           ///< File name from the offer.
+        std::uint64_t size = 0;                     ///< Announced size in bytes.
+        std::uint64_t received = 0;                 ///< Bytes written so far.
+        std::uint64_t acked = 0;                    ///< Bytes acknowledged to the sender.
+        std::string path;                           ///< Where the file is saved once accepted.
+        std::ofstream out;                          ///< Open while the transfer runs.
+    };
+
+    std::map<std::uint64_t, OutgoingFile> outgoing_files_;    ///< Transfers this client sends, by id.
+    std::map<std::uint64_t, IncomingFile> incoming_files_;    ///< Transfers offered to this client, by id.
+    std::uint64_t pending_offer_ = 0;                           ///< Latest offer awaiting `/accept` or `/decline`.
+    std::mutex files_mutex_;                                    ///< Mutex to protect the transfer maps.
 
     // Input/output mutex to prevent garbled console
     std::mutex console_mutex_;                                  ///< Mutex to synchronize console output.
+    chat::Channel<std::function<void()>> ui_;                   ///< Console output from the io thread, run by the UI thread.
+
+    // Chat screen; guarded by `console_mutex_`
+    chat::ChatRenderer renderer_{std::cout};                    ///< Draws the open conversation.
+    std::size_t scroll_ = 0;                                    ///< History lines hidden below the viewport; 0 follows new lines.
+    std::size_t shown_ = 0;                                     ///< History lines of the open conversation already on screen.
+    std::size_t unseen_ = 0;                                    ///< Lines that arrived while scrolled back.
+    bool covered_ = false;                                      ///< Search results cover the conversation.
 
     // Flag to indicate if we should quit
     std::atomic<bool> quit_{false};                             ///< Flag to signal application termination.
 
     // Threads
-    std::thread io_thread_;                                     ///< Thread for Boost.Asio I/O operations.
-    std::thread read_thread_;                                   ///< Thread for reading messages from the server.
+    std::thread io_thread_;                                     ///< Thread for all socket I/O.
+    std::thread ui_thread_;                                     ///< Thread running console output queued on `ui_`.
     std::thread input_thread_;                                  ///< Thread for handling user input.
 
 public:
@@ -92,15 +170,34 @@ public:
      * @param io_context The Boost.Asio I/O context.
      * @param server_ip The IP address of the server.
      * @param port The port number of the server.
+     * @param trace Whether to request end-to-end tracing of sent messages.
+     * @param history_capacity Messages per conversation kept in memory; older ones are moved
+     *                         to a spill file under `history/`.
+     * @param ask_password Whether to ask for a password at login.
+     * @param e2e_key_file X25519 private key file, created if missing, to encrypt direct
+     *                     messages end to end; empty to send them as plaintext.
      */
-    ChatClient(asio::io_context& io_context, const std::string& server_ip, const std::string& port)
+    ChatClient(asio::io_context& io_context, const std::string& server_ip, const std::string& port, bool trace = false,
+               std::size_t history_capacity = chat::kDefaultHistoryCapacity, bool ask_password = false,
+               std::string e2e_key_file = "")
         : io_context_(io_context),
           ssl_context_(ssl::context::tlsv12_client),
           server_ip_(server_ip),
-          port_(port) {
-
-        // Set SSL options
-        ssl_context_.set_verify_mode(ssl::verify_none);
+          port_(port),
+          trace_(trace),
+          ask_password_(ask_password),
+          e2e_key_file_(std::move(e2e_key_file)),
+          work_(asio::make_work_guard(io_context)),
+          chat_history_(history_capacity, private_directory("history") ? "history/" + std::to_string(::getpid()) + "-" : "") {
+
+        // Set SSL options. A password must only go to the real server, so with a
+        // password the server has to present the certificate the client trusts.
+        if (ask_password_) {
+            ssl_context_.load_verify_file("server.crt");
+            ssl_context_.set_verify_mode(ssl::verify_peer);
+        } else {
+            ssl_context_.set_verify_mode(ssl::verify_none);
+        }
     }
 
     /**
@@ -115,13 +212,19 @@ public:
             input_thread_.join();
         }
 
-        if (read_thread_.joinable()) {
-            read_thread_.join();
+        if (client_) {
+            client_->close();
         }
-
+        work_.reset();
+        io_context_.stop();
         if (io_thread_.joinable()) {
             io_thread_.join();
         }
+
+        ui_.close();
+        if (ui_thread_.joinable()) {
+            ui_thread_.join();
+        }
     }
 
     /**
@@ -136,16 +239,32 @@ public:
             tcp::resolver resolver(io_context_);
             auto endpoints = resolver.resolve(server_ip_, port_);
 
-            // Create SSL socket
-            ssl_socket_ = std::make_shared<ssl::stream<tcp::socket>>(io_context_, ssl_context_);
-            asio::connect(ssl_socket_->lowest_layer(), endpoints);
-
-            ssl_socket_->handshake(ssl::stream_base::client);
+            client_ = chat::Client::create(io_context_, ssl_context_);
+            if (!e2e_key_file_.empty()) {
+                client_->enable_e2e(chat::E2eIdentity::load_or_create(e2e_key_file_));
+            }
+            client_->on_message([this](const chat::Message& message) { process_message(message); });
+            client_->on_data([this](std::uint64_t transfer_id, const char* data, std::size_t size) {
+                process_file_data(transfer_id, data, size);
+            });
+            client_->on_close([this](const boost::system::error_code& error) {
+                disconnect(error == asio::error::eof ? "Server closed connection." : "Connection error: " + error.message());
+            });
+
+            std::promise<boost::system::error_code> connected;
+            client_->connect(endpoints, [&connected](const boost::system::error_code& error) { connected.set_value(error); });
+            io_thread_ = std::thread([this]() { io_context_.run(); });
+            boost::system::error_code error = connected.get_future().get();
+            if (error) {
+                throw boost::system::system_error(error);
+            }
             state_ = ClientState::CONNECTED;
 
-            // Start background I/O processing
-            io_thread_ = std::thread([this]() { io_context_.run(); });
-            read_thread_ = std::thread([this]() { read_loop(); });
+            ui_thread_ = std::thread([this]() {
+                while (auto task = ui_.pop()) {
+                    (*task)();
+                }
+            });
 
             return true;
         }
@@ -197,26 +316,42 @@ private:
     void print_header() {
         std::lock_guard<std::mutex> lock(console_mutex_);
         clear_screen();
-        std::cout << Color::CYAN << Color::BOLD << "══════════════════════════════════════════════════" << Color::RESET << std::endl;
-        std::cout << Color::CYAN << Color::BOLD << "           SECURE MESSENGER - CHAT APP           " << Color::RESET << std::endl;
-        std::cout << Color::CYAN << Color::BOLD << "══════════════════════════════════════════════════" << Color::RESET << std::endl;
+        for (const auto& line : header_lines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+    /**
+     * @brief Returns the lines of the application header, formatted.
+     */
+    std::vector<std::string> header_lines() const {
+        std::vector<std::string> lines{
+            Color::CYAN + Color::BOLD + "══════════════════════════════════════════════════" + Color::RESET,
+            Color::CYAN + Color::BOLD + "           SECURE MESSENGER - CHAT APP           " + Color::RESET,
+            Color::CYAN + Color::BOLD + "══════════════════════════════════════════════════" + Color::RESET};
 
         if (state_ == ClientState::REGISTERED || state_ == ClientState::CHATTING) {
-            std::cout << Color::GREEN << "Logged in as: " << Color::BOLD << username_ << Color::RESET << std::endl;
+            lines.push_back(Color::GREEN + "Logged in as: " + Color::BOLD + username_ + Color::RESET);
         }
 
-        std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
+        lines.push_back(Color::CYAN + "──────────────────────────────────────────────────" + Color::RESET);
+        return lines;
     }
 
     /**
      * @brief Displays the login screen and prompts the user for a username.
      *
-     * After getting the username, it calls `register_user()` to register with the server.
+     * After getting the username, and the password with `--auth`, it calls `register_user()`
+     * to register with the server.
      */
     void show_login_screen() {
         print_header();
         std::cout << Color::YELLOW << "Enter your username: " << Color::RESET;
         std::cin >> username_;
+        if (ask_password_) {
+            std::cout << Color::YELLOW << "Password: " << Color::RESET << std::flush;
+            client_->set_password(read_password());
+        }
 
         register_user();
 
@@ -224,11 +359,43 @@ private:
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
 
+    /**
+     * @brief Creates a directory only its owner can enter, or restricts an existing one.
+     * @return false if the directory cannot be used.
+     */
+    static bool private_directory(const char* path) {
+        if (::mkdir(path, 0700) == 0) {
+            return true;
+        }
+        return errno == EEXIST && ::chmod(path, 0700) == 0;
+    }
+
+    /**
+     * @brief Reads a line from stdin without echoing it when stdin is a terminal.
+     */
+    static std::string read_password() {
+        termios saved{};
+        bool terminal = ::tcgetattr(STDIN_FILENO, &saved) == 0;
+        if (terminal) {
+            termios silent = saved;
+            silent.c_lflag &= ~static_cast<tcflag_t>(ECHO);
+            ::tcsetattr(STDIN_FILENO, TCSANOW, &silent);
+        }
+        std::string password;
+        std::cin >> password;
+        if (terminal) {
+            ::tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+            std::cout << std::endl;
+        }
+        return password;
+    }
+
     /**
      * @brief Displays the user selection screen.
      *
-     * Shows a list of available users and allows the client to select one to chat with
-     * or refresh the user list. This loop continues as long as the client is in the
+     * Shows one page of available users and allows the client to select one to chat with,
+     * page through the list, filter it by prefix or refresh it. Pages are fetched from the
+     * server only when requested. This loop continues as long as the client is in the
      * `REGISTERED` state and has not quit.
      */
     void show_user_selection_screen() {
@@ -251,10 +418,21 @@ private:
                 if (idx == 1) {
                     std::cout << Color::RED << " No other users online." << Color::RESET << std::endl;
                 }
+
+                if (list_total_ > 0) {
+                    std::uint32_t pages = (list_total_ + chat::kDefaultListPageSize - 1) / chat::kDefaultListPageSize;
+                    std::cout << Color::CYAN << " Page " << list_offset_ / chat::kDefaultListPageSize + 1 << " of " << pages
+                              << " (" << list_total_ << " users";
+                    if (!list_prefix_.empty()) {
+                        std::cout << " matching '" << list_prefix_ << "'";
+                    }
+                    std::cout << ")" << Color::RESET << std::endl;
+                }
             }
 
             std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
-            std::cout << Color::YELLOW << "Enter user number or 'r' to refresh: " << Color::RESET;
+            std::cout << Color::YELLOW << "Enter user number, 'n'/'p' for next/previous page, '/<prefix>' to filter, 'r' to refresh," << std::endl
+                      << "'#<room>' to join a room or '+<room>' to create one: " << Color::RESET;
 
             std::string choice;
             std::cin >> choice;
@@ -263,6 +441,37 @@ private:
                 request_user_list();
                 std::this_thread::sleep_for(std::chrono::milliseconds(500));
             }
+            else if (choice == "n" || choice == "N" || choice == "p" || choice == "P") {
+                {
+                    std::lock_guard<std::mutex> lock(user_list_mutex_);
+                    if (choice == "n" || choice == "N") {
+                        if (list_offset_ + chat::kDefaultListPageSize < list_total_) {
+                            list_offset_ += chat::kDefaultListPageSize;
+                        }
+                    } else {
+                        list_offset_ -= std::min(list_offset_, chat::kDefaultListPageSize);
+                    }
+                }
+                request_user_list();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+            else if (choice[0] == '#' || choice[0] == '+') {
+                std::string room = "#" + choice.substr(1);
+                if (chat::is_room_name(room)) {
+                    send_room_request(choice[0] == '+' ? chat::MessageType::ROOM_CREATE : chat::MessageType::ROOM_JOIN, room);
+                    selected_user_ = room;
+                    state_ = ClientState::CHATTING;
+                }
+            }
+            else if (choice[0] == '/') {
+                {
+                    std::lock_guard<std::mutex> lock(user_list_mutex_);
+                    list_prefix_ = choice.substr(1);
+                    list_offset_ = 0;
+                }
+                request_user_list();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
             else {
                 try {
                     int user_idx = std::stoi(choice) - 1;
@@ -297,39 +506,36 @@ private:
     }
 
     /**
-     * @brief Displays the chat screen for the selected user.
+     * @brief Displays the chat screen for the selected user or room.
      *
-     * Shows the chat history with the selected user and allows the client to send messages
-     * or go back to the user selection screen. This loop continues as long as the client
-     * is in the `CHATTING` state with the `selected_user_` and has not quit.
+     * Shows the latest history with the selected user or room and allows the client to send
+     * messages, scroll back, leave a room or go back to the user selection screen. The screen
+     * is drawn in full only on entry and after commands; sent and received messages are
+     * appended, so each costs one line of output however long the conversation is. This loop
+     * continues as long as the client is in the `CHATTING` state with the `selected_user_`
+     * and has not quit.
      */
     void show_chat_screen() {
         // Clear any existing input
         std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-        while (state_ == ClientState::CHATTING && !quit_) {
-            print_header();
-            std::cout << Color::MAGENTA << Color::BOLD << "Chatting with: " << selected_user_ << Color::RESET << std::endl;
-            std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
-
-            // Display chat history
-            {
-                std::lock_guard<std::mutex> lock(chat_history_mutex_);
-                auto it = chat_history_.find(selected_user_);
-                if (it != chat_history_.end()) {
-                    for (const auto& msg : it->second) {
-                        if (msg.first == username_) {
-                            std::cout << Color::GREEN << "You: " << Color::RESET << msg.second << std::endl;
-                        } else {
-                            std::cout << Color::BLUE << selected_user_ << ": " << Color::RESET << msg.second << std::endl;
-                        }
-                    }
-                }
+        {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            scroll_ = 0;
+            unseen_ = 0;
+        }
+        {
+            // A conversation with nothing local, e.g. on a new device, starts from the server's
+            // history, if it keeps one; the features were set before the welcome reached us
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            if (client_->features().has(chat::Feature::history) && chat_history_.size(selected_user_) == 0 &&
+                history_fetches_.emplace(selected_user_, HistoryFetch{}).second) {
+                client_->request_history(selected_user_);
             }
+        }
+        draw_chat();
 
-            std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
-            std::cout << "Type a message or '/back' to return to user selection: ";
-
+        while (state_ == ClientState::CHATTING && !quit_) {
             std::string message;
             std::getline(std::cin, message);
 
@@ -337,10 +543,190 @@ private:
                 state_ = ClientState::REGISTERED;
                 break;
             }
-            else if (!message.empty()) {
-                send_message(message);
+            else if (message == "/leave" && chat::is_room_name(selected_user_)) {
+                send_room_request(chat::MessageType::ROOM_LEAVE, selected_user_);
+                state_ = ClientState::REGISTERED;
+                break;
+            }
+            else if (message == "/up" || message == "/down") {
+                scroll_chat(message == "/up");
+            }
+            else if (message.rfind("/search ", 0) == 0) {
+                show_search_results(message.substr(8));
+                draw_chat();
+            }
+            else if (message.rfind("/send ", 0) == 0) {
+                offer_file(message.substr(6));
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                draw_chat();
+            }
+            else if (message == "/accept" || message == "/decline") {
+                answer_file_offer(message == "/accept");
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                draw_chat();
+            }
+            else if (!e2e_key_file_.empty() && !chat::is_room_name(selected_user_) && message == "/plaintext") {
+                // The user agreed to send what is held for a peer without a key in the clear
+                client_->send_unencrypted(selected_user_);
+            }
+            else if (!e2e_key_file_.empty() && !chat::is_room_name(selected_user_) &&
+                     (message == "/trust" || message == "/distrust")) {
+                client_->trust_new_key(selected_user_, message == "/trust");
+            }
+            else if (message.empty()) {
+                draw_chat();
+            }
+            else {
+                std::size_t line = send_message(message);
+                std::unique_lock<std::mutex> lock(console_mutex_);
+                if (scroll_ == 0 && line == shown_ + 1) {
+                    shown_ = line;
+                    renderer_.replace_input(format_line(username_, message), chat_prompt());
+                } else {
+                    // Sending returns to the latest messages
+                    scroll_ = 0;
+                    unseen_ = 0;
+                    lock.unlock();
+                    draw_chat();
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Draws the chat screen in full: header and the viewport of history lines.
+     *
+     * Only the lines that fit are formatted, copied under the history lock and printed.
+     */
+    void draw_chat() {
+        std::vector<std::string> header = header_lines();
+        header.push_back(Color::MAGENTA + Color::BOLD + "Chatting with: " + selected_user_ + Color::RESET);
+        header.push_back(Color::CYAN + "──────────────────────────────────────────────────" + Color::RESET);
+
+        std::size_t scroll = 0;
+        std::size_t unseen = 0;
+        {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            scroll = scroll_;
+            unseen = unseen_;
+        }
+        if (scroll > 0) {
+            header.push_back(Color::YELLOW + "[Scrolled back" +
+                             (unseen > 0 ? ", " + std::to_string(unseen) + " new below" : std::string()) +
+                             "; '/down' to return]" + Color::RESET);
+        }
+
+        std::size_t rows = chat::ChatRenderer::viewport(header.size(), chat::terminal_rows());
+        std::vector<std::string> lines;
+        std::size_t end = 0;
+        {
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            std::size_t total = chat_history_.size(selected_user_);
+            end = total - std::min(scroll, total);
+            chat_history_.visit(selected_user_, end - std::min(rows, end), end,
+                                [&](const std::string& sender, std::string_view text, std::uint64_t /*timestamp*/) {
+                                    lines.push_back(format_line(sender, text));
+                                });
+        }
+
+        std::lock_guard<std::mutex> lock(console_mutex_);
+        if (scroll_ == 0) {
+            shown_ = end;
+        }
+        renderer_.draw(header, lines, chat_prompt());
+    }
+
+    /**
+     * @brief Moves the chat viewport one page back or forward and redraws it.
+     * @param back true for older lines, false for newer ones.
+     */
+    void scroll_chat(bool back) {
+        std::size_t total = 0;
+        {
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            total = chat_history_.size(selected_user_);
+        }
+        std::size_t page = chat::ChatRenderer::viewport(header_lines().size() + 3, chat::terminal_rows());
+        {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            if (back) {
+                scroll_ = std::min(scroll_ + page, total > page ? total - page : 0);
+            } else {
+                scroll_ -= std::min(scroll_, page);
+            }
+            if (scroll_ == 0) {
+                unseen_ = 0;
             }
         }
+        draw_chat();
+    }
+
+    /**
+     * @brief Shows the messages of all conversations that contain every word of a query.
+     *
+     * Results are looked up in the history's inverted index, newest first, and as many
+     * as fit the screen are shown until the user presses Enter.
+     * @param query Words to search for.
+     */
+    void show_search_results(const std::string& query) {
+        std::vector<std::string> header = header_lines();
+        header.push_back(Color::MAGENTA + Color::BOLD + "Search: " + query + Color::RESET);
+        header.push_back(Color::CYAN + "──────────────────────────────────────────────────" + Color::RESET);
+        std::size_t rows = chat::ChatRenderer::viewport(header.size() + 1, chat::terminal_rows());
+
+        std::vector<std::string> lines;
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            chat_history_.search(query, rows, [&](const std::string& conversation, std::size_t /*line*/,
+                                                  const std::string& sender, std::string_view text, std::uint64_t /*timestamp*/) {
+                lines.push_back(Color::CYAN + "[" + conversation + "] " + Color::RESET + format_line(sender, text));
+            });
+        }
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        lines.push_back(Color::YELLOW + std::to_string(lines.size()) + (lines.size() == rows ? "+" : "") + " matches in " +
+                        std::to_string(micros) + " us" + Color::RESET);
+
+        {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            covered_ = true;
+            renderer_.draw(header, lines, "Press Enter to return to the chat: ");
+        }
+        std::string ignored;
+        std::getline(std::cin, ignored);
+
+        std::lock_guard<std::mutex> lock(console_mutex_);
+        covered_ = false;
+    }
+
+    /**
+     * @brief Returns the prompt under the open conversation.
+     */
+    std::string chat_prompt() const {
+        std::string prompt = "Type a message, '/up' or '/down' to scroll, '/search <words>' to search, "
+                             "'/back' to return to user selection";
+        if (chat::is_room_name(selected_user_)) {
+            prompt += " ('/leave' to leave the room)";
+        } else {
+            prompt += " ('/send <path>' to send a file, '/accept' or '/decline' to answer an offer";
+            if (!e2e_key_file_.empty()) {
+                prompt += ", '/plaintext' to send held messages unencrypted, '/trust' or '/distrust' to answer a key change";
+            }
+            prompt += ")";
+        }
+        return prompt + ": ";
+    }
+
+    /**
+     * @brief Formats one history entry for the chat screen.
+     * @param sender Sender's username.
+     * @param text Message text.
+     */
+    std::string format_line(const std::string& sender, std::string_view text) const {
+        if (sender == username_) {
+            return Color::GREEN + "You: " + Color::RESET + std::string(text);
+        }
+        return Color::BLUE + sender + ": " + Color::RESET + std::string(text);
     }
 
     /**
@@ -370,37 +756,30 @@ private:
     /**
      * @brief Registers the client's username with the server.
      *
-     * Sends a `REGISTER` message to the server with the current `username_`.
+     * Sends a `REGISTER` message to the server with the current `username_`. The state
+     * moves on to `REGISTERED` when the user list arrives.
      */
     void register_user() {
-        chat::Message reg_msg;
-        reg_msg.type = chat::MessageType::REGISTER;
-        reg_msg.sender = username_;
-
-        try {
-            std::string serialized = reg_msg.serialize();
-            asio::write(*ssl_socket_, asio::buffer(serialized));
-        } catch (std::exception& e) {
-            std::cerr << "Failed to register: " << e.what() << std::endl;
-        }
+        client_->register_user(username_, [](const boost::system::error_code&) {});
     }
 
     /**
-     * @brief Requests the current list of users from the server.
+     * @brief Requests the currently viewed page of the user list from the server.
      *
-     * Sends a `LIST` message to the server.
+     * Sends a `LIST` message carrying the current prefix filter and page offset.
      */
     void request_user_list() {
-        chat::Message list_msg;
-        list_msg.type = chat::MessageType::LIST;
-        list_msg.sender = username_;
+        std::lock_guard<std::mutex> lock(user_list_mutex_);
+        client_->request_users(list_prefix_, list_offset_, chat::kDefaultListPageSize);
+    }
 
-        try {
-            std::string serialized = list_msg.serialize();
-            asio::write(*ssl_socket_, asio::buffer(serialized));
-        } catch (std::exception& e) {
-            std::cerr << "Failed to request user list: " << e.what() << std::endl;
-        }
+    /**
+     * @brief Sends a room membership request to the server.
+     * @param type `ROOM_CREATE`, `ROOM_JOIN` or `ROOM_LEAVE`.
+     * @param room The room name, starting with '#'.
+     */
+    void send_room_request(chat::MessageType type, const std::string& room) {
+        client_->room_request(type, room);
     }
 
     /**
@@ -410,10 +789,11 @@ private:
      * If the content or `selected_user_` is empty, the function does nothing.
      * Otherwise, it creates a `MESSAGE` type `chat::Message`, adds it to the local
      * `chat_history_`, and sends it to the server.
+     * @return The number of history entries of the conversation up to and including this one, or 0 if nothing was sent.
      */
-    void send_message(const std::string& content) {
+    std::size_t send_message(const std::string& content) {
         if (content.empty() || selected_user_.empty()) {
-            return;
+            return 0;
         }
 
         chat::Message msg;
@@ -421,65 +801,399 @@ private:
         msg.sender = username_;
         msg.recipient = selected_user_;
         msg.content = content;
+        if (trace_) {
+            msg.trace_id = unix_micros();
+            msg.t_client_send = msg.trace_id;
+        }
 
-        // Add to local chat history
+        // Add to local chat history, after the stored history if that is still being fetched
+        std::size_t line = 0;
         {
             std::lock_guard<std::mutex> lock(chat_history_mutex_);
-            chat_history_[selected_user_].push_back({username_, content});
+            auto fetch = history_fetches_.find(selected_user_);
+            if (fetch != history_fetches_.end()) {
+                fetch->second.held.push_back(msg);
+            } else {
+                line = chat_history_.append(selected_user_, username_, content, unix_micros());
+            }
         }
 
         // Send to server
+        client_->send(std::move(msg));
+        return line;
+    }
+
+    /**
+     * @brief Offers a file to the selected user.
+     * @param path The file to send.
+     *
+     * The file is mapped rather than read, so chunks are sent straight from the page
+     * cache once the receiver accepts; nothing is streamed before that.
+     */
+    void offer_file(const std::string& path) {
+        if (chat::is_room_name(selected_user_)) {
+            print_system("Files can only be sent in direct chats.");
+            return;
+        }
+
+        std::unique_ptr<chat::MappedFile> file;
         try {
-            std::string serialized = msg.serialize();
-            asio::write(*ssl_socket_, asio::buffer(serialized));
+            file = std::make_unique<chat::MappedFile>(path);
         } catch (std::exception& e) {
-            std::lock_guard<std::mutex> lock(console_mutex_);
-            std::cerr << "Failed to send message: " << e.what() << std::endl;
+            print_system(std::string("Cannot send file: ") + e.what());
+            return;
+        }
+
+        chat::Message offer;
+        offer.type = chat::MessageType::FILE_OFFER;
+        offer.sender = username_;
+        offer.recipient = selected_user_;
+        offer.content = base_name(path);
+        offer.file_size = file->size();
+        offer.transfer_id = new_transfer_id();
+
+        {
+            std::lock_guard<std::mutex> lock(files_mutex_);
+            OutgoingFile& outgoing = outgoing_files_[offer.transfer_id];
+            outgoing.file = std::move(file);
+            outgoing.recipient = selected_user_;
+            outgoing.name = offer.content;
+        }
+        {
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            chat_history_.append(selected_user_, username_,
+                                 "[offered file " + offer.content + ", " + std::to_string(offer.file_size) + " bytes]",
+                                 unix_micros());
+        }
+
+        client_->send(offer);
+    }
+
+    /**
+     * @brief Accepts or declines the latest file offer.
+     * @param accept true to accept and save it under `downloads/`, false to decline.
+     */
+    void answer_file_offer(bool accept) {
+        chat::Message reply;
+        reply.sender = username_;
+        bool empty_file = false;
+        {
+            std::lock_guard<std::mutex> lock(files_mutex_);
+            auto it = incoming_files_.find(pending_offer_);
+            if (it == incoming_files_.end()) {
+                print_system("No file offer to answer.");
+                return;
+            }
+            pending_offer_ = 0;
+            IncomingFile& incoming = it->second;
+            reply.transfer_id = it->first;
+            reply.recipient = incoming.sender;
+
+            if (accept) {
+                ::mkdir("downloads", 0755);
+                incoming.path = "downloads/" + incoming.name;
+                incoming.out.open(incoming.path, std::ios::binary | std::ios::trunc);
+                if (!incoming.out) {
+                    print_system("Cannot create " + incoming.path + ", declining.");
+                    accept = false;
+                }
+            }
+
+            if (accept) {
+                reply.type = chat::MessageType::FILE_ACCEPT;
+                reply.window = chat::kDefaultFileWindow;
+                empty_file = incoming.size == 0;
+                if (empty_file) {
+                    incoming_files_.erase(it);
+                }
+            } else {
+                reply.type = chat::MessageType::FILE_CANCEL;
+                reply.content = username_ + " declined the file.";
+                incoming_files_.erase(it);
+            }
+        }
+
+        client_->send(reply);
+        if (empty_file) {
+            // Nothing will be streamed; acknowledge completion right away
+            reply.type = chat::MessageType::FILE_ACK;
+            reply.window = 0;
+            client_->send(reply);
+        }
+    }
+
+    /**
+     * @brief Queues chunks of an outgoing file until its window is used up. Caller holds `files_mutex_`.
+     * @param transfer_id The transfer to advance.
+     * @param outgoing Its state.
+     */
+    void pump_file(std::uint64_t transfer_id, OutgoingFile& outgoing) {
+        std::uint64_t size = outgoing.file->size();
+        while (outgoing.sent < size && outgoing.sent - outgoing.acked < outgoing.window) {
+            std::uint64_t credit = outgoing.window - (outgoing.sent - outgoing.acked);
+            auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>({chat::kFileChunkSize, size - outgoing.sent, credit}));
+            client_->send_data(transfer_id, outgoing.file->data() + outgoing.sent, chunk);
+            outgoing.sent += chunk;
         }
     }
 
     /**
-     * @brief Main loop for reading messages from the server.
+     * @brief Writes one chunk of an incoming file and acknowledges progress.
+     * @param transfer_id The transfer the chunk belongs to.
+     * @param data Chunk bytes.
+     * @param size Chunk size.
      *
-     * Continuously tries to read data from the `ssl_socket_`. If a message is received,
-     * it's deserialized and processed by `process_message()`.
-     * Handles disconnection and read errors. This loop runs until the client state
-     * is `DISCONNECTED` or `quit_` is true.
-     */
-    void read_loop() {
-        while (state_ != ClientState::DISCONNECTED && !quit_) {
-            try {
-                std::array<char, 4096> buffer;
-                boost::system::error_code error;
-
-                size_t length = ssl_socket_->read_some(asio::buffer(buffer), error);
-
-                if (error) {
-                    if (error == asio::error::eof) {
-                        std::lock_guard<std::mutex> lock(console_mutex_);
-                        std::cout << "Server closed connection." << std::endl;
-                    } else {
-                        std::lock_guard<std::mutex> lock(console_mutex_);
-                        std::cerr << "Read error: " << error.message() << std::endl;
+     * Acknowledgements go out every half window, so the sender never stalls waiting
+     * for credit while the previous half is still in flight.
+     */
+    void process_file_data(std::uint64_t transfer_id, const char* data, std::size_t size) {
+        chat::Message ack;
+        std::string done;
+        {
+            std::lock_guard<std::mutex> lock(files_mutex_);
+            auto it = incoming_files_.find(transfer_id);
+            if (it == incoming_files_.end() || !it->second.out.is_open()) {
+                return;
+            }
+            IncomingFile& incoming = it->second;
+            incoming.out.write(data, static_cast<std::streamsize>(size));
+            incoming.received += size;
+
+            bool complete = incoming.received >= incoming.size;
+            if (!complete && incoming.received - incoming.acked < chat::kDefaultFileWindow / 2) {
+                return;
+            }
+            incoming.acked = incoming.received;
+            ack.type = chat::MessageType::FILE_ACK;
+            ack.sender = username_;
+            ack.recipient = incoming.sender;
+            ack.transfer_id = transfer_id;
+            ack.file_offset = incoming.received;
+            if (complete) {
+                incoming.out.close();
+                done = "Received " + incoming.name + " from " + incoming.sender + ", saved to " + incoming.path + ".";
+                incoming_files_.erase(it);
+            }
+        }
+
+        client_->send(std::move(ack));
+        if (!done.empty()) {
+            print_system(done);
+        }
+    }
+
+    /**
+     * @brief Handles the `FILE_*` messages relayed by the server.
+     * @param message A `FILE_OFFER`, `FILE_ACCEPT`, `FILE_ACK` or `FILE_CANCEL` message.
+     */
+    void process_file_message(const chat::Message& message) {
+        std::string notice;
+        {
+            std::lock_guard<std::mutex> lock(files_mutex_);
+            if (message.type == chat::MessageType::FILE_OFFER) {
+                IncomingFile& incoming = incoming_files_[message.transfer_id];
+                incoming.sender = message.sender;
+                incoming.name = base_name(message.content);
+                incoming.size = message.file_size;
+                pending_offer_ = message.transfer_id;
+                notice = message.sender + " offers " + incoming.name + " (" + std::to_string(incoming.size) +
+                         " bytes). Open the chat and type /accept or /decline.";
+            }
+            else if (message.type == chat::MessageType::FILE_ACCEPT || message.type == chat::MessageType::FILE_ACK) {
+                auto it = outgoing_files_.find(message.transfer_id);
+                if (it == outgoing_files_.end()) {
+                    return;
+                }
+                OutgoingFile& outgoing = it->second;
+                if (message.type == chat::MessageType::FILE_ACCEPT) {
+                    outgoing.window = message.window;
+                    notice = outgoing.recipient + " accepted " + outgoing.name + ", sending.";
+                } else {
+                    outgoing.acked = std::max(outgoing.acked, message.file_offset);
+                }
+
+                if (outgoing.acked >= outgoing.file->size()) {
+                    notice = "Sent " + outgoing.name + " to " + outgoing.recipient + ".";
+                    outgoing_files_.erase(it);
+                } else {
+                    pump_file(it->first, outgoing);
+                }
+            }
+            else {
+                outgoing_files_.erase(message.transfer_id);
+                auto it = incoming_files_.find(message.transfer_id);
+                if (it != incoming_files_.end()) {
+                    if (it->second.out.is_open()) {
+                        it->second.out.close();
+                        std::remove(it->second.path.c_str());
                     }
-                    state_ = ClientState::DISCONNECTED;
-                    quit_ = true;
-                    break;
+                    incoming_files_.erase(it);
                 }
+                notice = "File transfer cancelled" + (message.content.empty() ? "." : ": " + message.content);
+            }
+        }
+
+        if (!notice.empty()) {
+            print_system(notice);
+        }
+    }
 
-                std::string message_str(buffer.data(), length);
-                auto message = chat::Message::deserialize(message_str);
+    /**
+     * @brief Returns the last component of a path, or "file" if it has none usable.
+     *
+     * Offered names come from the peer, so this also keeps received files inside `downloads/`.
+     */
+    static std::string base_name(const std::string& path) {
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        return name.empty() || name == "." || name == ".." ? "file" : name;
+    }
 
-                process_message(message);
+    /**
+     * @brief Returns a random, non-zero transfer id.
+     */
+    static std::uint64_t new_transfer_id() {
+        std::random_device random;
+        std::uint64_t id = (std::uint64_t{random()} << 32) | random();
+        return id != 0 ? id : 1;
+    }
+
+    /**
+     * @brief Prints a `[System]` notice on the UI thread.
+     * @param text The notice.
+     */
+    void print_system(const std::string& text) {
+        print_notice("[System] " + text, true);
+    }
+
+    /**
+     * @brief Marks the connection as lost and tells the user why. io thread only.
+     * @param reason Shown to the user.
+     */
+    void disconnect(const std::string& reason) {
+        if (quit_) {
+            return;
+        }
+        state_ = ClientState::DISCONNECTED;
+        quit_ = true;
+        ui_.push([this, reason]() {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            std::cerr << reason << std::endl;
+        });
+    }
+
+    /**
+     * @brief Prints where a traced message spent its time between the two clients.
+     *
+     * Client and server timestamps come from different clocks, so the split is only
+     * as accurate as their synchronisation. The arrival time is taken on the io thread,
+     * before the line is handed to the UI thread.
+     * @param message A received message carrying trace timestamps.
+     */
+    void print_trace(const chat::Message& message) {
+        auto now = static_cast<long long>(unix_micros());
+        auto client_send = static_cast<long long>(message.t_client_send);
+        auto server_recv = static_cast<long long>(message.t_server_recv);
+        auto server_enqueue = static_cast<long long>(message.t_server_enqueue);
+        std::uint64_t trace_id = message.trace_id;
+
+        std::ostringstream line;
+        line << "[Trace " << trace_id << "] total " << (now - client_send) << "us";
+        if (server_recv != 0 && server_enqueue != 0) {
+            line << " (to server " << (server_recv - client_send) << "us, in server " << (server_enqueue - server_recv)
+                 << "us, to client " << (now - server_enqueue) << "us)";
+        }
+        print_notice(line.str(), false);
+    }
+
+    /**
+     * @brief Appends a received line to the open conversation on the UI thread.
+     * @param conversation The conversation it belongs to; nothing is drawn if it is no longer open.
+     * @param line Number of history entries of the conversation up to and including this one.
+     * @param sender Sender's username.
+     * @param text Message text.
+     */
+    void append_chat(const std::string& conversation, std::size_t line, const std::string& sender, const std::string& text) {
+        ui_.push([this, conversation, line, sender, text]() {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            if (state_ != ClientState::CHATTING || selected_user_ != conversation || line <= shown_ || covered_) {
+                return;     // Not open, or already drawn by a full redraw; the redraw after a search draws it
             }
-            catch (std::exception& e) {
-                std::lock_guard<std::mutex> lock(console_mutex_);
-                std::cerr << "Read error: " << e.what() << std::endl;
-                state_ = ClientState::DISCONNECTED;
-                quit_ = true;
-                break;
+            if (scroll_ > 0) {
+                ++scroll_;  // Keep the viewport on the same lines
+                ++unseen_;
+                return;
             }
+            shown_ = line;
+            renderer_.append(format_line(sender, text), chat_prompt());
+        });
+    }
+
+    /**
+     * @brief Prints a yellow line on the UI thread.
+     *
+     * On the chat screen the line goes above the prompt like a message.
+     * @param text The line, without colour codes.
+     * @param blank_line Elsewhere, print an empty line first to set the line apart from a prompt.
+     */
+    void print_notice(const std::string& text, bool blank_line) {
+        ui_.push([this, text, blank_line]() {
+            std::lock_guard<std::mutex> lock(console_mutex_);
+            if (state_ == ClientState::CHATTING) {
+                renderer_.append(Color::YELLOW + text + Color::RESET, chat_prompt());
+                return;
+            }
+            if (blank_line) {
+                std::cout << std::endl;
+            }
+            std::cout << Color::YELLOW << text << Color::RESET << std::endl;
+        });
+    }
+
+    /**
+     * @brief Collects a page of stored history and files it once the page ends.
+     *
+     * The page goes into `chat_history_` first, then the live messages held while it was
+     * fetched, minus those the page already contains: a received message is in the page
+     * if its timestamp is not newer than the page's last one, and a message sent from
+     * here (no timestamp) never is, because the server read the page before it got it.
+     * @param message One stored message, or the end of the page if `sender` is empty.
+     */
+    void process_history(const chat::Message& message) {
+        const std::string& conversation = message.recipient;
+        {
+            std::lock_guard<std::mutex> lock(chat_history_mutex_);
+            auto fetch = history_fetches_.find(conversation);
+            if (fetch == history_fetches_.end()) {
+                return;
+            }
+            if (!message.sender.empty()) {
+                fetch->second.page.push_back(message);
+                return;
+            }
+
+            std::uint64_t last = 0;
+            for (const auto& stored : fetch->second.page) {
+                chat_history_.append(conversation, stored.sender, stored.content, stored.timestamp);
+                last = stored.timestamp;
+            }
+            for (const auto& live : fetch->second.held) {
+                if (live.timestamp == 0 || live.timestamp > last) {
+                    chat_history_.append(conversation, live.sender, live.content,
+                                         live.timestamp != 0 ? live.timestamp : unix_micros());
+                }
+            }
+            history_fetches_.erase(fetch);
         }
+
+        ui_.push([this, conversation]() {
+            {
+                std::lock_guard<std::mutex> lock(console_mutex_);
+                if (state_ != ClientState::CHATTING || selected_user_ != conversation || covered_) {
+                    return;
+                }
+            }
+            draw_chat();
+        });
     }
 
     /**
@@ -487,18 +1201,28 @@ private:
      * @param message The `chat::Message` object received from the server.
      *
      * Handles different message types:
-     * - `LIST`: Updates the local `user_list_`, changes state to `REGISTERED` if needed,
-     *           and displays any system message content.
-     * - `MESSAGE`: Adds the message to `chat_history_`. If currently chatting with the
-     *              sender, refreshes the chat screen. Otherwise, displays a notification.
+     * - `LIST`: Updates the local `user_list_` if the page matches the one being viewed,
+     *           changes state to `REGISTERED` if needed, and displays any system message content.
+     * - `MESSAGE`: Adds the message to `chat_history_` under the sender, or under the room
+     *              for room messages. If that conversation is open, appends it to the chat
+     *              screen. Otherwise, displays a notification.
+     * - `HISTORY`: Passed to `process_history()`.
      * - `SYSTEM`: Displays the system message content.
+     * - `FILE_*`: Passed to `process_file_message()`.
      */
     void process_message(const chat::Message& message) {
         if (message.type == chat::MessageType::LIST) {
-            // Update user list
+            // Update user list; pages for another filter or offset are stale
             {
                 std::lock_guard<std::mutex> lock(user_list_mutex_);
-                user_list_ = message.users;
+                if (message.limit == 0) {
+                    user_list_ = message.users;
+                    list_total_ = static_cast<std::uint32_t>(message.users.size());
+                }
+                else if (message.prefix == list_prefix_ && message.offset == list_offset_) {
+                    user_list_ = message.users;
+                    list_total_ = message.total;
+                }
             }
 
             // Set state to registered if not already
@@ -508,51 +1232,55 @@ private:
 
             // Log system message if present
             if (!message.content.empty()) {
-                std::lock_guard<std::mutex> lock(console_mutex_);
-                std::cout << Color::YELLOW << "[System] " << message.content << Color::RESET << std::endl;
+                print_notice("[System] " + message.content, false);
             }
         }
         else if (message.type == chat::MessageType::MESSAGE) {
+            // Room messages are filed under the room, direct messages under the other user; a
+            // message from this user was sent from another of their devices
+            bool from_self = message.sender == username_;
+            const std::string& conversation =
+                chat::is_room_name(message.recipient) || from_self ? message.recipient : message.sender;
+
+            if (trace_ && message.t_client_send != 0) {
+                print_trace(message);
+            }
+
             // Add message to chat history
+            std::size_t line = 0;
             {
                 std::lock_guard<std::mutex> lock(chat_history_mutex_);
-                chat_history_[message.sender].push_back({message.sender, message.content});
-            }
-
-            // If we're currently chatting with this user, refresh the screen
-            if (state_ == ClientState::CHATTING && selected_user_ == message.sender) {
-                // Refresh the chat screen
-                print_header();
-                std::cout << Color::MAGENTA << Color::BOLD << "Chatting with: " << selected_user_ << Color::RESET << std::endl;
-                std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
-
-                // Display chat history
-                {
-                    std::lock_guard<std::mutex> lock(chat_history_mutex_);
-                    auto it = chat_history_.find(selected_user_);
-                    if (it != chat_history_.end()) {
-                        for (const auto& msg : it->second) {
-                            if (msg.first == username_) {
-                                std::cout << Color::GREEN << "You: " << Color::RESET << msg.second << std::endl;
-                            } else {
-                                std::cout << Color::BLUE << selected_user_ << ": " << Color::RESET << msg.second << std::endl;
-                            }
-                        }
-                    }
+                auto fetch = history_fetches_.find(conversation);
+                if (fetch != history_fetches_.end()) {
+                    fetch->second.held.push_back(message);
+                    return;
                 }
+                line = chat_history_.append(conversation, message.sender, message.content,
+                                            message.timestamp != 0 ? message.timestamp : unix_micros());
+            }
 
-                std::cout << Color::CYAN << "──────────────────────────────────────────────────" << Color::RESET << std::endl;
-                std::cout << "Type a message or '/back' to return to user selection: ";
+            // If we're currently in this conversation, add the line to the screen
+            if (state_ == ClientState::CHATTING && selected_user_ == conversation) {
+                append_chat(conversation, line, message.sender, message.content);
             }
             // If we're not chatting with this user, show notification
+            else if (from_self) {
+                print_notice("[Sent to " + conversation + " from another device]", true);
+            }
             else {
-                std::lock_guard<std::mutex> lock(console_mutex_);
-                std::cout << std::endl << Color::YELLOW << "[New message from " << message.sender << "]" << Color::RESET << std::endl;
+                print_notice("[New message from " + message.sender +
+                             (conversation != message.sender ? " in " + conversation : std::string()) + "]", true);
             }
         }
+        else if (message.type == chat::MessageType::HISTORY) {
+            process_history(message);
+        }
         else if (message.type == chat::MessageType::SYSTEM) {
-            std::lock_guard<std::mutex> lock(console_mutex_);
-            std::cout << Color::YELLOW << "[System] " << message.content << Color::RESET << std::endl;
+            print_notice("[System] " + message.content, false);
+        }
+        else if (message.type == chat::MessageType::FILE_OFFER || message.type == chat::MessageType::FILE_ACCEPT ||
+                 message.type == chat::MessageType::FILE_ACK || message.type == chat::MessageType::FILE_CANCEL) {
+            process_file_message(message);
         }
     }
 };
@@ -560,12 +1288,34 @@ private:
 /**
  * @brief Main function for the chat client.
  * @param argc Argument count.
- * @param argv Argument vector. Expects server IP and port as arguments.
+ * @param argv Argument vector. Expects server IP and port, optionally followed by `--trace`,
+ *             `--history <n>` (messages per conversation kept in memory; default 1000),
+ *             `--auth` (ask for a password at login) and `--e2e <keyfile>` (encrypt direct
+ *             messages end to end with the key pair in that file).
  * @return 0 on successful execution, 1 on error (e.g., incorrect arguments).
  */
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <server_ip> <port>\n";
+    bool trace = false;
+    bool ask_password = false;
+    std::string e2e_key_file;
+    std::size_t history_capacity = chat::kDefaultHistoryCapacity;
+    bool usage = argc < 3;
+    for (int i = 3; i < argc && !usage; ++i) {
+        std::string option = argv[i];
+        if (option == "--trace") {
+            trace = true;
+        } else if (option == "--auth") {
+            ask_password = true;
+        } else if (option == "--e2e" && i + 1 < argc) {
+            e2e_key_file = argv[++i];
+        } else if (option == "--history" && i + 1 < argc) {
+            history_capacity = static_cast<std::size_t>(std::max(2L, std::atol(argv[++i])));
+        } else {
+            usage = true;
+        }
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <port> [--trace] [--history <n>] [--auth] [--e2e <keyfile>]\n";
         return 1;
     }
 
@@ -575,7 +1325,7 @@ int main(int argc, char* argv[]) {
     try {
         asio::io_context io_context;
 
-        ChatClient client(io_context, server_ip, port);
+        ChatClient client(io_context, server_ip, port, trace, history_capacity, ask_password, e2e_key_file);
         client.run();
 
     } catch (std::exception& e) {
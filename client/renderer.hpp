@@ -0,0 +1,96 @@
+/**
+ * @file renderer.hpp
+ * @brief Incremental terminal rendering of a conversation.
+ */
+#pragma once
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Returns the height of the terminal on stdout, or 24 if it is not a terminal.
+ */
+inline std::size_t terminal_rows() {
+    winsize size{};
+    if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0) {
+        return size.ws_row;
+    }
+    return 24;
+}
+
+/**
+ * @brief Draws a conversation as a fixed header, a viewport of history lines and a prompt.
+ *
+ * A full `draw()` clears the screen and prints only as many history lines as fit, so
+ * its cost depends on the terminal height, not on the length of the conversation. New
+ * lines are then added with `append()` or `replace_input()`, which print just that
+ * line above the prompt and let the terminal scroll the older ones away.
+ *
+ * Not thread-safe; callers serialize output.
+ */
+class ChatRenderer {
+public:
+    /**
+     * @brief Creates a renderer.
+     * @param out Stream to draw on.
+     */
+    explicit ChatRenderer(std::ostream& out) : out_(out) {}
+
+    /**
+     * @brief Returns how many history lines fit on a screen.
+     * @param header_rows Lines taken by the header.
+     * @param rows Terminal height.
+     * @return At least 1; the prompt keeps one row.
+     */
+    static std::size_t viewport(std::size_t header_rows, std::size_t rows) {
+        return rows > header_rows + 2 ? rows - header_rows - 1 : 1;
+    }
+
+    /**
+     * @brief Redraws the whole screen.
+     * @param header Lines above the history, already formatted.
+     * @param lines History lines to show, oldest first; at most one viewport.
+     * @param prompt Printed last, without a newline.
+     */
+    void draw(const std::vector<std::string>& header, const std::vector<std::string>& lines, const std::string& prompt) {
+        out_ << "\033[2J\033[1;1H";
+        for (const auto& line : header) {
+            out_ << line << '\n';
+        }
+        for (const auto& line : lines) {
+            out_ << line << '\n';
+        }
+        out_ << prompt << std::flush;
+    }
+
+    /**
+     * @brief Adds a line above the prompt, which is on the cursor's row.
+     *
+     * Anything typed after the prompt is cleared from the screen (not from the input).
+     * @param line The formatted line.
+     * @param prompt The prompt to reprint below it.
+     */
+    void append(const std::string& line, const std::string& prompt) {
+        out_ << "\r\033[2K" << line << '\n' << prompt << std::flush;
+    }
+
+    /**
+     * @brief Replaces the line the user just entered, one row up, with its formatted form.
+     * @param line The formatted line.
+     * @param prompt The prompt to print below it.
+     */
+    void replace_input(const std::string& line, const std::string& prompt) {
+        out_ << "\033[1A\r\033[2K" << line << '\n' << prompt << std::flush;
+    }
+
+private:
+    std::ostream& out_;     ///< Stream drawn on.
+};
+
+}  // namespace chat
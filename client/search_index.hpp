@@ -0,0 +1,304 @@
+/**
+ * @file search_index.hpp
+ * @brief Incremental full-text index over chat messages with compressed posting lists.
+ */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Tokens longer than this are truncated before indexing and querying.
+ */
+constexpr std::size_t kMaxTokenLength = 32;
+
+/**
+ * @brief Postings per skip entry of a posting list.
+ */
+constexpr std::size_t kPostingSkipStride = 128;
+
+/**
+ * @brief Calls `sink(token)` for every word of a text.
+ *
+ * A word is a run of ASCII letters and digits or of non-ASCII (UTF-8) bytes. ASCII is
+ * lowercased, so matching is case-insensitive for it.
+ */
+template <typename Sink>
+void tokenize(std::string_view text, Sink&& sink) {
+    std::string token;
+    auto flush = [&]() {
+        if (!token.empty()) {
+            sink(token.size() > kMaxTokenLength ? token.substr(0, kMaxTokenLength) : token);
+            token.clear();
+        }
+    };
+    for (char c : text) {
+        auto byte = static_cast<unsigned char>(c);
+        if (byte >= 0x80 || (byte >= '0' && byte <= '9') || (byte >= 'a' && byte <= 'z')) {
+            token += c;
+        } else if (byte >= 'A' && byte <= 'Z') {
+            token += static_cast<char>(byte - 'A' + 'a');
+        } else {
+            flush();
+        }
+    }
+    flush();
+}
+
+/**
+ * @brief Ascending message ids stored as varint-encoded gaps.
+ *
+ * Ids are appended in increasing order, so each is stored as its distance from the
+ * previous one; in a chat most gaps fit one or two bytes. Every `kPostingSkipStride`-th
+ * posting is also recorded in a skip list, so an intersection can jump over the parts
+ * of a long list that cannot match instead of decoding them.
+ */
+class PostingList {
+public:
+    /**
+     * @brief Appends an id; ids equal to the last one are ignored.
+     * @param id Must not be smaller than the last id appended.
+     */
+    void add(std::uint32_t id) {
+        if (count_ > 0 && id == last_) {
+            return;
+        }
+        if (count_ % kPostingSkipStride == 0) {
+            skips_.push_back({last_, static_cast<std::uint32_t>(bytes_.size()), static_cast<std::uint32_t>(count_)});
+        }
+        std::uint32_t gap = count_ == 0 ? id : id - last_;
+        while (gap >= 0x80) {
+            bytes_ += static_cast<char>((gap & 0x7f) | 0x80);
+            gap >>= 7;
+        }
+        bytes_ += static_cast<char>(gap);
+        last_ = id;
+        ++count_;
+    }
+
+    /**
+     * @brief Returns the number of ids.
+     */
+    std::size_t size() const { return count_; }
+
+    /**
+     * @brief Returns the bytes used by the encoded list and its skips.
+     */
+    std::size_t memory_bytes() const { return bytes_.capacity() + skips_.capacity() * sizeof(Skip); }
+
+    /**
+     * @brief Returns the number of skip blocks; all but the last hold `kPostingSkipStride` ids.
+     */
+    std::size_t blocks() const { return skips_.size(); }
+
+    /**
+     * @brief Forward iterator over the ids.
+     */
+    class Cursor {
+    public:
+        explicit Cursor(const PostingList& list) : list_(list) { next(); }
+
+        /**
+         * @brief Creates a cursor on the first id of a skip block.
+         * @param block Index below `list.blocks()`.
+         */
+        Cursor(const PostingList& list, std::size_t block) : list_(list) {
+            const Skip& skip = list_.skips_[block];
+            id_ = skip.previous;
+            offset_ = skip.offset;
+            index_ = skip.index;
+            next();
+        }
+
+        /**
+         * @brief Returns the index of the current id in the list.
+         */
+        std::size_t position() const { return index_ - 1; }
+
+        /**
+         * @brief Returns true while `id()` is valid.
+         */
+        bool valid() const { return valid_; }
+
+        /**
+         * @brief Returns the current id.
+         */
+        std::uint32_t id() const { return id_; }
+
+        /**
+         * @brief Moves to the next id.
+         */
+        void next() {
+            if (index_ == list_.count_) {
+                valid_ = false;
+                return;
+            }
+            std::uint32_t gap = 0;
+            for (int shift = 0;; shift += 7) {
+                auto byte = static_cast<unsigned char>(list_.bytes_[offset_++]);
+                gap |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+                if (byte < 0x80) {
+                    break;
+                }
+            }
+            id_ = index_ == 0 ? gap : id_ + gap;
+            ++index_;
+        }
+
+        /**
+         * @brief Moves to the first id not smaller than `target`, skipping whole blocks where possible.
+         */
+        void advance_to(std::uint32_t target) {
+            if (!valid_ || id_ >= target) {
+                return;
+            }
+            // The last skip block starting before `target`; its first id is the one after `skip.previous`
+            auto it = std::upper_bound(list_.skips_.begin(), list_.skips_.end(), target,
+                                       [](std::uint32_t value, const Skip& skip) { return value <= skip.previous; });
+            if (it != list_.skips_.begin()) {
+                const Skip& skip = *(it - 1);
+                if (skip.index > index_) {
+                    id_ = skip.previous;
+                    offset_ = skip.offset;
+                    index_ = skip.index;
+                    next();
+                }
+            }
+            while (valid_ && id_ < target) {
+                next();
+            }
+        }
+
+    private:
+        const PostingList& list_;   ///< List iterated.
+        std::size_t offset_ = 0;    ///< Byte offset of the next gap.
+        std::size_t index_ = 0;     ///< Postings decoded so far.
+        std::uint32_t id_ = 0;      ///< Current id.
+        bool valid_ = true;         ///< False past the end.
+    };
+
+private:
+    /**
+     * @brief Where a block of postings starts.
+     */
+    struct Skip {
+        std::uint32_t previous;     ///< Id before the block (0 for the first), the base of its first gap.
+        std::uint32_t offset;       ///< Byte offset of the block's first gap.
+        std::uint32_t index;        ///< Number of postings before the block.
+    };
+
+    std::string bytes_;             ///< Varint-encoded gaps.
+    std::vector<Skip> skips_;       ///< One entry per `kPostingSkipStride` postings.
+    std::uint32_t last_ = 0;        ///< Last id appended.
+    std::size_t count_ = 0;         ///< Number of ids.
+};
+
+/**
+ * @brief Inverted index from words to the ids of the messages containing them.
+ *
+ * Messages are added as they arrive and get consecutive ids, so posting lists only ever
+ * grow at the end and never need rebuilding. A query returns the messages containing
+ * all of its words, newest first, by intersecting the posting lists: the shortest is
+ * walked block by block from its end and the query stops as soon as `limit` matches are
+ * found, so common words cost about as much as rare ones.
+ *
+ * Not thread-safe; the client guards it with a mutex.
+ */
+class SearchIndex {
+public:
+    /**
+     * @brief Indexes a message.
+     * @param text Message text.
+     * @return The message id: the number of messages added before it.
+     */
+    std::uint32_t add(std::string_view text) {
+        std::uint32_t id = next_id_++;
+        tokenize(text, [this, id](const std::string& token) { postings_[token].add(id); });
+        return id;
+    }
+
+    /**
+     * @brief Finds the messages containing every word of a query.
+     * @param query Words to match; case-insensitive for ASCII.
+     * @param limit Most ids to return.
+     * @return Matching message ids, newest first; empty if the query has no words.
+     */
+    std::vector<std::uint32_t> search(std::string_view query, std::size_t limit) const {
+        std::vector<const PostingList*> lists;
+        bool missing = false;
+        tokenize(query, [&](const std::string& token) {
+            auto it = postings_.find(token);
+            if (it == postings_.end()) {
+                missing = true;
+            } else if (std::find(lists.begin(), lists.end(), &it->second) == lists.end()) {
+                lists.push_back(&it->second);
+            }
+        });
+        if (missing || lists.empty()) {
+            return {};
+        }
+        std::sort(lists.begin(), lists.end(), [](const PostingList* a, const PostingList* b) { return a->size() < b->size(); });
+
+        // Walk the shortest list a block at a time from its newest end, probing the others,
+        // which mostly skip ahead, and stop once enough matches are found
+        std::vector<std::uint32_t> matches;
+        std::vector<std::uint32_t> block_matches;
+        const PostingList& shortest = *lists[0];
+        for (std::size_t block = shortest.blocks(); block-- > 0 && matches.size() < limit;) {
+            std::vector<PostingList::Cursor> others;
+            for (std::size_t i = 1; i < lists.size(); ++i) {
+                others.emplace_back(*lists[i]);
+            }
+            block_matches.clear();
+            std::size_t end = (block + 1) * kPostingSkipStride;
+            for (PostingList::Cursor cursor(shortest, block); cursor.valid() && cursor.position() < end; cursor.next()) {
+                std::uint32_t id = cursor.id();
+                bool all = true;
+                for (std::size_t i = 0; i < others.size() && all; ++i) {
+                    others[i].advance_to(id);
+                    all = others[i].valid() && others[i].id() == id;
+                }
+                if (all) {
+                    block_matches.push_back(id);
+                }
+            }
+            matches.insert(matches.end(), block_matches.rbegin(), block_matches.rend());
+        }
+        if (matches.size() > limit) {
+            matches.resize(limit);
+        }
+        return matches;
+    }
+
+    /**
+     * @brief Returns the number of messages indexed.
+     */
+    std::uint32_t size() const { return next_id_; }
+
+    /**
+     * @brief Returns the number of distinct words.
+     */
+    std::size_t terms() const { return postings_.size(); }
+
+    /**
+     * @brief Returns the bytes used by the posting lists.
+     */
+    std::size_t memory_bytes() const {
+        std::size_t bytes = 0;
+        for (const auto& entry : postings_) {
+            bytes += entry.first.capacity() + entry.second.memory_bytes();
+        }
+        return bytes;
+    }
+
+private:
+    std::unordered_map<std::string, PostingList> postings_;    ///< Posting list per word.
+    std::uint32_t next_id_ = 0;                                ///< Id of the next message.
+};
+
+}  // namespace chat
@@ -0,0 +1,155 @@
+/**
+ * @file capabilities.hpp
+ * @brief Protocol version and optional features, agreed on in `REGISTER` and the welcome.
+ *
+ * A client lists the features it supports in `REGISTER`; the server answers in the
+ * welcome with those it enables for the session. Either side only uses a feature once
+ * both agreed to it, so new frame formats and message types can be rolled out while
+ * older clients and servers keep working. Unknown feature names are ignored.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "compression.hpp"
+#include "message.hpp"
+
+namespace chat {
+
+/**
+ * @brief Protocol version spoken by this build.
+ *
+ * 1 is every peer from before the negotiation, which sends no `version`; 2 added it.
+ */
+constexpr std::uint32_t kProtocolVersion = 2;
+
+/**
+ * @brief An optional protocol feature; one bit each.
+ *
+ * New features get the next bit and an entry in `kFeatureNames`, and must not be used
+ * towards a peer that did not agree to them.
+ */
+enum class Feature : std::uint32_t {
+    compression = 1u << 0,  ///< Frames compressed with `kCompressionCodec`.
+    history = 1u << 1,      ///< `HISTORY` requests are answered from stored conversation logs.
+    e2e_keys = 1u << 2,     ///< Public keys are published in `REGISTER` and served for `KEY` requests.
+    batch = 1u << 3,        ///< Clients may send several messages in one `BATCH` frame.
+};
+
+/**
+ * @brief Wire name of a feature.
+ */
+struct FeatureName {
+    Feature feature;    ///< The feature.
+    const char* name;   ///< Its name in `Message::features`.
+};
+
+/**
+ * @brief Every feature this build knows, with its wire name.
+ */
+constexpr FeatureName kFeatureNames[] = {
+    {Feature::compression, kCompressionCodec},
+    {Feature::history, "history"},
+    {Feature::e2e_keys, "e2e-keys"},
+    {Feature::batch, "batch"},
+};
+
+/**
+ * @brief A set of features, stored as a bit mask.
+ */
+class FeatureSet {
+public:
+    FeatureSet() = default;
+
+    /**
+     * @brief Creates the set from its bit mask.
+     */
+    explicit FeatureSet(std::uint32_t bits) : bits_(bits) {}
+
+    /**
+     * @brief Creates the set of the listed features.
+     */
+    FeatureSet(std::initializer_list<Feature> features) {
+        for (Feature feature : features) {
+            add(feature);
+        }
+    }
+
+    /**
+     * @brief Parses wire names, skipping names this build does not know.
+     */
+    static FeatureSet from_names(const std::vector<std::string>& names) {
+        FeatureSet set;
+        for (const auto& entry : kFeatureNames) {
+            if (std::find(names.begin(), names.end(), entry.name) != names.end()) {
+                set.add(entry.feature);
+            }
+        }
+        return set;
+    }
+
+    /**
+     * @brief Returns the wire names of the features in the set.
+     */
+    std::vector<std::string> names() const {
+        std::vector<std::string> out;
+        for (const auto& entry : kFeatureNames) {
+            if (has(entry.feature)) {
+                out.emplace_back(entry.name);
+            }
+        }
+        return out;
+    }
+
+    /**
+     * @brief Returns true if the feature is in the set.
+     */
+    bool has(Feature feature) const { return (bits_ & static_cast<std::uint32_t>(feature)) != 0; }
+
+    /**
+     * @brief Adds a feature.
+     */
+    void add(Feature feature) { bits_ |= static_cast<std::uint32_t>(feature); }
+
+    /**
+     * @brief Returns the features in both sets.
+     */
+    FeatureSet operator&(FeatureSet other) const { return FeatureSet(bits_ & other.bits_); }
+
+    bool operator==(FeatureSet other) const { return bits_ == other.bits_; }
+    bool operator!=(FeatureSet other) const { return bits_ != other.bits_; }
+
+    /**
+     * @brief Returns the bit mask.
+     */
+    std::uint32_t bits() const { return bits_; }
+
+private:
+    std::uint32_t bits_ = 0;    ///< One bit per `Feature`.
+};
+
+/**
+ * @brief Returns the protocol version to speak with a peer.
+ * @param peer_version The peer's `version`; 0 if it sent none.
+ */
+inline std::uint32_t negotiate_version(std::uint32_t peer_version) {
+    return peer_version == 0 ? 1 : std::min(peer_version, kProtocolVersion);
+}
+
+/**
+ * @brief Returns the features a `REGISTER` asks for.
+ *
+ * Version 1 clients send no `features`, only the `compression` codec they support.
+ */
+inline FeatureSet requested_features(const Message& request) {
+    FeatureSet requested = FeatureSet::from_names(request.features);
+    if (request.compression == kCompressionCodec) {
+        requested.add(Feature::compression);
+    }
+    return requested;
+}
+
+}  // namespace chat
@@ -0,0 +1,220 @@
+/**
+ * @file compression.hpp
+ * @brief Optional per-frame deflate compression primed with a dictionary of chat traffic.
+ *
+ * A compressed frame's payload is `kCompressedFrameTag` followed by a raw deflate
+ * stream of the original payload. Frames are compressed independently, so any frame
+ * can be decoded on its own; to still compress short messages well, both sides prime
+ * deflate with the same preset dictionary of the JSON that every message repeats.
+ * Compression is only used once negotiated: the client names `kCompressionCodec` in
+ * its `REGISTER`, and the server echoes it in the welcome if it agrees.
+ */
+#pragma once
+#include <zlib.h>
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "frame.hpp"
+#include "message.hpp"
+
+namespace chat {
+
+/**
+ * @brief First payload byte of a compressed frame.
+ */
+constexpr char kCompressedFrameTag = 0x02;
+
+/**
+ * @brief Codec name negotiated in `REGISTER`; changes whenever the dictionary does.
+ */
+constexpr const char* kCompressionCodec = "deflate-chat-1";
+
+/**
+ * @brief Payloads shorter than this are sent as they are.
+ *
+ * zlib spends a few microseconds on even the smallest frame; below this size that buys
+ * only a few dozen bytes inside a TLS record. See `loadgen compress`.
+ */
+constexpr std::size_t kCompressThreshold = 128;
+
+/**
+ * @brief zlib level used for frames.
+ *
+ * Higher levels gain nothing on chat lines and little on user lists, at several times
+ * the CPU cost (`loadgen compress`).
+ */
+constexpr int kCompressionLevel = 1;
+
+/**
+ * @brief Preset dictionary shared by both sides.
+ *
+ * Deflate finds matches in the last 32 KiB, so the dictionary acts as if every frame
+ * were preceded by these bytes. Keys are in the order `Message::serialize()` writes
+ * them (sorted), and the most common strings come last, where matches are cheapest.
+ */
+constexpr char kCompressionDictionary[] =
+    "\"file_offset\":\"file_size\":\"transfer_id\":\"window\":262144,"
+    "\"t_client_send\":\"t_server_enqueue\":\"t_server_recv\":\"trace_id\":"
+    "Rate limit exceeded; messages are being dropped.You are now registered.Welcome "
+    "{\"content\":\"\",\"limit\":20,\"offset\":0,\"prefix\":\"\",\"recipient\":\"\",\"sender\":\"SERVER\",\"total\":"
+    ",\"type\":1,\"users\":[\"user"
+    "\",\"recipient\":\"#"
+    "{\"content\":\"\",\"recipient\":\"\",\"sender\":\"\",\"type\":4,\"users\":[]}"
+    " the you and to that is it for what this have with are not know was"
+    "\",\"recipient\":\"\",\"sender\":\"\",\"type\":3,\"users\":[]}"
+    "{\"content\":\"";
+
+/**
+ * @brief Deflate and inflate streams reused across frames.
+ *
+ * Setting up a deflate stream allocates a few hundred KiB, far more than compressing a
+ * chat message costs, so each thread keeps one pair and resets it per frame.
+ */
+class FrameCodec {
+public:
+    /**
+     * @brief Creates the streams.
+     * A small hash table (memLevel 4) keeps the per-frame reset cheap; frames are short.
+     * @param level zlib compression level (1 fastest, 9 smallest).
+     * @throws std::runtime_error if zlib cannot allocate them.
+     */
+    explicit FrameCodec(int level = kCompressionLevel) {
+        if (deflateInit2(&deflate_, level, Z_DEFLATED, -15, 4, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+        if (inflateInit2(&inflate_, -15) != Z_OK) {
+            deflateEnd(&deflate_);
+            throw std::runtime_error("inflateInit2 failed");
+        }
+    }
+
+    FrameCodec(const FrameCodec&) = delete;
+    FrameCodec& operator=(const FrameCodec&) = delete;
+
+    ~FrameCodec() {
+        deflateEnd(&deflate_);
+        inflateEnd(&inflate_);
+    }
+
+    /**
+     * @brief Compresses one payload.
+     * @param payload The payload.
+     * @param out Receives `kCompressedFrameTag` and the deflate stream.
+     * @return false if compressing would not make the payload smaller.
+     */
+    bool compress(const std::string& payload, std::string& out) {
+        deflateReset(&deflate_);
+        deflateSetDictionary(&deflate_, dictionary(), dictionary_size());
+
+        out.resize(1 + deflateBound(&deflate_, static_cast<uLong>(payload.size())));
+        out[0] = kCompressedFrameTag;
+        deflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+        deflate_.avail_in = static_cast<uInt>(payload.size());
+        deflate_.next_out = reinterpret_cast<Bytef*>(&out[1]);
+        deflate_.avail_out = static_cast<uInt>(out.size() - 1);
+        if (deflate(&deflate_, Z_FINISH) != Z_STREAM_END) {
+            return false;
+        }
+        out.resize(out.size() - deflate_.avail_out);
+        return out.size() < payload.size();
+    }
+
+    /**
+     * @brief Restores a compressed payload.
+     * @param payload A payload for which `is_compressed_frame()` is true.
+     * @param out Receives the original payload.
+     * @param max_size Largest original payload to accept.
+     * @return false if the payload is corrupt or would expand beyond `max_size`.
+     */
+    bool decompress(const std::string& payload, std::string& out, std::size_t max_size) {
+        inflateReset(&inflate_);
+        inflateSetDictionary(&inflate_, dictionary(), dictionary_size());
+
+        out.resize(std::min(max_size, std::max<std::size_t>(4 * payload.size(), 1024)));
+        inflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data() + 1));
+        inflate_.avail_in = static_cast<uInt>(payload.size() - 1);
+        inflate_.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        inflate_.avail_out = static_cast<uInt>(out.size());
+        for (;;) {
+            int result = inflate(&inflate_, Z_FINISH);
+            if (result == Z_STREAM_END) {
+                break;
+            }
+            if ((result != Z_BUF_ERROR && result != Z_OK) || inflate_.avail_out != 0 || out.size() >= max_size) {
+                return false;
+            }
+            std::size_t written = out.size();
+            out.resize(std::min(max_size, 2 * written));
+            inflate_.next_out = reinterpret_cast<Bytef*>(&out[written]);
+            inflate_.avail_out = static_cast<uInt>(out.size() - written);
+        }
+        out.resize(out.size() - inflate_.avail_out);
+        return true;
+    }
+
+private:
+    static const Bytef* dictionary() { return reinterpret_cast<const Bytef*>(kCompressionDictionary); }
+    static uInt dictionary_size() { return static_cast<uInt>(sizeof(kCompressionDictionary) - 1); }
+
+    z_stream deflate_{};    ///< Compression stream.
+    z_stream inflate_{};    ///< Decompression stream.
+};
+
+/**
+ * @brief Returns this thread's codec.
+ */
+inline FrameCodec& frame_codec() {
+    thread_local FrameCodec codec;
+    return codec;
+}
+
+/**
+ * @brief Returns true if a frame payload is compressed.
+ */
+inline bool is_compressed_frame(const std::string& payload) {
+    return !payload.empty() && payload[0] == kCompressedFrameTag;
+}
+
+/**
+ * @brief Returns true if an encoded message has end-to-end encrypted content.
+ *
+ * Ciphertext does not compress: deflate would only shrink the JSON keys around it, for
+ * a few microseconds on each side, so such frames are sent as they are.
+ */
+inline bool carries_ciphertext(const std::string& payload) {
+    static const std::string marker = std::string("\"content\":\"") + kE2ePrefix;
+    return payload.find(marker) != std::string::npos;
+}
+
+/**
+ * @brief Frames a payload, compressing it if it is long enough and compression pays off.
+ * @param payload The encoded message.
+ * @return The frame, ready to be written to the stream.
+ */
+inline std::string encode_compressed_frame(const std::string& payload) {
+    if (payload.size() >= kCompressThreshold && !carries_ciphertext(payload)) {
+        std::string compressed;
+        if (frame_codec().compress(payload, compressed)) {
+            return encode_frame(compressed);
+        }
+    }
+    return encode_frame(payload);
+}
+
+/**
+ * @brief Restores a compressed frame payload in place.
+ * @param payload A payload for which `is_compressed_frame()` is true; replaced by the original.
+ * @param max_size Largest original payload to accept.
+ * @return false if the payload is corrupt or too large.
+ */
+inline bool decompress_frame(std::string& payload, std::size_t max_size) {
+    std::string original;
+    if (!frame_codec().decompress(payload, original, max_size)) {
+        return false;
+    }
+    payload.swap(original);
+    return true;
+}
+
+}  // namespace chat
@@ -0,0 +1,147 @@
+/**
+ * @file file_transfer.hpp
+ * @brief Binary DATA frames and memory-mapped files for streaming file transfers.
+ *
+ * A transfer is negotiated with `FILE_OFFER` / `FILE_ACCEPT` messages and then streamed
+ * as DATA frames: frames whose payload starts with `kDataFrameTag` (JSON messages always
+ * start with '{'), followed by the 8-byte big-endian transfer id and the chunk bytes.
+ * The receiver grants credit with `FILE_ACK`; the sender keeps at most `window` bytes
+ * beyond the last acknowledged offset in flight.
+ */
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "frame.hpp"
+
+namespace chat {
+
+/**
+ * @brief First payload byte of a DATA frame.
+ */
+constexpr char kDataFrameTag = 0x01;
+
+/**
+ * @brief Bytes before the chunk in a DATA frame payload: tag and transfer id.
+ */
+constexpr std::size_t kDataHeaderSize = 1 + 8;
+
+/**
+ * @brief Chunk size; a whole DATA frame then fits one 16 KiB TLS record.
+ */
+constexpr std::size_t kFileChunkSize = 16 * 1024 - kFrameHeaderSize - kDataHeaderSize;
+
+/**
+ * @brief Bytes a receiver lets the sender run ahead of its acknowledgements.
+ */
+constexpr std::uint32_t kDefaultFileWindow = 256 * 1024;
+
+/**
+ * @brief Returns true if a frame payload is a DATA frame rather than a JSON message.
+ */
+inline bool is_data_frame(const std::string& payload) {
+    return !payload.empty() && payload[0] == kDataFrameTag;
+}
+
+/**
+ * @brief Encodes one chunk as a complete, framed DATA frame.
+ * @param transfer_id The transfer the chunk belongs to.
+ * @param data The chunk bytes.
+ * @param size Number of chunk bytes.
+ * @return The frame, ready to be written to the stream.
+ */
+inline std::string encode_data_frame(std::uint64_t transfer_id, const char* data, std::size_t size) {
+    auto length = static_cast<std::uint32_t>(kDataHeaderSize + size);
+    std::string frame;
+    frame.reserve(kFrameHeaderSize + length);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        frame.push_back(static_cast<char>((length >> shift) & 0xFF));
+    }
+    frame.push_back(kDataFrameTag);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        frame.push_back(static_cast<char>((transfer_id >> shift) & 0xFF));
+    }
+    frame.append(data, size);
+    return frame;
+}
+
+/**
+ * @brief Reads the transfer id of a DATA frame payload.
+ * @param payload A payload for which `is_data_frame()` is true.
+ * @param transfer_id Receives the transfer id.
+ * @return false if the payload is too short to be a DATA frame.
+ */
+inline bool parse_data_frame(const std::string& payload, std::uint64_t& transfer_id) {
+    if (payload.size() < kDataHeaderSize || !is_data_frame(payload)) {
+        return false;
+    }
+    transfer_id = 0;
+    for (std::size_t i = 1; i < kDataHeaderSize; ++i) {
+        transfer_id = (transfer_id << 8) | static_cast<unsigned char>(payload[i]);
+    }
+    return true;
+}
+
+/**
+ * @brief Read-only memory mapping of a whole file, so chunks are sent straight from the page cache.
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Maps a file.
+     * @param path The file to map.
+     * @throws std::runtime_error if the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            ::close(fd);
+            throw std::runtime_error(path + " is not a regular file");
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    /**
+     * @brief Returns the file contents.
+     */
+    const char* data() const { return data_; }
+
+    /**
+     * @brief Returns the file size.
+     */
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;    ///< Start of the mapping, or null for an empty file.
+    std::size_t size_ = 0;          ///< File size.
+};
+
+}  // namespace chat
@@ -0,0 +1,114 @@
+/**
+ * @file frame.hpp
+ * @brief Length-prefixed framing for byte streams.
+ *
+ * Each frame is a 4-byte big-endian payload length followed by the payload, so
+ * messages of any size survive arbitrary splitting and coalescing by the transport.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace chat {
+
+/**
+ * @brief Size of the frame header in bytes.
+ */
+constexpr std::size_t kFrameHeaderSize = 4;
+
+/**
+ * @brief Largest payload accepted by `FrameReader`; longer frames are treated as a protocol error.
+ */
+constexpr std::uint32_t kMaxFrameSize = 16 * 1024 * 1024;
+
+/**
+ * @brief Prepends the frame header to a payload.
+ * @param payload The bytes to frame.
+ * @return The framed bytes, ready to be written to the stream.
+ */
+inline std::string encode_frame(const std::string& payload) {
+    auto size = static_cast<std::uint32_t>(payload.size());
+    std::string frame;
+    frame.reserve(kFrameHeaderSize + payload.size());
+    frame.push_back(static_cast<char>((size >> 24) & 0xFF));
+    frame.push_back(static_cast<char>((size >> 16) & 0xFF));
+    frame.push_back(static_cast<char>((size >> 8) & 0xFF));
+    frame.push_back(static_cast<char>(size & 0xFF));
+    frame += payload;
+    return frame;
+}
+
+/**
+ * @brief Reassembles frames from stream reads of any size.
+ *
+ * Feed it whatever the socket returned, then call `next()` until it returns false.
+ */
+class FrameReader {
+public:
+    /**
+     * @brief Creates a reader.
+     * @param max_size Largest payload to accept from this peer.
+     */
+    explicit FrameReader(std::uint32_t max_size = kMaxFrameSize) : max_size_(max_size) {}
+
+    /**
+     * @brief Appends bytes read from the stream.
+     * @param data Pointer to the received bytes.
+     * @param size Number of received bytes.
+     */
+    void feed(const char* data, std::size_t size) {
+        buffer_.append(data, size);
+    }
+
+    /**
+     * @brief Extracts the next complete frame, if one has been fully received.
+     * @param payload Receives the frame payload.
+     * @return true if a frame was extracted.
+     * @throws std::length_error if the peer announces a frame larger than the reader's maximum.
+     */
+    bool next(std::string& payload) {
+        if (buffer_.size() - consumed_ < kFrameHeaderSize) {
+            compact();
+            return false;
+        }
+
+        const auto* header = reinterpret_cast<const unsigned char*>(buffer_.data() + consumed_);
+        std::uint32_t size = (std::uint32_t{header[0]} << 24) | (std::uint32_t{header[1]} << 16) |
+                             (std::uint32_t{header[2]} << 8) | std::uint32_t{header[3]};
+        if (size > max_size_) {
+            throw std::length_error("frame exceeds maximum size");
+        }
+        if (buffer_.size() - consumed_ - kFrameHeaderSize < size) {
+            compact();
+            return false;
+        }
+
+        payload.assign(buffer_, consumed_ + kFrameHeaderSize, size);
+        consumed_ += kFrameHeaderSize + size;
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of buffered bytes not yet returned as frames.
+     */
+    std::size_t pending() const { return buffer_.size() - consumed_; }
+
+private:
+    /**
+     * @brief Drops bytes of already extracted frames.
+     */
+    void compact() {
+        if (consumed_ > 0) {
+            buffer_.erase(0, consumed_);
+            consumed_ = 0;
+        }
+    }
+
+    std::string buffer_;            ///< Received bytes, starting with already consumed frames.
+    std::size_t consumed_ = 0;      ///< Bytes at the front of `buffer_` already returned.
+    std::uint32_t max_size_;        ///< Largest accepted payload.
+};
+
+}  // namespace chat
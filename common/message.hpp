@@ -3,12 +3,45 @@
  * @brief Defines the message structure and types for chat communication.
  */
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include "json.hpp"
 
 namespace chat {
 
+/**
+ * @brief Number of users per `LIST` page when the client does not ask for a size.
+ */
+constexpr std::uint32_t kDefaultListPageSize = 20;
+
+/**
+ * @brief Largest `LIST` page the server will return for a single request.
+ */
+constexpr std::uint32_t kMaxListPageSize = 100;
+
+/**
+ * @brief Most messages one `BATCH` may carry.
+ */
+constexpr std::size_t kMaxBatchSize = 256;
+
+/**
+ * @brief Largest encoded `BATCH` a client sends; bigger ones are split to stay within the server's frame limit.
+ */
+constexpr std::size_t kMaxBatchBytes = 48 * 1024;
+
+/**
+ * @brief Starts a `content` that is encrypted end to end; the server relays it untouched.
+ */
+constexpr char kE2ePrefix[] = "e2e1:";
+
+/**
+ * @brief Length of `public_key`: a 32-byte X25519 key in hex.
+ */
+constexpr std::size_t kPublicKeyHexLength = 64;
+
 /**
  * @brief Defines the type of a chat message.
  */
@@ -17,7 +50,24 @@ enum class MessageType {
     LIST,      /**< Message to request the list of connected users. */
     SELECT,    /**< Message to select a user to chat with. */
     MESSAGE,   /**< A standard chat message. */
-    SYSTEM     /**< A system notification or error message. */
+    SYSTEM,    /**< A system notification or error message. */
+    ROOM_CREATE, /**< Create the room named in `recipient` and join it. */
+    ROOM_JOIN,   /**< Join the existing room named in `recipient`. */
+    ROOM_LEAVE,  /**< Leave the room named in `recipient`. */
+    NODE_HELLO,  /**< Cluster: first message on an inter-node link; `sender` is the node id. */
+    PRESENCE,    /**< Cluster: users that joined ("join"), left ("leave") or are all of ("sync") node `sender`. */
+    PING,        /**< Heartbeat probe; the receiver answers with PONG. */
+    PONG,        /**< Heartbeat reply. */
+    FILE_OFFER,  /**< Offer file `content` of `file_size` bytes to `recipient` as transfer `transfer_id`. */
+    FILE_ACCEPT, /**< Accept transfer `transfer_id`, allowing `window` unacknowledged bytes. */
+    FILE_ACK,    /**< Receiver has written the first `file_offset` bytes of transfer `transfer_id`. */
+    FILE_CANCEL, /**< Decline or abort transfer `transfer_id`. */
+    HISTORY,     /**< Request: a page of the conversation with `recipient` (`before`/`after`, `limit`). Reply: one
+                      HISTORY per stored message, oldest first, then one with an empty `sender` and the count in `total`. */
+    KEY,         /**< Request: the end-to-end public key of user `recipient`. Reply: `sender` and its `public_key`
+                      (empty if the user published none). */
+    BATCH        /**< Several `MESSAGE`s in `batch`, handled in order as if sent one by one. Only with the
+                      "batch" feature. */
 };
 
 /**
@@ -29,22 +79,82 @@ enum class MessageType {
 struct Message {
     MessageType type;                   /**< The type of the message. */
     std::string sender;                 /**< The username of the message sender. */
-    std::string recipient;              /**< The username of the message recipient (if applicable). */
+    std::string recipient;              /**< The username or `#room` of the message recipient (if applicable). */
     std::string content;                /**< The content of the message. */
     std::vector<std::string> users;     /**< A list of usernames (used for LIST responses). */
 
+    // Optional fields; only written to JSON when set.
+    std::string prefix;                 /**< LIST: only return usernames starting with this prefix. */
+    std::uint32_t offset = 0;           /**< LIST: index of the first user of the page within the filtered list. */
+    std::uint32_t limit = 0;            /**< LIST / HISTORY request: page size (0 requests the full list / the default page). */
+    std::uint32_t total = 0;            /**< LIST response: number of users matching `prefix`; HISTORY end: messages in the page. */
+    std::uint64_t timestamp = 0;        /**< MESSAGE / HISTORY: server time when stored (µs since the Unix epoch); 0 if not stored. */
+    std::uint64_t before = 0;           /**< HISTORY request: newest messages older than this timestamp (0: the newest). */
+    std::uint64_t after = 0;            /**< HISTORY request: oldest messages newer than this timestamp, if `before` is 0. */
+    std::uint64_t trace_id = 0;         /**< Non-zero if this message is traced. */
+    std::uint64_t t_client_send = 0;    /**< Trace: sender's clock when the client sent it (µs since the Unix epoch). */
+    std::uint64_t t_server_recv = 0;    /**< Trace: server clock when it was read. */
+    std::uint64_t t_server_enqueue = 0; /**< Trace: server clock when it was queued for the recipient. */
+    std::uint64_t transfer_id = 0;      /**< FILE_*: transfer the message refers to. */
+    std::uint64_t file_size = 0;        /**< FILE_OFFER: size of the offered file in bytes. */
+    std::uint64_t file_offset = 0;      /**< FILE_ACK: bytes received and written so far. */
+    std::uint32_t window = 0;           /**< FILE_ACCEPT: bytes the sender may have unacknowledged. */
+    std::string compression;            /**< REGISTER: frame codec the client supports; welcome `SYSTEM`: codec the server agreed to. */
+    std::string password;               /**< REGISTER: password, when the server requires authentication. */
+    std::string token;                  /**< REGISTER: session token instead of a password; welcome `SYSTEM`: a new token. */
+    std::string public_key;             /**< REGISTER / KEY reply: the user's X25519 public key, in hex. */
+    std::uint32_t version = 0;          /**< REGISTER: newest protocol version the client speaks; welcome `SYSTEM`: the agreed one. */
+    std::vector<std::string> features;  /**< REGISTER: optional features the client supports; welcome `SYSTEM`: those enabled. */
+    std::vector<Message> batch;         /**< BATCH: the messages, in order; they carry no batch of their own. */
+
     /**
      * @brief Serializes the Message object to a JSON string.
      * @return A JSON string representation of the message.
      */
     std::string serialize() const {
+        return to_json().dump();
+    }
+
+    /**
+     * @brief Converts the Message object to a JSON object.
+     */
+    nlohmann::json to_json() const {
         nlohmann::json j;
         j["type"] = static_cast<int>(type);
         j["sender"] = sender;
         j["recipient"] = recipient;
         j["content"] = content;
         j["users"] = users;
-        return j.dump();
+        if (!prefix.empty()) j["prefix"] = prefix;
+        if (offset != 0) j["offset"] = offset;
+        if (limit != 0) j["limit"] = limit;
+        if (total != 0) j["total"] = total;
+        if (timestamp != 0) j["timestamp"] = timestamp;
+        if (before != 0) j["before"] = before;
+        if (after != 0) j["after"] = after;
+        if (trace_id != 0) {
+            j["trace_id"] = trace_id;
+            j["t_client_send"] = t_client_send;
+            j["t_server_recv"] = t_server_recv;
+            j["t_server_enqueue"] = t_server_enqueue;
+        }
+        if (transfer_id != 0) j["transfer_id"] = transfer_id;
+        if (file_size != 0) j["file_size"] = file_size;
+        if (file_offset != 0) j["file_offset"] = file_offset;
+        if (window != 0) j["window"] = window;
+        if (!compression.empty()) j["compression"] = compression;
+        if (!password.empty()) j["password"] = password;
+        if (!token.empty()) j["token"] = token;
+        if (!public_key.empty()) j["public_key"] = public_key;
+        if (version != 0) j["version"] = version;
+        if (!features.empty()) j["features"] = features;
+        if (!batch.empty()) {
+            nlohmann::json& entries = j["batch"];
+            for (const auto& entry : batch) {
+                entries.push_back(entry.to_json());
+            }
+        }
+        return j;
     }
 
     /**
@@ -54,19 +164,79 @@ struct Message {
      */
     static Message deserialize(const std::string& json_str) {
         Message msg;
+        try_deserialize(json_str, msg);
+        return msg;
+    }
+
+    /**
+     * @brief Deserializes a Message object from a JSON string, reporting failure.
+     * @param json_str The JSON string to parse.
+     * @param msg Receives the parsed fields; may be partially filled on failure.
+     * @return true if the string was a well-formed message.
+     */
+    static bool try_deserialize(const std::string& json_str, Message& msg) {
         try {
-            auto j = nlohmann::json::parse(json_str);
-            msg.type = static_cast<MessageType>(j["type"].get<int>());
-            msg.sender = j["sender"].get<std::string>();
-            msg.recipient = j["recipient"].get<std::string>();
-            msg.content = j["content"].get<std::string>();
-            msg.users = j["users"].get<std::vector<std::string>>();
+            from_json(nlohmann::json::parse(json_str), msg);
         }
         catch (std::exception& e) {
             // Handle parsing error
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Fills a Message object from a parsed JSON object.
+     * @throws std::exception if a required field is missing or has the wrong type, or a
+     *         batch entry holds a batch itself.
+     */
+    static void from_json(const nlohmann::json& j, Message& msg) {
+        msg.type = static_cast<MessageType>(j.at("type").get<int>());
+        msg.sender = j.at("sender").get<std::string>();
+        msg.recipient = j.at("recipient").get<std::string>();
+        msg.content = j.at("content").get<std::string>();
+        msg.users = j.at("users").get<std::vector<std::string>>();
+        msg.prefix = j.value("prefix", std::string());
+        msg.offset = j.value("offset", std::uint32_t{0});
+        msg.limit = j.value("limit", std::uint32_t{0});
+        msg.total = j.value("total", std::uint32_t{0});
+        msg.timestamp = j.value("timestamp", std::uint64_t{0});
+        msg.before = j.value("before", std::uint64_t{0});
+        msg.after = j.value("after", std::uint64_t{0});
+        msg.trace_id = j.value("trace_id", std::uint64_t{0});
+        msg.t_client_send = j.value("t_client_send", std::uint64_t{0});
+        msg.t_server_recv = j.value("t_server_recv", std::uint64_t{0});
+        msg.t_server_enqueue = j.value("t_server_enqueue", std::uint64_t{0});
+        msg.transfer_id = j.value("transfer_id", std::uint64_t{0});
+        msg.file_size = j.value("file_size", std::uint64_t{0});
+        msg.file_offset = j.value("file_offset", std::uint64_t{0});
+        msg.window = j.value("window", std::uint32_t{0});
+        msg.compression = j.value("compression", std::string());
+        msg.password = j.value("password", std::string());
+        msg.token = j.value("token", std::string());
+        msg.public_key = j.value("public_key", std::string());
+        msg.version = j.value("version", std::uint32_t{0});
+        msg.features = j.value("features", std::vector<std::string>());
+        msg.batch.clear();
+        auto entries = j.find("batch");
+        if (entries != j.end() && entries->is_array()) {
+            msg.batch.resize(entries->size());
+            for (std::size_t i = 0; i < entries->size(); ++i) {
+                if ((*entries)[i].contains("batch")) {
+                    throw std::invalid_argument("nested batch");
+                }
+                from_json((*entries)[i], msg.batch[i]);
+            }
         }
-        return msg;
     }
 };
 
+/**
+ * @brief Returns true if a recipient names a room rather than a user.
+ * @param name The recipient name.
+ */
+inline bool is_room_name(const std::string& name) {
+    return name.size() > 1 && name[0] == '#';
+}
+
 }  // namespace chat
@@ -4,6 +4,9 @@
  */
 
 #pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <string>
 
@@ -15,4 +18,50 @@
 inline bool file_exists(const std::string& path) {
     std::ifstream f(path);
     return f.good();
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Текущее время по системным часам.
+ * @return Микросекунды с начала эпохи Unix.
+ */
+inline std::uint64_t unix_micros() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief Returns the lowercase hex encoding of bytes.
+ */
+inline std::string to_hex(const unsigned char* data, std::size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(size * 2);
+    for (std::size_t i = 0; i < size; ++i) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0xf];
+    }
+    return out;
+}
+
+/**
+ * @brief Decodes hex into bytes.
+ * @return false if `hex` is not an even number of hex digits.
+ */
+inline bool from_hex(const std::string& hex, std::string& out) {
+    auto value = [](char c) {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    };
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    out.clear();
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+        int high = value(hex[i]);
+        int low = value(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
@@ -0,0 +1,493 @@
+/**
+ * @file auth.hpp
+ * @brief Password and token authentication, with hashing off the I/O threads.
+ */
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../common/utils.hpp"
+#include "metrics.hpp"
+
+namespace chat {
+
+/**
+ * @brief Cost of scrypt password hashes: N, r and p as in RFC 7914.
+ *
+ * The default takes 16 MiB and tens of milliseconds per hash.
+ */
+struct ScryptParams {
+    std::uint64_t n = 1 << 14;  ///< CPU/memory cost; a power of two.
+    std::uint64_t r = 8;        ///< Block size.
+    std::uint64_t p = 1;        ///< Parallelism.
+};
+
+/**
+ * @brief Derives a 32-byte scrypt key.
+ * @return false if the parameters are rejected.
+ */
+inline bool scrypt(const std::string& password, const std::string& salt, const ScryptParams& params, unsigned char (&key)[32]) {
+    std::uint64_t max_memory = 128 * params.n * params.r * params.p + 128 * params.r * params.p + (1 << 20);
+    return EVP_PBE_scrypt(password.data(), password.size(), reinterpret_cast<const unsigned char*>(salt.data()), salt.size(),
+                          params.n, params.r, params.p, max_memory, key, sizeof(key)) == 1;
+}
+
+/**
+ * @brief Hashes a password with a fresh random salt.
+ * @return `scrypt$N$r$p$<salt hex>$<hash hex>`, or an empty string on failure.
+ */
+inline std::string hash_password(const std::string& password, const ScryptParams& params = {}) {
+    unsigned char salt[16];
+    unsigned char key[32];
+    if (RAND_bytes(salt, sizeof(salt)) != 1 ||
+        !scrypt(password, std::string(reinterpret_cast<const char*>(salt), sizeof(salt)), params, key)) {
+        return {};
+    }
+    std::ostringstream out;
+    out << "scrypt$" << params.n << '$' << params.r << '$' << params.p << '$' << to_hex(salt, sizeof(salt)) << '$'
+        << to_hex(key, sizeof(key));
+    return out.str();
+}
+
+/**
+ * @brief Checks a password against a hash from `hash_password()`, in constant time.
+ */
+inline bool verify_password(const std::string& password, const std::string& encoded) {
+    std::vector<std::string> fields;
+    std::stringstream in(encoded);
+    for (std::string field; std::getline(in, field, '$');) {
+        fields.push_back(field);
+    }
+    std::string salt;
+    std::string expected;
+    if (fields.size() != 6 || fields[0] != "scrypt" || !from_hex(fields[4], salt) || !from_hex(fields[5], expected) ||
+        expected.size() != 32) {
+        return false;
+    }
+    ScryptParams params;
+    try {
+        params.n = std::stoull(fields[1]);
+        params.r = std::stoull(fields[2]);
+        params.p = std::stoull(fields[3]);
+    } catch (const std::exception&) {
+        return false;
+    }
+    unsigned char key[32];
+    return scrypt(password, salt, params, key) && CRYPTO_memcmp(key, expected.data(), sizeof(key)) == 0;
+}
+
+/**
+ * @brief Issues and checks HMAC-SHA256 signed session tokens.
+ *
+ * A token is `<username hex>.<expiry>.<mac hex>`, where the expiry is in seconds since
+ * the Unix epoch and the MAC covers both. Checking one is a single HMAC, so clients
+ * that log in again with their token skip password hashing entirely.
+ */
+class TokenSigner {
+public:
+    /**
+     * @brief Creates a signer.
+     * @param secret Signing key; tokens stay valid as long as it does not change.
+     */
+    explicit TokenSigner(std::string secret) : secret_(std::move(secret)) {}
+
+    /**
+     * @brief Returns a token for a user.
+     * @param username The authenticated user.
+     * @param expires_at When the token stops being accepted (seconds since the Unix epoch).
+     */
+    std::string issue(const std::string& username, std::uint64_t expires_at) const {
+        std::string body = to_hex(reinterpret_cast<const unsigned char*>(username.data()), username.size()) + "." +
+                           std::to_string(expires_at);
+        return body + "." + mac(body);
+    }
+
+    /**
+     * @brief Returns true if a token was issued for `username` and has not expired at `now`.
+     */
+    bool verify(const std::string& token, const std::string& username, std::uint64_t now) const {
+        auto first = token.find('.');
+        auto second = first == std::string::npos ? std::string::npos : token.find('.', first + 1);
+        if (second == std::string::npos) {
+            return false;
+        }
+        std::string body = token.substr(0, second);
+        std::string expected = mac(body);
+        std::string given = token.substr(second + 1);
+        if (given.size() != expected.size() || CRYPTO_memcmp(given.data(), expected.data(), expected.size()) != 0) {
+            return false;
+        }
+        std::string name;
+        if (!from_hex(token.substr(0, first), name) || name != username) {
+            return false;
+        }
+        try {
+            return std::stoull(token.substr(first + 1, second - first - 1)) > now;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+private:
+    std::string mac(const std::string& body) const {
+        unsigned char out[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        HMAC(EVP_sha256(), secret_.data(), static_cast<int>(secret_.size()), reinterpret_cast<const unsigned char*>(body.data()),
+             body.size(), out, &length);
+        return to_hex(out, length);
+    }
+
+    std::string secret_;    ///< Signing key.
+};
+
+/**
+ * @brief Bounded LRU set of recently verified credentials, each valid for a while.
+ *
+ * Keys are digests, never the credentials themselves. Not thread-safe; the owner
+ * guards it with a mutex.
+ */
+class VerificationCache {
+public:
+    using Clock = std::chrono::steady_clock;    ///< Clock of the expiry times.
+
+    /**
+     * @brief Creates a cache.
+     * @param capacity Most entries; the least recently used goes first.
+     * @param ttl How long an entry counts as verified.
+     */
+    VerificationCache(std::size_t capacity, Clock::duration ttl) : capacity_(capacity), ttl_(ttl) {}
+
+    /**
+     * @brief Returns true if `key` was verified within the TTL, and marks it recently used.
+     */
+    bool check(const std::string& key, Clock::time_point now) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return false;
+        }
+        if (it->second->second <= now) {
+            order_.erase(it->second);
+            entries_.erase(it);
+            return false;
+        }
+        order_.splice(order_.begin(), order_, it->second);
+        return true;
+    }
+
+    /**
+     * @brief Records `key` as verified now.
+     */
+    void insert(const std::string& key, Clock::time_point now) {
+        if (capacity_ == 0) {
+            return;
+        }
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            it->second->second = now + ttl_;
+            order_.splice(order_.begin(), order_, it->second);
+            return;
+        }
+        if (entries_.size() == capacity_) {
+            entries_.erase(order_.back().first);
+            order_.pop_back();
+        }
+        order_.emplace_front(key, now + ttl_);
+        entries_.emplace(key, order_.begin());
+    }
+
+    /**
+     * @brief Returns the number of entries, including expired ones not yet dropped.
+     */
+    std::size_t size() const { return entries_.size(); }
+
+private:
+    using Order = std::list<std::pair<std::string, Clock::time_point>>;    ///< Keys and expiry, most recent first.
+
+    std::size_t capacity_;                                      ///< Most entries.
+    Clock::duration ttl_;                                       ///< Lifetime of an entry.
+    Order order_;                                               ///< Recency order.
+    std::unordered_map<std::string, Order::iterator> entries_;  ///< Key → position in order_.
+};
+
+/**
+ * @brief Outcome of an authentication.
+ */
+struct AuthResult {
+    bool ok = false;        ///< Whether the user is authenticated.
+    bool created = false;   ///< The password created a new account.
+    std::string token;      ///< On success, a session token for later logins.
+    std::string error;      ///< On failure, why.
+};
+
+/**
+ * @brief Authenticates `REGISTER` requests against a file of scrypt password hashes.
+ *
+ * The first login under an unknown username creates the account with its password.
+ * Every successful login gets a signed session token, which later logins can present
+ * instead of the password.
+ *
+ * Tokens and cached passwords are checked inline, in microseconds. Anything needing
+ * scrypt runs on a worker pool, so a login storm never stalls the I/O threads that
+ * relay messages; past `max_pending` queued hashes new logins are turned away instead
+ * of queuing without bound. A password that verified recently is remembered in a
+ * `VerificationCache` under a SHA-256 of username, password and stored hash, so
+ * reconnecting clients skip the hash as well.
+ *
+ * Accounts live in `<users file>` as `username<TAB>hash` lines; the token key in
+ * `<users file>.key`, created on first start. Thread-safe.
+ */
+class AuthService {
+public:
+    /**
+     * @brief Configuration.
+     */
+    struct Options {
+        std::string users_file;                                     ///< Accounts file; created if missing.
+        unsigned threads = 2;                                       ///< Hashing threads.
+        std::chrono::seconds token_ttl = std::chrono::hours(24 * 7); ///< Lifetime of issued tokens.
+        std::size_t cache_capacity = 100000;                        ///< Most remembered passwords.
+        std::chrono::seconds cache_ttl = std::chrono::minutes(10);  ///< How long a verified password is remembered.
+        std::size_t max_pending = 1024;                             ///< Most hashes queued or running.
+        ScryptParams scrypt;                                        ///< Hash cost for new accounts.
+    };
+
+    /**
+     * @brief Loads the accounts and the token key.
+     * @throws std::runtime_error if the files cannot be opened.
+     */
+    explicit AuthService(Options options)
+        : options_(std::move(options)),
+          pool_(std::max(1u, options_.threads)),
+          signer_(load_secret(options_.users_file + ".key")),
+          cache_(options_.cache_capacity, options_.cache_ttl) {
+        std::ifstream in(options_.users_file);
+        for (std::string line; std::getline(in, line);) {
+            auto tab = line.find('\t');
+            if (tab != std::string::npos) {
+                users_[line.substr(0, tab)] = line.substr(tab + 1);
+            }
+        }
+        users_out_.open(options_.users_file, std::ios::app);
+        if (!users_out_) {
+            throw std::runtime_error("cannot open " + options_.users_file);
+        }
+    }
+
+    ~AuthService() { pool_.join(); }
+
+    /**
+     * @brief Authenticates a user with a token or a password.
+     *
+     * `handler(AuthResult)` runs inline when no hashing is needed, otherwise on a
+     * worker thread.
+     * @param username The name to log in as.
+     * @param password The password, if no token is given.
+     * @param token A token from an earlier login, or empty.
+     */
+    template <typename Handler>
+    void authenticate(const std::string& username, const std::string& password, const std::string& token, Handler&& handler) {
+        auto& metrics = server_metrics();
+        if (username.empty() || username.size() > 64 || username.find_first_of("\t\n\r") != std::string::npos) {
+            return fail(handler, "Invalid username.");
+        }
+        if (!token.empty()) {
+            if (!signer_.verify(token, username, unix_seconds())) {
+                return fail(handler, "Invalid or expired token.");
+            }
+            AuthResult result;
+            result.ok = true;
+            result.token = token;
+            return handler(std::move(result));
+        }
+        if (password.empty()) {
+            return fail(handler, "A password is required.");
+        }
+
+        std::string record = stored_hash(username);
+        if (!record.empty()) {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            if (cache_.check(cache_key(username, password, record), VerificationCache::Clock::now())) {
+                metrics.auth_cache_hits.inc();
+                return handler(success(username, false));
+            }
+        }
+
+        if (pending_.fetch_add(1) >= options_.max_pending) {
+            --pending_;
+            return fail(handler, "Server busy; try again later.");
+        }
+        boost::asio::post(pool_, [this, username, password, record, handler = std::forward<Handler>(handler)]() mutable {
+            auto started = std::chrono::steady_clock::now();
+            AuthResult result = check_password(username, password, record);
+            server_metrics().auth_hash_latency.observe(micros_since(started));
+            --pending_;
+            handler(std::move(result));
+        });
+    }
+
+    /**
+     * @brief Returns the number of accounts.
+     */
+    std::size_t users() const {
+        std::lock_guard<std::mutex> lock(users_mutex_);
+        return users_.size();
+    }
+
+    /**
+     * @brief Returns whether an account exists for a username.
+     */
+    bool has_account(const std::string& username) const {
+        std::lock_guard<std::mutex> lock(users_mutex_);
+        return users_.count(username) != 0;
+    }
+
+private:
+    /**
+     * @brief Reports a failure to a handler.
+     */
+    template <typename Handler>
+    static void fail(Handler& handler, const char* error) {
+        server_metrics().auth_failures.inc();
+        AuthResult result;
+        result.error = error;
+        handler(std::move(result));
+    }
+
+    /**
+     * @brief Returns the current time in seconds since the Unix epoch.
+     */
+    static std::uint64_t unix_seconds() {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * @brief Reads the token key, creating a random one if the file does not exist.
+     */
+    static std::string load_secret(const std::string& path) {
+        std::string secret(32, '\0');
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ssize_t got = ::read(fd, &secret[0], secret.size());
+            ::close(fd);
+            if (got == static_cast<ssize_t>(secret.size())) {
+                return secret;
+            }
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0 || RAND_bytes(reinterpret_cast<unsigned char*>(&secret[0]), static_cast<int>(secret.size())) != 1 ||
+            ::write(fd, secret.data(), secret.size()) != static_cast<ssize_t>(secret.size())) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("cannot create " + path);
+        }
+        ::close(fd);
+        return secret;
+    }
+
+    /**
+     * @brief Returns the SHA-256, in hex, of a verified credential and the hash it matched.
+     */
+    static std::string cache_key(const std::string& username, const std::string& password, const std::string& record) {
+        std::string input = username + '\0' + password + '\0' + record;
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        EVP_Digest(input.data(), input.size(), digest, &length, EVP_sha256(), nullptr);
+        OPENSSL_cleanse(&input[0], input.size());
+        return to_hex(digest, length);
+    }
+
+    /**
+     * @brief Returns the stored hash of a user, or an empty string for an unknown user.
+     */
+    std::string stored_hash(const std::string& username) const {
+        std::lock_guard<std::mutex> lock(users_mutex_);
+        auto it = users_.find(username);
+        return it == users_.end() ? std::string() : it->second;
+    }
+
+    /**
+     * @brief Returns a successful result with a fresh token.
+     */
+    AuthResult success(const std::string& username, bool created) const {
+        AuthResult result;
+        result.ok = true;
+        result.created = created;
+        result.token = signer_.issue(username, unix_seconds() + static_cast<std::uint64_t>(options_.token_ttl.count()));
+        return result;
+    }
+
+    /**
+     * @brief Verifies a password, or creates the account if the user is unknown. Runs on the pool.
+     */
+    AuthResult check_password(const std::string& username, const std::string& password, std::string record) {
+        auto& metrics = server_metrics();
+        bool created = false;
+        if (record.empty()) {
+            std::string hashed = hash_password(password, options_.scrypt);
+            metrics.auth_hashes.inc();
+            if (hashed.empty()) {
+                // Storing no hash would lock the name out for good
+                AuthResult result;
+                result.error = "Could not create the account.";
+                metrics.auth_failures.inc();
+                return result;
+            }
+            std::lock_guard<std::mutex> lock(users_mutex_);
+            auto inserted = users_.emplace(username, hashed);
+            if (inserted.second) {
+                users_out_ << username << '\t' << hashed << '\n' << std::flush;
+                record = hashed;
+                created = true;
+            } else {
+                record = inserted.first->second;    // Another login created it first
+            }
+        }
+        if (!created) {
+            metrics.auth_hashes.inc();
+            if (!verify_password(password, record)) {
+                AuthResult result;
+                result.error = "Wrong password.";
+                metrics.auth_failures.inc();
+                return result;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            cache_.insert(cache_key(username, password, record), VerificationCache::Clock::now());
+        }
+        return success(username, created);
+    }
+
+    Options options_;                                           ///< Configuration.
+    boost::asio::thread_pool pool_;                             ///< Runs password hashing.
+    std::atomic<std::size_t> pending_{0};                       ///< Hashes queued or running.
+    TokenSigner signer_;                                        ///< Issues and checks tokens.
+
+    mutable std::mutex users_mutex_;                            ///< Guards users_ and users_out_.
+    std::unordered_map<std::string, std::string> users_;        ///< Username → scrypt hash.
+    std::ofstream users_out_;                                   ///< Appends new accounts to the users file.
+
+    std::mutex cache_mutex_;                                    ///< Guards cache_.
+    VerificationCache cache_;                                   ///< Recently verified passwords.
+};
+
+}  // namespace chat
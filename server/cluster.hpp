@@ -0,0 +1,515 @@
+/**
+ * @file cluster.hpp
+ * @brief Multi-node operation: consistent-hash ring, presence gossip and message forwarding.
+ *
+ * Every node keeps one persistent outbound TLS link to each peer for sending and
+ * accepts the peers' links for receiving. Presence changes are batched and gossiped
+ * to all peers, and additionally sent immediately to the ring owner of the username,
+ * which is therefore the authoritative location of that user. A message whose
+ * recipient is not local goes straight to the node that gossip says hosts the user;
+ * if gossip has not caught up yet it goes to the owner, which forwards it once more.
+ * `KEY` requests for such users travel the same way, and the node hosting the user
+ * routes its answer back to the asking user's node.
+ *
+ * Links use mutual TLS: both ends present the shared server certificate and refuse a
+ * peer that does not, so only nodes holding its key can join, and the node port is
+ * bound to the node's own cluster address only.
+ */
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../common/frame.hpp"
+#include "../common/message.hpp"
+#include "hash_ring.hpp"
+#include "session.hpp"
+
+namespace chat {
+
+/**
+ * @brief One chat server's membership in a cluster.
+ *
+ * Owns the inter-node links and the directory of users connected to other nodes.
+ * The chat server plugs in through `Callbacks`, which are never invoked while the
+ * cluster's own mutex is held.
+ */
+class ClusterNode {
+public:
+    /**
+     * @brief Hooks into the local chat server.
+     */
+    struct Callbacks {
+        std::function<bool(const Message&)> deliver_local;      ///< Delivers a message or `KEY` reply to a local user; false if not connected here.
+        std::function<std::string(const std::string&)> public_key;  ///< Returns the key a user published here (hex), or empty.
+        std::function<std::vector<std::string>()> local_users;  ///< Returns all locally connected usernames.
+        std::function<void()> directory_changed;                ///< Called after remote presence changed.
+    };
+
+    /**
+     * @brief Constructs the node; call `start()` to open links.
+     * @param io_context The I/O context running the links.
+     * @param self_id This node's "host:port" cluster address.
+     * @param peers The other nodes' cluster addresses.
+     * @param callbacks Hooks into the local chat server.
+     */
+    ClusterNode(boost::asio::io_context& io_context, std::string self_id, std::vector<std::string> peers,
+                Callbacks callbacks)
+        : io_context_(io_context),
+          server_context_(boost::asio::ssl::context::tlsv12_server),
+          client_context_(boost::asio::ssl::context::tlsv12_client),
+          acceptor_(io_context),
+          flush_timer_(io_context),
+          self_id_(std::move(self_id)),
+          ring_(with_self(peers, self_id_)),
+          callbacks_(std::move(callbacks)) {
+
+        // All nodes share the server certificate, so it doubles as the trust anchor;
+        // each end presents it and requires it from the other
+        for (auto* context : {&server_context_, &client_context_}) {
+            context->use_certificate_chain_file("server.crt");
+            context->use_private_key_file("server.key", boost::asio::ssl::context::pem);
+            context->load_verify_file("server.crt");
+            context->set_verify_mode(boost::asio::ssl::verify_peer | boost::asio::ssl::verify_fail_if_no_peer_cert);
+        }
+
+        for (auto& peer : peers) {
+            if (peer != self_id_) {
+                links_.emplace(peer, std::make_shared<Link>(io_context_));
+            }
+        }
+    }
+
+    /**
+     * @brief Starts listening for peers on this node's cluster address and connecting to them.
+     */
+    void start() {
+        auto address = split_node_id(self_id_);
+        boost::asio::ip::tcp::resolver resolver(io_context_);
+        boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(address.first, address.second)->endpoint();
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+
+        std::cout << "Cluster node " << self_id_ << " with " << links_.size() << " peer(s)\n";
+        accept_link();
+        for (auto& link : links_) {
+            connect_link(link.first);
+        }
+    }
+
+    /**
+     * @brief Returns this node's id.
+     */
+    const std::string& self_id() const { return self_id_; }
+
+    /**
+     * @brief Returns the hash ring.
+     */
+    const HashRing& ring() const { return ring_; }
+
+    /**
+     * @brief Records a local user coming online or going offline and gossips it.
+     *
+     * The change goes to the username's ring owner at once and to every peer in the
+     * next batch.
+     * @param username The local user.
+     * @param online true on registration, false on disconnect.
+     */
+    void presence_changed(const std::string& username, bool online) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_presence_[username] = online;
+
+        const std::string& owner = ring_.owner(username);
+        if (owner != self_id_) {
+            send_to(owner, presence_message(online ? "join" : "leave", {username}));
+        }
+        schedule_flush();
+    }
+
+    /**
+     * @brief Forwards a message for a user that is not connected to this node.
+     * @param message The message; `recipient` is a username.
+     * @return false if the recipient is not known anywhere in the cluster.
+     */
+    bool route(const Message& message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = remote_users_.find(message.recipient);
+        const std::string& target = it != remote_users_.end() ? it->second : ring_.owner(message.recipient);
+        if (target == self_id_) {
+            return false;
+        }
+        return send_to(target, encode(message));
+    }
+
+    /**
+     * @brief Asks the node hosting a user for their end-to-end public key.
+     *
+     * The reply arrives through `Callbacks::deliver_local` as a `KEY` message from the
+     * user to `request.sender`.
+     * @param request `KEY` request; `sender` is the local user asking, `recipient` the user whose key is wanted.
+     * @return false if the user is not known anywhere in the cluster.
+     */
+    bool request_key(Message request) {
+        request.content = "request";
+        return route(request);
+    }
+
+    /**
+     * @brief Returns true if a user is connected to another node.
+     */
+    bool is_remote_user(const std::string& username) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return remote_users_.count(username) > 0;
+    }
+
+    /**
+     * @brief Runs `f` with the map of remote users (username → node id) under the cluster lock.
+     * @param f Callable taking `const std::map<std::string, std::string>&`.
+     */
+    template <typename F>
+    void with_remote_users(F f) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        f(remote_users_);
+    }
+
+private:
+    /**
+     * @brief Persistent outbound connection to one peer.
+     */
+    struct Link {
+        explicit Link(boost::asio::io_context& io_context) : retry_timer(io_context) {}
+
+        std::shared_ptr<Session> session;           ///< Established link, or null while down.
+        boost::asio::steady_timer retry_timer;      ///< Reconnect back-off timer.
+    };
+
+    static std::vector<std::string> with_self(std::vector<std::string> peers, const std::string& self_id) {
+        peers.push_back(self_id);
+        return peers;
+    }
+
+    static Session::Payload encode(const Message& message) {
+        return std::make_shared<const std::string>(encode_frame(message.serialize()));
+    }
+
+    Session::Payload presence_message(const std::string& kind, std::vector<std::string> users) const {
+        Message presence;
+        presence.type = MessageType::PRESENCE;
+        presence.sender = self_id_;
+        presence.content = kind;
+        presence.users = std::move(users);
+        return encode(presence);
+    }
+
+    /**
+     * @brief Queues a payload on the outbound link to `node`. Caller holds `mutex_`.
+     * @return false if the link is down.
+     */
+    bool send_to(const std::string& node, Session::Payload payload) {
+        auto it = links_.find(node);
+        if (it == links_.end() || !it->second->session) {
+            return false;
+        }
+        it->second->session->send(std::move(payload));
+        return true;
+    }
+
+    /**
+     * @brief Arms the gossip timer unless a flush is already pending. Caller holds `mutex_`.
+     */
+    void schedule_flush() {
+        if (flush_scheduled_) {
+            return;
+        }
+        flush_scheduled_ = true;
+        flush_timer_.expires_after(std::chrono::milliseconds(50));
+        flush_timer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                flush_presence();
+            }
+        });
+    }
+
+    /**
+     * @brief Sends the net presence changes since the last flush to every peer in one join and one leave message.
+     */
+    void flush_presence() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_scheduled_ = false;
+
+        std::vector<std::string> joined, left;
+        for (auto& change : pending_presence_) {
+            (change.second ? joined : left).push_back(change.first);
+        }
+        pending_presence_.clear();
+
+        auto join = joined.empty() ? nullptr : presence_message("join", std::move(joined));
+        auto leave = left.empty() ? nullptr : presence_message("leave", std::move(left));
+        for (auto& link : links_) {
+            if (join) send_to(link.first, join);
+            if (leave) send_to(link.first, leave);
+        }
+    }
+
+    /**
+     * @brief Opens (or re-opens) the outbound link to a peer.
+     * @param node The peer's id.
+     */
+    void connect_link(const std::string& node) {
+        auto address = split_node_id(node);
+        auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(io_context_);
+        auto stream = std::make_shared<Session::Stream>(io_context_, client_context_);
+
+        resolver->async_resolve(address.first, address.second,
+            [this, node, resolver, stream](const boost::system::error_code& error,
+                                           boost::asio::ip::tcp::resolver::results_type endpoints) {
+                if (error) {
+                    retry_link(node);
+                    return;
+                }
+                boost::asio::async_connect(stream->lowest_layer(), endpoints,
+                    [this, node, stream](const boost::system::error_code& error, const boost::asio::ip::tcp::endpoint&) {
+                        if (error) {
+                            retry_link(node);
+                            return;
+                        }
+                        stream->async_handshake(boost::asio::ssl::stream_base::client,
+                            [this, node, stream](const boost::system::error_code& error) {
+                                if (error) {
+                                    std::cerr << "Cluster link to " << node << " failed: " << error.message() << "\n";
+                                    retry_link(node);
+                                    return;
+                                }
+                                link_up(node, std::make_shared<Session>(stream));
+                            });
+                    });
+            });
+    }
+
+    /**
+     * @brief Schedules a reconnect to a peer after a short back-off.
+     */
+    void retry_link(const std::string& node) {
+        auto& link = *links_.at(node);
+        link.retry_timer.expires_after(std::chrono::seconds(1));
+        link.retry_timer.async_wait([this, node](const boost::system::error_code& error) {
+            if (!error) {
+                connect_link(node);
+            }
+        });
+    }
+
+    /**
+     * @brief Publishes an established link and sends the greeting and a full presence sync.
+     *
+     * The peer never writes on this link, so the pending read only completes when the
+     * link breaks, which triggers a reconnect.
+     */
+    void link_up(const std::string& node, std::shared_ptr<Session> session) {
+        std::cout << "Cluster link to " << node << " established\n";
+
+        Message hello;
+        hello.type = MessageType::NODE_HELLO;
+        hello.sender = self_id_;
+        session->send(encode(hello));
+        session->send(presence_message("sync", callbacks_.local_users()));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            links_.at(node)->session = session;
+        }
+
+        auto buffer = std::make_shared<std::array<char, 64>>();
+        session->stream().async_read_some(boost::asio::buffer(*buffer),
+            [this, node, session, buffer](const boost::system::error_code&, std::size_t) {
+                std::cerr << "Cluster link to " << node << " lost\n";
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (links_.at(node)->session == session) {
+                        links_.at(node)->session.reset();
+                    }
+                }
+                retry_link(node);
+            });
+    }
+
+    /**
+     * @brief Accepts inbound links from peers.
+     */
+    void accept_link() {
+        auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_context_);
+        acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code& error) {
+            if (!error) {
+                auto stream = std::make_shared<Session::Stream>(std::move(*socket), server_context_);
+                stream->async_handshake(boost::asio::ssl::stream_base::server,
+                    [this, stream](const boost::system::error_code& error) {
+                        if (!error) {
+                            read_link(stream, std::make_shared<FrameReader>(), std::make_shared<std::string>());
+                        }
+                    });
+            }
+            accept_link();
+        });
+    }
+
+    /**
+     * @brief Reads frames from an inbound link until it closes.
+     * @param stream The link's stream.
+     * @param reader Frame reassembly state.
+     * @param peer The peer's id, learned from its `NODE_HELLO`.
+     */
+    void read_link(std::shared_ptr<Session::Stream> stream, std::shared_ptr<FrameReader> reader,
+                   std::shared_ptr<std::string> peer) {
+        auto buffer = std::make_shared<std::array<char, 4096>>();
+        stream->async_read_some(boost::asio::buffer(*buffer),
+            [this, stream, reader, peer, buffer](const boost::system::error_code& error, std::size_t bytes_transferred) {
+                if (error) {
+                    peer_lost(*peer);
+                    return;
+                }
+
+                try {
+                    reader->feed(buffer->data(), bytes_transferred);
+                    std::string payload;
+                    while (reader->next(payload)) {
+                        handle_link_message(Message::deserialize(payload), *peer);
+                    }
+                } catch (std::exception& e) {
+                    std::cerr << "Cluster link protocol error: " << e.what() << "\n";
+                    peer_lost(*peer);
+                    return;
+                }
+
+                read_link(stream, reader, peer);
+            });
+    }
+
+    /**
+     * @brief Applies one message received from a peer.
+     * @param message The message.
+     * @param peer The peer's id; updated by `NODE_HELLO`.
+     */
+    void handle_link_message(const Message& message, std::string& peer) {
+        if (message.type == MessageType::NODE_HELLO) {
+            if (!peer.empty() || links_.count(message.sender) == 0) {
+                throw std::runtime_error("unexpected NODE_HELLO from " + message.sender);
+            }
+            peer = message.sender;
+        }
+        else if (peer.empty()) {
+            throw std::runtime_error("link message before NODE_HELLO");
+        }
+        else if (message.type == MessageType::PRESENCE) {
+            if (message.sender != peer) {
+                throw std::runtime_error("presence for " + message.sender + " from " + peer);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (message.content == "sync") {
+                    erase_node_users(message.sender);
+                }
+                for (const auto& user : message.users) {
+                    if (message.content == "leave") {
+                        auto it = remote_users_.find(user);
+                        if (it != remote_users_.end() && it->second == message.sender) {
+                            remote_users_.erase(it);
+                        }
+                    } else {
+                        remote_users_[user] = message.sender;
+                    }
+                }
+            }
+            callbacks_.directory_changed();
+        }
+        else if (message.type == MessageType::KEY && message.content == "request") {
+            std::string key = callbacks_.public_key(message.recipient);
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = remote_users_.find(message.recipient);
+            if (key.empty() && ring_.owner(message.recipient) == self_id_ && it != remote_users_.end() &&
+                it->second != peer) {
+                send_to(it->second, encode(message));     // The owner forwards once, as for messages
+                return;
+            }
+
+            Message reply;
+            reply.type = MessageType::KEY;
+            reply.sender = message.recipient;
+            reply.recipient = message.sender;
+            reply.content = "reply";
+            reply.public_key = std::move(key);
+            auto asker = remote_users_.find(reply.recipient);
+            send_to(asker != remote_users_.end() ? asker->second : peer, encode(reply));
+        }
+        else if (message.type == MessageType::KEY) {
+            Message reply = message;
+            reply.content.clear();
+            callbacks_.deliver_local(reply);
+        }
+        else if (message.type == MessageType::MESSAGE) {
+            if (callbacks_.deliver_local(message)) {
+                return;
+            }
+
+            // Only the owner forwards again, and never back to the sender, so a message takes at most two hops
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = remote_users_.find(message.recipient);
+            if (ring_.owner(message.recipient) == self_id_ && it != remote_users_.end() && it->second != peer) {
+                send_to(it->second, encode(message));
+            }
+        }
+    }
+
+    /**
+     * @brief Forgets all users of a peer whose inbound link closed.
+     */
+    void peer_lost(const std::string& peer) {
+        if (peer.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            erase_node_users(peer);
+        }
+        callbacks_.directory_changed();
+    }
+
+    /**
+     * @brief Removes every remote user located on `node`. Caller holds `mutex_`.
+     */
+    void erase_node_users(const std::string& node) {
+        for (auto it = remote_users_.begin(); it != remote_users_.end();) {
+            it = it->second == node ? remote_users_.erase(it) : std::next(it);
+        }
+    }
+
+    boost::asio::io_context& io_context_;                   ///< I/O context running the links.
+    boost::asio::ssl::context server_context_;              ///< TLS context for inbound links.
+    boost::asio::ssl::context client_context_;              ///< TLS context for outbound links.
+    boost::asio::ip::tcp::acceptor acceptor_;               ///< Acceptor for inbound links.
+    boost::asio::steady_timer flush_timer_;                 ///< Gossip batching timer.
+    bool flush_scheduled_ = false;                          ///< True while `flush_timer_` is armed.
+
+    std::string self_id_;                                   ///< This node's id.
+    HashRing ring_;                                         ///< Ring over all nodes, including this one.
+    Callbacks callbacks_;                                   ///< Hooks into the local chat server.
+
+    std::mutex mutex_;                                      ///< Protects the members below.
+    std::map<std::string, std::shared_ptr<Link>> links_;    ///< Peer id → outbound link.
+    std::map<std::string, std::string> remote_users_;       ///< Username → id of the node hosting it.
+    std::map<std::string, bool> pending_presence_;          ///< Local presence changes awaiting the next flush.
+};
+
+}  // namespace chat
@@ -0,0 +1,107 @@
+/**
+ * @file devices.hpp
+ * @brief The sessions of one user, one per connected device.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief The sessions a user is logged in with, oldest first.
+ *
+ * The first session is stored inline and only further devices go into a vector, so
+ * a user with one device costs one handle and an empty vector, with no allocation.
+ * Removing is O(devices), which stays tiny. Not thread-safe; the owner guards it
+ * with the lock of the user map.
+ * @tparam Member A cheap-to-copy, equality-comparable handle (e.g. `std::shared_ptr<Session>`).
+ */
+template <typename Member>
+class DeviceSet {
+public:
+    /**
+     * @brief Creates the set with a user's first session.
+     */
+    explicit DeviceSet(Member first) : first_(std::move(first)) {}
+
+    /**
+     * @brief Adds a session; adding one twice is a no-op.
+     */
+    void add(const Member& member) {
+        if (!contains(member)) {
+            others_.push_back(member);
+        }
+    }
+
+    /**
+     * @brief Removes a session.
+     * @return false if it was not in the set.
+     */
+    bool remove(const Member& member) {
+        if (empty_) {
+            return false;
+        }
+        if (first_ == member) {
+            if (others_.empty()) {
+                empty_ = true;
+                first_ = Member();
+            } else {
+                first_ = std::move(others_.front());
+                others_.erase(others_.begin());
+            }
+            return true;
+        }
+        auto pos = std::find(others_.begin(), others_.end(), member);
+        if (pos == others_.end()) {
+            return false;
+        }
+        others_.erase(pos);
+        return true;
+    }
+
+    /**
+     * @brief Returns true if a session is in the set.
+     */
+    bool contains(const Member& member) const {
+        return !empty_ && (first_ == member || std::find(others_.begin(), others_.end(), member) != others_.end());
+    }
+
+    /**
+     * @brief Returns the number of sessions.
+     */
+    std::size_t size() const { return empty_ ? 0 : 1 + others_.size(); }
+
+    /**
+     * @brief Returns true once the last session is removed.
+     */
+    bool empty() const { return empty_; }
+
+    /**
+     * @brief Returns the session that logged in last. The set must not be empty.
+     */
+    const Member& latest() const { return others_.empty() ? first_ : others_.back(); }
+
+    /**
+     * @brief Calls `visit(member)` for every session, oldest first.
+     */
+    template <typename Visitor>
+    void for_each(Visitor&& visit) const {
+        if (empty_) {
+            return;
+        }
+        visit(first_);
+        for (const auto& member : others_) {
+            visit(member);
+        }
+    }
+
+private:
+    Member first_;                  ///< Oldest session; meaningless when empty.
+    std::vector<Member> others_;    ///< Later sessions; empty for a single-device user.
+    bool empty_ = false;            ///< Set once the last session is removed.
+};
+
+}  // namespace chat
@@ -0,0 +1,173 @@
+/**
+ * @file handoff.hpp
+ * @brief Passing listening sockets to a new server process, systemd style.
+ *
+ * The parent forks and execs the server binary with the sockets on descriptors 3, 4, ...
+ * and sets `LISTEN_FDS`, `LISTEN_PID` and `LISTEN_FDNAMES` as systemd socket activation
+ * does, so the same code path also adopts sockets handed over by systemd.
+ */
+#pragma once
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace chat {
+
+/**
+ * @brief A listening socket received from the previous process.
+ */
+struct InheritedFd {
+    int fd;             ///< Descriptor number.
+    std::string name;   ///< Name from `LISTEN_FDNAMES`, or "unknown".
+};
+
+/**
+ * @brief Takes over the listening sockets passed in the environment, if any.
+ *
+ * Clears the variables so they are not passed on, and marks the descriptors close-on-exec.
+ * @return The inherited sockets, empty if none were passed to this process.
+ */
+inline std::vector<InheritedFd> inherited_listen_fds() {
+    constexpr int kFirstFd = 3;
+    const char* count_env = std::getenv("LISTEN_FDS");
+    const char* pid_env = std::getenv("LISTEN_PID");
+    std::vector<InheritedFd> fds;
+    if (count_env == nullptr || pid_env == nullptr || std::atol(pid_env) != static_cast<long>(getpid())) {
+        return fds;
+    }
+
+    std::vector<std::string> names;
+    if (const char* names_env = std::getenv("LISTEN_FDNAMES")) {
+        std::stringstream list(names_env);
+        std::string name;
+        while (std::getline(list, name, ':')) {
+            names.push_back(name);
+        }
+    }
+
+    int count = std::atoi(count_env);
+    for (int i = 0; i < count; ++i) {
+        fcntl(kFirstFd + i, F_SETFD, FD_CLOEXEC);
+        fds.push_back({kFirstFd + i, i < static_cast<int>(names.size()) ? names[i] : "unknown"});
+    }
+
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDNAMES");
+    return fds;
+}
+
+/**
+ * @brief Returns the absolute path of the running executable, or an empty string.
+ *
+ * Call at startup and keep the result: once a deploy replaces the binary, the kernel
+ * reports this process's image as "<path> (deleted)", while the path itself then names
+ * the new build, which is what a hot restart should run.
+ * @param argv0 This process's `argv[0]`, used where `/proc/self/exe` is unavailable.
+ */
+inline std::string executable_path(const char* argv0) {
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) {
+        return std::string(path, static_cast<std::size_t>(length));
+    }
+    if (argv0 != nullptr && realpath(argv0, path) != nullptr) {
+        return path;
+    }
+    return std::string();
+}
+
+/**
+ * @brief Starts a new copy of this executable that inherits the given listening sockets.
+ *
+ * Everything the child needs is prepared before `fork()`, because the parent is
+ * multithreaded and the child may only make async-signal-safe calls before `exec`.
+ * All other descriptors are closed in the child so it holds no client connections.
+ * @param executable Path of the binary to run, from `executable_path()` at startup.
+ * @param argv Command line for the new process; `argv[0]` is only used as its name.
+ * @param fds Listening sockets, passed as descriptors 3, 4, ... in this order.
+ * @return The child's pid, or -1 if it could not be started.
+ */
+inline pid_t spawn_with_listen_fds(const std::string& executable, const std::vector<std::string>& argv,
+                                   const std::vector<InheritedFd>& fds) {
+    constexpr int kFirstFd = 3;
+
+    std::vector<char*> args;
+    for (const auto& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    std::string names = "LISTEN_FDNAMES=";
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+        names += (i > 0 ? ":" : "") + fds[i].name;
+    }
+    std::string count = "LISTEN_FDS=" + std::to_string(fds.size());
+    std::string pid = "LISTEN_PID=00000000000000000000";   // Filled in by the child
+
+    std::vector<char*> env;
+    for (char** var = environ; *var != nullptr; ++var) {
+        std::string entry(*var);
+        if (entry.rfind("LISTEN_", 0) != 0) {
+            env.push_back(*var);
+        }
+    }
+    env.push_back(const_cast<char*>(count.c_str()));
+    env.push_back(&pid[0]);
+    env.push_back(const_cast<char*>(names.c_str()));
+    env.push_back(nullptr);
+
+    int first_unused = kFirstFd + static_cast<int>(fds.size());
+    std::vector<int> moved(fds.size());
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    pid_t child = fork();
+    if (child != 0) {
+        return child;
+    }
+
+    // Child: move the sockets above the target range first, so dup2 below never clobbers one
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+        moved[i] = fcntl(fds[i].fd, F_DUPFD, first_unused);
+        if (moved[i] < 0) {
+            _exit(127);
+        }
+    }
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+        if (dup2(moved[i], kFirstFd + static_cast<int>(i)) < 0) {
+            _exit(127);
+        }
+    }
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, first_unused, ~0U, 0) != 0)
+#endif
+    {
+        for (long fd = first_unused; fd < max_fd; ++fd) {
+            close(static_cast<int>(fd));
+        }
+    }
+
+    // LISTEN_PID must name the process that will receive the sockets, which is this one
+    char* digits = &pid[0] + pid.size();
+    for (pid_t value = getpid(); value > 0; value /= 10) {
+        *--digits = static_cast<char>('0' + value % 10);
+    }
+    char* value = &pid[0] + sizeof("LISTEN_PID=") - 1;
+    while (digits < &pid[0] + pid.size()) {
+        *value++ = *digits++;
+    }
+    *value = '\0';
+
+    execve(executable.c_str(), args.data(), env.data());
+    _exit(127);
+}
+
+}  // namespace chat
@@ -0,0 +1,95 @@
+/**
+ * @file hash_ring.hpp
+ * @brief Consistent hashing of usernames onto cluster nodes.
+ */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Splits a "host:port" node id.
+ * @param node_id The node id.
+ * @return The host and port parts; the port is empty if there is no ':'.
+ */
+inline std::pair<std::string, std::string> split_node_id(const std::string& node_id) {
+    auto colon = node_id.rfind(':');
+    if (colon == std::string::npos) {
+        return {node_id, ""};
+    }
+    return {node_id.substr(0, colon), node_id.substr(colon + 1)};
+}
+
+/**
+ * @brief Consistent-hash ring mapping usernames to node ids.
+ *
+ * Each node is placed at several virtual points so keys spread evenly and adding or
+ * removing a node only moves about 1/N of the keys. All nodes must be built from
+ * the same node list to agree on owners.
+ */
+class HashRing {
+public:
+    /**
+     * @brief Builds the ring.
+     * @param nodes Node ids; order does not matter.
+     * @param virtual_nodes Number of points per node.
+     */
+    explicit HashRing(std::vector<std::string> nodes, unsigned virtual_nodes = 64)
+        : nodes_(std::move(nodes)) {
+        std::sort(nodes_.begin(), nodes_.end());
+        nodes_.erase(std::unique(nodes_.begin(), nodes_.end()), nodes_.end());
+
+        points_.reserve(nodes_.size() * virtual_nodes);
+        for (std::size_t i = 0; i < nodes_.size(); ++i) {
+            for (unsigned v = 0; v < virtual_nodes; ++v) {
+                points_.emplace_back(hash(nodes_[i] + "#" + std::to_string(v)), i);
+            }
+        }
+        std::sort(points_.begin(), points_.end());
+    }
+
+    /**
+     * @brief Returns the node owning a key.
+     * @param key The username.
+     * @pre The ring has at least one node.
+     */
+    const std::string& owner(const std::string& key) const {
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(hash(key), std::size_t{0}));
+        if (it == points_.end()) {
+            it = points_.begin();
+        }
+        return nodes_[it->second];
+    }
+
+    /**
+     * @brief Returns the node ids in sorted order.
+     */
+    const std::vector<std::string>& nodes() const { return nodes_; }
+
+    /**
+     * @brief 64-bit FNV-1a followed by a SplitMix64 finalizer for better avalanche.
+     * @param key The bytes to hash.
+     */
+    static std::uint64_t hash(const std::string& key) {
+        std::uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            h = (h ^ c) * 1099511628211ULL;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+private:
+    std::vector<std::string> nodes_;                            ///< Sorted, unique node ids.
+    std::vector<std::pair<std::uint64_t, std::size_t>> points_; ///< Sorted (hash, node index) points.
+};
+
+}  // namespace chat
@@ -0,0 +1,504 @@
+/**
+ * @file history_store.hpp
+ * @brief Persistent per-conversation message history with time-range queries.
+ */
+#pragma once
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Records per entry of a log's sparse time index.
+ */
+constexpr std::size_t kHistoryIndexStride = 64;
+
+/**
+ * @brief Messages per `HISTORY` page when the client does not ask for a size.
+ */
+constexpr std::uint32_t kDefaultHistoryPageSize = 50;
+
+/**
+ * @brief Largest `HISTORY` page the server will return for a single request.
+ */
+constexpr std::uint32_t kMaxHistoryPageSize = 200;
+
+/**
+ * @brief Logs a `HistoryStore` keeps open by default; each holds two descriptors.
+ */
+constexpr std::size_t kDefaultOpenHistoryLogs = 256;
+
+/**
+ * @brief One stored message.
+ */
+struct HistoryRecord {
+    std::uint64_t timestamp = 0;    ///< Server time when stored (µs since the Unix epoch); unique within a log.
+    std::string sender;             ///< Username of the sender.
+    std::string content;            ///< Message text.
+};
+
+/**
+ * @brief Append-only message log of one conversation, with a sparse time index.
+ *
+ * `<path>.log` holds the records back to back: a 16-byte header (timestamp, sender
+ * length, content length, in host byte order) followed by the two strings.
+ * Timestamps are made strictly increasing, so they order the log and double as
+ * message ids for paging. Every `kHistoryIndexStride`-th record is also noted in
+ * `<path>.idx` and in memory as (timestamp, offset), 16 bytes per block.
+ *
+ * A query binary-searches the index for the block holding its time bound and reads
+ * whole blocks from there with one `pread` each, walking backwards or forwards
+ * until the page is full, so its cost depends on the page size, not on the length
+ * of the log.
+ *
+ * Opening a log reloads the index and scans only the records after the last index
+ * entry, re-adding entries a crash lost and cutting off a partly written record.
+ * Thread-safe.
+ */
+class HistoryLog {
+public:
+    /**
+     * @brief Opens or creates a log.
+     * @param path Path of the log without the `.log` / `.idx` extension.
+     * @param create Whether to create a missing log; if false, `ok()` reports whether it existed.
+     */
+    explicit HistoryLog(const std::string& path, bool create = true) {
+        int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0);
+        fd_ = ::open((path + ".log").c_str(), flags, 0600);
+        index_fd_ = ::open((path + ".idx").c_str(), flags, 0600);
+        if (fd_ < 0 || index_fd_ < 0) {
+            return;
+        }
+        struct stat info {};
+        if (::fstat(fd_, &info) == 0) {
+            size_ = static_cast<std::uint64_t>(info.st_size);
+        }
+        recover();
+    }
+
+    ~HistoryLog() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (index_fd_ >= 0) {
+            ::close(index_fd_);
+        }
+    }
+
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+
+    /**
+     * @brief Returns false if the log files could not be opened.
+     */
+    bool ok() const { return fd_ >= 0 && index_fd_ >= 0; }
+
+    /**
+     * @brief Appends a message.
+     * @param sender Username of the sender.
+     * @param content Message text.
+     * @param timestamp Current time (µs since the Unix epoch); raised past the last record's if needed.
+     * @return The timestamp stored, or 0 if the write failed.
+     */
+    std::uint64_t append(std::string_view sender, std::string_view content, std::uint64_t timestamp) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!ok()) {
+            return 0;
+        }
+        if (records_ > 0 && timestamp <= last_timestamp_) {
+            timestamp = last_timestamp_ + 1;
+        }
+
+        std::string record(kHeaderSize + sender.size() + content.size(), '\0');
+        Header header{timestamp, static_cast<std::uint32_t>(sender.size()), static_cast<std::uint32_t>(content.size())};
+        std::memcpy(&record[0], &header, kHeaderSize);
+        std::memcpy(&record[kHeaderSize], sender.data(), sender.size());
+        std::memcpy(&record[kHeaderSize + sender.size()], content.data(), content.size());
+        if (!write_all(fd_, record.data(), record.size(), size_)) {
+            (void)::ftruncate(fd_, static_cast<off_t>(size_));
+            return 0;
+        }
+
+        if (records_ % kHistoryIndexStride == 0) {
+            add_index_entry({timestamp, size_});
+        }
+        size_ += record.size();
+        ++records_;
+        last_timestamp_ = timestamp;
+        return timestamp;
+    }
+
+    /**
+     * @brief Returns the newest messages older than a time.
+     * @param before Exclusive upper bound; 0 for the newest messages.
+     * @param limit Most messages to return.
+     * @return Up to `limit` records, oldest first.
+     */
+    std::vector<HistoryRecord> before(std::uint64_t before, std::size_t limit) const {
+        if (before == 0) {
+            before = std::numeric_limits<std::uint64_t>::max();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Blocks from the first one starting at or after `before` hold nothing older
+        auto first_newer = std::lower_bound(index_.begin(), index_.end(), before,
+                                            [](const IndexEntry& entry, std::uint64_t value) { return entry.timestamp < value; });
+        std::vector<HistoryRecord> newest_first;
+        std::vector<HistoryRecord> block;
+        for (std::size_t b = static_cast<std::size_t>(first_newer - index_.begin()); b-- > 0 && newest_first.size() < limit;) {
+            block.clear();
+            scan(index_[b].offset, block_end(b), [&](HistoryRecord&& record) {
+                if (record.timestamp < before) {
+                    block.push_back(std::move(record));
+                }
+                return true;
+            });
+            for (auto it = block.rbegin(); it != block.rend() && newest_first.size() < limit; ++it) {
+                newest_first.push_back(std::move(*it));
+            }
+        }
+        return std::vector<HistoryRecord>(std::make_move_iterator(newest_first.rbegin()),
+                                          std::make_move_iterator(newest_first.rend()));
+    }
+
+    /**
+     * @brief Returns the oldest messages newer than a time.
+     * @param after Exclusive lower bound.
+     * @param limit Most messages to return.
+     * @return Up to `limit` records, oldest first.
+     */
+    std::vector<HistoryRecord> after(std::uint64_t after, std::size_t limit) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // The last block starting at or before `after` is the first that can hold newer messages
+        auto first_newer = std::upper_bound(index_.begin(), index_.end(), after,
+                                            [](std::uint64_t value, const IndexEntry& entry) { return value < entry.timestamp; });
+        std::size_t b = first_newer == index_.begin() ? 0 : static_cast<std::size_t>(first_newer - index_.begin()) - 1;
+        std::vector<HistoryRecord> records;
+        for (; b < index_.size() && records.size() < limit; ++b) {
+            scan(index_[b].offset, block_end(b), [&](HistoryRecord&& record) {
+                if (record.timestamp > after) {
+                    records.push_back(std::move(record));
+                }
+                return records.size() < limit;
+            });
+        }
+        return records;
+    }
+
+    /**
+     * @brief Returns the number of messages stored.
+     */
+    std::uint64_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return records_;
+    }
+
+    /**
+     * @brief Returns the number of index entries held in memory.
+     */
+    std::size_t index_entries() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return index_.size();
+    }
+
+private:
+    /**
+     * @brief Fixed part of a record.
+     */
+    struct Header {
+        std::uint64_t timestamp;        ///< Server time when stored.
+        std::uint32_t sender_length;    ///< Bytes of sender that follow.
+        std::uint32_t content_length;   ///< Bytes of content after the sender.
+    };
+    static constexpr std::size_t kHeaderSize = sizeof(Header);
+    static_assert(kHeaderSize == 16, "history records start with a 16-byte header");
+
+    /**
+     * @brief Start of a block of records.
+     */
+    struct IndexEntry {
+        std::uint64_t timestamp;        ///< Timestamp of the block's first record.
+        std::uint64_t offset;           ///< Byte offset of that record in the log.
+    };
+
+    /// Bytes read per `pread` when scanning more than a block, e.g. during recovery.
+    static constexpr std::size_t kReadChunk = 64 * 1024;
+
+    /**
+     * @brief Writes a whole buffer at an offset.
+     */
+    static bool write_all(int fd, const char* data, std::size_t size, std::uint64_t offset) {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+            offset += static_cast<std::uint64_t>(written);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Appends an entry to the index in memory and on disk.
+     */
+    void add_index_entry(const IndexEntry& entry) {
+        index_.push_back(entry);
+        write_all(index_fd_, reinterpret_cast<const char*>(&entry), sizeof(entry), (index_.size() - 1) * sizeof(IndexEntry));
+    }
+
+    /**
+     * @brief Returns the end offset of block `b`.
+     */
+    std::uint64_t block_end(std::size_t b) const {
+        return b + 1 < index_.size() ? index_[b + 1].offset : size_;
+    }
+
+    /**
+     * @brief Reads the records in `[begin, end)` in order.
+     *
+     * Calls `visit(HistoryRecord&&)` for each whole record until it returns false.
+     * @return The offset just past the last whole record read.
+     */
+    template <typename Visitor>
+    std::uint64_t scan(std::uint64_t begin, std::uint64_t end, Visitor&& visit) const {
+        std::string buffer;
+        std::size_t used = 0;           // Bytes of `buffer` already parsed
+        std::uint64_t position = begin; // File offset of `buffer[0]`
+        std::uint64_t read_to = begin;  // File offset just past `buffer`'s data
+        while (true) {
+            // Parse the whole records in the buffer
+            while (buffer.size() - used >= kHeaderSize) {
+                Header header;
+                std::memcpy(&header, buffer.data() + used, kHeaderSize);
+                std::size_t length = kHeaderSize + header.sender_length + header.content_length;
+                if (buffer.size() - used < length) {
+                    break;
+                }
+                HistoryRecord record;
+                record.timestamp = header.timestamp;
+                record.sender.assign(buffer.data() + used + kHeaderSize, header.sender_length);
+                record.content.assign(buffer.data() + used + kHeaderSize + header.sender_length, header.content_length);
+                used += length;
+                if (!visit(std::move(record))) {
+                    return position + used;
+                }
+            }
+            if (read_to >= end) {
+                return position + used;
+            }
+
+            // Keep the partial record and read more; a block usually arrives in one read
+            buffer.erase(0, used);
+            position += used;
+            used = 0;
+            std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(end - read_to, kReadChunk));
+            std::size_t old_size = buffer.size();
+            buffer.resize(old_size + want);
+            ssize_t got = ::pread(fd_, &buffer[old_size], want, static_cast<off_t>(read_to));
+            if (got <= 0) {
+                buffer.resize(old_size);
+                return position;
+            }
+            buffer.resize(old_size + static_cast<std::size_t>(got));
+            read_to += static_cast<std::uint64_t>(got);
+        }
+    }
+
+    /**
+     * @brief Loads the index and brings it up to date with the log.
+     */
+    void recover() {
+        struct stat info {};
+        std::uint64_t index_bytes = ::fstat(index_fd_, &info) == 0 ? static_cast<std::uint64_t>(info.st_size) : 0;
+        index_.resize(static_cast<std::size_t>(index_bytes / sizeof(IndexEntry)));
+        if (!index_.empty() &&
+            ::pread(index_fd_, index_.data(), index_.size() * sizeof(IndexEntry), 0) != static_cast<ssize_t>(index_.size() * sizeof(IndexEntry))) {
+            index_.clear();
+        }
+
+        // Entries past the end of the log describe records that never made it to disk
+        while (!index_.empty() && index_.back().offset >= size_) {
+            index_.pop_back();
+        }
+        if (index_bytes != index_.size() * sizeof(IndexEntry)) {
+            (void)::ftruncate(index_fd_, static_cast<off_t>(index_.size() * sizeof(IndexEntry)));
+        }
+
+        // Only the records after the last entry need reading
+        std::uint64_t start = index_.empty() ? 0 : index_.back().offset;
+        records_ = index_.empty() ? 0 : (index_.size() - 1) * kHistoryIndexStride;
+        std::uint64_t offset = start;
+        std::uint64_t end = scan(start, size_, [&](HistoryRecord&& record) {
+            if (records_ % kHistoryIndexStride == 0 && (index_.empty() || offset > index_.back().offset)) {
+                add_index_entry({record.timestamp, offset});
+            }
+            offset += kHeaderSize + record.sender.size() + record.content.size();
+            last_timestamp_ = record.timestamp;
+            ++records_;
+            return true;
+        });
+        if (end < size_) {
+            size_ = end;
+            (void)::ftruncate(fd_, static_cast<off_t>(size_));
+        }
+    }
+
+    mutable std::mutex mutex_;          ///< Guards everything below; reads also hold it.
+    int fd_ = -1;                       ///< The `.log` file.
+    int index_fd_ = -1;                 ///< The `.idx` file.
+    std::uint64_t size_ = 0;            ///< Bytes of whole records in the log.
+    std::uint64_t records_ = 0;         ///< Records in the log.
+    std::uint64_t last_timestamp_ = 0;  ///< Timestamp of the last record.
+    std::vector<IndexEntry> index_;     ///< One entry per `kHistoryIndexStride` records.
+};
+
+/**
+ * @brief The history logs of all conversations, in one directory.
+ *
+ * A direct conversation is stored once for both users, a room once for all members.
+ * Logs are opened on first use, and only appends create one. At most `max_open` logs
+ * stay open; the least recently used idle one is closed to make room, so the number
+ * of descriptors held does not grow with the number of conversations. Thread-safe.
+ */
+class HistoryStore {
+public:
+    /**
+     * @brief Opens a store, creating its directory if needed.
+     * @param directory Directory holding the logs.
+     * @param max_open Most logs kept open at once (logs in use may briefly exceed it).
+     */
+    explicit HistoryStore(std::string directory, std::size_t max_open = kDefaultOpenHistoryLogs)
+        : directory_(std::move(directory)), max_open_(std::max<std::size_t>(max_open, 1)) {
+        ::mkdir(directory_.c_str(), 0700);
+    }
+
+    /**
+     * @brief Returns the conversation a user shares with a peer or room.
+     * @param user The user.
+     * @param peer The other user, or a `#room`.
+     */
+    static std::string conversation(const std::string& user, const std::string& peer) {
+        if (!peer.empty() && peer[0] == '#') {
+            return peer;
+        }
+        return user < peer ? user + '\0' + peer : peer + '\0' + user;
+    }
+
+    /**
+     * @brief Appends a message to a conversation.
+     * @param create Whether to start the conversation's log if it has none yet.
+     * @return The timestamp stored, or 0 if it could not be stored.
+     */
+    std::uint64_t append(const std::string& conversation, std::string_view sender, std::string_view content,
+                         std::uint64_t timestamp, bool create = true) {
+        auto history = log(conversation, create);
+        return history ? history->append(sender, content, timestamp) : 0;
+    }
+
+    /**
+     * @brief Returns one page of a conversation, oldest first.
+     * @param conversation As returned by `conversation()`.
+     * @param before If non-zero, the newest messages older than this.
+     * @param after If non-zero (and `before` is 0), the oldest messages newer than this.
+     * @param limit Most messages to return. With neither bound, the newest messages.
+     * @return The page; empty if the conversation has no log. Reading never creates one.
+     */
+    std::vector<HistoryRecord> read(const std::string& conversation, std::uint64_t before, std::uint64_t after,
+                                    std::size_t limit) {
+        auto history = log(conversation, false);
+        if (!history) {
+            return {};
+        }
+        return before == 0 && after != 0 ? history->after(after, limit) : history->before(before, limit);
+    }
+
+    /**
+     * @brief Returns the number of logs open.
+     */
+    std::size_t open_logs() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return logs_.size();
+    }
+
+private:
+    /**
+     * @brief An open log and its place in the recency list.
+     */
+    struct OpenLog {
+        std::shared_ptr<HistoryLog> log;                ///< The log; shared with callers using it.
+        std::list<std::string>::iterator recent;        ///< Its entry in `recent_`.
+    };
+
+    /**
+     * @brief Returns the log of a conversation, opening it if needed.
+     *
+     * File names are the hex-encoded conversation, so any username is safe on disk.
+     * @param create Whether to create the log if it does not exist.
+     * @return The log, or null if it does not exist (and `create` is false) or cannot be opened.
+     */
+    std::shared_ptr<HistoryLog> log(const std::string& conversation, bool create) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = logs_.find(conversation);
+        if (it != logs_.end()) {
+            recent_.splice(recent_.begin(), recent_, it->second.recent);
+            return it->second.log;
+        }
+
+        static const char digits[] = "0123456789abcdef";
+        std::string name;
+        name.reserve(conversation.size() * 2);
+        for (unsigned char c : conversation) {
+            name += digits[c >> 4];
+            name += digits[c & 0xf];
+        }
+        auto history = std::make_shared<HistoryLog>(directory_ + "/" + name, create);
+        if (!history->ok()) {
+            return nullptr;
+        }
+
+        close_idle_logs(max_open_ - 1);
+        recent_.push_front(conversation);
+        logs_.emplace(conversation, OpenLog{history, recent_.begin()});
+        return history;
+    }
+
+    /**
+     * @brief Closes least recently used logs until at most `keep` are open. Caller holds `mutex_`.
+     *
+     * A log still used by another caller is skipped: reopening it meanwhile would give
+     * two writers to the same file.
+     */
+    void close_idle_logs(std::size_t keep) {
+        for (auto it = recent_.end(); logs_.size() > keep && it != recent_.begin();) {
+            --it;
+            auto open = logs_.find(*it);
+            if (open->second.log.use_count() == 1) {
+                logs_.erase(open);
+                it = recent_.erase(it);
+            }
+        }
+    }
+
+    std::string directory_;                                     ///< Directory holding the logs.
+    std::size_t max_open_;                                      ///< Most logs kept open.
+    mutable std::mutex mutex_;                                  ///< Guards logs_ and recent_ (not the logs).
+    std::unordered_map<std::string, OpenLog> logs_;             ///< Open log per conversation.
+    std::list<std::string> recent_;                             ///< Conversations of `logs_`, most recently used first.
+};
+
+}  // namespace chat
@@ -11,35 +11,186 @@
 #include <map>
 #include <mutex>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "../common/file_transfer.hpp"
 #include "../common/message.hpp"
 #include "../common/utils.hpp"          // ← новая строка
+#include "auth.hpp"
+#include "cluster.hpp"
+#include "devices.hpp"
+#include "handoff.hpp"
+#include "history_store.hpp"
+#include "metrics_http.hpp"
+#include "rate_limit.hpp"
+#include "rooms.hpp"
+#include "session.hpp"
+#include "timing_wheel.hpp"
+#include "tracing.hpp"
+#include "transfers.hpp"
+#include "user_list.hpp"
 
 namespace asio = boost::asio;
 using asio::ip::tcp;
 namespace ssl = asio::ssl;
 
+/// Reactor Boost.Asio runs the server's sockets on; io_uring when built with `SERVER_IO_URING`.
+#if defined(BOOST_ASIO_HAS_IO_URING) && !defined(BOOST_ASIO_HAS_EPOLL)
+constexpr const char* kIoBackend = "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+constexpr const char* kIoBackend = "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+constexpr const char* kIoBackend = "kqueue";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+constexpr const char* kIoBackend = "iocp";
+#else
+constexpr const char* kIoBackend = "select";
+#endif
+
+#ifdef SO_REUSEPORT
+/// Socket option letting several acceptors bind the same port; the kernel spreads connections across them.
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
 class ChatServer {
 private:
+    using Devices = chat::DeviceSet<std::shared_ptr<chat::Session>>;                   ///< The sessions of one user.
+
     asio::io_context& io_context_;      ///< Boost.Asio I/O context.
     ssl::context ssl_context_;          ///< Boost.Asio SSL context.
-    tcp::acceptor acceptor_;            ///< Boost.Asio TCP acceptor for incoming connections.
     unsigned short port_;               ///< Port number the server is listening on.
 
-    // Maps usernames to SSL sockets
-    std::map<std::string, std::shared_ptr<ssl::stream<tcp::socket>>> user_connections_; ///< Map of connected users and their SSL sockets.
+    // Accept path: acceptor i runs on worker context i (context 0 is io_context_)
+    std::vector<std::unique_ptr<asio::io_context>> worker_contexts_;                    ///< Extra I/O contexts, one per additional acceptor.
+    std::vector<std::unique_ptr<tcp::acceptor>> acceptors_;                             ///< TCP acceptors for incoming connections.
+    std::vector<std::thread> worker_threads_;                                           ///< Threads running worker_contexts_.
+
+    // Observability
+    chat::ServerMetrics& metrics_ = chat::server_metrics();                             ///< Process-wide metrics.
+    chat::Tracer& tracer_ = chat::server_tracer();                                      ///< Process-wide relay tracer.
+    std::unique_ptr<chat::MetricsEndpoint> metrics_endpoint_;                           ///< HTTP metrics exporter, or null if disabled.
+
+    // Maps usernames to their sessions, one per device
+    std::map<std::string, Devices> user_connections_;                                   ///< Map of connected users and their sessions.
     std::mutex users_mutex_;                                                            ///< Mutex to protect access to user_connections_.
+    std::map<std::string, std::string> public_keys_;                                    ///< End-to-end public key (hex) published by each user; guarded by users_mutex_.
+    chat::UserListCache user_list_;                                                     ///< Serialized user list, rebuilt only when membership changes.
+
+    // Group chats
+    chat::RoomRegistry<std::shared_ptr<chat::Session>> rooms_;                          ///< Rooms and their member sessions.
+    std::mutex rooms_mutex_;                                                            ///< Mutex to protect rooms_ and each session's room list.
+
+    // File transfers
+    chat::TransferTable<std::shared_ptr<chat::Session>> transfers_;                     ///< Open transfers and their flow-control state.
+    std::mutex transfers_mutex_;                                                        ///< Mutex to protect transfers_.
+
+    // Cluster mode
+    std::unique_ptr<chat::ClusterNode> cluster_;                                        ///< Inter-node routing, or null when running standalone.
+
+    // Authentication
+    std::unique_ptr<chat::AuthService> auth_;                                           ///< Checks REGISTER credentials, or null when anyone may register.
+
+    // Message history
+    std::unique_ptr<chat::HistoryStore> history_;                                       ///< Persistent conversation logs, or null when disabled.
+
+    // Frame compression
+    bool compression_ = true;                                                           ///< Whether clients may negotiate compressed frames.
+
+    // Idle detection: one wheel entry per session instead of one timer per session
+    static constexpr std::chrono::milliseconds kIdleTick{100};                          ///< Resolution of the idle wheel.
+    std::chrono::steady_clock::duration idle_timeout_ = std::chrono::seconds(60);       ///< Silence after which a session is closed; 0 disables.
+    chat::TimingWheel<std::weak_ptr<chat::Session>> idle_wheel_;                        ///< Next idle check of every session.
+    std::mutex idle_mutex_;                                                             ///< Mutex to protect idle_wheel_.
+    asio::steady_timer idle_timer_;                                                     ///< Drives idle_wheel_ once per kIdleTick.
+    std::chrono::steady_clock::time_point idle_epoch_;                                  ///< Time of wheel tick 0.
+
+    // Flood protection
+    std::int64_t max_connections_ = 0;                                                  ///< Cap on open sessions; 0 is unlimited.
+    std::int64_t max_handshakes_ = 0;                                                   ///< Cap on concurrent TLS handshakes; 0 is unlimited.
+    chat::RateLimiter handshake_rate_;                                                  ///< Cap on TLS handshakes started per second.
+    chat::RateLimitConfig rate_limits_;                                                 ///< Per-session limits and policy.
+    chat::RateLimiter global_messages_;                                                 ///< Frame rate over all sessions.
+
+    // Drain and hot restart
+    static constexpr std::chrono::milliseconds kDrainTick{100};                         ///< Interval between drain batches.
+    static constexpr std::chrono::seconds kDrainGrace{2};                               ///< Time left for the last sessions to flush.
+    std::vector<chat::InheritedFd> inherited_fds_;                                      ///< Listening sockets from the previous process.
+    std::vector<std::string> restart_command_;                                          ///< Command line for hot restart; empty disables it.
+    std::string restart_executable_;                                                    ///< Binary to run on hot restart, resolved at startup.
+    std::chrono::steady_clock::duration drain_time_ = std::chrono::seconds(5);          ///< Window over which sessions are closed when draining.
+    asio::signal_set signals_;                                                          ///< SIGINT/SIGTERM drain, SIGUSR2 hot restart.
+    asio::steady_timer drain_timer_;                                                    ///< Paces the drain and the restart handover.
+    std::atomic<bool> draining_{false};                                                 ///< Set once the server stops accepting.
+    std::vector<std::weak_ptr<chat::Session>> drain_queue_;                             ///< Sessions still to be finished.
+    std::size_t drain_batch_ = 0;                                                       ///< Sessions finished per kDrainTick.
+    std::chrono::steady_clock::time_point drain_deadline_;                              ///< When draining gives up and stops.
 
 public:
     /**
      * @brief Constructs a ChatServer object.
      * @param io_context The Boost.Asio I/O context.
      * @param port The port number for the server to listen on.
+     * @param acceptors Number of acceptors. With more than one, each gets its own I/O context
+     *                  and thread and binds the port with SO_REUSEPORT, so the kernel spreads
+     *                  incoming connections and their TLS handshakes across cores.
+     * @param inherited Listening sockets passed by a previous server process or systemd. Sockets
+     *                  named "client" replace binding the port, one acceptor each.
      */
-    ChatServer(asio::io_context& io_context, unsigned short port)
+    ChatServer(asio::io_context& io_context, unsigned short port, unsigned acceptors = 1,
+               std::vector<chat::InheritedFd> inherited = {})
         : io_context_(io_context),
           ssl_context_(ssl::context::tlsv12_server),
-          acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
-          port_(port) {
+          port_(port),
+          idle_timer_(io_context),
+          inherited_fds_(std::move(inherited)),
+          signals_(io_context, SIGINT, SIGTERM),
+          drain_timer_(io_context) {
+
+        std::vector<int> client_fds;
+        for (const auto& inherited_fd : inherited_fds_) {
+            if (inherited_fd.name == "client") {
+                client_fds.push_back(inherited_fd.fd);
+            }
+        }
+
+        if (!client_fds.empty()) {
+            for (std::size_t i = 0; i < client_fds.size(); ++i) {
+                asio::io_context* context = &io_context_;
+                if (i > 0) {
+                    worker_contexts_.push_back(std::make_unique<asio::io_context>(1));
+                    context = worker_contexts_.back().get();
+                }
+                acceptors_.push_back(std::make_unique<tcp::acceptor>(*context, tcp::v4(), client_fds[i]));
+            }
+        } else if (acceptors <= 1) {
+            acceptors_.push_back(std::make_unique<tcp::acceptor>(io_context_, tcp::endpoint(tcp::v4(), port)));
+        } else {
+#ifdef SO_REUSEPORT
+            tcp::endpoint endpoint(tcp::v4(), port);
+            for (unsigned i = 0; i < acceptors; ++i) {
+                asio::io_context* context = &io_context_;
+                if (i > 0) {
+                    worker_contexts_.push_back(std::make_unique<asio::io_context>(1));
+                    context = worker_contexts_.back().get();
+                }
+
+                auto acceptor = std::make_unique<tcp::acceptor>(*context);
+                acceptor->open(endpoint.protocol());
+                acceptor->set_option(tcp::acceptor::reuse_address(true));
+                acceptor->set_option(reuse_port(true));
+                acceptor->bind(endpoint);
+                acceptor->listen();
+                acceptors_.push_back(std::move(acceptor));
+            }
+#else
+            throw std::runtime_error("multiple acceptors require SO_REUSEPORT");
+#endif
+        }
 
         // Set up SSL context
         ssl_context_.set_options(
@@ -54,214 +205,1534 @@ public:
         ssl_context_.use_private_key_file("server.key", ssl::context::pem);
     }
 
+    /**
+     * @brief Enables cluster mode. Must be called before `start()`.
+     * @param node_id This node's "host:port" inter-node address.
+     * @param peers The other nodes' inter-node addresses.
+     */
+    void enable_cluster(const std::string& node_id, const std::vector<std::string>& peers) {
+        chat::ClusterNode::Callbacks callbacks;
+        callbacks.deliver_local = [this](const chat::Message& message) {
+            auto lock = lock_users();
+            auto it = user_connections_.find(message.recipient);
+            if (it == user_connections_.end()) {
+                return false;
+            }
+            std::string serialized;
+            if (history_ && message.type == chat::MessageType::MESSAGE) {
+                // The recipient's node keeps its own copy, so its history is complete without the sender's node
+                chat::Message stored = message;
+                record_history(stored, stored.recipient, true);
+                serialized = stored.serialize();
+            } else {
+                serialized = message.serialize();
+            }
+            std::size_t sent = send_to_devices(it->second, serialized, message.trace_id);
+            if (message.type == chat::MessageType::MESSAGE) {
+                metrics_.messages_relayed.inc(sent);
+            }
+            return true;
+        };
+        callbacks.public_key = [this](const std::string& username) {
+            auto lock = lock_users();
+            auto it = public_keys_.find(username);
+            return it != public_keys_.end() ? it->second : std::string();
+        };
+        callbacks.local_users = [this]() {
+            auto lock = lock_users();
+            std::vector<std::string> users;
+            users.reserve(user_connections_.size());
+            for (const auto& user : user_connections_) {
+                users.push_back(user.first);
+            }
+            return users;
+        };
+        callbacks.directory_changed = [this]() {
+            {
+                auto lock = lock_users();
+                rebuild_user_list();
+            }
+            broadcast_user_list();
+        };
+
+        cluster_ = std::make_unique<chat::ClusterNode>(io_context_, node_id, peers, std::move(callbacks));
+    }
+
+    /**
+     * @brief Stops the worker threads started by `start()`.
+     */
+    ~ChatServer() {
+        for (auto& context : worker_contexts_) {
+            context->stop();
+        }
+        for (auto& thread : worker_threads_) {
+            thread.join();
+        }
+    }
+
+    /**
+     * @brief Serves Prometheus metrics on a loopback HTTP port. Must be called before `start()`.
+     * @param port The local port for `GET /metrics` (and `GET /trace`).
+     */
+    void enable_metrics(unsigned short port) {
+        for (const auto& inherited_fd : inherited_fds_) {
+            if (inherited_fd.name == "metrics") {
+                metrics_endpoint_ = std::make_unique<chat::MetricsEndpoint>(io_context_, inherited_fd.fd);
+                return;
+            }
+        }
+        metrics_endpoint_ = std::make_unique<chat::MetricsEndpoint>(io_context_, port);
+    }
+
+    /**
+     * @brief Enables hot restart on SIGUSR2. Must be called before `start()`.
+     * @param command The command line to start the new process with, normally this process's own.
+     *
+     * The executable is resolved now, so a restart after the binary was replaced runs
+     * the new one rather than failing on the deleted image.
+     */
+    void enable_hot_restart(std::vector<std::string> command) {
+        restart_executable_ = chat::executable_path(command.empty() ? nullptr : command.front().c_str());
+        if (restart_executable_.empty()) {
+            std::cerr << "Cannot resolve the server executable; hot restart disabled\n";
+            return;
+        }
+        restart_command_ = std::move(command);
+    }
+
+    /**
+     * @brief Sets the admission caps checked right after accept. Must be called before `start()`.
+     *
+     * A connection over any cap is closed before the TLS handshake, so floods cost an
+     * accept and a close rather than a handshake.
+     * @param max_connections Maximum open connections; 0 is unlimited.
+     * @param max_handshakes Maximum TLS handshakes in progress; 0 is unlimited.
+     * @param handshakes_per_second Maximum TLS handshakes started per second (with a burst of
+     *                              one second's worth); 0 is unlimited.
+     */
+    void set_admission_limits(std::int64_t max_connections, std::int64_t max_handshakes, double handshakes_per_second) {
+        max_connections_ = max_connections;
+        max_handshakes_ = max_handshakes;
+        handshake_rate_.configure(handshakes_per_second, handshakes_per_second);
+    }
+
+    /**
+     * @brief Sets the relay rate limits. Must be called before `start()`.
+     * @param limits Per-session and global limits and the policy for frames over them.
+     */
+    void set_rate_limits(const chat::RateLimitConfig& limits) {
+        rate_limits_ = limits;
+        global_messages_.configure(limits.global_messages_per_second, limits.global_messages_per_second);
+    }
+
+    /**
+     * @brief Sets the window over which a drain closes sessions, so clients reconnect gradually.
+     * @param drain_time The drain window; zero closes every session at once.
+     */
+    void set_drain_time(std::chrono::steady_clock::duration drain_time) {
+        drain_time_ = drain_time;
+    }
+
+    /**
+     * @brief Requires a password or session token in `REGISTER`. Must be called before `start()`.
+     * @param users_file Accounts file; unknown usernames are created on first login.
+     * @param threads Threads for password hashing, apart from the I/O threads.
+     */
+    void enable_auth(const std::string& users_file, unsigned threads) {
+        chat::AuthService::Options options;
+        options.users_file = users_file;
+        options.threads = threads;
+        auth_ = std::make_unique<chat::AuthService>(options);
+    }
+
+    /**
+     * @brief Stores every relayed message and answers `HISTORY` requests. Must be called before `start()`.
+     * @param directory Directory of the history logs; created if missing.
+     */
+    void enable_history(const std::string& directory) {
+        history_ = std::make_unique<chat::HistoryStore>(directory);
+    }
+
+    /**
+     * @brief Allows or refuses compressed frames for clients that ask in `REGISTER`. Must be called before `start()`.
+     * @param enabled false to always send and expect uncompressed frames.
+     */
+    void set_compression(bool enabled) {
+        compression_ = enabled;
+    }
+
+    /**
+     * @brief Sets how long a client may stay silent. Must be called before `start()`.
+     *
+     * Registered clients are sent a PING after half of the timeout; whoever still has not
+     * sent anything when it runs out, including clients stuck before registering, is
+     * disconnected.
+     * @param timeout The idle timeout; zero disables heartbeats and idle timeouts.
+     */
+    void set_idle_timeout(std::chrono::steady_clock::duration timeout) {
+        idle_timeout_ = timeout;
+    }
+
     /**
      * @brief Starts the chat server.
      *
-     * Begins accepting incoming client connections.
+     * Begins accepting incoming client connections and, in cluster mode, inter-node links.
+     * Acceptor 0 is served by whoever runs `io_context_`; the others get a thread each.
      */
     void start() {
-        std::cout << "Secure chat server running on port " << port_ << "\n";
-        accept_connection();
+        std::cout << "Secure chat server running on port " << port_;
+        if (acceptors_.size() > 1) {
+            std::cout << " with " << acceptors_.size() << " acceptors";
+        }
+        std::cout << " (" << kIoBackend << ")\n";
+
+        if (cluster_) {
+            cluster_->start();
+        }
+        if (metrics_endpoint_) {
+            metrics_endpoint_->start();
+        }
+        if (idle_timeout_ != idle_timeout_.zero()) {
+            idle_epoch_ = std::chrono::steady_clock::now();
+            schedule_idle_tick();
+        }
+#ifdef SIGUSR2
+        if (!restart_command_.empty()) {
+            signals_.add(SIGUSR2);
+        }
+#endif
+        wait_for_signal();
+        for (auto& acceptor : acceptors_) {
+            accept_connection(*acceptor);
+        }
+        for (auto& context : worker_contexts_) {
+            worker_threads_.emplace_back([&context]() { context->run(); });
+        }
     }
 
 private:
+    /**
+     * @brief Waits for the next control signal.
+     *
+     * SIGINT and SIGTERM drain the server and exit; a second one during the drain exits at
+     * once. SIGUSR2 hands the listening sockets to a new process, then drains.
+     */
+    void wait_for_signal() {
+        signals_.async_wait([this](const boost::system::error_code& error, int signal) {
+            if (error) {
+                return;
+            }
+            if (draining_) {
+                std::cout << "Received signal " << signal << " while draining, stopping now\n";
+                stop();
+                return;
+            }
+#ifdef SIGUSR2
+            if (signal == SIGUSR2) {
+                hot_restart();
+                return;
+            }
+#endif
+            std::cout << "Received signal " << signal << ", draining\n";
+            begin_drain("Server is shutting down.");
+            wait_for_signal();
+        });
+    }
+
+    /**
+     * @brief Starts a new server process on the same listening sockets, then drains this one.
+     *
+     * Both processes accept on the shared sockets for a moment, so no connection is refused.
+     * If the new process exits during that moment, this one keeps serving.
+     */
+    void hot_restart() {
+        if (cluster_) {
+            std::cerr << "Hot restart is not supported in cluster mode\n";
+            wait_for_signal();
+            return;
+        }
+
+        std::vector<chat::InheritedFd> fds;
+        for (auto& acceptor : acceptors_) {
+            fds.push_back({acceptor->native_handle(), "client"});
+        }
+        if (metrics_endpoint_) {
+            fds.push_back({metrics_endpoint_->native_handle(), "metrics"});
+        }
+
+        pid_t child = chat::spawn_with_listen_fds(restart_executable_, restart_command_, fds);
+        if (child < 0) {
+            std::cerr << "Hot restart failed: could not fork\n";
+            wait_for_signal();
+            return;
+        }
+        std::cout << "Started new server process " << child << "\n";
+
+        drain_timer_.expires_after(std::chrono::seconds(1));
+        drain_timer_.async_wait([this, child](const boost::system::error_code& error) {
+            if (error) {
+                return;
+            }
+            int status = 0;
+            if (waitpid(child, &status, WNOHANG) == child) {
+                std::cerr << "New server process exited during handover, still serving\n";
+                wait_for_signal();
+                return;
+            }
+            std::cout << "Handed over to process " << child << ", draining\n";
+            begin_drain("Server is restarting. Please reconnect.");
+            wait_for_signal();
+        });
+    }
+
+    /**
+     * @brief Stops accepting, then closes the sessions in batches spread over `drain_time_`.
+     *
+     * Every session is told why and finished gracefully: its write queue is flushed before
+     * the TLS shutdown. The server stops once all sessions are gone, or `kDrainGrace` after
+     * the window at the latest.
+     * @param notice The `SYSTEM` text sent to every client.
+     */
+    void begin_drain(const std::string& notice) {
+        draining_ = true;
+        for (auto& acceptor : acceptors_) {
+            asio::post(acceptor->get_executor(), [&acceptor]() {
+                boost::system::error_code ignored;
+                acceptor->close(ignored);
+            });
+        }
+
+        {
+            auto lock = lock_users();
+            for (const auto& user : user_connections_) {
+                user.second.for_each([&](const std::shared_ptr<chat::Session>& device) {
+                    send_system(device, notice);
+                    drain_queue_.push_back(device);
+                });
+            }
+        }
+
+        std::size_t ticks = std::max<std::size_t>(1, static_cast<std::size_t>(drain_time_ / kDrainTick));
+        drain_batch_ = std::max<std::size_t>(1, (drain_queue_.size() + ticks - 1) / ticks);
+        drain_deadline_ = std::chrono::steady_clock::now() + drain_time_ + kDrainGrace;
+        drain_step();
+    }
+
+    /**
+     * @brief Finishes the next batch of sessions and stops once the drain is complete.
+     */
+    void drain_step() {
+        for (std::size_t i = 0; i < drain_batch_ && !drain_queue_.empty(); ++i) {
+            if (auto session = drain_queue_.back().lock()) {
+                session->finish();
+            }
+            drain_queue_.pop_back();
+        }
+
+        bool sessions_left;
+        {
+            auto lock = lock_users();
+            sessions_left = !user_connections_.empty();
+        }
+        if ((drain_queue_.empty() && !sessions_left && metrics_.write_queue_depth.value() == 0) ||
+            std::chrono::steady_clock::now() >= drain_deadline_) {
+            std::cout << "Drain complete\n";
+            stop();
+            return;
+        }
+
+        drain_timer_.expires_after(kDrainTick);
+        drain_timer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                drain_step();
+            }
+        });
+    }
+
+    /**
+     * @brief Stops all I/O; `io_context_.run()` returns and the worker threads are joined on destruction.
+     */
+    void stop() {
+        io_context_.stop();
+        for (auto& context : worker_contexts_) {
+            context->stop();
+        }
+    }
+
     /**
      * @brief Accepts a new client connection.
+     * @param acceptor The acceptor to wait on; the connection lives on the acceptor's I/O context.
      *
      * Asynchronously waits for a new connection and initiates the SSL handshake.
      */
-    void accept_connection() {
-        auto socket = std::make_shared<tcp::socket>(io_context_);
+    void accept_connection(tcp::acceptor& acceptor) {
+        auto socket = std::make_shared<tcp::socket>(acceptor.get_executor());
 
-        acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code& error) {
+        acceptor.async_accept(*socket, [this, &acceptor, socket](const boost::system::error_code& error) {
             if (!error) {
-                std::cout << "New connection from " << socket->remote_endpoint().address().to_string() << "\n";
+                metrics_.connections.inc();
+                auto accepted_at = std::chrono::steady_clock::now();
+
+                if (!admit_connection(*socket, accepted_at)) {
+                    accept_connection(acceptor);
+                    return;
+                }
 
-                auto ssl_socket = std::make_shared<ssl::stream<tcp::socket>>(std::move(*socket), ssl_context_);
+                // The peer may already be gone; don't let remote_endpoint() throw out of the handler
+                boost::system::error_code endpoint_error;
+                auto endpoint = socket->remote_endpoint(endpoint_error);
+                std::cout << "New connection from " << (endpoint_error ? "unknown" : endpoint.address().to_string()) << "\n";
+
+                auto session = std::make_shared<chat::Session>(
+                    std::make_shared<chat::Session::Stream>(std::move(*socket), ssl_context_));
+                watch_idle(session, idle_timeout_ / 2);
+                session->limits().messages.configure(rate_limits_.messages_per_second, rate_limits_.message_burst);
+                session->limits().bytes.configure(rate_limits_.bytes_per_second, rate_limits_.byte_burst);
 
                 // Perform SSL handshake
-                ssl_socket->async_handshake(ssl::stream_base::server,
-                    [this, ssl_socket](const boost::system::error_code& error) {
+                metrics_.handshakes_in_flight.add(1);
+                session->stream().async_handshake(ssl::stream_base::server,
+                    [this, session, accepted_at](const boost::system::error_code& error) {
+                        metrics_.handshakes_in_flight.add(-1);
                         if (!error) {
+                            metrics_.handshakes.inc();
+                            metrics_.handshake_latency.observe(chat::micros_since(accepted_at));
+                            if (tracer_.sample()) {
+                                tracer_.record(tracer_.next_trace_id(), "tls_handshake", accepted_at, std::chrono::steady_clock::now());
+                            }
                             std::cout << "SSL handshake successful\n";
-                            handle_register(ssl_socket);
+                            handle_register(session);
                         } else {
+                            metrics_.handshake_failures.inc();
                             std::cerr << "SSL handshake failed: " << error.message() << "\n";
                         }
                     });
+            } else if (!acceptor.is_open()) {
+                return;   // Closed by a drain
             } else {
                 std::cerr << "Accept error: " << error.message() << "\n";
             }
 
             // Accept next connection
-            accept_connection();
+            accept_connection(acceptor);
         });
     }
 
+    /**
+     * @brief Checks a freshly accepted connection against the admission caps.
+     *
+     * Rejected connections are reset (linger 0) so they leave no TIME_WAIT behind, and
+     * counted by reason.
+     * @param socket The accepted socket.
+     * @param now When it was accepted.
+     * @return false if the connection was rejected and closed.
+     */
+    bool admit_connection(tcp::socket& socket, std::chrono::steady_clock::time_point now) {
+        chat::RejectReason reason;
+        if (max_connections_ > 0 && metrics_.active_sessions.value() >= max_connections_) {
+            reason = chat::RejectReason::MAX_CONNECTIONS;
+        } else if (max_handshakes_ > 0 && metrics_.handshakes_in_flight.value() >= max_handshakes_) {
+            reason = chat::RejectReason::MAX_HANDSHAKES;
+        } else if (!handshake_rate_.try_acquire(now)) {
+            reason = chat::RejectReason::HANDSHAKE_RATE;
+        } else {
+            return true;
+        }
+
+        metrics_.connections_rejected.inc(static_cast<std::size_t>(reason));
+        boost::system::error_code ignored;
+        socket.set_option(tcp::socket::linger(true, 0), ignored);
+        socket.close(ignored);
+        return false;
+    }
+
     /**
      * @brief Handles the registration process for a new client.
      *
-     * Reads the registration message from the client, checks for username availability,
-     * and adds the user to the list of connected users.
-     * @param ssl_socket The SSL socket of the newly connected client.
-     */
-    void handle_register(std::shared_ptr<ssl::stream<tcp::socket>> ssl_socket) {
-        auto buffer = std::make_shared<std::array<char, 1024>>();
-
-        asio::async_read(*ssl_socket, asio::buffer(*buffer),
-            asio::transfer_at_least(1),
-            [this, ssl_socket, buffer](const boost::system::error_code& error, std::size_t bytes_transferred) {
-                if (!error) {
-                    std::string message_str(buffer->data(), bytes_transferred);
-                    auto message = chat::Message::deserialize(message_str);
-
-                    if (message.type == chat::MessageType::REGISTER) {
-                        std::string username = message.sender;
-
-                        // Check if username is already taken
-                        std::lock_guard<std::mutex> lock(users_mutex_);
-                        if (user_connections_.find(username) != user_connections_.end()) {
-                            // Send error
-                            chat::Message response;
-                            response.type = chat::MessageType::SYSTEM;
-                            response.content = "Username already taken. Please reconnect and choose another name.";
-
-                            asio::async_write(*ssl_socket, asio::buffer(response.serialize()),
-                                [](const boost::system::error_code&, std::size_t) {});
-
-                            return;
-                        }
+     * Reads until the client's first frame is complete and, if it is a `REGISTER`,
+     * authenticates it when authentication is enabled before `complete_registration()`.
+     * @param session The session of the newly connected client.
+     */
+    void handle_register(std::shared_ptr<chat::Session> session) {
+        session->stream().async_read_some(asio::buffer(session->read_buffer()),
+            [this, session](const boost::system::error_code& error, std::size_t bytes_transferred) {
+                if (error) {
+                    if (error != asio::error::eof) {
+                        std::cerr << "Read error: " << error.message() << "\n";
+                    }
+                    return;
+                }
 
-                        // Register the new user
-                        user_connections_[username] = ssl_socket;
-                        std::cout << "User registered: " << username << "\n";
+                session->touch();
+                metrics_.bytes_in.inc(bytes_transferred);
+                session->reader().feed(session->read_buffer().data(), bytes_transferred);
 
-                        // Send confirmation and user list
-                        chat::Message response;
-                        response.type = chat::MessageType::LIST;
-                        response.content = "Welcome " + username + "! You are now registered.";
+                std::string frame;
+                try {
+                    if (!session->reader().next(frame)) {
+                        handle_register(session);   // The rest of the frame is still on its way
+                        return;
+                    }
+                } catch (const std::length_error&) {
+                    metrics_.deserialize_failures.inc();
+                    return;
+                }
 
-                        for (const auto& user : user_connections_) {
-                            response.users.push_back(user.first);
-                        }
+                chat::Message message;
+                if (!chat::Message::try_deserialize(frame, message)) {
+                    metrics_.deserialize_failures.inc();
+                    return;
+                }
 
-                        asio::async_write(*ssl_socket, asio::buffer(response.serialize()),
-                            [this, ssl_socket, username](const boost::system::error_code& error, std::size_t) {
-                                if (!error) {
-                                    // Start listening for messages from this user
-                                    listen_for_messages(ssl_socket, username);
+                if (message.type == chat::MessageType::REGISTER) {
+                    if (!auth_) {
+                        complete_registration(session, message, std::string());
+                        return;
+                    }
 
-                                    // Broadcast updated user list to all users
-                                    broadcast_user_list();
+                    // Hashing may run on an auth worker; registration continues on the session's thread
+                    auth_->authenticate(message.sender, message.password, message.token,
+                        [this, session, message](chat::AuthResult result) {
+                            asio::dispatch(session->stream().get_executor(), [this, session, message, result = std::move(result)]() {
+                                if (!result.ok) {
+                                    std::cout << "Authentication failed for " << message.sender << ": " << result.error << "\n";
+                                    send_system(session, "Authentication failed: " + result.error);
+                                    return;
                                 }
+                                complete_registration(session, message, result.token);
                             });
-                    }
-                } else if (error != asio::error::eof) {
-                    std::cerr << "Read error: " << error.message() << "\n";
+                        });
                 }
             });
     }
 
+    /**
+     * @brief Registers an authenticated session under its username and welcomes it.
+     *
+     * The first device adds the user to the list of connected users. Further devices
+     * are only added for authenticated sessions; without authentication a name already
+     * in use is refused, as it is when the user is logged in on another node.
+     * @param session The registering session.
+     * @param request Its `REGISTER` message.
+     * @param token Session token for the welcome, or empty without authentication.
+     */
+    void complete_registration(const std::shared_ptr<chat::Session>& session, const chat::Message& request,
+                               const std::string& token) {
+        const std::string& username = request.sender;
+
+        bool new_user = false;
+        {
+            // A user logged in on another node cannot add devices here
+            auto lock = lock_users();
+            if (cluster_ && cluster_->is_remote_user(username)) {
+                // Send error
+                send_system(session, "Username already taken. Please reconnect and choose another name.");
+                return;
+            }
+
+            // Without authentication anyone could claim a connected user's name and read their messages
+            auto it = user_connections_.find(username);
+            if (!auth_ && it != user_connections_.end()) {
+                send_system(session, "Username already taken. Please reconnect and choose another name.");
+                return;
+            }
+
+            // Register the new user, or another device of a connected one. An authenticated
+            // login may replace the published key, the latest device's winning; devices sharing
+            // a key file publish the same one. Without authentication the name's first key stays,
+            // so a later login under the name cannot swap in its own key.
+            session->set_username(username);
+            if (request.public_key.size() == chat::kPublicKeyHexLength) {
+                if (auth_) {
+                    public_keys_[username] = request.public_key;
+                } else {
+                    public_keys_.emplace(username, request.public_key);
+                }
+            }
+            if (it == user_connections_.end()) {
+                user_connections_.emplace(username, Devices(session));
+                rebuild_user_list();
+                new_user = true;
+                std::cout << "User registered: " << username << "\n";
+
+                if (cluster_) {
+                    cluster_->presence_changed(username, true);
+                }
+            } else {
+                it->second.add(session);
+                std::cout << "User " << username << " added device " << it->second.size() << "\n";
+            }
+        }
+
+        // Send confirmation; the user list itself follows in the broadcast.
+        // Both are queued in order on the session. The welcome carries the
+        // agreed version and features; echoing the codec as well tells
+        // version 1 clients they may compress from now on.
+        chat::FeatureSet features = chat::requested_features(request) & supported_features();
+        std::uint32_t version = chat::negotiate_version(request.version);
+        if (request.version == 0) {
+            metrics_.legacy_registrations.inc();
+        }
+        session->set_protocol(version, features);
+
+        chat::Message welcome;
+        welcome.type = chat::MessageType::SYSTEM;
+        welcome.content = "Welcome " + username + "! You are now registered.";
+        welcome.token = token;
+        if (version >= 2) {
+            welcome.version = version;
+            welcome.features = features.names();
+        }
+        if (features.has(chat::Feature::compression)) {
+            welcome.compression = chat::kCompressionCodec;
+        }
+        session->send(welcome.serialize());
+
+        // Handle anything sent right behind the registration, then keep listening
+        session->enable_heartbeat();
+        process_frames(session);
+
+        // Broadcast updated user list to all users; another device only needs it itself
+        if (new_user) {
+            broadcast_user_list();
+        } else {
+            auto snapshot = user_list_.current();
+            session->send(chat::Session::Payload(snapshot, session->compression_enabled() ? &snapshot->first_page_compressed
+                                                                                          : &snapshot->first_page));
+        }
+    }
+
     /**
      * @brief Listens for messages from a specific client.
-     * @param ssl_socket The SSL socket of the client.
-     * @param username The username of the client.
+     * @param session The session of the client.
      *
-     * Asynchronously reads messages from the client. Handles `LIST` requests by sending
-     * the current user list and `MESSAGE` requests by forwarding the message to the
-     * intended recipient. Also handles client disconnection.
-     */
-    void listen_for_messages(std::shared_ptr<ssl::stream<tcp::socket>> ssl_socket, const std::string& username) {
-        auto buffer = std::make_shared<std::array<char, 4096>>();
-
-        asio::async_read(*ssl_socket, asio::buffer(*buffer),
-            asio::transfer_at_least(1),
-            [this, ssl_socket, buffer, username](const boost::system::error_code& error, std::size_t bytes_transferred) {
-                if (!error) {
-                    std::string message_str(buffer->data(), bytes_transferred);
-                    auto message = chat::Message::deserialize(message_str);
-
-                    if (message.type == chat::MessageType::LIST) {
-                        // Send updated user list
-                        chat::Message response;
-                        response.type = chat::MessageType::LIST;
-
-                        std::lock_guard<std::mutex> lock(users_mutex_);
-                        for (const auto& user : user_connections_) {
-                            response.users.push_back(user.first);
-                        }
+     * Reads whatever the client sent, hands every complete frame to `process_frames()`
+     * and cleans up when the client disconnects.
+     */
+    void listen_for_messages(std::shared_ptr<chat::Session> session) {
+        session->stream().async_read_some(asio::buffer(session->read_buffer()),
+            [this, session](const boost::system::error_code& error, std::size_t bytes_transferred) {
+                if (error) {
+                    // Client disconnected or error
+                    std::cout << "User " << session->username() << " disconnected: " << error.message() << "\n";
+                    end_session(session);
+                    return;
+                }
 
-                        asio::async_write(*ssl_socket, asio::buffer(response.serialize()),
-                            [this, ssl_socket, username](const boost::system::error_code& error, std::size_t) {
-                                if (!error) {
-                                    // Continue listening
-                                    listen_for_messages(ssl_socket, username);
-                                }
-                            });
+                session->touch();
+                metrics_.bytes_in.inc(bytes_transferred);
+                session->reader().feed(session->read_buffer().data(), bytes_transferred);
+                process_frames(session);
+            });
+    }
+
+    /**
+     * @brief Handles every complete frame received from a session, then reads on.
+     *
+     * A single read may carry several frames or only part of one; the reader keeps
+     * the remainder for the next read. A frame over `kMaxClientFrameSize` closes the
+     * connection, since the stream can't be resynchronised after it. Compressed frames
+     * are restored first; they are only accepted from clients that negotiated them.
+     * @param session The session of the client.
+     */
+    void process_frames(const std::shared_ptr<chat::Session>& session) {
+        auto received_at = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration throttle{};
+        std::string frame;
+        try {
+            while (session->reader().next(frame)) {
+                if (chat::is_compressed_frame(frame) &&
+                    (!session->compression_enabled() || !chat::decompress_frame(frame, chat::kMaxClientFrameSize))) {
+                    metrics_.deserialize_failures.inc();
+                    continue;
+                }
+                if (chat::is_data_frame(frame)) {
+                    handle_file_data(session, std::move(frame), received_at, throttle);
+                } else {
+                    handle_message(session, frame, received_at, throttle);
+                }
+            }
+        } catch (const std::length_error&) {
+            std::cerr << "Oversized frame from " << session->username() << ", closing connection\n";
+            metrics_.deserialize_failures.inc();
+            session->close();
+        }
+
+        // Continue listening for more messages from this user
+        resume_reading(session, throttle);
+    }
+
+    /**
+     * @brief Handles one message frame from a registered client.
+     *
+     * Handles `LIST` requests by sending the requested page of the current user list,
+     * `MESSAGE` requests by forwarding the message to the intended recipient or room,
+     * `BATCH` frames by relaying each of their messages, the `ROOM_*` requests by updating room membership and the `FILE_*` requests by
+     * relaying them between the parties of a transfer.
+     * @param session The session of the client.
+     * @param frame The frame payload.
+     * @param received_at When the frame was read.
+     * @param throttle Raised to the time to wait before the next read (delay policy).
+     */
+    void handle_message(const std::shared_ptr<chat::Session>& session, const std::string& frame,
+                        std::chrono::steady_clock::time_point received_at, std::chrono::steady_clock::duration& throttle) {
+        const std::string& username = session->username();
+        chat::Message message;
+        if (!chat::Message::try_deserialize(frame, message)) {
+            metrics_.deserialize_failures.inc();
+            return;
+        }
+        auto parsed_at = std::chrono::steady_clock::now();
+
+        // Heartbeats are exempt so a throttled client isn't also timed out; a batch costs one message per entry
+        if (message.type != chat::MessageType::PING && message.type != chat::MessageType::PONG &&
+            !admit(session, frame.size(), received_at, throttle, std::max<std::size_t>(message.batch.size(), 1))) {
+            return;
+        }
+
+        if (message.type == chat::MessageType::LIST) {
+            // Answer from the cached snapshot; no lock needed
+            auto snapshot = user_list_.current();
+
+            // A bare LIST gets the full pre-encoded list, a query gets one page
+            if (message.limit == 0 && message.prefix.empty()) {
+                session->send(chat::Session::Payload(snapshot, session->compression_enabled() ? &snapshot->serialized_compressed()
+                                                                                              : &snapshot->serialized));
+            } else {
+                session->send(snapshot->page(message.prefix, message.offset, message.limit).serialize());
+            }
+        }
+        else if (message.type == chat::MessageType::MESSAGE) {
+            std::cout << "Message from " << username << " to " << message.recipient << " (" << message.content.size()
+                      << " bytes)\n";
+
+            accept_message(message, username, received_at, parsed_at);
+            if (chat::is_room_name(message.recipient)) {
+                relay_to_room(session, message);
+            } else {
+                record_history(message, message.recipient, known_user(message.recipient));
+
+                // Forward the message to the recipient, locally or on another node
+                auto lock_requested_at = std::chrono::steady_clock::now();
+                auto lock = lock_users();
+                if (message.trace_id != 0) {
+                    tracer_.record(message.trace_id, "lock", lock_requested_at, std::chrono::steady_clock::now());
+                }
+                auto it = user_connections_.find(message.recipient);
+
+                std::string serialized;
+                if (it != user_connections_.end()) {
+                    if (message.trace_id != 0) {
+                        message.t_server_enqueue = unix_micros();
+                        tracer_.record(message.trace_id, "relay", received_at, std::chrono::steady_clock::now());
                     }
-                    else if (message.type == chat::MessageType::MESSAGE) {
-                        std::cout << "Message from " << username << " to " << message.recipient << ": " << message.content << "\n";
-
-                        // Forward the message to the recipient
-                        std::lock_guard<std::mutex> lock(users_mutex_);
-                        auto it = user_connections_.find(message.recipient);
-
-                        if (it != user_connections_.end()) {
-                            asio::async_write(*(it->second), asio::buffer(message.serialize()),
-                                [](const boost::system::error_code& error, std::size_t) {
-                                    if (error) {
-                                        std::cerr << "Failed to deliver message: " << error.message() << "\n";
-                                    }
-                                });
-                        }
+                    serialized = message.serialize();
+                    metrics_.messages_relayed.inc(send_to_devices(it->second, serialized, message.trace_id, session));
+                } else if (cluster_) {
+                    cluster_->route(message);
+                }
 
-                        // Continue listening for more messages from this user
-                        listen_for_messages(ssl_socket, username);
+                // The sender's other devices show what was sent from this one
+                auto own = user_connections_.find(username);
+                if (message.recipient != username && own != user_connections_.end() && own->second.size() > 1) {
+                    if (serialized.empty()) {
+                        serialized = message.serialize();
                     }
+                    send_to_devices(own->second, serialized, 0, session);
                 }
-                else {
-                    // Client disconnected or error
-                    std::cout << "User " << username << " disconnected: " << error.message() << "\n";
+            }
+        }
+        else if (message.type == chat::MessageType::BATCH) {
+            relay_batch(session, message, received_at, parsed_at);
+        }
+        else if (message.type == chat::MessageType::ROOM_CREATE ||
+                 message.type == chat::MessageType::ROOM_JOIN ||
+                 message.type == chat::MessageType::ROOM_LEAVE) {
+            handle_room_request(session, message);
+        }
+        else if (message.type == chat::MessageType::FILE_OFFER ||
+                 message.type == chat::MessageType::FILE_ACCEPT ||
+                 message.type == chat::MessageType::FILE_ACK ||
+                 message.type == chat::MessageType::FILE_CANCEL) {
+            handle_file_request(session, std::move(message));
+        }
+        else if (message.type == chat::MessageType::HISTORY) {
+            handle_history_request(session, message);
+        }
+        else if (message.type == chat::MessageType::KEY) {
+            chat::Message reply;
+            reply.type = chat::MessageType::KEY;
+            reply.sender = message.recipient;
+            bool local = false;
+            {
+                auto lock = lock_users();
+                auto it = public_keys_.find(message.recipient);
+                if (it != public_keys_.end()) {
+                    reply.public_key = it->second;
+                }
+                local = it != public_keys_.end() || user_connections_.count(message.recipient) != 0;
+            }
+
+            // A user on another node published their key there; that node answers
+            if (!local && cluster_) {
+                chat::Message request;
+                request.type = chat::MessageType::KEY;
+                request.sender = username;
+                request.recipient = message.recipient;
+                if (cluster_->request_key(std::move(request))) {
+                    return;
+                }
+            }
+            session->send(reply.serialize());
+        }
+        else if (message.type == chat::MessageType::PING) {
+            chat::Message pong;
+            pong.type = chat::MessageType::PONG;
+            session->send(pong.serialize());
+        }
+        // PONG needs no handling: any read already counts as activity
+    }
+
+    /**
+     * @brief Prepares a received `MESSAGE` for relaying.
+     *
+     * Never trusts the client-supplied sender or timestamp, and starts a trace for
+     * messages the client asked to trace plus a sample of the rest.
+     * @param message The message; updated in place.
+     * @param username The sending user.
+     * @param received_at When its frame was read.
+     * @param parsed_at When its frame was parsed.
+     */
+    void accept_message(chat::Message& message, const std::string& username,
+                        std::chrono::steady_clock::time_point received_at, std::chrono::steady_clock::time_point parsed_at) {
+        message.sender = username;
+        message.timestamp = 0;
+
+        if (message.trace_id != 0 || tracer_.sample()) {
+            if (message.trace_id == 0) {
+                message.trace_id = tracer_.next_trace_id();
+            }
+            message.t_server_recv = unix_micros() - chat::micros_since(received_at);
+            tracer_.record(message.trace_id, "parse", received_at, parsed_at);
+        }
+    }
+
+    /**
+     * @brief Relays the messages of a `BATCH` frame in one pass.
+     *
+     * Each entry is handled as a `MESSAGE` would be; entries of other types are skipped.
+     * Direct messages are grouped by recipient first, so `users_mutex_` is taken once for
+     * the whole batch and every receiving device gets all of its messages framed back to
+     * back in one payload: one write instead of one per message. Room messages and users
+     * on other nodes are relayed one by one. Frames from sessions that did not negotiate
+     * `Feature::batch`, or with more than `kMaxBatchSize` entries, are dropped.
+     * @param session The sending session.
+     * @param batch The `BATCH` message; its entries are consumed.
+     * @param received_at When the frame was read.
+     * @param parsed_at When the frame was parsed.
+     */
+    void relay_batch(const std::shared_ptr<chat::Session>& session, chat::Message& batch,
+                     std::chrono::steady_clock::time_point received_at, std::chrono::steady_clock::time_point parsed_at) {
+        const std::string& username = session->username();
+        if (!session->features().has(chat::Feature::batch) || batch.batch.size() > chat::kMaxBatchSize) {
+            metrics_.deserialize_failures.inc();
+            return;
+        }
+        metrics_.batches_received.inc();
+        std::cout << "Batch from " << username << " (" << batch.batch.size() << " messages)\n";
 
-                    {
-                        std::lock_guard<std::mutex> lock(users_mutex_);
-                        user_connections_.erase(username);
+        // Direct messages by recipient, recipients in order of first appearance
+        std::vector<std::pair<std::string, std::vector<chat::Message*>>> groups;
+        std::map<std::string, std::size_t> group_of;
+        for (auto& message : batch.batch) {
+            if (message.type != chat::MessageType::MESSAGE) {
+                continue;
+            }
+            accept_message(message, username, received_at, parsed_at);
+            if (chat::is_room_name(message.recipient)) {
+                relay_to_room(session, std::move(message));
+                continue;
+            }
+            record_history(message, message.recipient, known_user(message.recipient));
+            auto inserted = group_of.emplace(message.recipient, groups.size());
+            if (inserted.second) {
+                groups.emplace_back(message.recipient, std::vector<chat::Message*>());
+            }
+            groups[inserted.first->second].second.push_back(&message);
+        }
+        if (groups.empty()) {
+            return;
+        }
+
+        auto lock_requested_at = std::chrono::steady_clock::now();
+        auto lock = lock_users();
+        auto locked_at = std::chrono::steady_clock::now();
+
+        // The sender's other devices get everything sent to others, in one payload as well
+        std::vector<std::string> own_copies;
+        for (const auto& group : groups) {
+            auto it = user_connections_.find(group.first);
+            std::vector<std::string> serialized;
+            std::uint64_t trace_id = 0;
+            if (it != user_connections_.end()) {
+                for (chat::Message* message : group.second) {
+                    if (message->trace_id != 0) {
+                        tracer_.record(message->trace_id, "lock", lock_requested_at, locked_at);
+                        message->t_server_enqueue = unix_micros();
+                        tracer_.record(message->trace_id, "relay", received_at, std::chrono::steady_clock::now());
+                        if (trace_id == 0) {
+                            trace_id = message->trace_id;
+                        }
                     }
+                    serialized.push_back(message->serialize());
+                }
+                std::size_t devices = send_to_devices(it->second, serialized, trace_id, session);
+                metrics_.messages_relayed.inc(devices * serialized.size());
+            } else if (cluster_) {
+                for (chat::Message* message : group.second) {
+                    cluster_->route(*message);
+                }
+            }
 
-                    // Broadcast updated user list
-                    broadcast_user_list();
+            if (group.first == username) {
+                continue;
+            }
+            if (serialized.empty()) {
+                for (chat::Message* message : group.second) {
+                    own_copies.push_back(message->serialize());
                 }
-            });
+            } else {
+                own_copies.insert(own_copies.end(), std::make_move_iterator(serialized.begin()),
+                                  std::make_move_iterator(serialized.end()));
+            }
+        }
+
+        auto own = user_connections_.find(username);
+        if (!own_copies.empty() && own != user_connections_.end() && own->second.size() > 1) {
+            send_to_devices(own->second, own_copies, 0, session);
+        }
     }
 
     /**
-     * @brief Broadcasts the updated user list to all connected clients.
+     * @brief Removes a disconnected session from the users, rooms and transfers it took part in.
+     * @param session The disconnected session.
+     */
+    void end_session(const std::shared_ptr<chat::Session>& session) {
+        const std::string& username = session->username();
+        leave_all_rooms(session);
+
+        std::vector<std::pair<std::uint64_t, std::shared_ptr<chat::Session>>> ended;
+        {
+            std::lock_guard<std::mutex> lock(transfers_mutex_);
+            ended = transfers_.drop(session);
+        }
+        for (const auto& transfer : ended) {
+            send_file_cancel(transfer.second, transfer.first, username + " disconnected.");
+        }
+
+        // The user leaves the list with their last device
+        bool user_left = false;
+        {
+            auto lock = lock_users();
+            auto it = user_connections_.find(username);
+            if (it != user_connections_.end() && it->second.remove(session) && it->second.empty()) {
+                user_connections_.erase(it);
+                rebuild_user_list();
+                user_left = true;
+
+                if (cluster_) {
+                    cluster_->presence_changed(username, false);
+                }
+            }
+        }
+
+        // Broadcast updated user list
+        if (user_left) {
+            broadcast_user_list();
+        }
+    }
+
+    /**
+     * @brief Applies the session and global rate limits to one received frame.
      *
-     * Creates a `LIST` message containing all currently registered usernames and sends it
-     * to every connected client.
+     * With the reject policy an over-limit frame is dropped and the sender is told once per
+     * run of rejections; with the delay policy every frame is processed and `throttle` says
+     * how long to stop reading from the sender, which pushes back through TCP flow control.
+     * Costs are capped at each bucket's burst, so no frame is too big to ever be admitted.
+     * @param session The sending session.
+     * @param bytes Size of the frame.
+     * @param now When the frame was read.
+     * @param throttle Raised to the time to wait before the next read (delay policy).
+     * @param messages Messages the frame carries.
+     * @return false if the frame must be dropped.
      */
-    void broadcast_user_list() {
-        chat::Message user_list;
-        user_list.type = chat::MessageType::LIST;
-        user_list.sender = "SERVER";
+    bool admit(const std::shared_ptr<chat::Session>& session, std::size_t bytes,
+               std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration& throttle,
+               std::size_t messages = 1) {
+        chat::SessionLimits& limits = session->limits();
+        double message_cost = limits.messages.cap(static_cast<double>(messages));
+        double byte_cost = limits.bytes.cap(static_cast<double>(bytes));
+        double global_cost = global_messages_.cap(static_cast<double>(messages));
 
+        if (rate_limits_.policy == chat::RateLimitPolicy::REJECT) {
+            // Charge nothing unless every bucket conforms; the session's own buckets are
+            // only used from its read handler, so checking them first cannot race
+            if (limits.messages.conforms(now, message_cost) && limits.bytes.conforms(now, byte_cost) &&
+                global_messages_.try_acquire(now, global_cost)) {
+                limits.messages.try_acquire(now, message_cost);
+                limits.bytes.try_acquire(now, byte_cost);
+                limits.notified = false;
+                return true;
+            }
+            metrics_.rate_limit_rejected.inc();
+            if (!limits.notified) {
+                limits.notified = true;
+                send_system(session, "Rate limit exceeded; messages are being dropped.");
+            }
+            return false;
+        }
+
+        throttle = std::max({throttle, limits.messages.acquire(now, message_cost), limits.bytes.acquire(now, byte_cost),
+                             global_messages_.acquire(now, global_cost)});
+        if (throttle != throttle.zero()) {
+            metrics_.rate_limit_delayed.inc();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads from the session again, after `delay` if it is throttled.
+     */
+    void resume_reading(const std::shared_ptr<chat::Session>& session, std::chrono::steady_clock::duration delay) {
+        if (delay == delay.zero()) {
+            listen_for_messages(session);
+            return;
+        }
+        auto timer = std::make_shared<asio::steady_timer>(session->stream().get_executor(), delay);
+        timer->async_wait([this, session, timer](const boost::system::error_code&) {
+            listen_for_messages(session);
+        });
+    }
+
+    /**
+     * @brief Handles `ROOM_CREATE`, `ROOM_JOIN` and `ROOM_LEAVE` requests.
+     * @param session The requesting session.
+     * @param request The request; `recipient` names the room.
+     *
+     * Replies with a `SYSTEM` message describing the outcome.
+     */
+    void handle_room_request(const std::shared_ptr<chat::Session>& session, const chat::Message& request) {
+        const std::string& room = request.recipient;
+        if (!chat::is_room_name(room)) {
+            send_system(session, "Room names must start with '#'.");
+            return;
+        }
+
+        std::string reply;
         {
-            std::lock_guard<std::mutex> lock(users_mutex_);
-            for (const auto& user : user_connections_) {
-                user_list.users.push_back(user.first);
+            std::lock_guard<std::mutex> lock(rooms_mutex_);
+            auto& joined = session->rooms();
+            bool is_member = std::find(joined.begin(), joined.end(), room) != joined.end();
+
+            if (request.type == chat::MessageType::ROOM_CREATE) {
+                if (rooms_.create(room, session)) {
+                    joined.push_back(room);
+                    reply = "Created room " + room + ".";
+                } else {
+                    reply = "Room " + room + " already exists.";
+                }
+            }
+            else if (request.type == chat::MessageType::ROOM_JOIN) {
+                if (is_member) {
+                    reply = "Already in room " + room + ".";
+                } else if (rooms_.join(room, session)) {
+                    joined.push_back(room);
+                    reply = "Joined room " + room + ".";
+                } else {
+                    reply = "Room " + room + " does not exist.";
+                }
+            }
+            else {
+                if (is_member && rooms_.leave(room, session)) {
+                    joined.erase(std::find(joined.begin(), joined.end(), room));
+                    reply = "Left room " + room + ".";
+                } else {
+                    reply = "Not in room " + room + ".";
+                }
             }
         }
 
-        std::string serialized = user_list.serialize();
+        send_system(session, reply);
+    }
 
-        std::lock_guard<std::mutex> lock(users_mutex_);
-        for (const auto& user : user_connections_) {
-            asio::async_write(*(user.second), asio::buffer(serialized),
-                [username = user.first](const boost::system::error_code& error, std::size_t) {
-                    if (error) {
-                        std::cerr << "Failed to send user list to " << username << ": " << error.message() << "\n";
-                    }
+    /**
+     * @brief Handles a `HISTORY` request by streaming one page of a conversation.
+     *
+     * Users can read their direct conversations and the rooms they are in. The page is
+     * sent as one `HISTORY` message per stored message, oldest first, followed by one
+     * with an empty `sender` whose `total` is the page size; the client asks for the
+     * next older page with `before` set to the oldest timestamp it got. A page the user
+     * may not read, or any page when history is disabled, is just the end message.
+     * @param session The requesting session.
+     * @param request The request; `recipient` names the peer or room.
+     */
+    void handle_history_request(const std::shared_ptr<chat::Session>& session, const chat::Message& request) {
+        const std::string& peer = request.recipient;
+        bool allowed = history_ && !peer.empty();
+        if (allowed && chat::is_room_name(peer)) {
+            std::lock_guard<std::mutex> lock(rooms_mutex_);
+            const auto& joined = session->rooms();
+            allowed = std::find(joined.begin(), joined.end(), peer) != joined.end();
+        }
+
+        std::vector<chat::HistoryRecord> records;
+        if (allowed) {
+            std::uint32_t limit = std::min(request.limit == 0 ? chat::kDefaultHistoryPageSize : request.limit,
+                                           chat::kMaxHistoryPageSize);
+            auto started = std::chrono::steady_clock::now();
+            records = history_->read(chat::HistoryStore::conversation(session->username(), peer), request.before,
+                                     request.after, limit);
+            metrics_.history_read_latency.observe(chat::micros_since(started));
+        }
+
+        chat::Message reply;
+        reply.type = chat::MessageType::HISTORY;
+        reply.recipient = peer;
+        for (auto& record : records) {
+            reply.sender = std::move(record.sender);
+            reply.content = std::move(record.content);
+            reply.timestamp = record.timestamp;
+            session->send(reply.serialize());
+        }
+        reply.sender.clear();
+        reply.content.clear();
+        reply.timestamp = 0;
+        reply.total = static_cast<std::uint32_t>(records.size());
+        session->send(reply.serialize());
+    }
+
+    /**
+     * @brief Appends a message to the history of its conversation and stamps it with the stored time.
+     *
+     * Does nothing when history is disabled. A message that already carries a timestamp,
+     * such as one relayed by another node, keeps it unless the log needs a later one.
+     * A conversation's log is only started for a known recipient, so messages to
+     * made-up names cannot fill the disk or the descriptor table with logs.
+     * @param message The message; `sender` must be set.
+     * @param peer The recipient or room.
+     * @param known Whether `peer` is a known user or a room the sender is in.
+     */
+    void record_history(chat::Message& message, const std::string& peer, bool known) {
+        if (!history_) {
+            return;
+        }
+        message.timestamp = history_->append(chat::HistoryStore::conversation(message.sender, peer), message.sender,
+                                             message.content, message.timestamp != 0 ? message.timestamp : unix_micros(),
+                                             known);
+        if (message.timestamp != 0) {
+            metrics_.history_appended.inc();
+        }
+    }
+
+    /**
+     * @brief Returns whether a username belongs to an account, a connected user or a user on another node.
+     *
+     * Takes the users lock; call without holding it.
+     */
+    bool known_user(const std::string& username) {
+        if (auth_ && auth_->has_account(username)) {
+            return true;
+        }
+        if (cluster_ && cluster_->is_remote_user(username)) {
+            return true;
+        }
+        auto lock = lock_users();
+        return user_connections_.count(username) != 0;
+    }
+
+    /**
+     * @brief Handles `FILE_OFFER`, `FILE_ACCEPT`, `FILE_ACK` and `FILE_CANCEL` requests.
+     *
+     * Each is forwarded to the other party of the transfer once `transfers_` agrees the
+     * sender may make it; anything else is dropped. Offers can only be made to users
+     * connected to this server, since DATA frames are not routed between nodes.
+     * @param session The requesting session.
+     * @param request The request; `transfer_id` names the transfer.
+     */
+    void handle_file_request(const std::shared_ptr<chat::Session>& session, chat::Message request) {
+        request.sender = session->username();
+        std::optional<std::shared_ptr<chat::Session>> peer;
+
+        if (request.type == chat::MessageType::FILE_OFFER) {
+            std::shared_ptr<chat::Session> recipient;
+            {
+                auto lock = lock_users();
+                auto it = user_connections_.find(request.recipient);
+                if (it != user_connections_.end()) {
+                    recipient = it->second.latest();   // The device the user logged in with last
+                }
+            }
+
+            bool offered = false;
+            if (recipient && recipient != session && request.transfer_id != 0) {
+                std::lock_guard<std::mutex> lock(transfers_mutex_);
+                offered = transfers_.offer(request.transfer_id, session, recipient, request.file_size);
+            }
+            if (!offered) {
+                send_file_cancel(session, request.transfer_id,
+                                 "Cannot send a file to " + request.recipient + ": not connected to this server.");
+                return;
+            }
+            peer = recipient;
+        } else {
+            std::lock_guard<std::mutex> lock(transfers_mutex_);
+            if (request.type == chat::MessageType::FILE_ACCEPT) {
+                request.window = std::min(request.window == 0 ? chat::kDefaultFileWindow : request.window, chat::kMaxFileWindow);
+                peer = transfers_.accept(request.transfer_id, session, request.window);
+            } else if (request.type == chat::MessageType::FILE_ACK) {
+                peer = transfers_.ack(request.transfer_id, session, request.file_offset);
+            } else {
+                peer = transfers_.cancel(request.transfer_id, session);
+            }
+        }
+
+        if (peer) {
+            (*peer)->send(request.serialize());
+        }
+    }
+
+    /**
+     * @brief Relays one DATA frame to the receiver of its transfer.
+     *
+     * Chunks are never dropped by the rate limits, since that would corrupt the file;
+     * they only count against the byte limit, which slows the sender down. A chunk the
+     * transfer table refuses, such as one beyond the granted window, aborts the transfer.
+     * @param session The sending session.
+     * @param frame The DATA frame payload.
+     * @param received_at When the frame was read.
+     * @param throttle Raised to the time to wait before the next read.
+     */
+    void handle_file_data(const std::shared_ptr<chat::Session>& session, std::string frame,
+                          std::chrono::steady_clock::time_point received_at, std::chrono::steady_clock::duration& throttle) {
+        std::uint64_t transfer_id = 0;
+        if (!chat::parse_data_frame(frame, transfer_id)) {
+            metrics_.deserialize_failures.inc();
+            return;
+        }
+        throttle = std::max(throttle, session->limits().bytes.acquire(received_at, static_cast<double>(frame.size())));
+
+        std::size_t bytes = frame.size() - chat::kDataHeaderSize;
+        std::optional<std::shared_ptr<chat::Session>> recipient;
+        std::optional<std::shared_ptr<chat::Session>> aborted;
+        {
+            std::lock_guard<std::mutex> lock(transfers_mutex_);
+            recipient = transfers_.data(transfer_id, session, bytes);
+            if (!recipient) {
+                // Unknown ids are chunks that were in flight when the transfer was cancelled
+                aborted = transfers_.cancel(transfer_id, session);
+            }
+        }
+
+        if (recipient) {
+            // Chunks are relayed as they are; file contents rarely compress further
+            (*recipient)->send(std::make_shared<const std::string>(chat::encode_frame(frame)));
+            metrics_.file_bytes_relayed.inc(bytes);
+        } else if (aborted) {
+            std::string reason = "File transfer aborted: " + session->username() + " sent outside the window.";
+            send_file_cancel(session, transfer_id, reason);
+            send_file_cancel(*aborted, transfer_id, reason);
+        }
+    }
+
+    /**
+     * @brief Queues a `FILE_CANCEL` for one party of a transfer.
+     * @param session The receiving session.
+     * @param transfer_id The cancelled transfer.
+     * @param reason Why it was cancelled.
+     */
+    void send_file_cancel(const std::shared_ptr<chat::Session>& session, std::uint64_t transfer_id, const std::string& reason) {
+        chat::Message cancel;
+        cancel.type = chat::MessageType::FILE_CANCEL;
+        cancel.transfer_id = transfer_id;
+        cancel.content = reason;
+        session->send(cancel.serialize());
+    }
+
+    /**
+     * @brief Fans a message out to every other member of a room.
+     * @param session The sending session; must be a member of the room.
+     * @param message The message whose `recipient` names the room.
+     *
+     * The message is stored in the room's history, then encoded once and the same buffer
+     * is queued on every member, with a second, compressed buffer for members that
+     * negotiated compression. The history is written outside `rooms_mutex_`, so no
+     * room's fan-out waits on the disk.
+     */
+    void relay_to_room(const std::shared_ptr<chat::Session>& session, chat::Message message) {
+        if (message.trace_id != 0) {
+            message.t_server_enqueue = unix_micros();
+        }
+        chat::Session::Payload plain;
+        chat::Session::Payload compressed;
+
+        {
+            std::lock_guard<std::mutex> lock(rooms_mutex_);
+            const auto& joined = session->rooms();
+            if (std::find(joined.begin(), joined.end(), message.recipient) == joined.end()) {
+                return;
+            }
+        }
+        record_history(message, message.recipient, true);
+        std::string serialized = message.serialize();
+
+        // Members may have come or gone meanwhile; deliver to those in the room now
+        std::lock_guard<std::mutex> lock(rooms_mutex_);
+        const auto* members = rooms_.members(message.recipient);
+        if (members == nullptr) {
+            return;
+        }
+        for (const auto& member : *members) {
+            if (member != session) {
+                bool compress = member->compression_enabled();
+                auto& payload = compress ? compressed : plain;
+                if (!payload) {
+                    payload = std::make_shared<const std::string>(chat::encode_message_frame(serialized, compress));
+                }
+                member->send(payload, message.trace_id);
+            }
+        }
+        metrics_.messages_relayed.inc(members->size() - 1);
+    }
+
+    /**
+     * @brief Removes a disconnecting session from every room it joined.
+     * @param session The disconnecting session.
+     */
+    void leave_all_rooms(const std::shared_ptr<chat::Session>& session) {
+        std::lock_guard<std::mutex> lock(rooms_mutex_);
+        for (const auto& room : session->rooms()) {
+            rooms_.leave(room, session);
+        }
+        session->rooms().clear();
+    }
+
+    /**
+     * @brief Schedules the next idle check of a session.
+     * @param session The session to check.
+     * @param delay Time until the check; rounded up to whole wheel ticks.
+     */
+    void watch_idle(const std::shared_ptr<chat::Session>& session, std::chrono::steady_clock::duration delay) {
+        if (idle_timeout_ == idle_timeout_.zero()) {
+            return;
+        }
+        auto ticks = (delay + kIdleTick - std::chrono::nanoseconds(1)) / kIdleTick;
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_wheel_.schedule(static_cast<std::uint64_t>(std::max<decltype(ticks)>(ticks, 1)), session);
+    }
+
+    /**
+     * @brief Arms `idle_timer_` for the next wheel tick.
+     */
+    void schedule_idle_tick() {
+        std::uint64_t next_tick;
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            next_tick = idle_wheel_.now() + 1;
+        }
+        idle_timer_.expires_at(idle_epoch_ + next_tick * kIdleTick);
+        idle_timer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                check_idle_sessions();
+                schedule_idle_tick();
+            }
+        });
+    }
+
+    /**
+     * @brief Advances the idle wheel to the current time and checks the sessions that came due.
+     *
+     * Sessions are not rescheduled on every read: a read only stamps the session, and a
+     * check that finds recent activity re-arms itself for the remaining time. A session
+     * silent for half the timeout gets a PING; one silent for the whole timeout is closed,
+     * which fails its pending read and runs the usual disconnect cleanup.
+     */
+    void check_idle_sessions() {
+        std::vector<std::weak_ptr<chat::Session>> due;
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            auto target = static_cast<std::uint64_t>((std::chrono::steady_clock::now() - idle_epoch_) / kIdleTick);
+            if (target > idle_wheel_.now()) {
+                idle_wheel_.advance(target - idle_wheel_.now(), [&due](std::weak_ptr<chat::Session>&& session) {
+                    due.push_back(std::move(session));
                 });
+            }
+        }
+
+        auto ping_after = idle_timeout_ / 2;
+        for (const auto& weak : due) {
+            auto session = weak.lock();
+            if (!session) {
+                continue;
+            }
+
+            auto idle = session->idle_for();
+            if (idle >= idle_timeout_) {
+                std::cout << "Closing idle connection\n";
+                metrics_.idle_timeouts.inc();
+                session->close();
+            } else if (!session->heartbeat_enabled()) {
+                watch_idle(session, idle_timeout_ - idle);
+            } else if (idle >= ping_after) {
+                chat::Message ping;
+                ping.type = chat::MessageType::PING;
+                session->send(ping.serialize());
+                metrics_.heartbeats_sent.inc();
+                watch_idle(session, idle_timeout_ - idle);
+            } else {
+                watch_idle(session, ping_after - idle);
+            }
+        }
+    }
+
+    /**
+     * @brief Queues a `SYSTEM` message for one session.
+     * @param session The receiving session.
+     * @param text The notification text.
+     */
+    void send_system(const std::shared_ptr<chat::Session>& session, const std::string& text) {
+        chat::Message response;
+        response.type = chat::MessageType::SYSTEM;
+        response.content = text;
+        session->send(response.serialize());
+    }
+
+    /**
+     * @brief Queues an encoded message on every device of a user, except one.
+     *
+     * A single device gets the message framed for it, as before multiple devices. Several
+     * share one framed buffer per codec, the way room members do.
+     * @param devices The user's sessions. Caller holds `users_mutex_`.
+     * @param serialized The encoded message.
+     * @param trace_id Non-zero to trace the deliveries.
+     * @param except A session to leave out, such as the sending device.
+     * @return The number of sessions it was queued on.
+     */
+    std::size_t send_to_devices(const Devices& devices, const std::string& serialized, std::uint64_t trace_id,
+                                const std::shared_ptr<chat::Session>& except = nullptr) {
+        if (devices.size() == 1) {
+            if (devices.latest() == except) {
+                return 0;
+            }
+            devices.latest()->send(serialized, trace_id);
+            return 1;
+        }
+
+        chat::Session::Payload plain;
+        chat::Session::Payload compressed;
+        std::size_t sent = 0;
+        devices.for_each([&](const std::shared_ptr<chat::Session>& device) {
+            if (device == except) {
+                return;
+            }
+            bool compress = device->compression_enabled();
+            auto& payload = compress ? compressed : plain;
+            if (!payload) {
+                payload = std::make_shared<const std::string>(chat::encode_message_frame(serialized, compress));
+            }
+            device->send(payload, trace_id);
+            ++sent;
+        });
+        return sent;
+    }
+
+    /**
+     * @brief Queues several encoded messages on every device of a user, except one.
+     *
+     * Each device gets all of them framed back to back in one payload, shared per codec.
+     * @param devices The user's sessions. Caller holds `users_mutex_`.
+     * @param serialized The encoded messages, in order.
+     * @param trace_id Non-zero to trace the deliveries.
+     * @param except A session to leave out, such as the sending device.
+     * @return The number of sessions they were queued on.
+     */
+    std::size_t send_to_devices(const Devices& devices, const std::vector<std::string>& serialized, std::uint64_t trace_id,
+                                const std::shared_ptr<chat::Session>& except = nullptr) {
+        chat::Session::Payload plain;
+        chat::Session::Payload compressed;
+        std::size_t sent = 0;
+        devices.for_each([&](const std::shared_ptr<chat::Session>& device) {
+            if (device == except) {
+                return;
+            }
+            bool compress = device->compression_enabled();
+            auto& payload = compress ? compressed : plain;
+            if (!payload) {
+                payload = std::make_shared<const std::string>(chat::encode_message_frames(serialized, compress));
+            }
+            device->send(payload, trace_id);
+            ++sent;
+        });
+        return sent;
+    }
+
+    /**
+     * @brief Returns the optional features this server offers, given its configuration.
+     */
+    chat::FeatureSet supported_features() const {
+        chat::FeatureSet features{chat::Feature::e2e_keys, chat::Feature::batch};
+        if (compression_) {
+            features.add(chat::Feature::compression);
+        }
+        if (history_) {
+            features.add(chat::Feature::history);
+        }
+        return features;
+    }
+
+    /**
+     * @brief Locks `users_mutex_`, recording contention in the metrics.
+     */
+    std::unique_lock<std::mutex> lock_users() {
+        return chat::instrumented_lock(users_mutex_, metrics_.users_lock_contended, metrics_.users_lock_wait);
+    }
+
+    /**
+     * @brief Publishes a new user-list snapshot. Caller holds `users_mutex_`.
+     *
+     * In cluster mode the snapshot also lists users connected to other nodes.
+     */
+    void rebuild_user_list() {
+        if (cluster_) {
+            cluster_->with_remote_users([this](const std::map<std::string, std::string>& remote_users) {
+                user_list_.rebuild(user_connections_, remote_users);
+            });
+        } else {
+            user_list_.rebuild(user_connections_);
+        }
+    }
+
+    /**
+     * @brief Broadcasts the updated user list to all connected clients.
+     *
+     * Queues the first page of the cached `LIST` snapshot on every connected client;
+     * clients fetch further pages on demand. All sessions share the same serialized
+     * buffer (or its compressed twin), which stays alive until the last write completes.
+     */
+    void broadcast_user_list() {
+        // Every drained session would otherwise re-send the list to all the others
+        if (draining_) {
+            return;
+        }
+
+        auto snapshot = user_list_.current();
+        chat::Session::Payload payload(snapshot, &snapshot->first_page);
+        chat::Session::Payload compressed(snapshot, &snapshot->first_page_compressed);
+
+        auto lock = lock_users();
+        for (const auto& user : user_connections_) {
+            user.second.for_each([&](const std::shared_ptr<chat::Session>& device) {
+                device->send(device->compression_enabled() ? compressed : payload);
+            });
         }
     }
 };
@@ -269,11 +1740,93 @@ private:
 /**
  * @brief Main function for the chat server.
  * @param argc Argument count.
- * @param argv Argument vector. Optionally accepts port number as the first argument.
+ * @param argv Argument vector. Optionally accepts port number as the first argument, followed by
+ *             `--acceptors <n>` to accept on n SO_REUSEPORT sockets and threads,
+ *             `--metrics-port <port>` to serve Prometheus metrics and traces on 127.0.0.1,
+ *             `--trace-sample <n>` to trace one in n relayed messages,
+ *             `--idle-timeout <seconds>` to disconnect silent clients (0 disables; default 60),
+ *             `--drain-time <seconds>` to spread disconnects over when draining (default 5),
+ *             `--rate-limit <msgs/s>`, `--byte-limit <bytes/s>` and `--global-rate <msgs/s>` to limit
+ *             senders (0 disables; the bursts are twice and four times the per-session rates),
+ *             `--rate-policy reject|delay` for frames over a limit (default delay),
+ *             `--compression on|off` to allow clients to negotiate compressed frames (default on),
+ *             `--max-connections <n>`, `--max-handshakes <n>` and `--handshake-rate <n/s>` to reject
+ *             connections before the TLS handshake when over a cap (0, the default, is unlimited), and
+ *             `--history-dir <dir>` to store messages and answer HISTORY requests from logs in dir,
+ *             `--auth <users-file>` to require a password or token to register, hashing passwords on
+ *             `--auth-threads <n>` threads (default: half the cores), and
+ *             `--node <host:port> --peers <host:port,...>` to run as one node of a cluster.
  * @return 0 on successful execution, 1 on error (e.g., certificate files not found).
  */
 int main(int argc, char* argv[]) {
     unsigned short port = 8443; // Default SSL port
+    unsigned acceptors = 1;
+    unsigned short metrics_port = 0;
+    int idle_timeout = 60;
+    int drain_time = 5;
+    chat::RateLimitConfig rate_limits;
+    bool compression = true;
+    std::int64_t max_connections = 0;
+    std::int64_t max_handshakes = 0;
+    double handshake_rate = 0;
+    std::string node_id;
+    std::vector<std::string> peers;
+    std::string history_dir;
+    std::string users_file;
+    unsigned auth_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--acceptors") {
+            acceptors = static_cast<unsigned>(std::max(1, std::atoi(argv[i + 1])));
+        } else if (option == "--trace-sample") {
+            chat::server_tracer().set_sample_every(static_cast<std::uint32_t>(std::atoi(argv[i + 1])));
+        } else if (option == "--idle-timeout") {
+            idle_timeout = std::max(0, std::atoi(argv[i + 1]));
+        } else if (option == "--drain-time") {
+            drain_time = std::max(0, std::atoi(argv[i + 1]));
+        } else if (option == "--rate-limit") {
+            rate_limits.messages_per_second = std::max(0.0, std::atof(argv[i + 1]));
+            rate_limits.message_burst = 2 * rate_limits.messages_per_second;
+        } else if (option == "--byte-limit") {
+            rate_limits.bytes_per_second = std::max(0.0, std::atof(argv[i + 1]));
+            rate_limits.byte_burst = 4 * rate_limits.bytes_per_second;
+        } else if (option == "--global-rate") {
+            rate_limits.global_messages_per_second = std::max(0.0, std::atof(argv[i + 1]));
+        } else if (option == "--rate-policy") {
+            rate_limits.policy = std::string(argv[i + 1]) == "reject" ? chat::RateLimitPolicy::REJECT
+                                                                       : chat::RateLimitPolicy::DELAY;
+        } else if (option == "--compression") {
+            compression = std::string(argv[i + 1]) != "off";
+        } else if (option == "--max-connections") {
+            max_connections = std::max(0L, std::atol(argv[i + 1]));
+        } else if (option == "--max-handshakes") {
+            max_handshakes = std::max(0L, std::atol(argv[i + 1]));
+        } else if (option == "--handshake-rate") {
+            handshake_rate = std::max(0.0, std::atof(argv[i + 1]));
+        } else if (option == "--metrics-port") {
+            metrics_port = static_cast<unsigned short>(std::atoi(argv[i + 1]));
+        } else if (option == "--auth") {
+            users_file = argv[i + 1];
+        } else if (option == "--auth-threads") {
+            auth_threads = static_cast<unsigned>(std::max(1, std::atoi(argv[i + 1])));
+        } else if (option == "--history-dir") {
+            history_dir = argv[i + 1];
+        } else if (option == "--node") {
+            node_id = argv[i + 1];
+        } else if (option == "--peers") {
+            std::stringstream list(argv[i + 1]);
+            std::string peer;
+            while (std::getline(list, peer, ',')) {
+                if (!peer.empty()) {
+                    peers.push_back(peer);
+                }
+            }
+        } else {
+            std::cerr << "Unknown option: " << option << "\n";
+            return 1;
+        }
+    }
 
     if (argc >= 2) {
         try {
@@ -293,7 +1846,25 @@ int main(int argc, char* argv[]) {
 
         asio::io_context io_context;
 
-        ChatServer server(io_context, port);
+        ChatServer server(io_context, port, acceptors, chat::inherited_listen_fds());
+        if (!node_id.empty()) {
+            server.enable_cluster(node_id, peers);
+        }
+        if (metrics_port != 0) {
+            server.enable_metrics(metrics_port);
+        }
+        if (!history_dir.empty()) {
+            server.enable_history(history_dir);
+        }
+        if (!users_file.empty()) {
+            server.enable_auth(users_file, auth_threads);
+        }
+        server.set_idle_timeout(std::chrono::seconds(idle_timeout));
+        server.set_drain_time(std::chrono::seconds(drain_time));
+        server.set_rate_limits(rate_limits);
+        server.set_compression(compression);
+        server.set_admission_limits(max_connections, max_handshakes, handshake_rate);
+        server.enable_hot_restart(std::vector<std::string>(argv, argv + argc));
         server.start();
 
         io_context.run();
@@ -0,0 +1,357 @@
+/**
+ * @file metrics.hpp
+ * @brief Lock-free counters, gauges and histograms with Prometheus text exposition.
+ *
+ * Counters and histograms are sharded per thread: each thread updates its own
+ * cache-line-sized slot with a relaxed atomic add, so recording never contends and
+ * costs a few nanoseconds. Reads sum the shards and are only done by the exporter.
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Number of per-thread shards; threads beyond this share shards (still lock-free).
+ */
+constexpr std::size_t kMetricShards = 16;
+
+/**
+ * @brief Returns the calling thread's shard index.
+ */
+inline std::size_t metric_shard() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+    return shard;
+}
+
+/**
+ * @brief Common interface of exported metrics.
+ */
+class Metric {
+public:
+    Metric(std::string name, std::string help) : name_(std::move(name)), help_(std::move(help)) {}
+    virtual ~Metric() = default;
+
+    /**
+     * @brief Appends this metric in Prometheus text exposition format.
+     */
+    virtual void render(std::ostream& out) const = 0;
+
+    /**
+     * @brief Returns the metric name.
+     */
+    const std::string& name() const { return name_; }
+
+protected:
+    /**
+     * @brief Writes the `# HELP` and `# TYPE` lines.
+     */
+    void header(std::ostream& out, const char* type) const {
+        out << "# HELP " << name_ << " " << help_ << "\n# TYPE " << name_ << " " << type << "\n";
+    }
+
+    std::string name_;      ///< Metric name.
+    std::string help_;      ///< One-line description.
+};
+
+/**
+ * @brief Monotonically increasing counter.
+ */
+class Counter : public Metric {
+public:
+    using Metric::Metric;
+
+    /**
+     * @brief Adds `n` to the counter.
+     */
+    void inc(std::uint64_t n = 1) {
+        shards_[metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the sum over all shards.
+     */
+    std::uint64_t value() const {
+        std::uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void render(std::ostream& out) const override {
+        header(out, "counter");
+        out << name_ << " " << value() << "\n";
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<Shard, kMetricShards> shards_;   ///< Per-thread partial sums.
+};
+
+/**
+ * @brief Counters that differ in the value of one label, exported as one metric family.
+ */
+class CounterVec : public Metric {
+public:
+    /**
+     * @brief Creates one counter per label value.
+     * @param label The label name, e.g. "reason".
+     * @param values The label values; `inc(i)` increments the counter of `values[i]`.
+     */
+    CounterVec(std::string name, std::string help, std::string label, std::initializer_list<const char*> values)
+        : Metric(std::move(name), std::move(help)), label_(std::move(label)) {
+        for (const char* value : values) {
+            values_.emplace_back(value);
+            counters_.push_back(std::make_unique<Counter>(name_, help_));
+        }
+    }
+
+    /**
+     * @brief Adds `n` to the counter of label value `index`.
+     */
+    void inc(std::size_t index, std::uint64_t n = 1) { counters_[index]->inc(n); }
+
+    /**
+     * @brief Returns the counter of label value `index`.
+     */
+    std::uint64_t value(std::size_t index) const { return counters_[index]->value(); }
+
+    void render(std::ostream& out) const override {
+        header(out, "counter");
+        for (std::size_t i = 0; i < values_.size(); ++i) {
+            out << name_ << "{" << label_ << "=\"" << values_[i] << "\"} " << counters_[i]->value() << "\n";
+        }
+    }
+
+private:
+    std::string label_;                                 ///< Label name.
+    std::vector<std::string> values_;                   ///< Label values.
+    std::vector<std::unique_ptr<Counter>> counters_;    ///< One counter per label value.
+};
+
+/**
+ * @brief Value that goes up and down, such as a current count.
+ */
+class Gauge : public Metric {
+public:
+    using Metric::Metric;
+
+    /**
+     * @brief Adds `n` (which may be negative).
+     */
+    void add(std::int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the current value.
+     */
+    std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    void render(std::ostream& out) const override {
+        header(out, "gauge");
+        out << name_ << " " << value() << "\n";
+    }
+
+private:
+    std::atomic<std::int64_t> value_{0};    ///< Current value.
+};
+
+/**
+ * @brief Histogram with fixed bucket upper bounds.
+ *
+ * Values are recorded in integer units (e.g. microseconds) and exported multiplied by
+ * `scale` (e.g. 1e-6 to export seconds).
+ */
+class Histogram : public Metric {
+public:
+    static constexpr std::size_t kMaxBuckets = 24;     ///< Maximum number of finite bounds.
+
+    /**
+     * @brief Creates the histogram.
+     * @param bounds Ascending finite bucket upper bounds (at most `kMaxBuckets`); +Inf is implicit.
+     * @param scale Factor applied to bounds and sum on export.
+     */
+    Histogram(std::string name, std::string help, std::initializer_list<std::uint64_t> bounds, double scale = 1.0)
+        : Metric(std::move(name), std::move(help)), bounds_(bounds), scale_(scale) {}
+
+    /**
+     * @brief Records one value.
+     */
+    void observe(std::uint64_t value) {
+        std::size_t bucket = 0;
+        while (bucket < bounds_.size() && value > bounds_[bucket]) {
+            ++bucket;
+        }
+        auto& shard = shards_[metric_shard()];
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of recorded values.
+     */
+    std::uint64_t count() const {
+        std::uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            for (std::size_t b = 0; b <= bounds_.size(); ++b) {
+                total += shard.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+
+    void render(std::ostream& out) const override {
+        header(out, "histogram");
+
+        std::uint64_t cumulative = 0;
+        std::uint64_t sum = 0;
+        for (std::size_t b = 0; b <= bounds_.size(); ++b) {
+            for (const auto& shard : shards_) {
+                cumulative += shard.buckets[b].load(std::memory_order_relaxed);
+            }
+            out << name_ << "_bucket{le=\"";
+            if (b < bounds_.size()) {
+                out << bounds_[b] * scale_;
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+        for (const auto& shard : shards_) {
+            sum += shard.sum.load(std::memory_order_relaxed);
+        }
+        out << name_ << "_sum " << sum * scale_ << "\n";
+        out << name_ << "_count " << cumulative << "\n";
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<std::uint64_t>, kMaxBuckets + 1> buckets{};
+        std::atomic<std::uint64_t> sum{0};
+    };
+
+    std::vector<std::uint64_t> bounds_;         ///< Finite bucket upper bounds.
+    double scale_;                              ///< Export scale factor.
+    std::array<Shard, kMetricShards> shards_;   ///< Per-thread bucket counts and sums.
+};
+
+/**
+ * @brief Microseconds elapsed since `start`, for latency histograms.
+ */
+inline std::uint64_t micros_since(std::chrono::steady_clock::time_point start) {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+ * @brief Label values of `ServerMetrics::connections_rejected`, in declaration order.
+ */
+enum class RejectReason : std::size_t {
+    MAX_CONNECTIONS,    /**< Too many open connections. */
+    MAX_HANDSHAKES,     /**< Too many TLS handshakes in progress. */
+    HANDSHAKE_RATE      /**< Too many TLS handshakes started per second. */
+};
+
+/**
+ * @brief Every metric the chat server records.
+ */
+struct ServerMetrics {
+    Counter connections{"chat_connections_total", "Accepted TCP connections."};
+    Gauge active_sessions{"chat_active_sessions", "Sessions currently open."};
+    Counter handshakes{"chat_handshakes_total", "Completed TLS handshakes."};
+    Gauge handshakes_in_flight{"chat_handshakes_in_flight", "TLS handshakes currently in progress."};
+    CounterVec connections_rejected{"chat_connections_rejected_total", "Connections closed before the TLS handshake by admission control.",
+        "reason", {"max_connections", "max_handshakes", "handshake_rate"}};
+    Counter handshake_failures{"chat_handshake_failures_total", "Failed TLS handshakes."};
+    Histogram handshake_latency{"chat_handshake_latency_seconds", "Time from accept to completed TLS handshake.",
+        {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000}, 1e-6};
+    Counter messages_relayed{"chat_messages_relayed_total", "Messages queued for delivery to a recipient."};
+    Counter bytes_in{"chat_bytes_in_total", "Application bytes read from clients."};
+    Counter bytes_out{"chat_bytes_out_total", "Application bytes written to clients."};
+    Gauge write_queue_depth{"chat_write_queue_depth", "Payloads queued for writing, over all sessions."};
+    Histogram write_queue_length{"chat_write_queue_length", "Per-session write queue length seen by each enqueue.",
+        {1, 2, 4, 8, 16, 32, 64, 128, 256, 1024}};
+    Counter users_lock_contended{"chat_users_lock_contended_total", "Acquisitions of users_mutex_ that had to wait."};
+    Histogram users_lock_wait{"chat_users_lock_wait_seconds", "Time spent waiting for a contended users_mutex_.",
+        {1, 5, 10, 50, 100, 500, 1000, 10000}, 1e-6};
+    Counter deserialize_failures{"chat_deserialize_failures_total", "Frames that could not be parsed as a message."};
+    Counter heartbeats_sent{"chat_heartbeats_sent_total", "PINGs sent to idle sessions."};
+    Counter idle_timeouts{"chat_idle_timeouts_total", "Sessions closed for being idle too long."};
+    Counter rate_limit_rejected{"chat_rate_limit_rejected_total", "Frames dropped for exceeding a rate limit."};
+    Counter rate_limit_delayed{"chat_rate_limit_delayed_total", "Reads postponed because the sender exceeded a rate limit."};
+    Counter file_bytes_relayed{"chat_file_bytes_relayed_total", "File bytes relayed in DATA frames."};
+    Counter frames_compressed{"chat_frames_compressed_total", "Outgoing frames encoded compressed."};
+    Counter compression_saved_bytes{"chat_compression_saved_bytes_total", "Bytes saved by compressing outgoing frames, once per encoding."};
+    Counter history_appended{"chat_history_appended_total", "Messages written to the history logs."};
+    Histogram history_read_latency{"chat_history_read_latency_seconds", "Time to read one HISTORY page from the logs.",
+        {10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000}, 1e-6};
+    Counter auth_hashes{"chat_auth_hashes_total", "Password hashes computed to create or check an account."};
+    Counter auth_cache_hits{"chat_auth_cache_hits_total", "Password logins accepted from the verification cache."};
+    Counter auth_failures{"chat_auth_failures_total", "Logins refused."};
+    Histogram auth_hash_latency{"chat_auth_hash_latency_seconds", "Time from a hashing job starting to its result.",
+        {1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000}, 1e-6};
+    Counter batches_received{"chat_batches_total", "BATCH frames received."};
+    Counter legacy_registrations{"chat_legacy_registrations_total", "Registrations from clients that sent no protocol version."};
+
+    /**
+     * @brief Renders all metrics in Prometheus text exposition format.
+     */
+    std::string render() const {
+        std::ostringstream out;
+        for (const Metric* metric : all()) {
+            metric->render(out);
+        }
+        return out.str();
+    }
+
+    /**
+     * @brief Returns every metric, in export order.
+     */
+    std::vector<const Metric*> all() const {
+        return {&connections, &active_sessions, &handshakes, &handshakes_in_flight, &connections_rejected,
+                &handshake_failures, &handshake_latency, &messages_relayed, &bytes_in, &bytes_out, &write_queue_depth, &write_queue_length,
+                &users_lock_contended, &users_lock_wait, &deserialize_failures, &heartbeats_sent, &idle_timeouts,
+                &rate_limit_rejected, &rate_limit_delayed, &file_bytes_relayed,
+                &frames_compressed, &compression_saved_bytes, &history_appended, &history_read_latency,
+                &auth_hashes, &auth_cache_hits, &auth_failures, &auth_hash_latency, &batches_received, &legacy_registrations};
+    }
+};
+
+/**
+ * @brief Returns the process-wide server metrics.
+ */
+inline ServerMetrics& server_metrics() {
+    static ServerMetrics metrics;
+    return metrics;
+}
+
+/**
+ * @brief Locks `mutex`, recording contention and wait time when it is already held.
+ *
+ * The uncontended path is a single `try_lock`.
+ */
+template <typename Mutex>
+std::unique_lock<Mutex> instrumented_lock(Mutex& mutex, Counter& contended, Histogram& wait) {
+    std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        contended.inc();
+        wait.observe(micros_since(start));
+    }
+    return lock;
+}
+
+}  // namespace chat
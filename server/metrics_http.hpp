@@ -0,0 +1,124 @@
+/**
+ * @file metrics_http.hpp
+ * @brief Minimal plain-HTTP endpoint serving the server metrics to Prometheus.
+ */
+#pragma once
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "metrics.hpp"
+#include "tracing.hpp"
+
+namespace chat {
+
+/**
+ * @brief Serves `GET /metrics` and `GET /trace` on a loopback port.
+ *
+ * `/metrics` returns the full text exposition, which is all a Prometheus scraper
+ * needs; `/trace` returns the tracer's recent spans as Chrome trace JSON. The
+ * connection is closed after each response. The endpoint binds to 127.0.0.1 only.
+ */
+class MetricsEndpoint {
+public:
+    /**
+     * @brief Binds the endpoint.
+     * @param io_context The I/O context serving scrapes.
+     * @param port The local port to listen on.
+     */
+    MetricsEndpoint(boost::asio::io_context& io_context, unsigned short port)
+        : acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
+          retry_timer_(io_context) {}
+
+    /**
+     * @brief Adopts a listening socket inherited from a previous server process.
+     * @param io_context The I/O context serving scrapes.
+     * @param listen_fd The listening socket.
+     */
+    MetricsEndpoint(boost::asio::io_context& io_context, int listen_fd)
+        : acceptor_(io_context, boost::asio::ip::tcp::v4(), listen_fd), retry_timer_(io_context) {}
+
+    /**
+     * @brief Returns the listening socket, for handing it to a new process.
+     */
+    int native_handle() { return acceptor_.native_handle(); }
+
+    /**
+     * @brief Starts accepting scrapes.
+     */
+    void start() {
+        std::cout << "Metrics available at http://127.0.0.1:" << acceptor_.local_endpoint().port() << "/metrics\n";
+        accept();
+    }
+
+private:
+    /**
+     * @brief Accepts one scrape connection and answers it.
+     *
+     * Stops once the acceptor is closed. After any other error, such as running out of
+     * file descriptors, it waits `kRetryDelay` before accepting again instead of spinning.
+     */
+    void accept() {
+        auto socket = std::make_shared<boost::asio::ip::tcp::socket>(acceptor_.get_executor());
+        acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code& error) {
+            if (!error) {
+                respond(socket);
+                accept();
+            } else if (error != boost::asio::error::operation_aborted && acceptor_.is_open()) {
+                retry_timer_.expires_after(kRetryDelay);
+                retry_timer_.async_wait([this](const boost::system::error_code& error) {
+                    if (!error) {
+                        accept();
+                    }
+                });
+            }
+        });
+    }
+
+    /**
+     * @brief Reads the request head and writes the metrics.
+     */
+    static void respond(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+        auto request = std::make_shared<std::string>();
+        boost::asio::async_read_until(*socket, boost::asio::dynamic_buffer(*request, 8192), "\r\n\r\n",
+            [socket, request](const boost::system::error_code& error, std::size_t) {
+                if (error) {
+                    return;
+                }
+
+                std::string status = "200 OK";
+                std::string content_type = "text/plain; version=0.0.4";
+                std::string body;
+                if (request->compare(0, 13, "GET /metrics ") == 0) {
+                    body = server_metrics().render();
+                } else if (request->compare(0, 11, "GET /trace ") == 0) {
+                    content_type = "application/json";
+                    body = server_tracer().chrome_json();
+                } else {
+                    status = "404 Not Found";
+                    body = "not found\n";
+                }
+
+                auto response = std::make_shared<std::string>(
+                    "HTTP/1.1 " + status + "\r\n"
+                    "Content-Type: " + content_type + "\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                    "Connection: close\r\n\r\n" + body);
+
+                boost::asio::async_write(*socket, boost::asio::buffer(*response),
+                    [socket, response](const boost::system::error_code&, std::size_t) {
+                        boost::system::error_code ignored;
+                        socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                    });
+            });
+    }
+
+    static constexpr std::chrono::milliseconds kRetryDelay{100};    ///< Back-off after a failed accept.
+
+    boost::asio::ip::tcp::acceptor acceptor_;   ///< Loopback acceptor for scrapes.
+    boost::asio::steady_timer retry_timer_;     ///< Paces accepts after an error.
+};
+
+}  // namespace chat
@@ -0,0 +1,144 @@
+/**
+ * @file rate_limit.hpp
+ * @brief Lock-free token-bucket rate limiting for the relay path.
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace chat {
+
+/**
+ * @brief Token bucket in its GCRA form: one atomic "theoretical arrival time" per bucket.
+ *
+ * Each unit of cost pushes the arrival time forward by `1 / rate`; a request conforms
+ * while the arrival time stays within `burst / rate` of now. That is the same decision as
+ * a bucket of `burst` tokens refilled at `rate` per second, but the whole state is a
+ * single integer, so a check is one load and one compare-exchange and never locks. The
+ * same limiter serves one session (uncontended) or the whole server.
+ */
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    RateLimiter() = default;
+
+    /**
+     * @brief Creates a limiter.
+     * @param rate Sustained units per second; 0 disables the limiter.
+     * @param burst Units that may be spent at once after an idle period.
+     */
+    RateLimiter(double rate, double burst) { configure(rate, burst); }
+
+    /**
+     * @brief Changes the limits. Not safe while other threads use the limiter.
+     */
+    void configure(double rate, double burst) {
+        interval_ns_ = rate > 0 ? std::max(1.0, 1e9 / rate) : 0;
+        tolerance_ns_ = interval_ns_ * std::max(1.0, burst);
+    }
+
+    /**
+     * @brief Returns whether the limiter is enabled.
+     */
+    bool enabled() const { return interval_ns_ > 0; }
+
+    /**
+     * @brief Returns the largest cost a single request can ever be granted; unbounded when disabled.
+     */
+    double cap(double cost) const { return enabled() ? std::min(cost, tolerance_ns_ / interval_ns_) : cost; }
+
+    /**
+     * @brief Returns whether spending `cost` units now would stay within the limit, without spending them.
+     */
+    bool conforms(Clock::time_point now, double cost = 1) const {
+        if (!enabled()) {
+            return true;
+        }
+        std::int64_t now_ns = to_ns(now);
+        std::int64_t next = std::max(arrival_ns_.load(std::memory_order_relaxed), now_ns) +
+                            static_cast<std::int64_t>(cost * interval_ns_);
+        return next - now_ns <= static_cast<std::int64_t>(tolerance_ns_);
+    }
+
+    /**
+     * @brief Spends `cost` units if that stays within the limit ("reject" policy).
+     * @return true if the request conforms; nothing is spent otherwise.
+     */
+    bool try_acquire(Clock::time_point now, double cost = 1) {
+        if (!enabled()) {
+            return true;
+        }
+        std::int64_t now_ns = to_ns(now);
+        std::int64_t arrival = arrival_ns_.load(std::memory_order_relaxed);
+        std::int64_t next;
+        do {
+            next = std::max(arrival, now_ns) + static_cast<std::int64_t>(cost * interval_ns_);
+            if (next - now_ns > static_cast<std::int64_t>(tolerance_ns_)) {
+                return false;
+            }
+        } while (!arrival_ns_.compare_exchange_weak(arrival, next, std::memory_order_relaxed));
+        return true;
+    }
+
+    /**
+     * @brief Spends `cost` units unconditionally ("delay" policy).
+     * @return How long the caller should wait before its next request to get back within the limit.
+     */
+    Clock::duration acquire(Clock::time_point now, double cost = 1) {
+        if (!enabled()) {
+            return Clock::duration::zero();
+        }
+        std::int64_t now_ns = to_ns(now);
+        std::int64_t arrival = arrival_ns_.load(std::memory_order_relaxed);
+        std::int64_t next;
+        do {
+            next = std::max(arrival, now_ns) + static_cast<std::int64_t>(cost * interval_ns_);
+        } while (!arrival_ns_.compare_exchange_weak(arrival, next, std::memory_order_relaxed));
+
+        std::int64_t excess = next - now_ns - static_cast<std::int64_t>(tolerance_ns_);
+        return std::chrono::nanoseconds(std::max<std::int64_t>(0, excess));
+    }
+
+private:
+    static std::int64_t to_ns(Clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    double interval_ns_ = 0;                        ///< Nanoseconds per unit; 0 when disabled.
+    double tolerance_ns_ = 0;                       ///< How far ahead of now the arrival time may run.
+    std::atomic<std::int64_t> arrival_ns_{0};       ///< Theoretical arrival time of the next unit.
+};
+
+/**
+ * @brief What to do with a frame that exceeds a limit.
+ */
+enum class RateLimitPolicy {
+    REJECT,     /**< Drop the frame and tell the sender. */
+    DELAY       /**< Process it, then stop reading from the sender until it is back within the limit. */
+};
+
+/**
+ * @brief Relay-path limits of one session.
+ */
+struct SessionLimits {
+    RateLimiter messages;   ///< Frames per second.
+    RateLimiter bytes;      ///< Bytes per second.
+    bool notified = false;  ///< Whether the sender was told about the current run of rejected frames.
+};
+
+/**
+ * @brief Server-wide rate-limit settings.
+ */
+struct RateLimitConfig {
+    double messages_per_second = 100;           ///< Per-session frame rate; 0 disables.
+    double message_burst = 200;                 ///< Per-session frame burst.
+    double bytes_per_second = 1 << 20;          ///< Per-session byte rate; 0 disables.
+    double byte_burst = 4 << 20;                ///< Per-session byte burst.
+    double global_messages_per_second = 0;      ///< Frame rate over all sessions; 0 disables.
+    RateLimitPolicy policy = RateLimitPolicy::DELAY;    ///< Handling of frames over a limit.
+};
+
+}  // namespace chat
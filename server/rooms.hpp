@@ -0,0 +1,89 @@
+/**
+ * @file rooms.hpp
+ * @brief Group chat rooms and their membership.
+ */
+#pragma once
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Registry of rooms, each holding its members in a contiguous vector.
+ *
+ * Fan-out walks a flat array of member handles, so delivering to a large room is a
+ * tight loop with no per-member allocation. Join and leave are O(members), which is
+ * acceptable because they are far rarer than messages. Not thread-safe; the owner
+ * guards it with its own mutex.
+ * @tparam Member A cheap-to-copy, equality-comparable handle (e.g. `std::shared_ptr<Session>`).
+ */
+template <typename Member>
+class RoomRegistry {
+public:
+    /**
+     * @brief Creates a room with `member` as its first member.
+     * @return false if the room already exists.
+     */
+    bool create(const std::string& room, const Member& member) {
+        auto inserted = rooms_.emplace(room, std::vector<Member>{member});
+        return inserted.second;
+    }
+
+    /**
+     * @brief Adds `member` to an existing room; joining twice is a no-op.
+     * @return false if the room does not exist.
+     */
+    bool join(const std::string& room, const Member& member) {
+        auto it = rooms_.find(room);
+        if (it == rooms_.end()) {
+            return false;
+        }
+        auto& members = it->second;
+        if (std::find(members.begin(), members.end(), member) == members.end()) {
+            members.push_back(member);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Removes `member` from a room, deleting the room once it is empty.
+     * @return false if the member was not in the room.
+     */
+    bool leave(const std::string& room, const Member& member) {
+        auto it = rooms_.find(room);
+        if (it == rooms_.end()) {
+            return false;
+        }
+        auto& members = it->second;
+        auto pos = std::find(members.begin(), members.end(), member);
+        if (pos == members.end()) {
+            return false;
+        }
+        *pos = std::move(members.back());
+        members.pop_back();
+        if (members.empty()) {
+            rooms_.erase(it);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Returns the members of a room, or nullptr if it does not exist.
+     */
+    const std::vector<Member>* members(const std::string& room) const {
+        auto it = rooms_.find(room);
+        return it == rooms_.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief Returns the number of rooms.
+     */
+    std::size_t size() const { return rooms_.size(); }
+
+private:
+    std::map<std::string, std::vector<Member>> rooms_;  ///< Room name → members.
+};
+
+}  // namespace chat
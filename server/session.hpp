@@ -0,0 +1,314 @@
+/**
+ * @file session.hpp
+ * @brief Per-connection state of the chat server: SSL stream, identity and write queue.
+ */
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../common/capabilities.hpp"
+#include "../common/compression.hpp"
+#include "../common/frame.hpp"
+#include "metrics.hpp"
+#include "rate_limit.hpp"
+#include "tracing.hpp"
+
+namespace chat {
+
+/**
+ * @brief Largest frame a client may send; file contents travel as chunks well below it.
+ */
+constexpr std::uint32_t kMaxClientFrameSize = 64 * 1024;
+
+/**
+ * @brief Frames an encoded message, compressing it for clients that negotiated compression.
+ * @param payload The encoded message.
+ * @param compress Whether the receiving client accepts compressed frames.
+ * @return The frame, ready to be queued.
+ */
+inline std::string encode_message_frame(const std::string& payload, bool compress) {
+    if (!compress) {
+        return encode_frame(payload);
+    }
+    std::string frame = encode_compressed_frame(payload);
+    std::size_t plain = kFrameHeaderSize + payload.size();
+    if (frame.size() < plain) {
+        server_metrics().frames_compressed.inc();
+        server_metrics().compression_saved_bytes.inc(plain - frame.size());
+    }
+    return frame;
+}
+
+/**
+ * @brief Frames several encoded messages back to back, so they go out in one write.
+ * @param payloads The encoded messages, in order.
+ * @param compress Whether the receiving client accepts compressed frames.
+ */
+inline std::string encode_message_frames(const std::vector<std::string>& payloads, bool compress) {
+    std::string frames;
+    for (const auto& payload : payloads) {
+        frames += encode_message_frame(payload, compress);
+    }
+    return frames;
+}
+
+/**
+ * @brief One connected client.
+ *
+ * All writes go through `send()`, which appends to a FIFO queue and keeps at most
+ * one `async_write` in flight on the SSL stream. Queued payloads are shared,
+ * immutable buffers, so the same encoded message can sit in any number of
+ * sessions' queues without being copied.
+ */
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    using Stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;  ///< Underlying SSL stream type.
+    using Payload = std::shared_ptr<const std::string>;                      ///< Shared, encoded and framed message.
+
+    /**
+     * @brief Constructs a session around an accepted (not yet handshaken) stream.
+     * @param stream The SSL stream of the client.
+     */
+    explicit Session(std::shared_ptr<Stream> stream) : stream_(std::move(stream)) {
+        server_metrics().active_sessions.add(1);
+        touch();
+    }
+
+    ~Session() {
+        server_metrics().active_sessions.add(-1);
+    }
+
+    /**
+     * @brief Returns the SSL stream of this session.
+     */
+    Stream& stream() { return *stream_; }
+
+    /**
+     * @brief Returns the registered username (empty before registration).
+     */
+    const std::string& username() const { return username_; }
+
+    /**
+     * @brief Sets the username once registration succeeds.
+     * @param username The registered username.
+     */
+    void set_username(const std::string& username) { username_ = username; }
+
+    /**
+     * @brief Rooms this session has joined. Guarded by the server's rooms mutex.
+     */
+    std::vector<std::string>& rooms() { return rooms_; }
+
+    /**
+     * @brief Buffer for the session's reads. Used only by its single pending read.
+     */
+    std::array<char, 4096>& read_buffer() { return read_buffer_; }
+
+    /**
+     * @brief Reassembles frames from the session's reads. Used only from its read handler.
+     */
+    FrameReader& reader() { return reader_; }
+
+    /**
+     * @brief Rate limits of this session. Used only from its read handler.
+     */
+    SessionLimits& limits() { return limits_; }
+
+    /**
+     * @brief Records that the peer just sent something. Safe from any thread.
+     */
+    void touch() {
+        last_activity_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns how long the peer has been silent. Safe from any thread.
+     */
+    std::chrono::steady_clock::duration idle_for() const {
+        std::chrono::steady_clock::duration last(last_activity_.load(std::memory_order_relaxed));
+        return std::chrono::steady_clock::now().time_since_epoch() - last;
+    }
+
+    /**
+     * @brief Allows heartbeat PINGs; set once the client is registered and reading messages.
+     */
+    void enable_heartbeat() { heartbeat_.store(true, std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns whether the session may be sent PINGs. Safe from any thread.
+     */
+    bool heartbeat_enabled() const { return heartbeat_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Records what was agreed on at registration.
+     * @param version Protocol version spoken with the client.
+     * @param features Features enabled for the session; `Feature::compression` lets the
+     *                 client be sent compressed frames.
+     */
+    void set_protocol(std::uint32_t version, FeatureSet features) {
+        protocol_version_.store(version, std::memory_order_relaxed);
+        features_.store(features.bits(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the protocol version agreed with the client; 0 before registration.
+     */
+    std::uint32_t protocol_version() const { return protocol_version_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the features enabled for the session. Safe from any thread.
+     */
+    FeatureSet features() const { return FeatureSet(features_.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief Returns whether the client negotiated compressed frames. Safe from any thread.
+     */
+    bool compression_enabled() const { return features().has(Feature::compression); }
+
+    /**
+     * @brief Closes the TCP connection without a TLS shutdown, failing any pending read or write.
+     *
+     * Used for peers that stopped answering, so it must not wait on them.
+     */
+    void close() {
+        boost::asio::dispatch(stream_->get_executor(), [self = shared_from_this()]() {
+            boost::system::error_code ignored;
+            self->stream_->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+            self->stream_->lowest_layer().close(ignored);
+        });
+    }
+
+    /**
+     * @brief Queues a payload for delivery.
+     *
+     * Runs inline when called from the session's own thread, otherwise posts to it.
+     * @param payload The framed message; shared with any other recipients.
+     * @param trace_id Non-zero to record "queue" and "write" spans for this payload.
+     */
+    void send(Payload payload, std::uint64_t trace_id = 0) {
+        auto queued_at = trace_id != 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        boost::asio::dispatch(stream_->get_executor(),
+            [self = shared_from_this(), payload = std::move(payload), trace_id, queued_at]() mutable {
+                if (self->closed_ || self->finishing_) {
+                    return;
+                }
+                self->write_queue_.emplace_back(std::move(payload), trace_id, queued_at);
+                server_metrics().write_queue_depth.add(1);
+                server_metrics().write_queue_length.observe(self->write_queue_.size());
+                if (self->write_queue_.size() == 1) {
+                    self->write_next();
+                }
+            });
+    }
+
+    /**
+     * @brief Convenience overload that frames and queues a freshly encoded message.
+     *
+     * The frame is compressed if the client negotiated it and the message is long enough.
+     * @param payload The encoded message, without frame header.
+     * @param trace_id Non-zero to trace this payload.
+     */
+    void send(const std::string& payload, std::uint64_t trace_id = 0) {
+        send(std::make_shared<const std::string>(encode_message_frame(payload, compression_enabled())), trace_id);
+    }
+
+    /**
+     * @brief Ends the session gracefully: flushes the write queue, then sends a TLS close_notify.
+     *
+     * Later sends are dropped. The TCP connection is closed once the shutdown completes.
+     */
+    void finish() {
+        boost::asio::dispatch(stream_->get_executor(), [self = shared_from_this()]() {
+            if (self->closed_ || self->finishing_) {
+                return;
+            }
+            self->finishing_ = true;
+            if (self->write_queue_.empty()) {
+                self->shutdown();
+            }
+        });
+    }
+
+private:
+    /**
+     * @brief Sends the TLS close_notify and closes the connection.
+     */
+    void shutdown() {
+        stream_->async_shutdown([self = shared_from_this()](const boost::system::error_code&) {
+            boost::system::error_code ignored;
+            self->stream_->lowest_layer().close(ignored);
+        });
+    }
+
+    /**
+     * @brief Writes the payload at the front of the queue and continues until it is empty.
+     */
+    void write_next() {
+        auto& front = write_queue_.front();
+        if (front.trace_id != 0) {
+            front.write_started = std::chrono::steady_clock::now();
+            server_tracer().record(front.trace_id, "queue", front.queued_at, front.write_started);
+        }
+
+        boost::asio::async_write(*stream_, boost::asio::buffer(*front.payload),
+            [self = shared_from_this()](const boost::system::error_code& error, std::size_t bytes_transferred) {
+                auto& metrics = server_metrics();
+                if (error) {
+                    std::cerr << "Failed to deliver message to " << self->username_ << ": " << error.message() << "\n";
+                    metrics.write_queue_depth.add(-static_cast<std::int64_t>(self->write_queue_.size()));
+                    self->closed_ = true;
+                    self->write_queue_.clear();
+                    return;
+                }
+
+                metrics.bytes_out.inc(bytes_transferred);
+                metrics.write_queue_depth.add(-1);
+                auto& done = self->write_queue_.front();
+                if (done.trace_id != 0) {
+                    server_tracer().record(done.trace_id, "write", done.write_started, std::chrono::steady_clock::now());
+                }
+                self->write_queue_.pop_front();
+                if (!self->write_queue_.empty()) {
+                    self->write_next();
+                } else if (self->finishing_) {
+                    self->shutdown();
+                }
+            });
+    }
+
+    /**
+     * @brief A payload waiting in the write queue.
+     */
+    struct QueuedWrite {
+        QueuedWrite(Payload payload, std::uint64_t trace_id, std::chrono::steady_clock::time_point queued_at)
+            : payload(std::move(payload)), trace_id(trace_id), queued_at(queued_at) {}
+
+        Payload payload;                                        ///< Encoded message.
+        std::uint64_t trace_id = 0;                             ///< Trace id, or 0 if not traced.
+        std::chrono::steady_clock::time_point queued_at;        ///< When `send()` was called (traced only).
+        std::chrono::steady_clock::time_point write_started;    ///< When the write began (traced only).
+    };
+
+    std::shared_ptr<Stream> stream_;        ///< SSL stream of the client.
+    std::string username_;                  ///< Registered username.
+    std::vector<std::string> rooms_;        ///< Joined rooms.
+    std::array<char, 4096> read_buffer_;    ///< Bytes of the pending read.
+    FrameReader reader_{kMaxClientFrameSize};   ///< Frames received but not yet handled.
+    SessionLimits limits_;                  ///< Message and byte rate limits.
+    std::deque<QueuedWrite> write_queue_;   ///< Payloads waiting to be written; front is in flight.
+    bool closed_ = false;                   ///< Set after a write error; further sends are dropped.
+    bool finishing_ = false;                ///< Set by `finish()`; the connection closes once the queue drains.
+    std::atomic<std::chrono::steady_clock::rep> last_activity_{0};   ///< Time of the last read, in steady_clock ticks.
+    std::atomic<bool> heartbeat_{false};                            ///< Whether PINGs may be sent.
+    std::atomic<std::uint32_t> protocol_version_{0};                ///< Protocol version agreed at registration.
+    std::atomic<std::uint32_t> features_{0};                        ///< Bits of the features enabled at registration.
+};
+
+}  // namespace chat
@@ -0,0 +1,205 @@
+/**
+ * @file timing_wheel.hpp
+ * @brief Hierarchical timing wheel for large numbers of coarse timeouts.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Timers keyed by integer ticks, with O(1) schedule, cancel and per-tick work.
+ *
+ * Four levels of 64 slots each cover delays up to 2^24 - 1 ticks. A timer sits in the
+ * lowest level whose span covers its delay; whenever the lower levels wrap, the next
+ * slot of the level above is cascaded down, so every timer moves at most three times
+ * before it fires. Nodes live in one vector and are linked by index, so scheduling
+ * does not allocate once the vector has grown.
+ *
+ * The wheel is not thread-safe; callers serialize access.
+ * @tparam T Value handed back when a timer expires.
+ */
+template <typename T>
+class TimingWheel {
+public:
+    using TimerId = std::uint64_t;                                          ///< Generation in the high half, node index in the low half.
+
+    static constexpr unsigned kLevels = 4;                                  ///< Wheel levels.
+    static constexpr unsigned kSlotBits = 6;                                ///< log2 of slots per level.
+    static constexpr std::uint64_t kSlots = 1ull << kSlotBits;              ///< Slots per level.
+    static constexpr std::uint64_t kMaxDelay = (1ull << (kLevels * kSlotBits)) - 1;   ///< Longer delays are clamped.
+
+    TimingWheel() {
+        for (auto& level : slots_) {
+            level.fill(kNil);
+        }
+    }
+
+    /**
+     * @brief Returns the current tick.
+     */
+    std::uint64_t now() const { return now_; }
+
+    /**
+     * @brief Returns the number of pending timers.
+     */
+    std::size_t size() const { return size_; }
+
+    /**
+     * @brief Schedules `value` to expire `delay` ticks from now.
+     * @param delay Ticks until expiry; clamped to [1, kMaxDelay].
+     * @param value Value passed to the expiry handler.
+     * @return Id for `cancel()`.
+     */
+    TimerId schedule(std::uint64_t delay, T value) {
+        std::uint32_t index = allocate();
+        Node& node = nodes_[index];
+        node.value = std::move(value);
+        node.expires = now_ + std::clamp<std::uint64_t>(delay, 1, kMaxDelay);
+        node.active = true;
+        link(index);
+        ++size_;
+        return (static_cast<TimerId>(node.generation) << 32) | index;
+    }
+
+    /**
+     * @brief Cancels a pending timer.
+     * @return false if the timer already fired or was cancelled.
+     */
+    bool cancel(TimerId id) {
+        auto index = static_cast<std::uint32_t>(id);
+        if (index >= nodes_.size() || !nodes_[index].active ||
+            nodes_[index].generation != static_cast<std::uint32_t>(id >> 32)) {
+            return false;
+        }
+        unlink(index);
+        release(index);
+        return true;
+    }
+
+    /**
+     * @brief Moves time forward, handing every expired value to `on_expire`.
+     *
+     * The handler may schedule and cancel timers.
+     * @param ticks Number of ticks to advance.
+     * @param on_expire Called as `on_expire(T&&)` once per expired timer.
+     */
+    template <typename Handler>
+    void advance(std::uint64_t ticks, Handler&& on_expire) {
+        for (; ticks > 0; --ticks) {
+            ++now_;
+
+            // Cascade every level whose lower levels just wrapped, highest first
+            unsigned top = 0;
+            while (top + 1 < kLevels && (now_ & ((1ull << ((top + 1) * kSlotBits)) - 1)) == 0) {
+                ++top;
+            }
+            for (unsigned level = top; level >= 1; --level) {
+                cascade(level);
+            }
+
+            std::uint32_t& head = slots_[0][now_ & (kSlots - 1)];
+            while (head != kNil) {
+                std::uint32_t index = head;
+                unlink(index);
+                T value = std::move(nodes_[index].value);
+                release(index);
+                on_expire(std::move(value));
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint32_t kNil = 0xFFFFFFFF;
+
+    struct Node {
+        T value{};
+        std::uint64_t expires = 0;          ///< Absolute expiry tick.
+        std::uint32_t prev = kNil;          ///< Previous node in the slot list.
+        std::uint32_t next = kNil;          ///< Next node in the slot list, or in the free list.
+        std::uint32_t generation = 0;       ///< Bumped on release so stale ids don't cancel reused nodes.
+        std::uint8_t level = 0;             ///< Level of the slot holding the node.
+        std::uint8_t slot = 0;              ///< Slot holding the node.
+        bool active = false;                ///< True while scheduled.
+    };
+
+    std::uint32_t allocate() {
+        if (free_ != kNil) {
+            std::uint32_t index = free_;
+            free_ = nodes_[index].next;
+            return index;
+        }
+        nodes_.emplace_back();
+        return static_cast<std::uint32_t>(nodes_.size() - 1);
+    }
+
+    void release(std::uint32_t index) {
+        Node& node = nodes_[index];
+        node.value = T{};
+        node.active = false;
+        ++node.generation;
+        node.next = free_;
+        free_ = index;
+        --size_;
+    }
+
+    /**
+     * @brief Puts a node into the slot matching its remaining delay.
+     */
+    void link(std::uint32_t index) {
+        Node& node = nodes_[index];
+        std::uint64_t delay = node.expires - now_;
+        unsigned level = 0;
+        while (level + 1 < kLevels && delay >= (1ull << ((level + 1) * kSlotBits))) {
+            ++level;
+        }
+        node.level = static_cast<std::uint8_t>(level);
+        node.slot = static_cast<std::uint8_t>((node.expires >> (level * kSlotBits)) & (kSlots - 1));
+
+        std::uint32_t& head = slots_[level][node.slot];
+        node.prev = kNil;
+        node.next = head;
+        if (head != kNil) {
+            nodes_[head].prev = index;
+        }
+        head = index;
+    }
+
+    void unlink(std::uint32_t index) {
+        Node& node = nodes_[index];
+        if (node.prev != kNil) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            slots_[node.level][node.slot] = node.next;
+        }
+        if (node.next != kNil) {
+            nodes_[node.next].prev = node.prev;
+        }
+    }
+
+    /**
+     * @brief Re-links the current slot of `level` into the levels below.
+     */
+    void cascade(unsigned level) {
+        std::uint32_t& head = slots_[level][(now_ >> (level * kSlotBits)) & (kSlots - 1)];
+        std::uint32_t index = head;
+        head = kNil;
+        while (index != kNil) {
+            std::uint32_t next = nodes_[index].next;
+            link(index);
+            index = next;
+        }
+    }
+
+    std::vector<Node> nodes_;                                       ///< Node storage, scheduled and free.
+    std::array<std::array<std::uint32_t, kSlots>, kLevels> slots_;  ///< Head node of each slot list.
+    std::uint32_t free_ = kNil;                                     ///< Head of the free node list.
+    std::uint64_t now_ = 0;                                         ///< Current tick.
+    std::size_t size_ = 0;                                          ///< Pending timers.
+};
+
+}  // namespace chat
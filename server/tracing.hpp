@@ -0,0 +1,141 @@
+/**
+ * @file tracing.hpp
+ * @brief Sampling tracer recording relay spans into a lock-free ring, exported as Chrome trace JSON.
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace chat {
+
+/**
+ * @brief Records timed spans of sampled messages.
+ *
+ * Writers claim a slot with one `fetch_add` and publish it with a sequence number,
+ * so recording never locks; when the ring is full the oldest spans are overwritten.
+ * The reader skips slots that are being rewritten while it looks at them.
+ * Load the result of `chrome_json()` in chrome://tracing or Perfetto.
+ */
+class Tracer {
+public:
+    static constexpr std::size_t kCapacity = 8192;   ///< Spans kept in the ring.
+
+    /**
+     * @brief Sets how many messages to skip between samples.
+     * @param every Trace one in `every` messages; 0 traces only messages that ask for it.
+     */
+    void set_sample_every(std::uint32_t every) { sample_every_.store(every, std::memory_order_relaxed); }
+
+    /**
+     * @brief Decides whether to trace the next message handled by this thread.
+     */
+    bool sample() {
+        std::uint32_t every = sample_every_.load(std::memory_order_relaxed);
+        if (every == 0) {
+            return false;
+        }
+        thread_local std::uint32_t countdown = 0;
+        if (countdown == 0) {
+            countdown = every - 1;
+            return true;
+        }
+        --countdown;
+        return false;
+    }
+
+    /**
+     * @brief Returns a new non-zero trace id.
+     */
+    std::uint64_t next_trace_id() {
+        return next_id_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Records one span.
+     * @param trace_id The trace the span belongs to.
+     * @param name Static span name (e.g. "parse", "lock", "queue", "write").
+     * @param start Start of the span.
+     * @param end End of the span.
+     */
+    void record(std::uint64_t trace_id, const char* name,
+                std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        std::uint64_t index = head_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = ring_[index % kCapacity];
+
+        // Seqlock: the fence keeps the field writes below after the store of 0
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.trace_id.store(trace_id, std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.start_us.store(to_micros(start), std::memory_order_relaxed);
+        slot.duration_us.store(to_micros(end) - to_micros(start), std::memory_order_relaxed);
+        slot.thread.store(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFF, std::memory_order_relaxed);
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns the recorded spans in Chrome trace event format.
+     */
+    std::string chrome_json() const {
+        std::ostringstream out;
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const Slot& slot : ring_) {
+            std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == 0) {
+                continue;
+            }
+            std::uint64_t trace_id = slot.trace_id.load(std::memory_order_relaxed);
+            const char* name = slot.name.load(std::memory_order_relaxed);
+            std::uint64_t start = slot.start_us.load(std::memory_order_relaxed);
+            std::uint64_t duration = slot.duration_us.load(std::memory_order_relaxed);
+            std::uint64_t thread = slot.thread.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);   // Keeps the field reads before the re-check
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;   // Rewritten while reading
+            }
+
+            out << (first ? "" : ",") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+                << ",\"ts\":" << start << ",\"dur\":" << duration << ",\"args\":{\"trace_id\":" << trace_id << "}}";
+            first = false;
+        }
+        out << "]}";
+        return out.str();
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::uint64_t> sequence{0};         ///< Ring index + 1 once published, 0 while written.
+        std::atomic<std::uint64_t> trace_id{0};
+        std::atomic<const char*> name{nullptr};
+        std::atomic<std::uint64_t> start_us{0};
+        std::atomic<std::uint64_t> duration_us{0};
+        std::atomic<std::uint64_t> thread{0};
+    };
+
+    static std::uint64_t to_micros(std::chrono::steady_clock::time_point time) {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count());
+    }
+
+    std::atomic<std::uint32_t> sample_every_{0};    ///< Sampling interval; 0 disables sampling.
+    std::atomic<std::uint64_t> next_id_{1};         ///< Next trace id handed out.
+    std::atomic<std::uint64_t> head_{0};            ///< Total spans ever recorded.
+    std::array<Slot, kCapacity> ring_;              ///< Most recent spans.
+};
+
+/**
+ * @brief Returns the process-wide tracer.
+ */
+inline Tracer& server_tracer() {
+    static Tracer tracer;
+    return tracer;
+}
+
+}  // namespace chat
@@ -0,0 +1,142 @@
+/**
+ * @file transfers.hpp
+ * @brief Bookkeeping and flow-control enforcement for relayed file transfers.
+ */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace chat {
+
+/**
+ * @brief Largest window a receiver may grant; bounds what one transfer can queue on the server.
+ */
+constexpr std::uint32_t kMaxFileWindow = 4 * 1024 * 1024;
+
+/**
+ * @brief Open file transfers between pairs of members.
+ *
+ * The server relays DATA frames without storing them, so the only per-transfer state
+ * is who may send, who receives and how far each side got. A sender that runs more than
+ * the granted window ahead of the receiver's acknowledgements is refused, which bounds
+ * what a transfer can ever queue on the server to one window.
+ *
+ * Not thread-safe; the server guards it with a mutex.
+ * @tparam Member Handle identifying a participant (e.g. `std::shared_ptr<Session>`).
+ */
+template <typename Member>
+class TransferTable {
+public:
+    /**
+     * @brief Registers an offer.
+     * @return false if `id` is already in use.
+     */
+    bool offer(std::uint64_t id, const Member& sender, const Member& recipient, std::uint64_t size) {
+        return transfers_.emplace(id, Transfer{sender, recipient, size}).second;
+    }
+
+    /**
+     * @brief Records that the recipient accepted.
+     * @param window Bytes the sender may have unacknowledged.
+     * @return The sender to forward the acceptance to, or nothing if `by` is not the recipient.
+     */
+    std::optional<Member> accept(std::uint64_t id, const Member& by, std::uint32_t window) {
+        auto it = transfers_.find(id);
+        if (it == transfers_.end() || it->second.recipient != by || it->second.window != 0) {
+            return std::nullopt;
+        }
+        it->second.window = std::max<std::uint32_t>(window, 1);
+        return it->second.sender;
+    }
+
+    /**
+     * @brief Checks one chunk against the transfer's state and flow-control window.
+     * @param bytes Chunk size.
+     * @return The recipient to relay the chunk to, or nothing if `from` may not send it.
+     */
+    std::optional<Member> data(std::uint64_t id, const Member& from, std::uint64_t bytes) {
+        auto it = transfers_.find(id);
+        if (it == transfers_.end()) {
+            return std::nullopt;
+        }
+        Transfer& transfer = it->second;
+        if (transfer.sender != from || transfer.window == 0 || transfer.relayed + bytes > transfer.size ||
+            transfer.relayed + bytes - transfer.acked > transfer.window) {
+            return std::nullopt;
+        }
+        transfer.relayed += bytes;
+        return transfer.recipient;
+    }
+
+    /**
+     * @brief Records the recipient's progress; the transfer ends when all bytes are acknowledged.
+     * @param offset Bytes the recipient has written.
+     * @return The sender to forward the acknowledgement to, or nothing if `by` is not the recipient.
+     */
+    std::optional<Member> ack(std::uint64_t id, const Member& by, std::uint64_t offset) {
+        auto it = transfers_.find(id);
+        if (it == transfers_.end() || it->second.recipient != by || offset > it->second.relayed) {
+            return std::nullopt;
+        }
+        Member sender = it->second.sender;
+        it->second.acked = std::max(it->second.acked, offset);
+        if (it->second.acked == it->second.size) {
+            transfers_.erase(it);
+        }
+        return sender;
+    }
+
+    /**
+     * @brief Ends a transfer on behalf of one participant.
+     * @return The other participant, or nothing if `by` takes no part in the transfer.
+     */
+    std::optional<Member> cancel(std::uint64_t id, const Member& by) {
+        auto it = transfers_.find(id);
+        if (it == transfers_.end() || (it->second.sender != by && it->second.recipient != by)) {
+            return std::nullopt;
+        }
+        Member other = it->second.sender == by ? it->second.recipient : it->second.sender;
+        transfers_.erase(it);
+        return other;
+    }
+
+    /**
+     * @brief Ends every transfer of a member that went away.
+     * @return The transfers ended and, for each, the other participant.
+     */
+    std::vector<std::pair<std::uint64_t, Member>> drop(const Member& member) {
+        std::vector<std::pair<std::uint64_t, Member>> ended;
+        for (auto it = transfers_.begin(); it != transfers_.end();) {
+            if (it->second.sender == member || it->second.recipient == member) {
+                ended.emplace_back(it->first, it->second.sender == member ? it->second.recipient : it->second.sender);
+                it = transfers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return ended;
+    }
+
+    /**
+     * @brief Returns the number of open transfers.
+     */
+    std::size_t size() const { return transfers_.size(); }
+
+private:
+    struct Transfer {
+        Member sender;                  ///< Participant sending DATA frames.
+        Member recipient;               ///< Participant receiving them.
+        std::uint64_t size = 0;         ///< File size in bytes.
+        std::uint32_t window = 0;       ///< Granted window; 0 until accepted.
+        std::uint64_t relayed = 0;      ///< Bytes relayed to the recipient.
+        std::uint64_t acked = 0;        ///< Bytes the recipient acknowledged.
+    };
+
+    std::map<std::uint64_t, Transfer> transfers_;   ///< Open transfers by id.
+};
+
+}  // namespace chat
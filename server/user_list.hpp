@@ -0,0 +1,173 @@
+/**
+ * @file user_list.hpp
+ * @brief Versioned, pre-serialized snapshot of the connected-user list.
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../common/compression.hpp"
+#include "../common/frame.hpp"
+#include "../common/message.hpp"
+
+namespace chat {
+
+/**
+ * @brief Immutable view of the user list at one membership version.
+ *
+ * Once published a snapshot is never modified, so it can be shared by
+ * reference between any number of pending writes.
+ */
+struct UserListSnapshot {
+    std::uint64_t version = 0;          /**< Membership version this snapshot was built from. */
+    std::vector<std::string> users;     /**< Usernames in ascending order. */
+    std::string serialized;             /**< The full `LIST` message, already encoded and framed for the wire. */
+    std::string first_page;             /**< The first unfiltered `LIST` page, already encoded and framed for the wire. */
+    std::string first_page_compressed;  /**< `first_page` as a compressed frame, for clients that negotiated compression. */
+
+    /**
+     * @brief Returns the full `LIST` message as a compressed frame, compressing it on first use.
+     *
+     * The full list can be large and few clients ask for it, so it is not compressed
+     * under the users lock when the snapshot is built.
+     */
+    const std::string& serialized_compressed() const {
+        std::call_once(compress_once_, [this]() {
+            serialized_compressed_ = encode_compressed_frame(serialized.substr(kFrameHeaderSize));
+        });
+        return serialized_compressed_;
+    }
+
+    /**
+     * @brief Builds a `LIST` response for one page of the users matching a prefix.
+     *
+     * The matching range is located with two binary searches over the sorted
+     * `users`, so a page costs O(log N + limit) regardless of `offset`.
+     * @param prefix Only usernames starting with this string are returned.
+     * @param offset Index of the first returned user within the matching range.
+     * @param limit Maximum number of users to return (clamped to `kMaxListPageSize`).
+     * @return A `LIST` message carrying the page and the total number of matches.
+     */
+    Message page(const std::string& prefix, std::uint32_t offset, std::uint32_t limit) const {
+        limit = std::min(limit == 0 ? kDefaultListPageSize : limit, kMaxListPageSize);
+
+        auto first = std::lower_bound(users.begin(), users.end(), prefix);
+        auto last = std::partition_point(first, users.end(), [&prefix](const std::string& name) {
+            return name.compare(0, prefix.size(), prefix) == 0;
+        });
+
+        Message response;
+        response.type = MessageType::LIST;
+        response.sender = "SERVER";
+        response.prefix = prefix;
+        response.offset = offset;
+        response.limit = limit;
+        response.total = static_cast<std::uint32_t>(last - first);
+
+        if (offset < response.total) {
+            auto begin = first + offset;
+            auto end = begin + std::min<std::ptrdiff_t>(limit, last - begin);
+            response.users.assign(begin, end);
+        }
+        return response;
+    }
+
+private:
+    mutable std::once_flag compress_once_;          ///< Guards the lazy compression of `serialized`.
+    mutable std::string serialized_compressed_;     ///< `serialized` as a compressed frame, once requested.
+};
+
+/**
+ * @brief Holds the current user-list snapshot and rebuilds it on membership changes.
+ *
+ * `rebuild()` is called by the writer while it already holds the lock guarding
+ * the user map; `current()` is lock-free and O(1), so `LIST` requests and
+ * broadcasts never walk the map or re-encode the full list.
+ */
+class UserListCache {
+public:
+    UserListCache() : current_(build({}, 0)) {}
+
+    /**
+     * @brief Publishes a new snapshot built from an ordered username → value map.
+     * @param users The map of connected users (iterated in key order).
+     * @return The newly published snapshot.
+     */
+    template <typename Map>
+    std::shared_ptr<const UserListSnapshot> rebuild(const Map& users) {
+        std::vector<std::string> names;
+        names.reserve(users.size());
+        for (const auto& user : users) {
+            names.push_back(user.first);
+        }
+
+        auto next = build(std::move(names), ++version_);
+        std::atomic_store(&current_, next);
+        return next;
+    }
+
+    /**
+     * @brief Publishes a new snapshot built from the union of two ordered username-keyed maps.
+     *
+     * Used in cluster mode to list local and remote users together.
+     * @param users The map of locally connected users.
+     * @param more The map of users connected elsewhere.
+     * @return The newly published snapshot.
+     */
+    template <typename Map, typename OtherMap>
+    std::shared_ptr<const UserListSnapshot> rebuild(const Map& users, const OtherMap& more) {
+        std::vector<std::string> names;
+        names.reserve(users.size() + more.size());
+
+        auto a = users.begin();
+        auto b = more.begin();
+        while (a != users.end() || b != more.end()) {
+            if (b == more.end() || (a != users.end() && a->first < b->first)) {
+                names.push_back((a++)->first);
+            } else if (a == users.end() || b->first < a->first) {
+                names.push_back((b++)->first);
+            } else {
+                names.push_back(a->first);
+                ++a;
+                ++b;
+            }
+        }
+
+        auto next = build(std::move(names), ++version_);
+        std::atomic_store(&current_, next);
+        return next;
+    }
+
+    /**
+     * @brief Returns the most recently published snapshot.
+     */
+    std::shared_ptr<const UserListSnapshot> current() const {
+        return std::atomic_load(&current_);
+    }
+
+private:
+    static std::shared_ptr<const UserListSnapshot> build(std::vector<std::string> names, std::uint64_t version) {
+        Message list;
+        list.type = MessageType::LIST;
+        list.sender = "SERVER";
+        list.users = std::move(names);
+
+        auto snapshot = std::make_shared<UserListSnapshot>();
+        snapshot->version = version;
+        snapshot->serialized = encode_frame(list.serialize());
+        snapshot->users = std::move(list.users);
+        std::string first_page = snapshot->page("", 0, kDefaultListPageSize).serialize();
+        snapshot->first_page = encode_frame(first_page);
+        snapshot->first_page_compressed = encode_compressed_frame(first_page);
+        return snapshot;
+    }
+
+    std::shared_ptr<const UserListSnapshot> current_;   ///< Published snapshot (accessed atomically).
+    std::uint64_t version_ = 0;                         ///< Last version handed out by `rebuild()`.
+};
+
+}  // namespace chat
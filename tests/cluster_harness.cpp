@@ -0,0 +1,256 @@
+/**
+ * @file cluster_harness.cpp
+ * @brief Local multi-process test of cluster mode.
+ *
+ * Starts several server processes on consecutive local ports, connects one client
+ * to each node and checks that presence is gossiped, that direct messages are
+ * routed between nodes, and that a user's published key can be fetched from another
+ * node so that a direct message to them crosses the cluster end-to-end encrypted. Usage: `cluster_harness <server-binary> [nodes] [base-port]`.
+ * Runs in the current directory, generating `server.crt`/`server.key` there if missing.
+ */
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../common/frame.hpp"
+#include "../common/message.hpp"
+#include "../common/utils.hpp"
+#include "../client/e2e.hpp"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+namespace ssl = asio::ssl;
+
+/**
+ * @brief A minimal test client speaking the chat protocol over TLS.
+ */
+class TestClient {
+public:
+    /**
+     * @brief Connects, handshakes and registers `username` with the server on `port`.
+     * @param public_key End-to-end public key (hex) to publish, or empty.
+     */
+    TestClient(asio::io_context& io_context, ssl::context& ssl_context, unsigned short port, const std::string& username,
+               const std::string& public_key = "")
+        : io_context_(io_context), stream_(io_context, ssl_context) {
+        tcp::resolver resolver(io_context_);
+        asio::connect(stream_.lowest_layer(), resolver.resolve("127.0.0.1", std::to_string(port)));
+        stream_.handshake(ssl::stream_base::client);
+
+        chat::Message reg;
+        reg.type = chat::MessageType::REGISTER;
+        reg.sender = username;
+        reg.public_key = public_key;
+        send(reg);
+    }
+
+    /**
+     * @brief Sends one message.
+     */
+    void send(const chat::Message& message) {
+        asio::write(stream_, asio::buffer(chat::encode_frame(message.serialize())));
+    }
+
+    /**
+     * @brief Reads messages until one satisfies `match` or the timeout expires.
+     * @return true if a matching message arrived in time.
+     */
+    bool wait_for(const std::function<bool(const chat::Message&)>& match, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::string frame;
+        while (std::chrono::steady_clock::now() < deadline) {
+            while (reader_.next(frame)) {
+                if (match(chat::Message::deserialize(frame))) {
+                    return true;
+                }
+            }
+
+            bool done = false;
+            bool failed = false;
+            stream_.async_read_some(asio::buffer(buffer_), [&](const boost::system::error_code& error, std::size_t n) {
+                done = true;
+                failed = static_cast<bool>(error);
+                reader_.feed(buffer_.data(), n);
+            });
+
+            io_context_.restart();
+            io_context_.run_for(deadline - std::chrono::steady_clock::now());
+            if (!done) {
+                stream_.lowest_layer().cancel();
+                io_context_.restart();
+                io_context_.run();
+                return false;
+            }
+            if (failed) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+private:
+    asio::io_context& io_context_;          ///< I/O context driving the reads.
+    ssl::stream<tcp::socket> stream_;       ///< TLS connection to the server.
+    std::array<char, 65536> buffer_;        ///< Receive buffer.
+    chat::FrameReader reader_;              ///< Frames received but not yet matched.
+};
+
+/**
+ * @brief Runs the harness.
+ * @return 0 if every check passed, 1 otherwise.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <server-binary> [nodes] [base-port]\n";
+        return 1;
+    }
+
+    std::string server_binary = argv[1];
+    int nodes = argc > 2 ? std::stoi(argv[2]) : 3;
+    int base_port = argc > 3 ? std::stoi(argv[3]) : 18443;
+
+    if (!file_exists("server.crt") || !file_exists("server.key")) {
+        if (std::system("openssl req -x509 -newkey rsa:2048 -keyout server.key -out server.crt "
+                        "-days 1 -nodes -subj '/CN=localhost' 2>/dev/null") != 0) {
+            std::cerr << "Could not generate certificates\n";
+            return 1;
+        }
+    }
+
+    // Launch one server process per node; node links listen 1000 ports above the client ports
+    std::vector<std::string> node_ids;
+    for (int i = 0; i < nodes; ++i) {
+        node_ids.push_back("127.0.0.1:" + std::to_string(base_port + 1000 + i));
+    }
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < nodes; ++i) {
+        std::string peers;
+        for (int j = 0; j < nodes; ++j) {
+            if (j != i) {
+                peers += (peers.empty() ? "" : ",") + node_ids[j];
+            }
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::string port = std::to_string(base_port + i);
+            execl(server_binary.c_str(), server_binary.c_str(), port.c_str(),
+                  "--node", node_ids[i].c_str(), "--peers", peers.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        children.push_back(pid);
+    }
+
+    auto stop_servers = [&children]() {
+        for (pid_t pid : children) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+    };
+
+    int failures = 0;
+    auto check = [&failures](bool ok, const std::string& what) {
+        std::cout << (ok ? "[ OK ] " : "[FAIL] ") << what << "\n";
+        if (!ok) {
+            ++failures;
+        }
+    };
+
+    try {
+        // Give the nodes time to bind and link up
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+        asio::io_context io_context;
+        ssl::context ssl_context(ssl::context::tlsv12_client);
+        ssl_context.set_verify_mode(ssl::verify_none);
+
+        // Every user publishes an end-to-end key
+        std::vector<std::unique_ptr<chat::EndToEnd>> keys;
+        std::vector<std::unique_ptr<TestClient>> clients;
+        for (int i = 0; i < nodes; ++i) {
+            keys.push_back(std::make_unique<chat::EndToEnd>(chat::E2eIdentity::generate()));
+            const std::string& key = keys.back()->public_key();
+            clients.push_back(std::make_unique<TestClient>(io_context, ssl_context, base_port + i, "user" + std::to_string(i),
+                to_hex(reinterpret_cast<const unsigned char*>(key.data()), key.size())));
+        }
+
+        // Presence: the last node must eventually list every user
+        auto& last = *clients.back();
+        bool all_listed = false;
+        for (int attempt = 0; attempt < 20 && !all_listed; ++attempt) {
+            chat::Message list;
+            list.type = chat::MessageType::LIST;
+            last.send(list);
+            all_listed = last.wait_for([nodes](const chat::Message& m) {
+                return m.type == chat::MessageType::LIST && m.limit == 0 && static_cast<int>(m.users.size()) == nodes;
+            }, std::chrono::milliseconds(250));
+        }
+        check(all_listed, "presence of all users gossiped to the last node");
+
+        // Routing: every client messages the client on the next node
+        for (int i = 0; i < nodes; ++i) {
+            int to = (i + 1) % nodes;
+            chat::Message message;
+            message.type = chat::MessageType::MESSAGE;
+            message.recipient = "user" + std::to_string(to);
+            message.content = "hello from node " + std::to_string(i);
+            clients[i]->send(message);
+
+            bool delivered = clients[to]->wait_for([&](const chat::Message& m) {
+                return m.type == chat::MessageType::MESSAGE && m.content == message.content &&
+                       m.sender == "user" + std::to_string(i);
+            }, std::chrono::seconds(2));
+            check(delivered, "message routed from node " + std::to_string(i) + " to node " + std::to_string(to));
+        }
+
+        // Encryption: user0 fetches user1's key from node 1 and seals a message to it
+        if (nodes > 1) {
+            chat::Message request;
+            request.type = chat::MessageType::KEY;
+            request.recipient = "user1";
+            clients[0]->send(request);
+
+            std::string peer_key;
+            clients[0]->wait_for([&](const chat::Message& m) {
+                return m.type == chat::MessageType::KEY && m.sender == "user1" && from_hex(m.public_key, peer_key);
+            }, std::chrono::seconds(2));
+            check(peer_key == keys[1]->public_key(), "key of a user on node 1 fetched from node 0");
+
+            chat::Message message;
+            message.type = chat::MessageType::MESSAGE;
+            message.recipient = "user1";
+            bool sealed = !peer_key.empty() && keys[0]->seal(peer_key, "secret across nodes", message.content);
+            if (sealed) {
+                clients[0]->send(message);
+            }
+
+            bool encrypted = sealed && clients[1]->wait_for([&](const chat::Message& m) {
+                std::string text;
+                std::string sender_key;
+                return m.type == chat::MessageType::MESSAGE && m.sender == "user0" &&
+                       m.content.rfind("e2e1:", 0) == 0 &&
+                       keys[1]->open(m.content, text, sender_key) == chat::EndToEnd::Opened::ok &&
+                       text == "secret across nodes" && sender_key == keys[0]->public_key();
+            }, std::chrono::seconds(2));
+            check(encrypted, "direct message from node 0 to node 1 arrives as an e2e1: envelope");
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Harness exception: " << e.what() << "\n";
+        ++failures;
+    }
+
+    stop_servers();
+    std::cout << (failures == 0 ? "Cluster harness passed\n" : "Cluster harness FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -5,8 +5,33 @@
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest/doctest.h"
+#include "../client/channel.hpp"
+#include "../client/e2e.hpp"
+#include "../client/history.hpp"
+#include "../client/renderer.hpp"
 #include "../common/message.hpp"
 #include "../common/utils.hpp"        // новая утилита
+#include "../common/capabilities.hpp"
+#include "../common/compression.hpp"
+#include "../common/file_transfer.hpp"
+#include "../common/frame.hpp"
+#include "../server/auth.hpp"
+#include "../server/devices.hpp"
+#include "../server/handoff.hpp"
+#include "../server/hash_ring.hpp"
+#include "../server/history_store.hpp"
+#include "../server/metrics.hpp"
+#include "../server/rate_limit.hpp"
+#include "../server/rooms.hpp"
+#include "../server/timing_wheel.hpp"
+#include "../server/tracing.hpp"
+#include "../server/transfers.hpp"
+#include "../server/user_list.hpp"
+#include <future>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
 
 using namespace chat;
 
@@ -36,6 +61,86 @@ TEST_SUITE("Message") {
         CHECK(r.users     == m.users);
     }
 
+    /**
+     * @brief Tests that optional LIST paging fields round-trip and default to zero when absent.
+     */
+    TEST_CASE("optional paging fields") {
+        Message m;
+        m.type   = MessageType::LIST;
+        m.prefix = "al";
+        m.offset = 40;
+        m.limit  = 20;
+        m.total  = 95;
+
+        auto r = Message::deserialize(m.serialize());
+        CHECK(r.prefix == "al");
+        CHECK(r.offset == 40);
+        CHECK(r.limit  == 20);
+        CHECK(r.total  == 95);
+
+        Message plain;
+        plain.type = MessageType::LIST;
+        auto j = nlohmann::json::parse(plain.serialize());
+        CHECK_FALSE(j.contains("prefix"));
+        CHECK_FALSE(j.contains("limit"));
+    }
+
+    /**
+     * @brief Tests that trace timestamps round-trip and are omitted for untraced messages.
+     */
+    TEST_CASE("optional trace fields") {
+        Message m;
+        m.type             = MessageType::MESSAGE;
+        m.trace_id         = 7;
+        m.t_client_send    = 1000;
+        m.t_server_recv    = 1200;
+        m.t_server_enqueue = 1250;
+
+        auto r = Message::deserialize(m.serialize());
+        CHECK(r.trace_id         == 7);
+        CHECK(r.t_client_send    == 1000);
+        CHECK(r.t_server_recv    == 1200);
+        CHECK(r.t_server_enqueue == 1250);
+
+        Message untraced;
+        untraced.type = MessageType::MESSAGE;
+        auto j = nlohmann::json::parse(untraced.serialize());
+        CHECK_FALSE(j.contains("trace_id"));
+        CHECK_FALSE(j.contains("t_client_send"));
+    }
+
+    /**
+     * @brief Tests that BATCH entries round-trip in order and may not nest.
+     */
+    TEST_CASE("batch entries") {
+        Message batch;
+        batch.type = MessageType::BATCH;
+        for (const char* recipient : {"bob", "carol", "bob"}) {
+            Message entry;
+            entry.type      = MessageType::MESSAGE;
+            entry.recipient = recipient;
+            entry.content   = std::string("to ") + recipient;
+            batch.batch.push_back(entry);
+        }
+
+        auto r = Message::deserialize(batch.serialize());
+        CHECK(r.type == MessageType::BATCH);
+        REQUIRE(r.batch.size() == 3);
+        CHECK(r.batch[1].recipient == "carol");
+        CHECK(r.batch[2].content   == "to bob");
+        Message single;
+        single.type = MessageType::MESSAGE;
+        CHECK_FALSE(nlohmann::json::parse(single.serialize()).contains("batch"));
+
+        Message nested;
+        nested.type = MessageType::BATCH;
+        nested.batch.push_back(batch);
+        Message parsed;
+        CHECK_FALSE(Message::try_deserialize(nested.serialize(), parsed));
+        CHECK_FALSE(Message::try_deserialize(R"({"type":18,"sender":"","recipient":"","content":"","users":[],)"
+                                             R"("batch":[{"type":1}]})", parsed));
+    }
+
     /**
      * @brief Tests that deserialization handles invalid JSON gracefully.
      */
@@ -44,6 +149,18 @@ TEST_SUITE("Message") {
         CHECK_NOTHROW(Message::deserialize(garbage));
     }
 
+    /**
+     * @brief Tests that try_deserialize reports malformed input.
+     */
+    TEST_CASE("try_deserialize reports failure") {
+        Message m;
+        CHECK_FALSE(Message::try_deserialize("{ invalid json }", m));
+        CHECK_FALSE(Message::try_deserialize("{\"type\": 3}", m));
+        Message list;
+        list.type = MessageType::LIST;
+        CHECK(Message::try_deserialize(list.serialize(), m));
+    }
+
     /**
      * @brief Tests that the MessageType enum is correctly stored as an integer in JSON.
      */
@@ -87,3 +204,1475 @@ TEST_SUITE("Utils") {
         CHECK(file_exists("definitely_no_file_42.tmp") == false);
     }
 }
+
+
+/* ─────── UserListCache ─────── */
+/**
+ * @brief Test suite for the cached user-list snapshot.
+ */
+TEST_SUITE("UserListCache") {
+    /**
+     * @brief Tests that a rebuild publishes a new version with the encoded user list.
+     */
+    TEST_CASE("rebuild publishes sorted, serialized snapshot") {
+        UserListCache cache;
+        std::map<std::string, int> users{{"carol", 0}, {"alice", 0}, {"bob", 0}};
+
+        auto before = cache.current();
+        auto after  = cache.rebuild(users);
+
+        CHECK(after->version == before->version + 1);
+        CHECK(after->users == std::vector<std::string>{"alice", "bob", "carol"});
+
+        auto decoded = Message::deserialize(after->serialized.substr(kFrameHeaderSize));
+        CHECK(decoded.type  == MessageType::LIST);
+        CHECK(decoded.users == after->users);
+    }
+
+    /**
+     * @brief Tests that readers share the same snapshot until membership changes.
+     */
+    TEST_CASE("current is shared until next rebuild") {
+        UserListCache cache;
+        std::map<std::string, int> users{{"alice", 0}};
+        cache.rebuild(users);
+
+        auto a = cache.current();
+        auto b = cache.current();
+        CHECK(a.get() == b.get());
+
+        users.erase("alice");
+        cache.rebuild(users);
+        CHECK(cache.current().get() != a.get());
+        CHECK(a->users == std::vector<std::string>{"alice"});
+        CHECK(cache.current()->users.empty());
+    }
+
+    /**
+     * @brief Tests prefix filtering and offset/limit paging over the snapshot.
+     */
+    TEST_CASE("page filters by prefix and slices by offset") {
+        UserListCache cache;
+        std::map<std::string, int> users{{"al", 0}, {"alice", 0}, {"alina", 0}, {"bob", 0}, {"zed", 0}};
+        auto snapshot = cache.rebuild(users);
+
+        auto page = snapshot->page("al", 1, 5);
+        CHECK(page.total == 3);
+        CHECK(page.users == std::vector<std::string>{"alice", "alina"});
+
+        CHECK(snapshot->page("", 4, 2).users == std::vector<std::string>{"zed"});
+        CHECK(snapshot->page("", 10, 2).users.empty());
+        CHECK(snapshot->page("x", 0, 2).total == 0);
+        CHECK(snapshot->page("", 0, 100000).limit == kMaxListPageSize);
+
+        auto first = Message::deserialize(snapshot->first_page.substr(kFrameHeaderSize));
+        CHECK(first.total == 5);
+        CHECK(first.users.size() == 5);
+    }
+}
+
+/* ─────── RoomRegistry ─────── */
+/**
+ * @brief Test suite for room membership.
+ */
+TEST_SUITE("RoomRegistry") {
+    /**
+     * @brief Tests create, join and leave semantics, including removal of empty rooms.
+     */
+    TEST_CASE("create / join / leave") {
+        RoomRegistry<int> rooms;
+
+        CHECK(rooms.create("#dev", 1));
+        CHECK_FALSE(rooms.create("#dev", 2));
+        CHECK_FALSE(rooms.join("#ops", 2));
+
+        CHECK(rooms.join("#dev", 2));
+        CHECK(rooms.join("#dev", 2));          // idempotent
+        CHECK(rooms.members("#dev")->size() == 2);
+
+        CHECK(rooms.leave("#dev", 1));
+        CHECK_FALSE(rooms.leave("#dev", 1));
+        CHECK(*rooms.members("#dev") == std::vector<int>{2});
+
+        CHECK(rooms.leave("#dev", 2));
+        CHECK(rooms.members("#dev") == nullptr);
+        CHECK(rooms.size() == 0);
+    }
+
+    /**
+     * @brief Tests room name detection.
+     */
+    TEST_CASE("is_room_name") {
+        CHECK(is_room_name("#general"));
+        CHECK_FALSE(is_room_name("#"));
+        CHECK_FALSE(is_room_name("alice"));
+    }
+}
+
+/* ─────── DeviceSet ─────── */
+/**
+ * @brief Test suite for the sessions of a multi-device user.
+ */
+TEST_SUITE("DeviceSet") {
+    /**
+     * @brief Returns the members in visiting order.
+     */
+    std::vector<int> members(const DeviceSet<int>& devices) {
+        std::vector<int> out;
+        devices.for_each([&out](int member) { out.push_back(member); });
+        return out;
+    }
+
+    /**
+     * @brief Tests add, remove and ordering, including removing the first device.
+     */
+    TEST_CASE("add / remove") {
+        DeviceSet<int> devices(1);
+        CHECK(devices.size() == 1);
+        CHECK(devices.latest() == 1);
+
+        devices.add(2);
+        devices.add(3);
+        devices.add(2);                         // idempotent
+        CHECK(members(devices) == std::vector<int>{1, 2, 3});
+        CHECK(devices.latest() == 3);
+        CHECK(devices.contains(2));
+
+        CHECK(devices.remove(1));
+        CHECK(members(devices) == std::vector<int>{2, 3});
+        CHECK_FALSE(devices.remove(1));
+        CHECK(devices.remove(3));
+        CHECK(devices.latest() == 2);
+
+        CHECK(devices.remove(2));
+        CHECK(devices.empty());
+        CHECK(devices.size() == 0);
+        CHECK(members(devices).empty());
+        CHECK_FALSE(devices.contains(2));
+        CHECK_FALSE(devices.remove(2));
+    }
+}
+
+/* ─────── Framing ─────── */
+/**
+ * @brief Test suite for length-prefixed framing.
+ */
+TEST_SUITE("Frame") {
+    /**
+     * @brief Tests that frames split and coalesced arbitrarily by the transport are reassembled.
+     */
+    TEST_CASE("reassembles split and coalesced frames") {
+        std::string stream = encode_frame("first") + encode_frame("") + encode_frame(std::string(5000, 'x'));
+
+        FrameReader reader;
+        std::vector<std::string> frames;
+        std::string payload;
+        for (std::size_t i = 0; i < stream.size(); i += 7) {
+            reader.feed(stream.data() + i, std::min<std::size_t>(7, stream.size() - i));
+            while (reader.next(payload)) {
+                frames.push_back(payload);
+            }
+        }
+
+        REQUIRE(frames.size() == 3);
+        CHECK(frames[0] == "first");
+        CHECK(frames[1].empty());
+        CHECK(frames[2] == std::string(5000, 'x'));
+        CHECK(reader.pending() == 0);
+    }
+
+    /**
+     * @brief Tests that an oversized length header is rejected instead of buffered.
+     */
+    TEST_CASE("rejects oversized frames") {
+        FrameReader reader;
+        const char header[] = {'\x7f', '\x00', '\x00', '\x00'};
+        reader.feed(header, sizeof(header));
+        std::string payload;
+        CHECK_THROWS_AS(reader.next(payload), std::length_error);
+
+        FrameReader small(16);
+        std::string frame = encode_frame(std::string(17, 'x'));
+        small.feed(frame.data(), frame.size());
+        CHECK_THROWS_AS(small.next(payload), std::length_error);
+    }
+
+    /**
+     * @brief Tests that DATA frames carry their transfer id and chunk through a FrameReader.
+     */
+    TEST_CASE("data frames round-trip") {
+        std::string chunk("chunk\0bytes", 11);
+        Message ping;
+        ping.type = MessageType::PING;
+        std::string stream = encode_frame(ping.serialize()) +
+                             encode_data_frame(0x0102030405060708ULL, chunk.data(), chunk.size());
+
+        FrameReader reader;
+        reader.feed(stream.data(), stream.size());
+        std::string payload;
+        REQUIRE(reader.next(payload));
+        CHECK_FALSE(is_data_frame(payload));
+        REQUIRE(reader.next(payload));
+        REQUIRE(is_data_frame(payload));
+
+        std::uint64_t id = 0;
+        REQUIRE(parse_data_frame(payload, id));
+        CHECK(id == 0x0102030405060708ULL);
+        CHECK(payload.substr(kDataHeaderSize) == chunk);
+        CHECK_FALSE(parse_data_frame(std::string(1, kDataFrameTag), id));
+        CHECK(kFrameHeaderSize + kDataHeaderSize + kFileChunkSize == 16 * 1024);
+    }
+}
+
+/* ─────── Compression ─────── */
+/**
+ * @brief Test suite for per-frame compression.
+ */
+TEST_SUITE("Compression") {
+    /**
+     * @brief Tests that long messages shrink and come back intact, and short ones are left alone.
+     */
+    TEST_CASE("compressed frames round-trip") {
+        Message message;
+        message.type = MessageType::MESSAGE;
+        message.sender = "alice";
+        message.recipient = "bob";
+        message.content = "see you at the meeting tomorrow, the build failed again so I am looking at the logs";
+        std::string payload = message.serialize();
+        REQUIRE(payload.size() >= kCompressThreshold);
+
+        std::string frame = encode_compressed_frame(payload);
+        CHECK(frame.size() < kFrameHeaderSize + payload.size());
+
+        FrameReader reader;
+        reader.feed(frame.data(), frame.size());
+        std::string received;
+        REQUIRE(reader.next(received));
+        REQUIRE(is_compressed_frame(received));
+        REQUIRE(decompress_frame(received, kMaxFrameSize));
+        CHECK(received == payload);
+
+        Message small;
+        small.type = MessageType::PING;
+        std::string ping = small.serialize();
+        CHECK(encode_compressed_frame(ping) == encode_frame(ping));
+    }
+
+    /**
+     * @brief Tests that end-to-end encrypted messages are framed without compression.
+     */
+    TEST_CASE("ciphertext is not compressed") {
+        EndToEnd alice(E2eIdentity::generate());
+        EndToEnd bob(E2eIdentity::generate());
+        Message message;
+        message.type = MessageType::MESSAGE;
+        message.sender = "alice";
+        message.recipient = "bob";
+        REQUIRE(alice.seal(bob.public_key(), "see you at the meeting tomorrow", message.content));
+        std::string payload = message.serialize();
+        REQUIRE(payload.size() >= kCompressThreshold);
+        CHECK(carries_ciphertext(payload));
+        CHECK(encode_compressed_frame(payload) == encode_frame(payload));
+
+        message.content = "e2e is short for end to end, and this line is long enough to be compressed";
+        CHECK_FALSE(carries_ciphertext(message.serialize()));
+    }
+
+    /**
+     * @brief Tests that corrupt input and output beyond the size limit are rejected.
+     */
+    TEST_CASE("rejects corrupt and oversized payloads") {
+        std::string compressed;
+        REQUIRE(frame_codec().compress(std::string(100000, 'a'), compressed));
+        CHECK(compressed.size() < 1000);
+
+        std::string bomb = compressed;
+        CHECK_FALSE(decompress_frame(bomb, 64 * 1024));
+
+        std::string truncated = compressed.substr(0, compressed.size() / 2);
+        CHECK_FALSE(decompress_frame(truncated, kMaxFrameSize));
+
+        std::string garbage = std::string(1, kCompressedFrameTag) + "\xff\xff\xff\xff";
+        CHECK_FALSE(decompress_frame(garbage, kMaxFrameSize));
+
+        std::string restored = compressed;
+        REQUIRE(decompress_frame(restored, kMaxFrameSize));
+        CHECK(restored == std::string(100000, 'a'));
+    }
+
+    /**
+     * @brief Tests that the negotiated codec survives serialization and is omitted when unset.
+     */
+    TEST_CASE("codec field is optional") {
+        Message reg;
+        reg.type = MessageType::REGISTER;
+        reg.sender = "alice";
+        CHECK(reg.serialize().find("compression") == std::string::npos);
+
+        reg.compression = kCompressionCodec;
+        CHECK(Message::deserialize(reg.serialize()).compression == kCompressionCodec);
+    }
+
+    /**
+     * @brief Tests that user-list snapshots carry compressed twins of their frames.
+     */
+    TEST_CASE("user list snapshot has compressed frames") {
+        std::map<std::string, int> users;
+        for (int i = 0; i < 50; ++i) {
+            users["user" + std::to_string(i)] = i;
+        }
+        UserListCache cache;
+        auto snapshot = cache.rebuild(users);
+
+        std::string page = snapshot->first_page_compressed.substr(kFrameHeaderSize);
+        REQUIRE(is_compressed_frame(page));
+        REQUIRE(decompress_frame(page, kMaxFrameSize));
+        CHECK(page == snapshot->first_page.substr(kFrameHeaderSize));
+
+        std::string full = snapshot->serialized_compressed().substr(kFrameHeaderSize);
+        REQUIRE(decompress_frame(full, kMaxFrameSize));
+        CHECK(full == snapshot->serialized.substr(kFrameHeaderSize));
+    }
+}
+
+/* ─────── File transfers ─────── */
+/**
+ * @brief Test suite for the server's transfer table.
+ */
+TEST_SUITE("TransferTable") {
+    /**
+     * @brief Tests a transfer from offer to the final acknowledgement within its window.
+     */
+    TEST_CASE("enforces the window until complete") {
+        TransferTable<std::string> transfers;
+        REQUIRE(transfers.offer(1, "alice", "bob", 300));
+        CHECK_FALSE(transfers.offer(1, "carol", "bob", 10));
+
+        CHECK_FALSE(transfers.data(1, "alice", 100));               // Not accepted yet
+        CHECK_FALSE(transfers.accept(1, "alice", 200));             // Only the recipient accepts
+        CHECK(transfers.accept(1, "bob", 200) == std::optional<std::string>("alice"));
+
+        CHECK(transfers.data(1, "alice", 200) == std::optional<std::string>("bob"));
+        CHECK_FALSE(transfers.data(1, "alice", 1));                 // Window used up
+        CHECK_FALSE(transfers.data(1, "bob", 1));                   // Wrong direction
+        CHECK_FALSE(transfers.ack(1, "bob", 250));                  // Beyond what was relayed
+        CHECK(transfers.ack(1, "bob", 200) == std::optional<std::string>("alice"));
+        CHECK(transfers.data(1, "alice", 100));
+        CHECK_FALSE(transfers.data(1, "alice", 1));                 // Past the announced size
+        CHECK(transfers.ack(1, "bob", 300));
+        CHECK(transfers.size() == 0);
+    }
+
+    /**
+     * @brief Tests cancelling by either party and dropping a disconnected member.
+     */
+    TEST_CASE("cancel and drop") {
+        TransferTable<std::string> transfers;
+        transfers.offer(1, "alice", "bob", 10);
+        transfers.offer(2, "bob", "carol", 10);
+        transfers.offer(3, "dave", "alice", 10);
+
+        CHECK_FALSE(transfers.cancel(2, "alice"));
+        CHECK(transfers.cancel(2, "carol") == std::optional<std::string>("bob"));
+
+        auto ended = transfers.drop("alice");
+        REQUIRE(ended.size() == 2);
+        CHECK(ended[0] == std::make_pair(std::uint64_t{1}, std::string("bob")));
+        CHECK(ended[1] == std::make_pair(std::uint64_t{3}, std::string("dave")));
+        CHECK(transfers.size() == 0);
+    }
+}
+
+/* ─────── HashRing ─────── */
+/**
+ * @brief Test suite for the cluster's consistent-hash ring.
+ */
+TEST_SUITE("HashRing") {
+    /**
+     * @brief Tests that every node agrees on owners regardless of node list order.
+     */
+    TEST_CASE("owner is independent of node order") {
+        HashRing a({"n1:1", "n2:2", "n3:3"});
+        HashRing b({"n3:3", "n1:1", "n2:2", "n1:1"});
+        CHECK(b.nodes().size() == 3);
+        for (int i = 0; i < 100; ++i) {
+            std::string user = "user" + std::to_string(i);
+            CHECK(a.owner(user) == b.owner(user));
+        }
+    }
+
+    /**
+     * @brief Tests that keys spread over all nodes and that adding a node moves only a fraction of them.
+     */
+    TEST_CASE("spreads keys and moves few on growth") {
+        HashRing three({"n1:1", "n2:2", "n3:3"});
+        HashRing four({"n1:1", "n2:2", "n3:3", "n4:4"});
+
+        std::set<std::string> owners;
+        int moved = 0;
+        for (int i = 0; i < 1000; ++i) {
+            std::string user = "user" + std::to_string(i);
+            owners.insert(three.owner(user));
+            if (three.owner(user) != four.owner(user)) {
+                CHECK(four.owner(user) == "n4:4");
+                ++moved;
+            }
+        }
+        CHECK(owners.size() == 3);
+        CHECK(moved > 100);
+        CHECK(moved < 450);
+    }
+
+    /**
+     * @brief Tests node id parsing.
+     */
+    TEST_CASE("split_node_id") {
+        CHECK(split_node_id("127.0.0.1:9443") == std::make_pair(std::string("127.0.0.1"), std::string("9443")));
+        CHECK(split_node_id("host").second.empty());
+    }
+}
+
+/* ─────── Metrics ─────── */
+/**
+ * @brief Test suite for the lock-free metrics.
+ */
+TEST_SUITE("Metrics") {
+    /**
+     * @brief Tests that per-thread counter shards add up.
+     */
+    TEST_CASE("counter sums over threads") {
+        Counter counter("test_total", "Test counter.");
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&counter] {
+                for (int i = 0; i < 10000; ++i) {
+                    counter.inc();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(counter.value() == 40000);
+    }
+
+    /**
+     * @brief Tests histogram bucketing and the text exposition format.
+     */
+    TEST_CASE("histogram renders cumulative buckets") {
+        Histogram histogram("test_latency_seconds", "Test histogram.", {10, 100}, 1e-6);
+        histogram.observe(5);
+        histogram.observe(10);
+        histogram.observe(50);
+        histogram.observe(1000);
+        CHECK(histogram.count() == 4);
+
+        std::ostringstream out;
+        histogram.render(out);
+        auto text = out.str();
+        CHECK(text.find("# TYPE test_latency_seconds histogram") != std::string::npos);
+        CHECK(text.find("test_latency_seconds_bucket{le=\"1e-05\"} 2") != std::string::npos);
+        CHECK(text.find("test_latency_seconds_bucket{le=\"0.0001\"} 3") != std::string::npos);
+        CHECK(text.find("test_latency_seconds_bucket{le=\"+Inf\"} 4") != std::string::npos);
+        CHECK(text.find("test_latency_seconds_count 4") != std::string::npos);
+    }
+
+    /**
+     * @brief Tests that a labelled counter family renders one line per label value.
+     */
+    TEST_CASE("counter vec renders labels") {
+        CounterVec rejected("test_rejected_total", "Test family.", "reason", {"a", "b"});
+        rejected.inc(1, 2);
+        CHECK(rejected.value(0) == 0);
+        CHECK(rejected.value(1) == 2);
+
+        std::ostringstream out;
+        rejected.render(out);
+        auto text = out.str();
+        CHECK(text.find("# TYPE test_rejected_total counter") != std::string::npos);
+        CHECK(text.find("test_rejected_total{reason=\"a\"} 0") != std::string::npos);
+        CHECK(text.find("test_rejected_total{reason=\"b\"} 2") != std::string::npos);
+    }
+
+    /**
+     * @brief Tests that the server metric set renders every metric.
+     */
+    TEST_CASE("server metrics render") {
+        ServerMetrics metrics;
+        metrics.connections.inc(3);
+        auto text = metrics.render();
+        CHECK(text.find("chat_connections_total 3") != std::string::npos);
+        for (const Metric* metric : metrics.all()) {
+            CHECK(text.find("# TYPE " + metric->name() + " ") != std::string::npos);
+        }
+    }
+}
+
+/* ─────── Tracing ─────── */
+/**
+ * @brief Test suite for the sampling tracer.
+ */
+TEST_SUITE("Tracer") {
+    /**
+     * @brief Tests that recorded spans are exported as Chrome trace events.
+     */
+    TEST_CASE("records spans as chrome trace json") {
+        auto tracer = std::make_unique<Tracer>();
+        CHECK(tracer->chrome_json() == "{\"traceEvents\":[]}");
+
+        auto start = std::chrono::steady_clock::now();
+        tracer->record(42, "parse", start, start + std::chrono::microseconds(15));
+
+        auto j = nlohmann::json::parse(tracer->chrome_json());
+        REQUIRE(j["traceEvents"].size() == 1);
+        CHECK(j["traceEvents"][0]["name"] == "parse");
+        CHECK(j["traceEvents"][0]["ph"] == "X");
+        CHECK(j["traceEvents"][0]["dur"] == 15);
+        CHECK(j["traceEvents"][0]["args"]["trace_id"] == 42);
+    }
+
+    /**
+     * @brief Tests that the ring keeps only the most recent spans.
+     */
+    TEST_CASE("ring overwrites oldest spans") {
+        auto tracer = std::make_unique<Tracer>();
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 1; i <= Tracer::kCapacity + 10; ++i) {
+            tracer->record(i, "write", start, start);
+        }
+
+        auto j = nlohmann::json::parse(tracer->chrome_json());
+        REQUIRE(j["traceEvents"].size() == Tracer::kCapacity);
+        std::set<std::uint64_t> ids;
+        for (const auto& event : j["traceEvents"]) {
+            ids.insert(event["args"]["trace_id"].get<std::uint64_t>());
+        }
+        CHECK(*ids.begin() == 11);
+    }
+
+    /**
+     * @brief Tests the sampling interval.
+     */
+    TEST_CASE("samples one in n") {
+        auto tracer = std::make_unique<Tracer>();
+        CHECK_FALSE(tracer->sample());
+
+        tracer->set_sample_every(4);
+        int sampled = 0;
+        for (int i = 0; i < 400; ++i) {
+            sampled += tracer->sample() ? 1 : 0;
+        }
+        CHECK(sampled == 100);
+        CHECK(tracer->next_trace_id() != tracer->next_trace_id());
+    }
+}
+
+/* ─────── TimingWheel ─────── */
+/**
+ * @brief Test suite for the hierarchical timing wheel.
+ */
+TEST_SUITE("TimingWheel") {
+    /**
+     * @brief Tests that timers on every level fire exactly on their tick.
+     */
+    TEST_CASE("fires on the scheduled tick across levels") {
+        TimingWheel<std::uint64_t> wheel;
+        std::vector<std::uint64_t> delays = {1, 5, 63, 64, 65, 4095, 4096, 4097, 300000, 70000};
+        for (auto delay : delays) {
+            wheel.schedule(delay, delay);
+        }
+        CHECK(wheel.size() == delays.size());
+
+        std::map<std::uint64_t, std::uint64_t> fired_at;
+        for (int i = 0; i < 300000; ++i) {
+            wheel.advance(1, [&](std::uint64_t&& delay) { fired_at[delay] = wheel.now(); });
+        }
+        CHECK(wheel.size() == 0);
+        REQUIRE(fired_at.size() == delays.size());
+        for (const auto& entry : fired_at) {
+            CHECK(entry.first == entry.second);
+        }
+    }
+
+    /**
+     * @brief Tests cancellation, including ids of nodes that were reused.
+     */
+    TEST_CASE("cancel") {
+        TimingWheel<int> wheel;
+        auto first = wheel.schedule(10, 1);
+        CHECK(wheel.cancel(first));
+        CHECK_FALSE(wheel.cancel(first));
+
+        auto second = wheel.schedule(10, 2);   // Reuses the node of `first`
+        CHECK_FALSE(wheel.cancel(first));
+
+        std::vector<int> fired;
+        wheel.advance(10, [&](int&& value) { fired.push_back(value); });
+        CHECK(fired == std::vector<int>{2});
+        CHECK_FALSE(wheel.cancel(second));
+    }
+
+    /**
+     * @brief Tests that handlers can re-arm timers and batched advances catch up.
+     */
+    TEST_CASE("handlers may reschedule") {
+        TimingWheel<int> wheel;
+        wheel.schedule(3, 0);
+        int fired = 0;
+        wheel.advance(30, [&](int&& count) {
+            ++fired;
+            wheel.schedule(3, count + 1);
+        });
+        CHECK(fired == 10);
+        CHECK(wheel.size() == 1);
+    }
+}
+
+/* ─────── Handoff ─────── */
+/**
+ * @brief Test suite for inheriting listening sockets.
+ */
+TEST_SUITE("Handoff") {
+    /**
+     * @brief Tests parsing of the systemd-style environment and that it is consumed.
+     */
+    TEST_CASE("inherited_listen_fds reads LISTEN_* for this pid only") {
+        setenv("LISTEN_FDS", "2", 1);
+        setenv("LISTEN_PID", std::to_string(getpid() + 1).c_str(), 1);
+        CHECK(inherited_listen_fds().empty());
+
+        setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+        setenv("LISTEN_FDNAMES", "client:metrics", 1);
+        auto fds = inherited_listen_fds();
+        REQUIRE(fds.size() == 2);
+        CHECK(fds[0].fd == 3);
+        CHECK(fds[0].name == "client");
+        CHECK(fds[1].fd == 4);
+        CHECK(fds[1].name == "metrics");
+
+        CHECK(std::getenv("LISTEN_FDS") == nullptr);
+        CHECK(inherited_listen_fds().empty());
+    }
+}
+
+/* ─────── RateLimiter ─────── */
+/**
+ * @brief Test suite for the token-bucket rate limiter.
+ */
+TEST_SUITE("RateLimiter") {
+    /**
+     * @brief Tests that a burst is allowed, then the sustained rate.
+     */
+    TEST_CASE("reject policy allows burst then rate") {
+        RateLimiter limiter(10, 5);     // 10/s, burst of 5
+        auto now = std::chrono::steady_clock::now();
+        for (int i = 0; i < 5; ++i) {
+            CHECK(limiter.try_acquire(now));
+        }
+        CHECK_FALSE(limiter.try_acquire(now));
+        CHECK_FALSE(limiter.try_acquire(now + std::chrono::milliseconds(50)));
+        CHECK(limiter.try_acquire(now + std::chrono::milliseconds(100)));
+        CHECK_FALSE(limiter.try_acquire(now + std::chrono::milliseconds(100)));
+
+        // A weighted request may not exceed the burst either
+        RateLimiter bytes(1000, 4000);
+        CHECK(bytes.try_acquire(now, 4000));
+        CHECK_FALSE(bytes.try_acquire(now, 1));
+        CHECK(bytes.try_acquire(now + std::chrono::seconds(1), 1000));
+    }
+
+    /**
+     * @brief Tests checking without spending, and capping costs at the burst.
+     */
+    TEST_CASE("conforms and cap") {
+        RateLimiter bytes(1000, 4000);
+        auto now = std::chrono::steady_clock::now();
+        CHECK(bytes.conforms(now, 4000));
+        CHECK(bytes.conforms(now, 4000));   // Nothing was spent
+        CHECK_FALSE(bytes.conforms(now, 4001));
+        CHECK(bytes.cap(10000) == doctest::Approx(4000));
+        CHECK(bytes.cap(10) == doctest::Approx(10));
+        CHECK(bytes.try_acquire(now, bytes.cap(10000)));
+        CHECK_FALSE(bytes.conforms(now, 1));
+        CHECK(RateLimiter(0, 0).cap(1e9) == doctest::Approx(1e9));
+    }
+
+    /**
+     * @brief Tests that the delay policy reports how long to back off.
+     */
+    TEST_CASE("delay policy reports back-off") {
+        RateLimiter limiter(100, 2);    // 10 ms per unit
+        auto now = std::chrono::steady_clock::now();
+        CHECK(limiter.acquire(now) == std::chrono::steady_clock::duration::zero());
+        CHECK(limiter.acquire(now) == std::chrono::steady_clock::duration::zero());
+        CHECK(limiter.acquire(now) == std::chrono::milliseconds(10));
+        CHECK(limiter.acquire(now) == std::chrono::milliseconds(20));
+    }
+
+    /**
+     * @brief Tests that a zero rate disables the limiter.
+     */
+    TEST_CASE("zero rate disables") {
+        RateLimiter limiter(0, 0);
+        auto now = std::chrono::steady_clock::now();
+        CHECK_FALSE(limiter.enabled());
+        for (int i = 0; i < 1000; ++i) {
+            CHECK(limiter.try_acquire(now, 1e9));
+        }
+        CHECK(limiter.acquire(now, 1e9) == std::chrono::steady_clock::duration::zero());
+    }
+}
+
+/* ─────── Channel ─────── */
+/**
+ * @brief Test suite for the client's thread hand-off channel.
+ */
+TEST_SUITE("Channel") {
+    /**
+     * @brief Tests that items arrive in order and that close lets the consumer drain first.
+     */
+    TEST_CASE("fifo then drain after close") {
+        Channel<int> channel;
+        channel.push(1);
+        channel.push(2);
+        channel.close();
+        channel.push(3);                // dropped
+
+        CHECK(channel.pop() == 1);
+        CHECK(channel.pop() == 2);
+        CHECK_FALSE(channel.pop().has_value());
+    }
+
+    /**
+     * @brief Tests that a blocked consumer receives items from several producers and wakes on close.
+     */
+    TEST_CASE("producers and blocked consumer") {
+        Channel<int> channel;
+        long long sum = 0;
+        int count = 0;
+        std::thread consumer([&]() {
+            while (auto item = channel.pop()) {
+                sum += *item;
+                ++count;
+            }
+        });
+
+        std::vector<std::thread> producers;
+        for (int p = 0; p < 4; ++p) {
+            producers.emplace_back([&channel]() {
+                for (int i = 1; i <= 1000; ++i) {
+                    channel.push(i);
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        channel.close();
+        consumer.join();
+
+        CHECK(count == 4000);
+        CHECK(sum == 4 * 500500LL);
+    }
+}
+
+/* ─────── ChatRenderer ─────── */
+/**
+ * @brief Test suite for the incremental chat renderer.
+ */
+TEST_SUITE("ChatRenderer") {
+    /**
+     * @brief Tests that the viewport leaves room for header and prompt.
+     */
+    TEST_CASE("viewport") {
+        CHECK(ChatRenderer::viewport(8, 24) == 15);
+        CHECK(ChatRenderer::viewport(8, 10) == 1);
+        CHECK(ChatRenderer::viewport(30, 24) == 1);
+    }
+
+    /**
+     * @brief Tests that a draw clears the screen once and that appends only print their line.
+     */
+    TEST_CASE("draw then append") {
+        std::ostringstream out;
+        ChatRenderer renderer(out);
+        renderer.draw({"header"}, {"a: 1", "b: 2"}, "> ");
+        CHECK(out.str() == "\033[2J\033[1;1Hheader\na: 1\nb: 2\n> ");
+
+        out.str("");
+        renderer.append("a: 3", "> ");
+        CHECK(out.str() == "\r\033[2Ka: 3\n> ");
+
+        out.str("");
+        renderer.replace_input("You: 4", "> ");
+        CHECK(out.str() == "\033[1A\r\033[2KYou: 4\n> ");
+    }
+}
+
+/* ─────── ChatHistory ─────── */
+/**
+ * @brief Test suite for the bounded chat history.
+ */
+TEST_SUITE("ChatHistory") {
+    /**
+     * @brief Collects messages `[begin, end)` of a conversation as "sender:text" strings.
+     */
+    std::vector<std::string> collect(ChatHistory& history, const std::string& conversation, std::size_t begin, std::size_t end) {
+        std::vector<std::string> out;
+        history.visit(conversation, begin, end, [&out](const std::string& sender, std::string_view text, std::uint64_t) {
+            out.push_back(sender + ":" + std::string(text));
+        });
+        return out;
+    }
+
+    /**
+     * @brief Tests appends, ranges and per-conversation counts in memory.
+     */
+    TEST_CASE("append and visit") {
+        ChatHistory history(10);
+        CHECK(history.append("bob", "alice", "hi", 1) == 1);
+        CHECK(history.append("bob", "bob", "hello", 2) == 2);
+        CHECK(history.append("#room", "bob", "", 3) == 1);
+
+        CHECK(history.size("bob") == 2);
+        CHECK(history.size("nobody") == 0);
+        CHECK(collect(history, "bob", 0, 10) == std::vector<std::string>{"alice:hi", "bob:hello"});
+        CHECK(collect(history, "#room", 0, 1) == std::vector<std::string>{"bob:"});
+        CHECK(collect(history, "bob", 1, 2) == std::vector<std::string>{"bob:hello"});
+    }
+
+    /**
+     * @brief Tests that old messages leave memory and are discarded without a spill file.
+     */
+    TEST_CASE("bounded without spill") {
+        Conversation conversation(8);
+        for (std::uint32_t i = 0; i < 100; ++i) {
+            conversation.append(0, "message " + std::to_string(i), i);
+        }
+        CHECK(conversation.size() == 100);
+        CHECK(conversation.size() - conversation.first_in_memory() <= 8);
+
+        std::vector<std::uint64_t> seen;
+        conversation.visit(0, 100, [&seen](std::uint32_t, std::string_view text, std::uint64_t timestamp) {
+            CHECK(text == "message " + std::to_string(timestamp));
+            seen.push_back(timestamp);
+        });
+        CHECK(seen.size() == conversation.size() - conversation.first_in_memory());
+        CHECK(seen.back() == 99);
+    }
+
+    /**
+     * @brief Tests that spilled messages are read back in order from any start.
+     */
+    TEST_CASE("spill and read back") {
+        std::string prefix = "tmp_history_test_";
+        {
+            ChatHistory history(16, prefix);
+            for (int i = 0; i < 500; ++i) {
+                history.append("bob", i % 3 == 0 ? "bob" : "alice", std::string(i % 7, 'x') + std::to_string(i), i);
+            }
+            CHECK(history.size("bob") == 500);
+            CHECK(file_exists(prefix + "0.spill"));
+            struct stat info {};
+            REQUIRE(::stat((prefix + "0.spill").c_str(), &info) == 0);
+            CHECK((info.st_mode & 0777) == 0600);
+
+            for (std::size_t begin : {0, 63, 64, 65, 200, 490}) {
+                std::size_t next = begin;
+                history.visit("bob", begin, begin + 20, [&next](const std::string& sender, std::string_view text, std::uint64_t timestamp) {
+                    CHECK(timestamp == next);
+                    CHECK(sender == (next % 3 == 0 ? "bob" : "alice"));
+                    CHECK(text == std::string(next % 7, 'x') + std::to_string(next));
+                    ++next;
+                });
+                CHECK(next == std::min<std::size_t>(begin + 20, 500));
+            }
+        }
+        CHECK_FALSE(file_exists(prefix + "0.spill"));
+    }
+
+    /**
+     * @brief Tests that search finds messages across conversations, including spilled ones.
+     */
+    TEST_CASE("search") {
+        std::string prefix = "tmp_history_search_test_";
+        ChatHistory history(16, prefix);
+        for (int i = 0; i < 200; ++i) {
+            history.append(i % 2 ? "bob" : "#room", "alice", "note " + std::to_string(i) + (i % 50 == 0 ? " deploy" : ""), i);
+        }
+
+        std::vector<std::string> found;
+        history.search("DEPLOY note", 10, [&found](const std::string& conversation, std::size_t line, const std::string& sender,
+                                                   std::string_view text, std::uint64_t timestamp) {
+            CHECK(sender == "alice");
+            CHECK(line == timestamp / 2);
+            found.push_back(conversation + ":" + std::string(text));
+        });
+        CHECK(found == std::vector<std::string>{"#room:note 150 deploy", "#room:note 100 deploy", "#room:note 50 deploy",
+                                                "#room:note 0 deploy"});
+    }
+}
+
+/* ─────── SearchIndex ─────── */
+/**
+ * @brief Test suite for the full-text index.
+ */
+TEST_SUITE("SearchIndex") {
+    /**
+     * @brief Tests word splitting, lowercasing and truncation.
+     */
+    TEST_CASE("tokenize") {
+        std::vector<std::string> tokens;
+        tokenize("Hello, WORLD!  x2 привет " + std::string(40, 'a'), [&tokens](const std::string& token) { tokens.push_back(token); });
+        CHECK(tokens == std::vector<std::string>{"hello", "world", "x2", "привет", std::string(kMaxTokenLength, 'a')});
+    }
+
+    /**
+     * @brief Tests AND queries, result order and limits.
+     */
+    TEST_CASE("queries") {
+        SearchIndex index;
+        CHECK(index.add("the quick brown fox") == 0);
+        CHECK(index.add("The lazy dog") == 1);
+        CHECK(index.add("quick dog, quick!") == 2);
+
+        CHECK(index.search("quick", 10) == std::vector<std::uint32_t>{2, 0});
+        CHECK(index.search("QUICK dog", 10) == std::vector<std::uint32_t>{2});
+        CHECK(index.search("the", 1) == std::vector<std::uint32_t>{1});
+        CHECK(index.search("cat", 10).empty());
+        CHECK(index.search("quick cat", 10).empty());
+        CHECK(index.search("!?", 10).empty());
+        CHECK(index.terms() == 6);
+    }
+
+    /**
+     * @brief Tests intersections of long lists against a brute-force scan.
+     */
+    TEST_CASE("intersection across skip blocks") {
+        SearchIndex index;
+        std::vector<std::uint32_t> expected;
+        for (std::uint32_t i = 0; i < 20000; ++i) {
+            std::string text = "m";
+            if (i % 3 == 0) text += " three";
+            if (i % 7 == 0) text += " seven";
+            if (i % 1000 == 999) text += " rare";
+            index.add(text);
+            if (i % 3 == 0 && i % 7 == 0 && i % 1000 == 999) {
+                expected.insert(expected.begin(), i);
+            }
+        }
+        CHECK(index.search("rare seven three", 100) == expected);
+        CHECK(index.search("three seven", 100000).size() == 20000 / 21 + 1);
+        CHECK(index.search("m", 5) == std::vector<std::uint32_t>{19999, 19998, 19997, 19996, 19995});
+    }
+
+    /**
+     * @brief Tests that cursors land on the first id not below the target from any position.
+     */
+    TEST_CASE("posting list advance") {
+        PostingList list;
+        for (std::uint32_t id = 5; id < 100000; id += 5 + id % 300) {
+            list.add(id);
+        }
+        std::vector<std::uint32_t> ids;
+        for (PostingList::Cursor cursor(list); cursor.valid(); cursor.next()) {
+            ids.push_back(cursor.id());
+        }
+        CHECK(ids.size() == list.size());
+        CHECK(list.memory_bytes() < ids.size() * sizeof(std::uint32_t));
+
+        for (std::uint32_t target : {0u, 5u, 6u, 640u, 5000u, 40001u, 99999u, 200000u}) {
+            PostingList::Cursor cursor(list);
+            cursor.advance_to(target / 2);
+            cursor.advance_to(target);
+            auto it = std::lower_bound(ids.begin(), ids.end(), target);
+            CHECK(cursor.valid() == (it != ids.end()));
+            if (it != ids.end()) {
+                CHECK(cursor.id() == *it);
+            }
+        }
+    }
+}
+
+/* ─────── HistoryStore ─────── */
+/**
+ * @brief Test suite for the server's persistent conversation history.
+ */
+TEST_SUITE("HistoryStore") {
+    /**
+     * @brief Removes the files of a test log.
+     */
+    void remove_log(const std::string& path) {
+        std::remove((path + ".log").c_str());
+        std::remove((path + ".idx").c_str());
+    }
+
+    /**
+     * @brief Returns the timestamps of some records.
+     */
+    std::vector<std::uint64_t> timestamps(const std::vector<HistoryRecord>& records) {
+        std::vector<std::uint64_t> out;
+        for (const auto& record : records) {
+            out.push_back(record.timestamp);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Returns the timestamps `[first, last]`.
+     */
+    std::vector<std::uint64_t> range(std::uint64_t first, std::uint64_t last) {
+        std::vector<std::uint64_t> out;
+        for (std::uint64_t t = first; t <= last; ++t) {
+            out.push_back(t);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Tests paging back and forward across index blocks.
+     */
+    TEST_CASE("time-range pages") {
+        std::string path = "tmp_history_log_test";
+        remove_log(path);
+        {
+            HistoryLog log(path);
+            REQUIRE(log.ok());
+            for (std::uint64_t t = 1; t <= 1000; ++t) {
+                CHECK(log.append(t % 2 ? "alice" : "bob", "message " + std::to_string(t), t) == t);
+            }
+            CHECK(log.size() == 1000);
+            CHECK(log.index_entries() == (1000 + kHistoryIndexStride - 1) / kHistoryIndexStride);
+
+            auto newest = log.before(0, 5);
+            CHECK(timestamps(newest) == range(996, 1000));
+            CHECK(newest.back().sender == "bob");
+            CHECK(newest.back().content == "message 1000");
+
+            CHECK(timestamps(log.before(996, 100)) == range(896, 995));
+            CHECK(timestamps(log.before(65, 3)) == range(62, 64));
+            CHECK(timestamps(log.before(3, 10)) == range(1, 2));
+            CHECK(log.before(1, 10).empty());
+
+            CHECK(timestamps(log.after(63, 3)) == range(64, 66));
+            CHECK(timestamps(log.after(900, 1000)) == range(901, 1000));
+            CHECK(log.after(1000, 10).empty());
+        }
+        remove_log(path);
+    }
+
+    /**
+     * @brief Tests that timestamps stay strictly increasing when the clock does not.
+     */
+    TEST_CASE("timestamps are unique") {
+        std::string path = "tmp_history_log_test";
+        remove_log(path);
+        {
+            HistoryLog log(path);
+            CHECK(log.append("alice", "a", 100) == 100);
+            CHECK(log.append("alice", "b", 100) == 101);
+            CHECK(log.append("alice", "c", 50) == 102);
+            CHECK(log.append("alice", "d", 200) == 200);
+        }
+        remove_log(path);
+    }
+
+    /**
+     * @brief Tests reopening a log with a lost index and a partly written record.
+     */
+    TEST_CASE("recovery") {
+        std::string path = "tmp_history_log_test";
+        remove_log(path);
+        {
+            HistoryLog log(path);
+            for (std::uint64_t t = 1; t <= 300; ++t) {
+                log.append("alice", std::string(t % 10, 'x'), t);
+            }
+        }
+        {
+            // Drop the last index entries and leave half a record at the end of the log
+            REQUIRE(::truncate((path + ".idx").c_str(), 2 * 16) == 0);
+            std::ofstream log(path + ".log", std::ios::binary | std::ios::app);
+            log.write("\x2d\x01\x00\x00\x00\x00\x00", 7);
+        }
+        {
+            HistoryLog log(path);
+            CHECK(log.size() == 300);
+            CHECK(log.index_entries() == (300 + kHistoryIndexStride - 1) / kHistoryIndexStride);
+            CHECK(timestamps(log.before(0, 3)) == range(298, 300));
+            CHECK(timestamps(log.after(150, 2)) == range(151, 152));
+            CHECK(log.append("bob", "after restart", 1) == 301);
+        }
+        {
+            HistoryLog log(path);
+            auto last = log.before(0, 1);
+            REQUIRE(last.size() == 1);
+            CHECK(last[0].content == "after restart");
+        }
+        remove_log(path);
+    }
+
+    /**
+     * @brief Tests that both users of a direct conversation share one log and rooms have their own.
+     */
+    TEST_CASE("conversations") {
+        CHECK(HistoryStore::conversation("alice", "bob") == HistoryStore::conversation("bob", "alice"));
+        CHECK(HistoryStore::conversation("alice", "#room") == "#room");
+        CHECK(HistoryStore::conversation("alice", "bob") != HistoryStore::conversation("alice", "bobby"));
+
+        std::string directory = "tmp_history_store_test";
+        {
+            HistoryStore store(directory);
+            std::uint64_t first = store.append(HistoryStore::conversation("alice", "bob"), "alice", "hi", 10);
+            store.append(HistoryStore::conversation("bob", "alice"), "bob", "hello", 11);
+            store.append("#room", "carol", "welcome", 12);
+
+            auto page = store.read(HistoryStore::conversation("bob", "alice"), 0, 0, 10);
+            REQUIRE(page.size() == 2);
+            CHECK(page[0].content == "hi");
+            CHECK(page[1].sender == "bob");
+            CHECK(store.read(HistoryStore::conversation("alice", "bob"), 0, first, 10).size() == 1);
+            CHECK(store.read("#room", 0, 0, 10).size() == 1);
+            CHECK(store.open_logs() == 2);
+        }
+        for (const std::string& name : {std::string("#room"), std::string("alice") + '\0' + "bob"}) {
+            std::string hex;
+            for (unsigned char c : name) {
+                hex += "0123456789abcdef"[c >> 4];
+                hex += "0123456789abcdef"[c & 0xf];
+            }
+            remove_log(directory + "/" + hex);
+        }
+        ::rmdir(directory.c_str());
+    }
+
+    /**
+     * @brief Tests that reads never create a log, appends can be told not to, and idle logs are closed.
+     */
+    TEST_CASE("missing logs and open log limit") {
+        std::string directory = "tmp_history_store_limit_test";
+        {
+            HistoryStore store(directory, 2);
+            CHECK(store.read("#nobody", 0, 0, 10).empty());
+            CHECK(store.append("#nobody", "mallory", "hi", 10, false) == 0);
+            CHECK(store.open_logs() == 0);
+            CHECK(::access((directory + "/236e6f626f6479.log").c_str(), F_OK) != 0);
+
+            store.append("#a", "alice", "one", 10);
+            store.append("#b", "alice", "two", 11);
+            store.append("#c", "alice", "three", 12);
+            CHECK(store.open_logs() == 2);
+
+            // A closed log is reopened on demand, and existing logs take appends without create
+            CHECK(store.append("#a", "alice", "four", 13, false) == 13);
+            auto page = store.read("#a", 0, 0, 10);
+            REQUIRE(page.size() == 2);
+            CHECK(page[1].content == "four");
+            CHECK(store.open_logs() == 2);
+        }
+        for (const char* hex : {"2361", "2362", "2363"}) {
+            remove_log(directory + "/" + hex);
+        }
+        ::rmdir(directory.c_str());
+    }
+}
+
+/* ─────── Auth ─────── */
+/**
+ * @brief Test suite for password hashing, session tokens and the authentication service.
+ */
+TEST_SUITE("Auth") {
+    /**
+     * @brief Cheap scrypt parameters so the tests stay fast.
+     */
+    ScryptParams cheap() {
+        ScryptParams params;
+        params.n = 1 << 10;
+        return params;
+    }
+
+    /**
+     * @brief Runs one authentication to completion.
+     */
+    AuthResult login(AuthService& auth, const std::string& username, const std::string& password, const std::string& token = "") {
+        std::promise<AuthResult> done;
+        auth.authenticate(username, password, token, [&done](AuthResult result) { done.set_value(std::move(result)); });
+        return done.get_future().get();
+    }
+
+    /**
+     * @brief Tests that hashes verify only their own password and are salted.
+     */
+    TEST_CASE("password hashes") {
+        std::string hash = hash_password("correct horse", cheap());
+        CHECK(hash.rfind("scrypt$1024$8$1$", 0) == 0);
+        CHECK(verify_password("correct horse", hash));
+        CHECK_FALSE(verify_password("correct horsE", hash));
+        CHECK(hash_password("correct horse", cheap()) != hash);
+        CHECK_FALSE(verify_password("correct horse", "scrypt$1024$8$1$zz$00"));
+        CHECK_FALSE(verify_password("correct horse", ""));
+    }
+
+    /**
+     * @brief Tests token verification, expiry and tampering.
+     */
+    TEST_CASE("tokens") {
+        TokenSigner signer("secret");
+        std::string token = signer.issue("alice", 1000);
+        CHECK(signer.verify(token, "alice", 999));
+        CHECK_FALSE(signer.verify(token, "alice", 1000));
+        CHECK_FALSE(signer.verify(token, "bob", 999));
+        CHECK_FALSE(TokenSigner("other").verify(token, "alice", 999));
+        CHECK_FALSE(signer.verify(signer.issue("bob", 1000).substr(0, 7) + token.substr(7), "bob", 999));
+
+        std::string extended = token;
+        extended.replace(token.find('.') + 1, 4, "9999");
+        CHECK_FALSE(signer.verify(extended, "alice", 999));
+        CHECK_FALSE(signer.verify("", "alice", 0));
+        CHECK_FALSE(signer.verify("616c696365.x.y", "alice", 0));
+    }
+
+    /**
+     * @brief Tests LRU eviction and expiry of verified credentials.
+     */
+    TEST_CASE("verification cache") {
+        using Clock = VerificationCache::Clock;
+        VerificationCache cache(2, std::chrono::seconds(10));
+        auto now = Clock::now();
+        cache.insert("a", now);
+        cache.insert("b", now);
+        CHECK(cache.check("a", now));          // "b" is now least recently used
+        cache.insert("c", now);
+        CHECK(cache.size() == 2);
+        CHECK_FALSE(cache.check("b", now));
+        CHECK(cache.check("a", now + std::chrono::seconds(9)));
+        CHECK_FALSE(cache.check("a", now + std::chrono::seconds(10)));
+        CHECK(cache.size() == 1);
+    }
+
+    /**
+     * @brief Tests account creation, password and token logins, the cache and reloading.
+     */
+    TEST_CASE("service") {
+        std::string users_file = "tmp_auth_users_test";
+        std::remove(users_file.c_str());
+        std::remove((users_file + ".key").c_str());
+        AuthService::Options options;
+        options.users_file = users_file;
+        options.scrypt = cheap();
+        std::string token;
+        {
+            AuthService auth(options);
+            auto created = login(auth, "alice", "pw");
+            CHECK(created.ok);
+            CHECK(created.created);
+            CHECK(auth.users() == 1);
+
+            CHECK_FALSE(login(auth, "alice", "wrong").ok);
+            CHECK_FALSE(login(auth, "alice", "").ok);
+            CHECK_FALSE(login(auth, "bad\tname", "pw").ok);
+
+            auto hits = server_metrics().auth_cache_hits.value();
+            auto again = login(auth, "alice", "pw");
+            CHECK(again.ok);
+            CHECK_FALSE(again.created);
+            CHECK(server_metrics().auth_cache_hits.value() == hits + 1);
+
+            token = again.token;
+            CHECK(login(auth, "alice", "", token).ok);
+            CHECK_FALSE(login(auth, "bob", "", token).ok);
+        }
+        {
+            AuthService auth(options);
+            CHECK(auth.users() == 1);
+            CHECK(login(auth, "alice", "", token).ok);     // Same key file, so old tokens still hold
+            CHECK(login(auth, "alice", "pw").ok);
+            CHECK_FALSE(login(auth, "alice", "wrong").ok);
+        }
+        std::remove(users_file.c_str());
+        std::remove((users_file + ".key").c_str());
+    }
+
+    /**
+     * @brief Tests that a failed hash creates no account, so the name can still be claimed.
+     */
+    TEST_CASE("failed hash creates no account") {
+        std::string users_file = "tmp_auth_failed_hash_test";
+        std::remove(users_file.c_str());
+        std::remove((users_file + ".key").c_str());
+        AuthService::Options options;
+        options.users_file = users_file;
+        options.scrypt = cheap();
+        options.scrypt.n = 3;                   // Not a power of two, so scrypt refuses it
+        {
+            AuthService auth(options);
+            auto failures = server_metrics().auth_failures.value();
+            auto result = login(auth, "alice", "pw");
+            CHECK_FALSE(result.ok);
+            CHECK_FALSE(result.created);
+            CHECK(result.token.empty());
+            CHECK(auth.users() == 0);
+            CHECK(server_metrics().auth_failures.value() == failures + 1);
+        }
+        std::ifstream in(users_file);
+        std::string line;
+        CHECK_FALSE(std::getline(in, line));
+        std::remove(users_file.c_str());
+        std::remove((users_file + ".key").c_str());
+    }
+}
+
+/* ─────── E2E ─────── */
+/**
+ * @brief Test suite for end-to-end encryption of direct messages.
+ */
+TEST_SUITE("E2E") {
+    /**
+     * @brief Tests base64 round trips, including padding and invalid input.
+     */
+    TEST_CASE("base64") {
+        std::string decoded;
+        for (std::string data : {std::string(), std::string("a"), std::string("ab"), std::string("abc"),
+                                 std::string("\0\xff\x10\x80", 4)}) {
+            CHECK(base64_decode(base64_encode(data), decoded));
+            CHECK(decoded == data);
+        }
+        CHECK(base64_encode("abcd") == "YWJjZA==");
+        CHECK_FALSE(base64_decode("YWJ", decoded));
+        CHECK_FALSE(base64_decode("YW!j", decoded));
+    }
+
+    /**
+     * @brief Tests that both parties, and only they, can open a message.
+     */
+    TEST_CASE("seal and open") {
+        EndToEnd alice(E2eIdentity::generate());
+        EndToEnd bob(E2eIdentity::generate());
+        EndToEnd eve(E2eIdentity::generate());
+
+        std::string envelope;
+        REQUIRE(alice.seal(bob.public_key(), "hello bob", envelope));
+        CHECK(EndToEnd::is_envelope(envelope));
+        CHECK(envelope.find("hello") == std::string::npos);
+
+        std::string text;
+        std::string peer;
+        CHECK(bob.open(envelope, text, peer) == EndToEnd::Opened::ok);
+        CHECK(text == "hello bob");
+        CHECK(peer == alice.public_key());
+
+        // The sender (or another device with its key) can read what it sent
+        CHECK(alice.open(envelope, text, peer) == EndToEnd::Opened::ok);
+        CHECK(peer == bob.public_key());
+        CHECK(eve.open(envelope, text, peer) == EndToEnd::Opened::foreign);
+
+        // Fresh nonce per message, one cipher per peer
+        std::string again;
+        REQUIRE(alice.seal(bob.public_key(), "hello bob", again));
+        CHECK(again != envelope);
+        CHECK(alice.peers() == 1);
+
+        std::string empty;
+        REQUIRE(bob.seal(alice.public_key(), "", empty));
+        CHECK(alice.open(empty, text, peer) == EndToEnd::Opened::ok);
+        CHECK(text.empty());
+    }
+
+    /**
+     * @brief Tests that tampered or malformed envelopes are rejected.
+     */
+    TEST_CASE("tampering") {
+        EndToEnd alice(E2eIdentity::generate());
+        EndToEnd bob(E2eIdentity::generate());
+        std::string envelope;
+        REQUIRE(alice.seal(bob.public_key(), "pay 10", envelope));
+
+        std::string binary;
+        REQUIRE(base64_decode(envelope.substr(sizeof(kE2ePrefix) - 1), binary));
+        std::string text;
+        std::string peer;
+        for (std::size_t at : {std::size_t{2 * kE2eKeySize}, binary.size() - 8, binary.size() - 1}) {
+            std::string forged = binary;
+            forged[at] ^= 1;
+            CHECK(bob.open(kE2ePrefix + base64_encode(forged), text, peer) == EndToEnd::Opened::corrupt);
+        }
+        CHECK(bob.open(kE2ePrefix + base64_encode(binary.substr(0, 70)), text, peer) == EndToEnd::Opened::corrupt);
+        CHECK(bob.open(std::string(kE2ePrefix) + "!!!!", text, peer) == EndToEnd::Opened::corrupt);
+        CHECK_FALSE(alice.seal(std::string(kE2eKeySize, '\0'), "x", envelope));     // Low-order point
+        CHECK_FALSE(alice.seal("short", "x", envelope));
+    }
+
+    /**
+     * @brief Tests that a key file is created once and then reloaded.
+     */
+    TEST_CASE("key file") {
+        std::string path = "tmp_e2e_key_test";
+        std::remove(path.c_str());
+        std::string created = E2eIdentity::load_or_create(path).public_key();
+        CHECK(E2eIdentity::load_or_create(path).public_key() == created);
+        CHECK(E2eIdentity::generate().public_key() != created);
+        std::remove(path.c_str());
+
+        std::ofstream(path) << "short";
+        CHECK_THROWS_AS(E2eIdentity::load_or_create(path), std::runtime_error);
+        std::remove(path.c_str());
+    }
+}
+
+/* ─────── Capabilities ─────── */
+/**
+ * @brief Test suite for protocol version and feature negotiation.
+ */
+TEST_SUITE("Capabilities") {
+    /**
+     * @brief Tests wire names round trips and that unknown names are skipped.
+     */
+    TEST_CASE("feature names") {
+        FeatureSet set{Feature::compression, Feature::e2e_keys};
+        CHECK(set.names() == std::vector<std::string>{kCompressionCodec, "e2e-keys"});
+        CHECK(FeatureSet::from_names(set.names()) == set);
+        CHECK(FeatureSet::from_names({"history", "binary-codec-9", ""}) == FeatureSet{Feature::history});
+        CHECK(FeatureSet().names().empty());
+        CHECK((set & FeatureSet{Feature::e2e_keys, Feature::history}) == FeatureSet{Feature::e2e_keys});
+    }
+
+    /**
+     * @brief Tests what current and version 1 registrations ask for.
+     */
+    TEST_CASE("negotiation") {
+        Message current;
+        current.type = MessageType::REGISTER;
+        current.version = kProtocolVersion;
+        current.features = FeatureSet{Feature::history, Feature::compression}.names();
+        current.compression = kCompressionCodec;
+        CHECK(requested_features(current) == FeatureSet{Feature::history, Feature::compression});
+        CHECK(negotiate_version(current.version) == kProtocolVersion);
+        CHECK(negotiate_version(kProtocolVersion + 5) == kProtocolVersion);
+
+        // A version 1 client only knows the codec field
+        Message legacy = Message::deserialize(R"({"type":0,"sender":"old","recipient":"","content":"","users":[],)"
+                                              R"("compression":"deflate-chat-1"})");
+        CHECK(legacy.version == 0);
+        CHECK(negotiate_version(legacy.version) == 1);
+        CHECK(requested_features(legacy) == FeatureSet{Feature::compression});
+        legacy.compression.clear();
+        CHECK(requested_features(legacy) == FeatureSet());
+    }
+
+    /**
+     * @brief Tests that version and features survive serialization and are omitted when unset.
+     */
+    TEST_CASE("fields are optional") {
+        Message reg;
+        reg.type = MessageType::REGISTER;
+        std::string plain = reg.serialize();
+        CHECK(plain.find("version") == std::string::npos);
+        CHECK(plain.find("features") == std::string::npos);
+
+        reg.version = 7;
+        reg.features = {"history", "future-thing"};
+        Message parsed = Message::deserialize(reg.serialize());
+        CHECK(parsed.version == 7);
+        CHECK(parsed.features == reg.features);
+    }
+}
@@ -0,0 +1,583 @@
+/**
+ * @file loadgen.cpp
+ * @brief Load generator for benchmarking the chat server.
+ *
+ * Modes:
+ * - `storm`: opens many short-lived TLS connections as fast as allowed by the
+ *   concurrency limit and reports accept throughput and connect latency.
+ * - `compress`: runs the frame codec over generated chat traffic offline and
+ *   reports bytes saved per TLS record against CPU time per frame.
+ * - `chat`: registers many virtual users through libchatclient and has pairs of them
+ *   exchange messages, reporting relay throughput and round-trip latency.
+ */
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../common/compression.hpp"
+#include "../common/message.hpp"
+#include "chat_client.hpp"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+namespace ssl = asio::ssl;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Command-line options shared by all modes.
+ */
+struct Options {
+    std::string mode;                   ///< Benchmark mode.
+    std::string host = "127.0.0.1";     ///< Server address.
+    std::string port = "8443";          ///< Server port.
+    unsigned connections = 1000;        ///< Total connections to open (`compress`: messages per kind).
+    unsigned concurrency = 64;          ///< Connections in flight at once.
+    unsigned threads = 1;               ///< Client I/O threads.
+    unsigned messages = 100;            ///< `chat`: round trips per user.
+    unsigned burst = 1;                 ///< `chat`: pings per round trip, sent as one batch.
+    std::string password;               ///< `chat`: password of every bot, for servers run with `--auth`.
+    bool e2e = false;                   ///< `chat`: encrypt messages end to end, one key pair per bot.
+};
+
+/**
+ * @brief Latency samples in microseconds with percentile reporting.
+ */
+class Histogram {
+public:
+    /**
+     * @brief Adds one sample.
+     */
+    void add(double micros) { samples_.push_back(micros); }
+
+    /**
+     * @brief Appends another histogram's samples.
+     */
+    void merge(const Histogram& other) { samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end()); }
+
+    /**
+     * @brief Prints p50/p90/p99/max on one line.
+     */
+    void print(const std::string& label) {
+        if (samples_.empty()) {
+            std::cout << label << ": no samples\n";
+            return;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        auto at = [this](double q) { return samples_[std::min(samples_.size() - 1, static_cast<std::size_t>(q * samples_.size()))]; };
+        std::cout << std::fixed << std::setprecision(0) << label << " (us): p50 " << at(0.50) << "  p90 " << at(0.90)
+                  << "  p99 " << at(0.99) << "  max " << samples_.back() << "\n";
+    }
+
+private:
+    std::vector<double> samples_;   ///< Recorded samples.
+};
+
+/**
+ * @brief Connection storm: connect, handshake and close, repeatedly.
+ */
+class Storm {
+public:
+    /**
+     * @brief Prepares one worker; `remaining` is shared by all workers.
+     */
+    Storm(const Options& options, const tcp::resolver::results_type& endpoints, std::atomic<long>& remaining)
+        : options_(options), endpoints_(endpoints), ssl_context_(ssl::context::tlsv12_client), remaining_(remaining) {
+        ssl_context_.set_verify_mode(ssl::verify_none);
+    }
+
+    /**
+     * @brief Runs this worker's share of the concurrency until all connections are done.
+     */
+    void run(unsigned slots) {
+        for (unsigned i = 0; i < slots; ++i) {
+            next();
+        }
+        io_context_.run();
+    }
+
+    Histogram tcp_latency;      ///< Time to TCP connect.
+    Histogram tls_latency;      ///< Time to completed TLS handshake.
+    unsigned failures = 0;      ///< Connections that failed.
+
+private:
+    /**
+     * @brief Starts the next connection if any are left.
+     */
+    void next() {
+        if (remaining_.fetch_sub(1) <= 0) {
+            return;
+        }
+
+        auto stream = std::make_shared<ssl::stream<tcp::socket>>(io_context_, ssl_context_);
+        auto start = Clock::now();
+        asio::async_connect(stream->lowest_layer(), endpoints_,
+            [this, stream, start](const boost::system::error_code& error, const tcp::endpoint&) {
+                if (error) {
+                    ++failures;
+                    next();
+                    return;
+                }
+                tcp_latency.add(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+                stream->async_handshake(ssl::stream_base::client, [this, stream, start](const boost::system::error_code& error) {
+                    if (error) {
+                        ++failures;
+                    } else {
+                        tls_latency.add(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+                    }
+                    boost::system::error_code ignored;
+                    stream->lowest_layer().close(ignored);
+                    next();
+                });
+            });
+    }
+
+    const Options& options_;                        ///< Benchmark options.
+    tcp::resolver::results_type endpoints_;         ///< Resolved server address.
+    asio::io_context io_context_{1};                ///< This worker's I/O context.
+    ssl::context ssl_context_;                      ///< Client TLS context.
+    std::atomic<long>& remaining_;                  ///< Connections not yet started, across workers.
+};
+
+/**
+ * @brief Runs the connection storm and prints the report.
+ */
+int run_storm(const Options& options) {
+    asio::io_context resolver_context;
+    tcp::resolver resolver(resolver_context);
+    auto endpoints = resolver.resolve(options.host, options.port);
+
+    std::atomic<long> remaining{static_cast<long>(options.connections)};
+    std::vector<std::unique_ptr<Storm>> workers;
+    for (unsigned i = 0; i < options.threads; ++i) {
+        workers.push_back(std::make_unique<Storm>(options, endpoints, remaining));
+    }
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.threads; ++i) {
+        unsigned slots = options.concurrency / options.threads + (i < options.concurrency % options.threads ? 1 : 0);
+        threads.emplace_back([&workers, i, slots]() { workers[i]->run(slots); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Histogram tcp_latency, tls_latency;
+    unsigned failures = 0;
+    for (auto& worker : workers) {
+        tcp_latency.merge(worker->tcp_latency);
+        tls_latency.merge(worker->tls_latency);
+        failures += worker->failures;
+    }
+
+    unsigned ok = options.connections - failures;
+    std::cout << "connections: " << ok << " ok, " << failures << " failed in " << std::setprecision(2) << std::fixed
+              << seconds << " s\n";
+    std::cout << "accept rate: " << std::setprecision(0) << ok / seconds << " handshakes/s\n";
+    tcp_latency.print("tcp connect");
+    tls_latency.print("tls ready  ");
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Virtual chat users for the `chat` mode.
+ *
+ * Users are paired. Each sends its partner a ping carrying the send time; the partner
+ * echoes it back as a pong, and the next ping goes out once the pong is back. With
+ * `--burst`, each round is that many pings sent as one batch. All users
+ * share one `io_context` run by `threads` threads; each `chat::Client` keeps its own
+ * callbacks on its strand, so per-user state needs no locks.
+ */
+class ChatLoad {
+public:
+    /**
+     * @brief Prepares the users; nothing connects until `run()`.
+     */
+    ChatLoad(const Options& options, const tcp::resolver::results_type& endpoints)
+        : options_(options), endpoints_(endpoints), ssl_context_(ssl::context::tlsv12_client),
+          bots_(options.connections + options.connections % 2) {
+        ssl_context_.set_verify_mode(ssl::verify_none);
+    }
+
+    /**
+     * @brief Registers every user, runs the exchange and prints the report.
+     * @return 0 if every user registered and completed its round trips.
+     */
+    int run() {
+        auto work = asio::make_work_guard(io_context_);
+        for (unsigned i = 0; i < std::min<std::size_t>(options_.concurrency, bots_.size()); ++i) {
+            start_next();
+        }
+
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < options_.threads; ++i) {
+            threads.emplace_back([this]() { io_context_.run(); });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            finished_.wait(lock, [this]() { return phase_ == Phase::DONE; });
+        }
+        for (auto& bot : bots_) {
+            if (bot.client) {
+                bot.client->close();
+            }
+        }
+        work.reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        Histogram rtt;
+        for (const auto& bot : bots_) {
+            rtt.merge(bot.rtt);
+        }
+        double setup = std::chrono::duration<double>((registered_ == bots_.size() ? exchange_start_ : end_) - start).count();
+        double seconds = std::chrono::duration<double>(end_ - exchange_start_).count();
+        std::cout << "users: " << registered_ << " registered, " << failures_ << " failed in " << std::setprecision(2)
+                  << std::fixed << setup << " s\n";
+        if (failures_ == 0) {
+            double relayed = 2.0 * options_.messages * options_.burst * static_cast<double>(bots_.size());
+            std::cout << "relayed: " << std::setprecision(0) << relayed << " messages in " << std::setprecision(2) << seconds
+                      << " s (" << std::setprecision(0) << relayed / seconds << " msg/s)\n";
+            rtt.print("round trip ");
+        }
+        return failures_ == 0 ? 0 : 1;
+    }
+
+private:
+    /**
+     * @brief One virtual user. Touched only on its client's strand once connected.
+     */
+    struct Bot {
+        std::shared_ptr<chat::Client> client;   ///< Its connection.
+        std::string partner;                    ///< Username it exchanges messages with.
+        unsigned sent = 0;                      ///< Rounds of pings sent.
+        unsigned awaiting = 0;                  ///< Pongs still due in the current round.
+        Histogram rtt;                          ///< Round-trip times of its pings.
+    };
+
+    enum class Phase { SETUP, EXCHANGE, DONE };
+
+    static std::string name(std::size_t index) { return "bot" + std::to_string(index); }
+
+    /**
+     * @brief Connects and registers the next user, if any are left.
+     */
+    void start_next() {
+        std::size_t index = next_.fetch_add(1);
+        if (index >= bots_.size()) {
+            return;
+        }
+
+        Bot& bot = bots_[index];
+        bot.partner = name(index ^ 1);
+        bot.client = chat::Client::create(io_context_, ssl_context_);
+        bot.client->on_message([this, &bot](const chat::Message& message) { handle(bot, message); });
+        bot.client->set_password(options_.password);
+        if (options_.e2e) {
+            bot.client->enable_e2e(chat::E2eIdentity::generate());
+        }
+        bot.client->on_close([this](const boost::system::error_code&) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (phase_ == Phase::EXCHANGE) {    // Setup failures are counted by registered()
+                ++failures_;
+                finish(lock);
+            }
+        });
+        bot.client->connect(endpoints_, [this, &bot, index](const boost::system::error_code& error) {
+            if (error) {
+                registered(false);
+                return;
+            }
+            bot.client->register_user(name(index), [this](const boost::system::error_code& error) {
+                registered(!error);
+            });
+        });
+    }
+
+    /**
+     * @brief Counts one finished registration; starts the exchange once all are in.
+     */
+    void registered(bool ok) {
+        start_next();
+        std::lock_guard<std::mutex> lock(mutex_);
+        ok ? ++registered_ : ++failures_;
+        if (registered_ + failures_ < bots_.size()) {
+            return;
+        }
+        if (failures_ != 0) {
+            finish(lock);
+            return;
+        }
+        phase_ = Phase::EXCHANGE;
+        exchange_start_ = Clock::now();
+        for (auto& bot : bots_) {
+            asio::post(bot.client->strand(), [this, &bot]() { ping(bot); });
+        }
+    }
+
+    /**
+     * @brief Sends the next ping, or reports the user done.
+     */
+    void ping(Bot& bot) {
+        if (bot.sent == options_.messages) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++done_ == bots_.size()) {
+                finish(lock);
+            }
+            return;
+        }
+        ++bot.sent;
+        bot.awaiting = options_.burst;
+        if (options_.burst == 1) {
+            bot.client->send_message(bot.partner, "ping " + std::to_string(Clock::now().time_since_epoch().count()));
+            return;
+        }
+        std::vector<chat::Message> pings(options_.burst);
+        for (auto& message : pings) {
+            message.type = chat::MessageType::MESSAGE;
+            message.recipient = bot.partner;
+            message.content = "ping " + std::to_string(Clock::now().time_since_epoch().count());
+        }
+        bot.client->send_batch(std::move(pings));
+    }
+
+    /**
+     * @brief Answers pings and times pongs.
+     */
+    void handle(Bot& bot, const chat::Message& message) {
+        if (message.type != chat::MessageType::MESSAGE || message.content.size() < 5) {
+            return;
+        }
+        std::string stamp = message.content.substr(5);
+        if (message.content.compare(0, 5, "ping ") == 0) {
+            bot.client->send_message(message.sender, "pong " + stamp);
+        } else if (message.content.compare(0, 5, "pong ") == 0) {
+            Clock::duration sent(std::stoll(stamp));
+            bot.rtt.add(std::chrono::duration<double, std::micro>(Clock::now().time_since_epoch() - sent).count());
+            if (--bot.awaiting == 0) {
+                ping(bot);
+            }
+        }
+    }
+
+    /**
+     * @brief Ends the run. Caller holds `mutex_`.
+     */
+    void finish(std::lock_guard<std::mutex>&) {
+        phase_ = Phase::DONE;
+        end_ = Clock::now();
+        finished_.notify_one();
+    }
+
+    const Options& options_;                        ///< Benchmark options.
+    tcp::resolver::results_type endpoints_;         ///< Resolved server address.
+    asio::io_context io_context_;                   ///< Shared by all users.
+    ssl::context ssl_context_;                      ///< Client TLS context.
+    std::vector<Bot> bots_;                         ///< All users; an even number.
+    std::atomic<std::size_t> next_{0};              ///< Next user to connect.
+
+    std::mutex mutex_;                              ///< Protects the fields below.
+    std::condition_variable finished_;              ///< Signalled when the run ends.
+    Phase phase_ = Phase::SETUP;                    ///< Progress of the run.
+    std::size_t registered_ = 0;                    ///< Users registered.
+    std::size_t failures_ = 0;                      ///< Users that failed to register or dropped.
+    std::size_t done_ = 0;                          ///< Users that completed their round trips.
+    Clock::time_point exchange_start_;              ///< When all users were registered.
+    Clock::time_point end_;                         ///< When the run ended.
+};
+
+/**
+ * @brief Runs the chat exchange and prints the report.
+ */
+int run_chat(const Options& options) {
+    asio::io_context resolver_context;
+    tcp::resolver resolver(resolver_context);
+    ChatLoad load(options, resolver.resolve(options.host, options.port));
+    return load.run();
+}
+
+/**
+ * @brief Payloads of one kind for the compression benchmark.
+ */
+struct PayloadClass {
+    std::string name;                   ///< Label in the report.
+    std::vector<std::string> payloads;  ///< Encoded messages.
+};
+
+/**
+ * @brief Builds representative traffic: chat lines of several lengths, LIST pages and a full LIST.
+ */
+std::vector<PayloadClass> sample_traffic(unsigned count) {
+    static const char* words[] = {"hi", "the", "you", "and", "meeting", "tomorrow", "deploy", "is", "it", "ok",
+                                  "lunch", "at", "noon", "build", "failed", "again", "thanks", "see", "logs", "for"};
+    std::mt19937 random(42);
+    auto user = [&random]() { return "user" + std::to_string(random() % 100000); };
+    auto text = [&random](std::size_t length) {
+        std::string line;
+        while (line.size() < length) {
+            line += words[random() % (sizeof(words) / sizeof(words[0]))];
+            line += ' ';
+        }
+        return line;
+    };
+
+    std::vector<PayloadClass> classes{{"chat 20 B", {}}, {"chat 100 B", {}}, {"chat 400 B", {}},
+                                      {"list page 20", {}}, {"list full 1000", {}}};
+    for (unsigned i = 0; i < count; ++i) {
+        std::size_t lengths[] = {20, 100, 400};
+        for (std::size_t c = 0; c < 3; ++c) {
+            chat::Message message;
+            message.type = chat::MessageType::MESSAGE;
+            message.sender = user();
+            message.recipient = user();
+            message.content = text(lengths[c]);
+            classes[c].payloads.push_back(message.serialize());
+        }
+
+        chat::Message page;
+        page.type = chat::MessageType::LIST;
+        page.sender = "SERVER";
+        page.limit = chat::kDefaultListPageSize;
+        page.offset = (i % 50) * chat::kDefaultListPageSize;
+        page.total = 1000;
+        for (std::uint32_t u = 0; u < chat::kDefaultListPageSize; ++u) {
+            page.users.push_back(user());
+        }
+        classes[3].payloads.push_back(page.serialize());
+    }
+
+    chat::Message list;
+    list.type = chat::MessageType::LIST;
+    list.sender = "SERVER";
+    for (int u = 0; u < 1000; ++u) {
+        list.users.push_back(user());
+    }
+    std::sort(list.users.begin(), list.users.end());
+    for (unsigned i = 0; i < std::max(1u, count / 100); ++i) {
+        classes[4].payloads.push_back(list.serialize());
+    }
+    return classes;
+}
+
+/**
+ * @brief Measures the frame codec on sample traffic at each compression level.
+ *
+ * Reports bytes on the wire per frame, including the frame header and ~29 bytes of
+ * TLS 1.2 AES-GCM record overhead (header, explicit nonce and tag), since that is
+ * what the link actually carries, and the CPU time to compress and decompress.
+ */
+int run_compress(const Options& options) {
+    constexpr double kTlsRecordOverhead = 5 + 8 + 16;
+    constexpr double kTlsRecordSize = 16 * 1024;
+    auto classes = sample_traffic(options.connections);
+    auto wire = [&](double frame) { return frame + kTlsRecordOverhead * std::ceil(frame / kTlsRecordSize); };
+
+    std::cout << std::left << std::setw(16) << "payload" << std::right << std::setw(6) << "level" << std::setw(10) << "raw B"
+              << std::setw(10) << "comp B" << std::setw(10) << "wire raw" << std::setw(10) << "wire comp" << std::setw(8)
+              << "saved" << std::setw(12) << "comp ns" << std::setw(12) << "decomp ns" << "\n";
+    for (int level : {1, 6, 9}) {
+        chat::FrameCodec codec(level);
+        for (const auto& payload_class : classes) {
+            double raw = 0, compressed = 0;
+            std::string out, restored;
+            auto start = Clock::now();
+            for (const auto& payload : payload_class.payloads) {
+                raw += static_cast<double>(payload.size());
+                compressed += static_cast<double>(codec.compress(payload, out) ? out.size() : payload.size());
+            }
+            double compress_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            start = Clock::now();
+            for (const auto& payload : payload_class.payloads) {
+                codec.compress(payload, out);
+                codec.decompress(out, restored, chat::kMaxFrameSize);
+            }
+            double decompress_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() - compress_ns;
+
+            double n = static_cast<double>(payload_class.payloads.size());
+            double wire_raw = wire(raw / n + chat::kFrameHeaderSize);
+            double wire_compressed = wire(compressed / n + chat::kFrameHeaderSize);
+            std::cout << std::left << std::setw(16) << payload_class.name << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(6) << level << std::setw(10) << raw / n << std::setw(10) << compressed / n
+                      << std::setw(10) << wire_raw << std::setw(10) << wire_compressed << std::setw(7)
+                      << 100 * (1 - wire_compressed / wire_raw) << "%" << std::setw(12) << compress_ns / n
+                      << std::setw(12) << decompress_ns / n << "\n";
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints usage.
+ */
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " storm [--host H] [--port P] [--connections N] [--concurrency C] [--threads T]\n"
+              << "       " << program << " compress [--connections N]\n"
+              << "       " << program << " chat [--host H] [--port P] [--connections N] [--concurrency C] [--threads T]"
+              << " [--messages M] [--burst B] [--password W] [--e2e on]\n";
+}
+
+/**
+ * @brief Main function for the load generator.
+ * @return 0 if the run completed without failures.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Options options;
+    options.mode = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--host") options.host = value;
+        else if (option == "--port") options.port = value;
+        else if (option == "--connections") options.connections = static_cast<unsigned>(std::stoul(value));
+        else if (option == "--concurrency") options.concurrency = static_cast<unsigned>(std::stoul(value));
+        else if (option == "--threads") options.threads = std::max(1u, static_cast<unsigned>(std::stoul(value)));
+        else if (option == "--messages") options.messages = static_cast<unsigned>(std::stoul(value));
+        else if (option == "--burst") options.burst = std::max(1u, static_cast<unsigned>(std::stoul(value)));
+        else if (option == "--password") options.password = value;
+        else if (option == "--e2e") options.e2e = value == "on";
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        if (options.mode == "storm") {
+            return run_storm(options);
+        }
+        if (options.mode == "compress") {
+            return run_compress(options);
+        }
+        if (options.mode == "chat") {
+            return run_chat(options);
+        }
+        usage(argv[0]);
+        return 1;
+    } catch (std::exception& e) {
+        std::cerr << "loadgen: " << e.what() << "\n";
+        return 1;
+    }
+}